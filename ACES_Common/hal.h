@@ -0,0 +1,49 @@
+/** @file hal.h
+ *  @author Nick Moore
+ *  @date October 15, 2026
+ *  @brief Hardware abstraction hooks shared by the ECU and ESB firmware
+ *
+ *  The firmware talks to the ATmega2561 registers directly, and on the target this header adds nothing
+ *  on top of that.  The host build (HOST_SIM, see the top level CMakeLists.txt) swaps <avr/io.h> for the
+ *  simulated register file in ACES_Host, where every status poll made through bit_is_set(),
+ *  bit_is_clear() or loop_until_bit_is_set() runs the peripheral models.  Busy-waits on hardware flags
+ *  therefore have to use those macros rather than open coded register tests.
+ *
+ *  The only things a register write cannot tell the simulator are a chip select edge and a write of SPDR,
+ *  which looks no different from writing the same byte again, so SPI slave select lines and SPI transfers
+ *  run from SPI_STC_vect are driven through the macros below.
+ *
+ *  @bug No known bugs
+ */
+
+#ifndef HAL_H_
+#define HAL_H_
+
+#include <avr/io.h>
+
+#ifdef HOST_SIM
+#include "avr_sim.h"
+
+//! Pulls an SPI slave select line low and starts a transaction on the simulated bus
+#define hal_cs_low(port, pin)   do { (port) &= ~(1 << (pin)); avr_sim_spi_cs(1); } while (0)
+
+//! Releases an SPI slave select line and ends the transaction on the simulated bus
+#define hal_cs_high(port, pin)  do { (port) |= (1 << (pin)); avr_sim_spi_cs(0); } while (0)
+
+//! Starts an SPI transfer, which the simulated bus clocks in the background while SPIE is set
+#define hal_spi_write(data)     do { SPDR = (data); avr_sim_spi_start(); } while (0)
+
+#else
+
+//! Pulls an SPI slave select line low
+#define hal_cs_low(port, pin)   ((port) &= ~(1 << (pin)))
+
+//! Releases an SPI slave select line
+#define hal_cs_high(port, pin)  ((port) |= (1 << (pin)))
+
+//! Starts an SPI transfer
+#define hal_spi_write(data)     (SPDR = (data))
+
+#endif
+
+#endif /* HAL_H_ */
@@ -0,0 +1,199 @@
+/** @file link.c
+ *  @author Nick Moore
+ *  @date October 15, 2026
+ *  @brief Framing of the serial link between the ECU and ESB, see link.h
+ *
+ *  @bug No known bugs
+ */
+
+#include <string.h>
+#include "link.h"
+
+const uint16_t linkCrcTable[256] PROGMEM = {
+	0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+	0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF,
+	0x1231, 0x0210, 0x3273, 0x2252, 0x52B5, 0x4294, 0x72F7, 0x62D6,
+	0x9339, 0x8318, 0xB37B, 0xA35A, 0xD3BD, 0xC39C, 0xF3FF, 0xE3DE,
+	0x2462, 0x3443, 0x0420, 0x1401, 0x64E6, 0x74C7, 0x44A4, 0x5485,
+	0xA56A, 0xB54B, 0x8528, 0x9509, 0xE5EE, 0xF5CF, 0xC5AC, 0xD58D,
+	0x3653, 0x2672, 0x1611, 0x0630, 0x76D7, 0x66F6, 0x5695, 0x46B4,
+	0xB75B, 0xA77A, 0x9719, 0x8738, 0xF7DF, 0xE7FE, 0xD79D, 0xC7BC,
+	0x48C4, 0x58E5, 0x6886, 0x78A7, 0x0840, 0x1861, 0x2802, 0x3823,
+	0xC9CC, 0xD9ED, 0xE98E, 0xF9AF, 0x8948, 0x9969, 0xA90A, 0xB92B,
+	0x5AF5, 0x4AD4, 0x7AB7, 0x6A96, 0x1A71, 0x0A50, 0x3A33, 0x2A12,
+	0xDBFD, 0xCBDC, 0xFBBF, 0xEB9E, 0x9B79, 0x8B58, 0xBB3B, 0xAB1A,
+	0x6CA6, 0x7C87, 0x4CE4, 0x5CC5, 0x2C22, 0x3C03, 0x0C60, 0x1C41,
+	0xEDAE, 0xFD8F, 0xCDEC, 0xDDCD, 0xAD2A, 0xBD0B, 0x8D68, 0x9D49,
+	0x7E97, 0x6EB6, 0x5ED5, 0x4EF4, 0x3E13, 0x2E32, 0x1E51, 0x0E70,
+	0xFF9F, 0xEFBE, 0xDFDD, 0xCFFC, 0xBF1B, 0xAF3A, 0x9F59, 0x8F78,
+	0x9188, 0x81A9, 0xB1CA, 0xA1EB, 0xD10C, 0xC12D, 0xF14E, 0xE16F,
+	0x1080, 0x00A1, 0x30C2, 0x20E3, 0x5004, 0x4025, 0x7046, 0x6067,
+	0x83B9, 0x9398, 0xA3FB, 0xB3DA, 0xC33D, 0xD31C, 0xE37F, 0xF35E,
+	0x02B1, 0x1290, 0x22F3, 0x32D2, 0x4235, 0x5214, 0x6277, 0x7256,
+	0xB5EA, 0xA5CB, 0x95A8, 0x8589, 0xF56E, 0xE54F, 0xD52C, 0xC50D,
+	0x34E2, 0x24C3, 0x14A0, 0x0481, 0x7466, 0x6447, 0x5424, 0x4405,
+	0xA7DB, 0xB7FA, 0x8799, 0x97B8, 0xE75F, 0xF77E, 0xC71D, 0xD73C,
+	0x26D3, 0x36F2, 0x0691, 0x16B0, 0x6657, 0x7676, 0x4615, 0x5634,
+	0xD94C, 0xC96D, 0xF90E, 0xE92F, 0x99C8, 0x89E9, 0xB98A, 0xA9AB,
+	0x5844, 0x4865, 0x7806, 0x6827, 0x18C0, 0x08E1, 0x3882, 0x28A3,
+	0xCB7D, 0xDB5C, 0xEB3F, 0xFB1E, 0x8BF9, 0x9BD8, 0xABBB, 0xBB9A,
+	0x4A75, 0x5A54, 0x6A37, 0x7A16, 0x0AF1, 0x1AD0, 0x2AB3, 0x3A92,
+	0xFD2E, 0xED0F, 0xDD6C, 0xCD4D, 0xBDAA, 0xAD8B, 0x9DE8, 0x8DC9,
+	0x7C26, 0x6C07, 0x5C64, 0x4C45, 0x3CA2, 0x2C83, 0x1CE0, 0x0CC1,
+	0xEF1F, 0xFF3E, 0xCF5D, 0xDF7C, 0xAF9B, 0xBFBA, 0x8FD9, 0x9FF8,
+	0x6E17, 0x7E36, 0x4E55, 0x5E74, 0x2E93, 0x3EB2, 0x0ED1, 0x1EF0
+};
+
+/** @brief Gives the payload length of a frame type
+ *
+ *  @param[in] type One of the LINK_ frame types
+ *  @return uint8_t The payload length, or LINK_NO_TYPE if there is no such type
+ */
+uint8_t linkLength(uint8_t type)
+{
+	switch (type){
+		case LINK_CONNECT:
+			return LINK_CONNECT_LEN;
+		case LINK_WELCOME:
+			return LINK_WELCOME_LEN;
+		case LINK_SHUTDOWN:
+			return LINK_SHUTDOWN_LEN;
+		case LINK_STARTUP:
+			return LINK_STARTUP_LEN;
+		case LINK_THROTTLE:
+			return LINK_THROTTLE_LEN;
+		case LINK_ECU_DATA:
+			return LINK_ECU_DATA_LEN;
+		case LINK_ACK:
+			return LINK_ACK_LEN;
+		case LINK_ESB_DATA:
+			return LINK_ESB_DATA_LEN;
+		default:
+			return LINK_NO_TYPE;
+	}
+}
+
+/** @brief Builds a frame around a payload
+ *
+ *  @param[out] frame Buffer for the frame, at least LINK_FRAME_LEN(len) bytes
+ *  @param[in] type One of the LINK_ frame types
+ *  @param[in] seq Sequence number of the frame
+ *  @param[in] payload The payload, len bytes
+ *  @param[in] len Length of the payload, which must be linkLength(type)
+ *  @return uint8_t Length of the whole frame
+ */
+uint8_t linkBuild(uint8_t *frame, uint8_t type, uint8_t seq, const void *payload, uint8_t len)
+{
+	uint16_t crc = LINK_CRC_INIT;
+	frame[0] = LINK_SOF;
+	frame[1] = type;
+	frame[2] = seq;
+	frame[3] = len;
+	memcpy(frame + LINK_HEADER, payload, len);
+	for (uint8_t i = 1; i < LINK_HEADER + len; i++){
+		crc = linkCrc(crc, frame[i]);
+	}
+	frame[LINK_HEADER + len] = crc >> 8;
+	frame[LINK_HEADER + len + 1] = crc;
+	return LINK_FRAME_LEN(len);
+}
+
+/** @brief Clears a receiver and its statistics
+ *
+ *  @param[out] rx The receiver
+ *  @return void
+ */
+void linkInit(struct link_rx *rx)
+{
+	memset(rx, 0, sizeof(*rx));
+}
+
+/** @brief Removes bytes from the front of the receive buffer, then everything up to the next start delimiter
+ *
+ *  @param[in,out] rx The receiver
+ *  @param[in] count Number of bytes to remove before looking for the next start delimiter
+ *  @return void
+ */
+static void linkDrop(struct link_rx *rx, uint8_t count)
+{
+	while (count < rx->fill && rx->buf[count] != LINK_SOF){
+		count++;
+		rx->stats.skipped++;
+	}
+	rx->fill -= count;
+	memmove(rx->buf, rx->buf + count, rx->fill);
+	rx->parsed = 0;
+}
+
+/** @brief Hands the receiver the next byte from the line
+ *
+ *  Bytes are only kept from a start delimiter onward.  linkPoll() has to be called until it returns 0
+ *  after every byte.
+ *
+ *  @param[in,out] rx The receiver
+ *  @param[in] byte The byte
+ *  @return void
+ */
+void linkPush(struct link_rx *rx, uint8_t byte)
+{
+	if (rx->fill == LINK_FRAME_MAX){
+		linkDrop(rx, 1);               // only if linkPoll() was not called, give up on the oldest frame
+	}
+	if (!rx->fill && byte != LINK_SOF){
+		rx->stats.skipped++;
+		return;
+	}
+	rx->buf[rx->fill++] = byte;
+}
+
+/** @brief Checks the bytes the receiver has been handed since the last call
+ *
+ *  This performs the following functions:
+ *  1) Runs the CRC over each new byte, and checks the length against the type once the header is in
+ *  2) Once a whole frame is in, checks the CRC, copies the frame to rx->frame and counts any lost frames
+ *  3) When the length or CRC is wrong, starts again from the next start delimiter after the bad frame's
+ *
+ *  Because a failed frame is searched again for a start delimiter, one call can find more than one frame.
+ *
+ *  @param[in,out] rx The receiver
+ *  @return uint8_t 1 if rx->frame holds a new frame, 0 once there are no more
+ */
+uint8_t linkPoll(struct link_rx *rx)
+{
+	while (rx->parsed < rx->fill){
+		uint8_t at = rx->parsed++;
+		uint8_t byte = rx->buf[at];
+		if (at == 0){
+			rx->crc = LINK_CRC_INIT;
+			continue;
+		}
+		if (at == 3 && byte != linkLength(rx->buf[1])){
+			rx->stats.lengthErrors++;
+			linkDrop(rx, 1);
+			continue;
+		}
+		if (at < LINK_HEADER || at < LINK_HEADER + rx->buf[3]){
+			rx->crc = linkCrc(rx->crc, byte);
+		}
+		else if (at == LINK_HEADER + rx->buf[3] + 1){
+			if (rx->crc != ((uint16_t) rx->buf[at - 1] << 8 | byte)){
+				rx->stats.crcErrors++;
+				linkDrop(rx, 1);
+				continue;
+			}
+			rx->frame.type = rx->buf[1];
+			rx->frame.seq = rx->buf[2];
+			rx->frame.len = rx->buf[3];
+			memcpy(rx->frame.payload, rx->buf + LINK_HEADER, rx->frame.len);
+			if (rx->synced){
+				rx->stats.lost += (uint8_t) (rx->frame.seq - rx->seq);
+			}
+			rx->seq = rx->frame.seq + 1;
+			rx->synced = 1;
+			rx->stats.frames++;
+			linkDrop(rx, at + 1);
+			return 1;
+		}
+	}
+	return 0;
+}
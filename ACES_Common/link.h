@@ -0,0 +1,100 @@
+/** @file link.h
+ *  @author Nick Moore
+ *  @date October 15, 2026
+ *  @brief Framing of the serial link between the ECU and ESB, shared by the ECU and ESB firmware
+ *
+ *  Every message on the link is sent as one frame:
+ *
+ *      LINK_SOF | type | sequence | length | payload (length bytes) | CRC high | CRC low
+ *
+ *  The CRC is CRC-16/CCITT (polynomial 0x1021, starting at 0xFFFF) over the type, sequence, length and
+ *  payload.  Each type has a fixed payload length, so a header whose length does not match its type is
+ *  rejected as soon as it arrives.  The sequence number goes up by one with every frame a side sends, which
+ *  lets the receiver count the frames it has lost.
+ *
+ *  The receiver is fed one byte at a time from the receive interrupt and checks the CRC as the bytes come
+ *  in.  When a frame fails, the receiver goes back to the byte after that frame's start delimiter and looks
+ *  for the next one, so a corrupted, dropped or extra byte costs the frame it landed in and nothing after it.
+ *
+ *  @bug No known bugs
+ */
+
+#include <stdint.h>
+#include <avr/pgmspace.h>
+
+#ifndef LINK_H_
+#define LINK_H_
+
+///////////////////////////////////////////////////////////////////////////
+///////////////////////// Frame Layout ////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////
+#define LINK_SOF 0x7E                  // Start delimiter of every frame
+#define LINK_HEADER 4                  // Start delimiter, type, sequence and length
+#define LINK_MAX_PAYLOAD 12            // Longest payload of any frame type
+#define LINK_FRAME_LEN(len) (LINK_HEADER + (len) + 2)    // Length of a whole frame with a len byte payload
+#define LINK_FRAME_MAX LINK_FRAME_LEN(LINK_MAX_PAYLOAD)
+#define LINK_CRC_INIT 0xFFFF
+#define LINK_NO_TYPE 0xFF              // linkLength() of a type which does not exist
+
+///////////////////////////////////////////////////////////////////////////
+///////////////////////// Frame Types /////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////
+#define LINK_CONNECT 'A'               // ECU to ESB, connection request carrying the password "ACES"
+#define LINK_CONNECT_LEN 4
+#define LINK_WELCOME 'D'               // ESB to ECU, answer to the connection request carrying "DALE"
+#define LINK_WELCOME_LEN 4
+#define LINK_SHUTDOWN 'S'              // ECU to ESB, shut the engine down
+#define LINK_SHUTDOWN_LEN 0
+#define LINK_STARTUP 'r'               // ECU to ESB, start the engine
+#define LINK_STARTUP_LEN 0
+#define LINK_THROTTLE 't'              // ECU to ESB, new throttle value
+#define LINK_THROTTLE_LEN 1
+#define LINK_ECU_DATA 'N'              // ECU to ESB, mass flow and battery voltage as two floats
+#define LINK_ECU_DATA_LEN 8
+#define LINK_ACK 'K'                   // ESB to ECU, carries the type of the command being acknowledged
+#define LINK_ACK_LEN 1
+#define LINK_ESB_DATA 'E'              // ESB to ECU, opMode, RPM, EGT, glow plug and ESB temperature
+#define LINK_ESB_DATA_LEN 12
+
+//! A frame which has passed its CRC
+struct link_frame {
+	uint8_t type;
+	uint8_t seq;
+	uint8_t len;
+	uint8_t payload[LINK_MAX_PAYLOAD];
+};
+
+//! Receiver statistics, which only ever count up
+struct link_stats {
+	uint16_t frames;                   // frames which passed their CRC
+	uint16_t crcErrors;                // frames which failed their CRC
+	uint16_t lengthErrors;             // headers with an unknown type, or a length which does not match the type
+	uint16_t lost;                     // frames missing from the sequence numbers of the frames received
+	uint16_t skipped;                  // bytes thrown away while looking for a start delimiter
+};
+
+//! Receiving end of the link
+struct link_rx {
+	uint8_t buf[LINK_FRAME_MAX];       // bytes from the start delimiter of the frame being received onward
+	uint8_t fill;                      // bytes in buf
+	uint8_t parsed;                    // bytes of buf the CRC has been run over
+	uint16_t crc;                      // CRC of buf up to parsed
+	uint8_t seq;                       // sequence number the next frame should carry
+	uint8_t synced;                    // set once a frame has been received, so that seq means something
+	struct link_frame frame;           // the latest good frame, see linkPoll()
+	struct link_stats stats;
+};
+
+//! CRC-16/CCITT of every byte value
+extern const uint16_t linkCrcTable[256] PROGMEM;
+
+//! Folds one byte into a running CRC
+#define linkCrc(crc, byte) ((uint16_t) ((crc) << 8) ^ pgm_read_word(&linkCrcTable[(uint8_t) (((crc) >> 8) ^ (byte))]))
+
+uint8_t linkLength(uint8_t type);
+uint8_t linkBuild(uint8_t *frame, uint8_t type, uint8_t seq, const void *payload, uint8_t len);
+void linkInit(struct link_rx *rx);
+void linkPush(struct link_rx *rx, uint8_t byte);
+uint8_t linkPoll(struct link_rx *rx);
+
+#endif /* LINK_H_ */
@@ -0,0 +1,44 @@
+/** @file parity.c
+ *  @author Nick Moore
+ *  @date October 15, 2026
+ *  @brief Parity bytes of the GUI serial frame, see parity.h
+ *
+ *  @bug No known bugs
+ */
+
+#include "parity.h"
+
+const uint8_t parityOnes[256] PROGMEM = {
+	0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+	1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5,
+	1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5,
+	2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6,
+	1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5,
+	2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6,
+	2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6,
+	3, 4, 4, 5, 4, 5, 5, 6, 4, 5, 5, 6, 5, 6, 6, 7,
+	1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5,
+	2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6,
+	2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6,
+	3, 4, 4, 5, 4, 5, 5, 6, 4, 5, 5, 6, 5, 6, 6, 7,
+	2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6,
+	3, 4, 4, 5, 4, 5, 5, 6, 4, 5, 5, 6, 5, 6, 6, 7,
+	3, 4, 4, 5, 4, 5, 5, 6, 4, 5, 5, 6, 5, 6, 6, 7,
+	4, 5, 5, 6, 5, 6, 6, 7, 5, 6, 6, 7, 6, 7, 7, 8
+};
+
+/** @brief Function to calculate the parity byte for a corresponding sequence of 6 bytes
+ *
+ *  @param[in] message Entire message which a subset will be used in order to calculate the parity byte
+ *  @param[in] start_index Starting index within message for which to calculate the parity byte
+ *  @return uint8_t
+ */
+uint8_t calculateParity(const void *message, uint8_t start_index)
+{
+	const uint8_t *bytes = (const uint8_t *) message + start_index;
+	
+	// bytes 0-2 take up the low nibble and bytes 3-5 the high nibble, each count modulo 16
+	uint8_t low = countOnes(bytes[0]) + countOnes(bytes[1]) + countOnes(bytes[2]);
+	uint8_t high = countOnes(bytes[3]) + countOnes(bytes[4]) + countOnes(bytes[5]);
+	return (low & 0x0F) | (high << 4);
+}
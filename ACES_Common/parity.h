@@ -0,0 +1,27 @@
+/** @file parity.h
+ *  @author Nick Moore
+ *  @date October 15, 2026
+ *  @brief Parity bytes of the GUI serial frame
+ *
+ *  A parity byte covers 6 bytes of a frame.  Its low nibble is the number of high bits in the first 3 bytes
+ *  and its high nibble is the number in the other 3, both modulo 16.  The ECU/ESB link is checked with the
+ *  CRC-16 in link.h instead.
+ *
+ *  @bug No known bugs
+ */
+
+#include <stdint.h>
+#include <avr/pgmspace.h>
+
+#ifndef PARITY_H_
+#define PARITY_H_
+
+//! Number of high bits in a byte, looked up in flash
+#define countOnes(byte) pgm_read_byte(&parityOnes[(uint8_t) (byte)])
+
+//! Number of high bits in every byte value
+extern const uint8_t parityOnes[256] PROGMEM;
+
+uint8_t calculateParity(const void *message, uint8_t start_index);
+
+#endif /* PARITY_H_ */
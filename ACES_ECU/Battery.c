@@ -0,0 +1,121 @@
+/** @file Battery.c
+ *  @author Nick Moore
+ *  @date October 15, 2026
+ *  @brief Per cell monitoring of the LiPo, see Battery.h
+ *
+ *  @bug No known bugs
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <string.h>
+#include "ECU_funcs.h"
+#include "Battery.h"
+
+/** @brief Clears the state of the pack, before the ADC sampler starts
+ *
+ *  @param void
+ *  @return void
+ */
+void batInit(void)
+{
+	memset((void *) &bat, 0, sizeof(bat));
+	bat.secondsLeft = BAT_NO_PREDICTION;
+	bat.readings = BAT_WINDOW - 1;     // the first window starts on the first steady reading
+	batLoaded = 0;
+}
+
+/** @brief Updates the state of the pack from a new reading of every ADC channel.  Called from ADC_vect
+ *
+ *  This performs the following functions:
+ *
+ *  1) Works out the voltage of each cell from the taps on either side of it
+ *  2) Once the voltages are steady after the pump switched, updates the voltages at rest while it is off,
+ *     or takes the sag of each cell once when it has come on
+ *  3) At the end of every window, measures how far the pack at rest has dropped and predicts how long is
+ *     left before it browns the ESB out
+ *  4) Raises or clears the warnings
+ *
+ *  @param void
+ *  @return void
+ */
+void batUpdate(void)
+{
+	volatile struct battery *b = &bat;
+	uint16_t tap1 = adcScale(adcChannels[BAT_TAP1].total);
+	uint16_t tap2 = adcScale(adcChannels[BAT_TAP2].total);
+	uint16_t pack = adcScale(adcChannels[ADC_PACK].total);
+	uint8_t loaded = batLoaded;
+
+	b->cell[0] = tap1;
+	b->cell[1] = (tap2 > tap1) ? tap2 - tap1 : 0;
+	b->cell[2] = (pack > tap2) ? pack - tap2 : 0;
+	b->pack = pack;
+
+	if (loaded != b->wasLoaded){
+		b->wasLoaded = loaded;
+		b->steady = 0;
+	}
+	if (b->steady <= BAT_SETTLE)
+		b->steady++;
+	uint16_t sag = 0;
+	uint8_t low = 0;
+	for (uint8_t i = 0; i < BAT_CELLS; i++){
+		if (!loaded && b->steady >= BAT_SETTLE)
+			b->rest[i] = b->cell[i];
+		else if (loaded && b->steady == BAT_SETTLE)    // only as it comes on, after that the drop is the pack running down
+			b->sag[i] = (b->rest[i] > b->cell[i]) ? b->rest[i] - b->cell[i] : 0;
+		sag += b->sag[i];
+		low |= b->cell[i] < BAT_CELL_LOW_MV;
+	}
+	uint16_t atRest = loaded ? pack + sag : pack;
+	uint16_t underLoad = loaded ? pack : ((pack > sag) ? pack - sag : 0);
+
+	// a window only ends once the voltages are steady, as atRest is off while the pump has just switched
+	if (++b->readings >= BAT_WINDOW && b->steady > BAT_SETTLE){
+		if (b->windowed){
+			int16_t rate = (int32_t) ((int32_t) b->windowStart - atRest) * 60000 / (int32_t) BAT_WINDOW_MS;
+			if (b->rated)
+				b->rate += (rate - b->rate) / (1 << BAT_RATE_SMOOTH);
+			else
+				b->rate = rate;
+			b->rated = 1;
+			if (b->rate <= 0)
+				b->secondsLeft = BAT_NO_PREDICTION;
+			else if (underLoad <= BAT_PACK_MIN_MV)
+				b->secondsLeft = 0;
+			else{
+				uint32_t seconds = (uint32_t) (underLoad - BAT_PACK_MIN_MV) * 60 / b->rate;
+				b->secondsLeft = (seconds < BAT_NO_PREDICTION) ? seconds : BAT_NO_PREDICTION - 1;
+			}
+		}
+		b->windowed = 1;
+		b->windowStart = atRest;
+		b->readings = 0;
+	}
+
+	uint8_t warning = low ? BAT_WARN_CELL : 0;
+	if (underLoad <= BAT_PACK_MIN_MV || b->secondsLeft < BAT_WARN_SECONDS)
+		warning |= BAT_WARN_SOON;
+	b->warning = warning;
+}
+
+/** @brief Copies the state of the pack into the telemetry frame
+ *
+ *  The cells and their sag go in as uint16_t mV, then the rate as an int16_t in mV a minute, the seconds
+ *  left as a uint16_t and the warnings, BAT_PACKED bytes in all.
+ *
+ *  @param[out] data Where in the frame it goes
+ *  @return void
+ */
+void batPack(uint8_t *data)
+{
+	uint8_t sreg = SREG;
+	cli();
+	memcpy(data, (const void *) bat.cell, sizeof(bat.cell));
+	memcpy(data + 6, (const void *) bat.sag, sizeof(bat.sag));
+	memcpy(data + 12, (const void *) &bat.rate, sizeof(bat.rate));
+	memcpy(data + 14, (const void *) &bat.secondsLeft, sizeof(bat.secondsLeft));
+	data[16] = bat.warning;
+	SREG = sreg;
+}
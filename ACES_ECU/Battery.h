@@ -0,0 +1,93 @@
+/** @file Battery.h
+ *  @author Nick Moore
+ *  @date October 15, 2026
+ *  @brief Per cell monitoring of the 3S LiPo which powers the ECU, ESB and fuel pump, worked out in ADC_vect
+ *
+ *  The pack is on ADC_PACK and the balance taps after cells 1 and 2 on BAT_TAP1 and BAT_TAP2, all through
+ *  the same 1:3 divider.  Every time the ADC sampler has a new reading of all three, ADC_vect calls batUpdate(),
+ *  which does the following:
+ *
+ *  1) Takes each cell as the difference between the taps on either side of it
+ *  2) Keeps the last voltages read at rest, while no fuel is flowing, and takes the sag of each cell under
+ *     pump load as the drop from those to the voltages read while the pump runs
+ *  3) Measures how fast the pack is running down over windows of BAT_WINDOW readings, about 5 s, from its
+ *     voltage at rest, which is the voltage under load plus the sag, so the pump switching on or off is not
+ *     taken for the pack running down.  The rate is smoothed over several windows
+ *  4) From the rate, predicts how long the pack has before it drops under BAT_PACK_MIN_MV under load, where
+ *     the ESB browns out, and warns when that is less than BAT_WARN_SECONDS or a cell is below BAT_CELL_LOW_MV
+ *
+ *  It only costs ADC_vect a few multiplies every reading and two divisions every window, and the main loop
+ *  nothing but batPack() when it puts the telemetry frame together.
+ *
+ *  The warnings go to the GUI only, for the operator to shut the engine down with its cooling cycle while
+ *  there is still time.  The ESB is not sent them, as nothing on it would act on them, and a shutdown
+ *  ordered from a prediction alone is not wanted.
+ *
+ *  @bug No known bugs
+ */
+
+#include <stdint.h>
+#include "Sampler.h"
+
+#ifndef BATTERY_H_
+#define BATTERY_H_
+
+///////////////////////////////////////////////////////////////////////////
+///////////////////////// Configuration ///////////////////////////////////
+///////////////////////////////////////////////////////////////////////////
+#define BAT_CELLS 3
+#define BAT_TAP1 1                     // ADC channel of the balance tap after cell 1
+#define BAT_TAP2 2                     // ADC channel of the balance tap after cell 2
+#define BAT_CELL_LOW_MV 3500           // A cell below this is warned about
+#define BAT_PACK_MIN_MV 9900           // Pack voltage under load at which the ESB browns out, 3.3 V a cell
+#define BAT_WARN_SECONDS 60            // Warning given this long before the pack is predicted to reach BAT_PACK_MIN_MV
+#define BAT_WINDOW_BITS 10             // log2 of the readings the discharge rate is measured over
+#define BAT_RATE_SMOOTH 2              // log2 of the windows the discharge rate is smoothed over
+
+#define BAT_WINDOW (1U << BAT_WINDOW_BITS)
+#define BAT_WINDOW_MS ((uint32_t) ((uint64_t) BAT_WINDOW * ADC_READING_CYCLES * 1000 / F_CPU))   // Length of a window
+#define BAT_SETTLE (ADC_RING + 2)     // Readings after the pump switches before the voltages are taken as steady
+#define BAT_NO_PREDICTION 0xFFFF       // secondsLeft while the pack is not running down
+#define BAT_PACKED 17                  // Bytes batPack() puts in the telemetry frame
+
+///////////////////////////////////////////////////////////////////////////
+/////////////////////////// Warnings //////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////
+#define BAT_WARN_CELL 0x01             // A cell is below BAT_CELL_LOW_MV
+#define BAT_WARN_SOON 0x02             // The pack is predicted to brown the ESB out within BAT_WARN_SECONDS
+
+//! State of the pack, only written by batUpdate()
+struct battery {
+	uint16_t cell[BAT_CELLS];          // mV of each cell, cell 1 at the negative end
+	uint16_t rest[BAT_CELLS];          // mV of each cell as last read at rest
+	uint16_t sag[BAT_CELLS];           // mV each cell last dropped by under pump load
+	uint16_t pack;                     // mV of the whole pack
+	int16_t rate;                      // mV a minute the pack is running down at, negative while it recovers
+	uint16_t secondsLeft;              // Until the pack reaches BAT_PACK_MIN_MV under load, BAT_NO_PREDICTION if unknown
+	uint8_t warning;                   // BAT_WARN_ bits
+	uint8_t rated;                     // Set once rate has been measured over a whole window
+	uint8_t windowed;                  // Set once the first window has started
+	uint16_t readings;                 // Readings so far in the current window
+	uint16_t windowStart;              // mV of the pack at rest when the current window started
+	uint8_t wasLoaded;                 // batLoaded as of the last reading
+	uint8_t steady;                    // Readings since the pump last switched on or off, up to BAT_SETTLE + 1
+};
+
+//////////////////////////////////////////////////////////////////////////
+///////////////////////////  Functions  //////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+void batInit(void);
+void batUpdate(void);
+void batPack(uint8_t *data);
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////// Global Variables  ///////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+//! State of the pack, see batPack() to read it from the main loop
+volatile struct battery bat;
+
+//! Set by measureFlow while fuel is flowing, so the pump is drawing from the pack
+volatile uint8_t batLoaded;
+
+#endif /* BATTERY_H_ */
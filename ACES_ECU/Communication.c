@@ -13,29 +13,59 @@
 #include <string.h>
 #include "ECU_funcs.h"
 
-/** @brief Transmits data between the ECU and ESB
+/** @brief Queues a frame for transmission to the ESB
  *
  *  This performs the following functions:
  *  
- *  1) Pulls the SS line for the ESB low, this will cause the ESB to listen to the com line
- *  2) Fills the specified data into the transmit buffer
- *  3) Waits for the data to be received from the ESB
- *  4) Pulls the SS line high to end communication with ESB for that byte
+ *  1) Builds the frame around the payload with the next sequence number and its CRC
+ *  2) Copies the frame into the transmit queue
+ *  3) Enables the USART1 data register empty interrupt, which sends the queue in the background
  *
- *  @param char The byte that is going to be sent to the ESB
- *  @return char The received byte from the ESB
+ *  A frame which does not fit in the free space of the queue is dropped whole rather than sent in part, and
+ *  does not use up a sequence number.
+ *
+ *  @param type One of the LINK_ frame types
+ *  @param payload The payload of the frame
+ *  @param len The length of the payload, which must be linkLength(type)
+ *  @return uint8_t 1 if the frame was queued, 0 if it was dropped
  */
-void sendToESB(uint8_t len)
+uint8_t sendToESB(uint8_t type, const void *payload, uint8_t len)
 {
-	// this will send the number of character in ESBmessage up to len
+	uint8_t frame[LINK_FRAME_MAX];
+	uint8_t queued = 0;
 	cli();
-	for(uint8_t i = 0; i < len; i++)
-	{
-		while ( !( UCSR1A & (1<<UDRE1)) );
-		/* Put data into buffer, sends the data */
-		UDR1 = ESBtransmit[i];
+	uint8_t size = linkBuild(frame, type, ESBtxSeq, payload, len);
+	uint8_t head = ESBtxHead;
+	if (size <= ((ESBtxTail - head - 1) & (ESB_TX_SIZE - 1))){      // one slot is kept empty to tell full from empty
+		for (uint8_t i = 0; i < size; i++){
+			ESBtxQueue[head] = frame[i];
+			head = (head + 1) & (ESB_TX_SIZE - 1);
+		}
+		ESBtxHead = head;
+		ESBtxSeq++;
+		UCSR1B |= (1 << UDRIE1);     // start sending
+		queued = 1;
+	}
+	sei();     // always turn these back on, shutdown() and friends are run from ISRs and need the ESB's reply
+	return queued;
+}
+
+/** @brief Interrupt Service Routine which sends the next queued byte to the ESB
+ *
+ *  When the queue is empty the interrupt disables itself until sendToESB queues another message.
+ *
+ *  @param void
+ *  @return void
+ */
+ISR(USART1_UDRE_vect)
+{
+	if (ESBtxTail == ESBtxHead){
+		assign_bit(&UCSR1B, UDRIE1, 0);      // nothing left to send
+	}
+	else{
+		UDR1 = ESBtxQueue[ESBtxTail];
+		ESBtxTail = (ESBtxTail + 1) & (ESB_TX_SIZE - 1);
 	}
-	sei();
 }
 
 /** @brief Establishes the connection between the ECU and ESB
@@ -52,12 +82,7 @@ void sendToESB(uint8_t len)
  */
 void ESB_Connect(void)
 {
-
-	ESBtransmit[0] = 'A';
-	ESBtransmit[1] = 'C';
-	ESBtransmit[2] = 'E';
-	ESBtransmit[3] = 'S';
-	sendToESB(4);	
+	sendToESB(LINK_CONNECT, "ACES", LINK_CONNECT_LEN);
 }
 
 /** @brief Establishes the connection between the ECU and Windows GUI
@@ -72,33 +97,28 @@ void ESB_Connect(void)
  */
 void GUI_Connect(void)
 {
-	char message[] = "DALE";
-	for (uint8_t i = 0; i < 4; i++){                // This will also send the terminator
-		/* Wait for empty transmit buffer */
-		while ( !( UCSR0A & (1<<UDRE0)) );
-		/* Put data into buffer, sends the data */
-		UDR0 = message[i];
-	}
+	replyToLaptop("DALE", 4);
 	connected_GUI = 1;
 	doTransmit = -1;
 }
 
-/** @brief Transmits periodic data between the ECU and Windows GUI
+/** @brief Fills the GUIframe which is not on the serial line with a snapshot of the data, parity bytes included
  *
- *  This performs the following functions:
- *  
- *  1) Prepares the message to send to the Windows GUI
- *  2) Loops through this message, sending it one byte at a time
+ *  The frame is taken out of the rotation until publishToLaptop() is called, so it can be sent over
+ *  Ethernet in the meantime.  Timer 4 is started, which the GUI stops by acknowledging the frame.
  *
  *  @param void
- *  @return void
+ *  @return const char* The frame, GUI_FRAME_LEN bytes, which stays as it is until the next call
  */
-void sendToLaptop(void)
+const char *packLaptopFrame(void)
 {
 	//loadESBData();
-	dummyData();    // remove this later
-	// This function will be responsible for packaging and sending the desired data to the Windows GUI
-	char message[28];              // this is the base length of the message with room for the parity bytes
+	//dummyData();    // remove this later
+	// Take the spare frame out of the rotation while it is being filled
+	cli();
+	GUIframeReady = 0;
+	char *message = GUIframe[GUIsending ^ 1];
+	sei();
 	// now fill the message
 	if (!connected_ESB){
 		message[0] = 'b';          // This means that the ESB is not connected or it has lost connection
@@ -146,31 +166,120 @@ void sendToLaptop(void)
 	memcpy(message+1,&massFlow,sizeof(float));          // This should fill 1->4 with the float value
 	memcpy(message+5,&Hall_effect,sizeof(uint16_t));    // This should fill 5->6 with the Hall effect sensor value
 	memcpy(message+7,&EGT,sizeof(float));            // This should fill 7->8 with the EGT value 
+	voltage.f = batMillivolts * 0.001;
 	memcpy(message+11,&voltage,sizeof(float));      // this should fill 9->12 with the value of the battery voltage
 	memcpy(message+15,&glow_plug,sizeof(char));         // This should fill 13 with the glow plug on/off
 	memcpy(message+16,&ECU_temp,sizeof(float));         // This should fill 14->17 with the temperature of the ECU
 	memcpy(message+20,&ESB_temp,sizeof(float));         // This should fill 18->21 with the ambient temperature of the ESB
+	memset(message+GUI_TEMPS, 0, GUI_DATA_LEN-GUI_TEMPS);
+	for (uint8_t i = 0; i < ECU_temp_sensors; i++){
+		int16_t temp;
+		tempReading(i, &temp);
+		memcpy(message+GUI_TEMPS+2*i,&temp,sizeof(int16_t));   // Then every ECU sensor, TEMP_NONE if it has no reading
+	}
+	batPack((uint8_t *) message+GUI_BATTERY);           // Then the cells of the battery
 	
 	// now that the message is made, I need to calculate and populate the parity bytes
-	message[24] = calculateParity(message, 0);
-	message[25] = calculateParity(message, 6);
-	message[26] = calculateParity(message, 12);
-	message[27] = calculateParity(message, 18);
+	for (uint8_t i = 0; i < GUI_DATA_LEN; i += 6){
+		message[GUI_DATA_LEN + i/6] = calculateParity(message, i);
+	}
 	
-	// At this point it is advantageous to turn off global interrupts so that this process is not interrupted
+	TCCR4B = (1 << CS42);      // start timer 4 with prescalar of 256
+	return message;
+}
+
+/** @brief Marks the frame packLaptopFrame() filled last ready, the USART0 data register empty interrupt sends
+ *  it once the current frame is out
+ *
+ *  If a snapshot is published before the previous one has gone out, the newer one replaces it.
+ *
+ *  @param void
+ *  @return void
+ */
+void publishToLaptop(void)
+{
 	cli();
-	for (uint8_t i = 0; i < 28; i++){
-		/* Wait for empty transmit buffer */
-		while ( !( UCSR0A & (1<<UDRE0)) );
-		/* Put data into buffer, sends the data */
-		UDR0 = message[i];
+	GUIframeReady = 1;
+	UCSR0B |= (1 << UDRIE0);
+	sei();
+}
+
+/** @brief Transmits periodic data between the ECU and Windows GUI over the serial link
+ *
+ *  @param void
+ *  @return void
+ */
+void sendToLaptop(void)
+{
+	packLaptopFrame();
+	publishToLaptop();
+}
+
+/** @brief Sends the last data frame to the Windows GUI again
+ *
+ *  Nothing is rebuilt, the frame which went out last is just sent again.  If it is still going out, or
+ *  a newer frame is waiting, that frame serves as the repeat.  This is called from USART0_RX_vect.
+ *
+ *  @param void
+ *  @return void
+ */
+void resendToLaptop(void)
+{
+	if (GUIframeIndex >= GUI_FRAME_LEN && !GUIframeReady){
+		GUIframeIndex = 0;
+		UCSR0B |= (1 << UDRIE0);
 	}
-	sei();   // Now need to turn global interrupts back on
-	// Now start the timer
-	
 	TCCR4B = (1 << CS42);      // start timer 4 with prescalar of 256
+}
 
+/** @brief Queues a short reply to a command from the Windows GUI
+ *
+ *  The reply goes out between data frames so it cannot split one.  This is called from USART0_RX_vect.
+ *
+ *  @param[in] message The reply
+ *  @param[in] len Length of the reply, at most GUI_REPLY_LEN
+ *  @return uint8_t 1 if the reply was queued, 0 if the previous reply has not gone out yet
+ */
+uint8_t replyToLaptop(const char *message, uint8_t len)
+{
+	if (GUIreplyIndex < GUIreplyLen || len > GUI_REPLY_LEN)
+		return 0;
+	memcpy(GUIreply, message, len);
+	GUIreplyLen = len;
+	GUIreplyIndex = 0;
+	UCSR0B |= (1 << UDRIE0);
+	return 1;
+}
 
+/** @brief Interrupt Service Routine which sends the next byte to the Windows GUI
+ *
+ *  This performs the following functions:
+ *  
+ *  1) Finishes the data frame in progress
+ *  2) Then sends any reply to a GUI command
+ *  3) Then swaps to the newest data frame if one has been published
+ *  4) Otherwise disables itself until there is something to send
+ *
+ *  @param void
+ *  @return void
+ */
+ISR(USART0_UDRE_vect)
+{
+	if (GUIframeIndex < GUI_FRAME_LEN){
+		UDR0 = GUIframe[GUIsending][GUIframeIndex++];
+	}
+	else if (GUIreplyIndex < GUIreplyLen){
+		UDR0 = GUIreply[GUIreplyIndex++];
+	}
+	else if (GUIframeReady){
+		GUIframeReady = 0;
+		GUIsending ^= 1;
+		UDR0 = GUIframe[GUIsending][0];
+		GUIframeIndex = 1;
+	}
+	else{
+		assign_bit(&UCSR0B, UDRIE0, 0);      // nothing left to send
+	}
 }
 
 /** @brief Interrupt Service Routine for when a message has been received from the Windows GUI
@@ -227,7 +336,7 @@ ISR(USART0_RX_vect)
 		}
 		else if (data == 'R'){    // This means that the data needs to be sent to the GUI one more time
 			newCommand = 1;
-			sendToLaptop();   // this will just use what ever the values of the data currently are
+			resendToLaptop();   // this just repeats the last frame
 		}
 		else{
 			commandMode = 0;               // This will handle all undefined behavior
@@ -262,79 +371,68 @@ ISR(USART0_RX_vect)
 	}
 }
 
-// This interrupt will be triggered whenever data is received from the ESB
+/** @brief Acts on a frame received from the ESB
+ *
+ *  Every good frame from the ESB restarts the Timer 5 connection watchdog.
+ *
+ *  @param[in] frame The frame, which has already passed its CRC
+ *  @return void
+ */
+static void ESBframe(const struct link_frame *frame)
+{
+	TCNT5 = ESB_timer_val;
+	switch (frame->type){
+		case LINK_WELCOME:                  // this means that the ESB is sending the connection string back
+			if (!memcmp(frame->payload, "DALE", LINK_WELCOME_LEN)){
+				connected_ESB = 1;
+				TCCR5B |= (1 << CS52);      // start the ESB connection timer with a prescalar of 256
+			}
+			break;
+		
+		case LINK_ACK:
+			ESBack = frame->payload[0];
+			break;
+		
+		case LINK_ESB_DATA:                 // This will handle the normal data transmission
+			loadESBData(frame->payload);
+			break;
+	}
+}
+
+/** @brief Interrupt Service Routine for the data received from the ESB
+ *
+ *  Each byte is handed to the link receiver, which checks the CRC as the frame comes in and finds the start
+ *  of the next frame on its own after a bad one.
+ *
+ *  @param void
+ *  @return void
+ */
 ISR(USART1_RX_vect)
 {
 	uint8_t data = UDR1;
 	hasInterrupted = 1;      // set this flag so other functions will know if they have been interrupted
-	if (newCommand_ESB == 1)
-	{
-		ESBreceive[0] = data;
-		if (data == 'K'){
-			newCommand_ESB = 1;
-			ESBreceiveCount = 0;
-		}
-		else if (data == 'D'){
-			newCommand_ESB = 2;       // this means that the ESB is sending the connection string back
-			ESBreceiveCount = 0;
-		}
-		else if (data == 'N'){
-			newCommand_ESB = 3;
-			ESBreceiveCount = 0;
-			TCNT5 = ESB_timer_val;
-		}
+	linkPush(&ESBlink, data);
+	while (linkPoll(&ESBlink)){
+		ESBframe(&ESBlink.frame);
 	}
-	else if (newCommand_ESB == 2){
-		ESBreceiveCount++;
-		switch(ESBreceiveCount){
-			case 1:
-				if (data != 'A'){
-					ESBreceiveCount = 0;
-					newCommand_ESB = 1;
-				}
-				break;
-			case 2:
-				if (data != 'L'){
-					ESBreceiveCount = 0;
-					newCommand_ESB = 1;	
-				}
-				break;
-			case 3:
-				if (data == 'E'){
-					connected_ESB = 1;
-					TCCR5B |= (1 << CS52);      // start the ESB connection timer with a prescalar of 256
-				}
-				ESBreceiveCount = 0;
-				newCommand_ESB = 1;
-				break;
-
-		}
-	}
-	else if (newCommand_ESB == 3){                     // This will handle the normal data transmission
-		ESBreceiveCount++;
-		ESBreceive[ESBreceiveCount] = data;
-		if (ESBreceiveCount >= 10){
-			ESBreceiveCount = 0;
-			newCommand_ESB = 1;                       // This indicates the end of the data string
-			loadESBData();
-		}
-	}
-	
 }
 
+/** @brief Loads the mass flow and battery voltage into ESBtransmit, the payload of the LINK_ECU_DATA frame
+ *
+ *  @param void
+ *  @return void
+ */
 void packageMessage(void)
 {
-	ESBtransmit[0] = 'N';
-	ESBtransmit[1] = massFlow.c[0];
-	ESBtransmit[2] = massFlow.c[1];
-	ESBtransmit[3] = massFlow.c[2];
-	ESBtransmit[4] = massFlow.c[3];
-	ESBtransmit[5] = voltage.c[0];
-	ESBtransmit[6] = voltage.c[1];
-	ESBtransmit[7] = voltage.c[2];
-	ESBtransmit[8] = voltage.c[3];
-	ESBtransmit[9] = calculateParity(ESBtransmit, 0);
-	ESBtransmit[10] = calculateParity(ESBtransmit, 3);
+	ESBtransmit[0] = massFlow.c[0];
+	ESBtransmit[1] = massFlow.c[1];
+	ESBtransmit[2] = massFlow.c[2];
+	ESBtransmit[3] = massFlow.c[3];
+	voltage.f = batMillivolts * 0.001;
+	ESBtransmit[4] = voltage.c[0];
+	ESBtransmit[5] = voltage.c[1];
+	ESBtransmit[6] = voltage.c[2];
+	ESBtransmit[7] = voltage.c[3];
 }
 
 /** @brief Requests the Windows GUI to repeat the last sent command
@@ -348,87 +446,21 @@ void packageMessage(void)
  */
 void repeatCommand(void)
 {
-	/* Wait for empty transmit buffer */
-	while ( !( UCSR0A & (1<<UDRE0)) );
-	
-	/* Put data into buffer, sends the data */
-	UDR0 = 'V';	
+	replyToLaptop("V", 1);
 	// Will have to see in unit testing how long this takes to get the response from the GUI
 }
 
-void i2c_Start(unsigned char address)
-{
-	TWCR = (1<<TWSTA) | (1<<TWINT) | (1 << TWEN);   // this will issue the start command, enable TWI, and clear the interrupt flag, if needed
-	while (!(TWCR & (1<<TWINT)));    // wait for the start condition to be transmitted 
-	if ((TWSR & 0xF8) != 0x08 && (TWSR & 0xF8) != 0x10)
-		i2c_Start(address);            // it will call this recursively until the start is transmitted
-		
-	// Now send the addressing byte 
-	TWDR = address;
-	TWCR = (1<<TWINT) | (1 << TWEN);    // this will start the data transfer
-	
-	while (!(TWCR & (1<<TWINT)));    // wait for the address byte to be sent
-	
-	if ((TWSR & 0xF8) != 0x18 && (TWSR & 0xF8) != 0x40){    // the first is if it is in write mode and the second is if it is in read mode
-		i2c_Stop();   // stop the current i2c message string
-		i2c_Start(address);  // retry.  This will make an infinite loop if something is wrong
-			
-	}
-		
-}
-
-void i2c_Stop(void)
-{
-	TWCR = (1<<TWINT) | (1<<TWSTO) | (1 << TWEN);  // this will issue the stop command
-	
-}
-
-void i2c_write(unsigned char data)
-{
-	TWDR = data;
-	TWCR = (1<<TWINT) | (1 << TWEN);    // this will start the data transmission
-	
-	while (!(TWCR & (1<<TWINT)));    // wait for the data to be transmitted
-	
-	if ((TWSR & 0xF8) != 0x28) {   // this is the hex number that should be received if the acknowledge has been received
-	     // fill in this later for error checking	
-	}
-		
-}
-
-unsigned char i2c_read(unsigned char ack)
-{
-	// write the interrupt bit low and set the appropriate acknowledge bit
-	TWCR = (1<<TWINT) | (ack << TWEA) | (1 << TWEN);  
-	
-	// and now we wait for data
-	while (!(TWCR & (1<<TWINT)));
-	
-	if ((TWSR & 0xF8) != 0x50 && ack) {   // this is the hex number that should be received if the acknowledge has been received
-		// fill in this later for error checking for in the acknowledge bit was meant to be sent
-	}
-	else if ((TWSR & 0xF8) != 0x58 && !ack) {
-		// fill in this later for error checking when the NOT acknowledge bit was meant to be sent
-	}
-	
-	return TWDR;
-}
-
-void loadESBData(void)
+/** @brief Unpacks the payload of a LINK_ESB_DATA frame
+ *
+ *  @param[in] payload opMode, RPM, EGT, glow plug and ESB temperature, as packed by the ESB's package_message
+ *  @return void
+ */
+void loadESBData(const uint8_t *payload)
 {
-	// First need to check the parity bytes 
-	char parity1_check = calculateParity(ESBreceive, 0);
-	char parity2_check = calculateParity(ESBreceive, 6);
-	
-	if (parity1_check != ESBreceive[12] || parity2_check != ESBreceive[13]){      // This means that the parity bytes do not match
-		shutdown();         // hopefully this message still gets through
-		ESBreceive[0] = 12;      // this will set the correct opMode	
-	}
-	
 	// This will convert the values that were recorded from the communication into usable variables
-	memcpy(&opMode, ESBreceive+1, sizeof(uint8_t));
-	memcpy(&Hall_effect, ESBreceive+2, sizeof(uint16_t));
-	memcpy(&EGT, ESBreceive+3, sizeof(float));
-	memcpy(&glow_plug, ESBreceive+7, sizeof(uint8_t));
-	memcpy(&ESB_temp, ESBreceive+8, sizeof(float));
+	memcpy(&opMode, payload, sizeof(uint8_t));
+	memcpy(&Hall_effect, payload+1, sizeof(uint16_t));
+	memcpy(&EGT, payload+3, sizeof(float));
+	memcpy(&glow_plug, payload+7, sizeof(uint8_t));
+	memcpy(&ESB_temp, payload+8, sizeof(float));
 }
\ No newline at end of file
@@ -9,91 +9,103 @@
 #include <avr/io.h>
 #include <avr/interrupt.h>
 #include "ECU_funcs.h"
+#include "Scheduler.h"
 
+//! Addresses of the ECU temperature sensors, in the order of temps
+static const uint8_t tempAddress[ECU_temp_sensors] = TEMP_ADDRESSES;
 
-/** @brief Measures the voltage on the Lipo battery from the 3 different ADC channels
+//! Register pointer write which comes before the first read of each sensor
+static const uint8_t tempPointer[1] = {TA_REG};
+
+
+/** @brief Takes the voltage of the Lipo battery from the ADC sampler
  *
- *  This performs the following functions:
- *  
- *  1) Measures the ADC voltage on the current ADC channel
- *  2) Combines this result will the current float value of the voltage
- *  3) Changes the ADC channel to the next one in the rotation 0->1->2->0
+ *  The ADC is read by ADC_vect, so this only picks up the filtered reading of the pack channel.  It is
+ *  turned into the float voltage the frames carry only when a frame is put together.
  *
  *  @param void
  *  @return void
  */
 void batVoltage(void)
 {
-	// first check to see if the conversion has completed
-	if (bit_is_set(ADCSRA,ADSC))
-		return;
-	
-	uint8_t low_bits = ADCL;
-	uint8_t high_bits = ADCH;						 // Do the shifting so that there is room made inside of the 16 bit register
-	uint16_t result = (high_bits << 8) | low_bits;
-	
-	// Now I need to convert this 16 bit number into an actual temperature
-	voltage.f = 3.0 * (float) result;            // Convert to float value of the voltage
-	voltage.f = voltage.f * (4.96 / 1024.0);      // This will return Vin
-	
-	ADCSRA |= (1 << ADSC);                     // Start the next conversion
-		
+	batMillivolts = adcMillivolts(ADC_PACK);
 }
 
 /** @brief Measures the fuel flow passing through the Flow meter
  *
  *  This performs the following functions:
  *  
- *  1) If the flow meter measurement has not started, it enables the appropriate interrupts and returns
- *  2) If the flow meter measurement is in progress, it simply returns
- *  3) If the flow meter measurement has concluded, it calculates the recorded pulses
+ *  1) Collects the pulses the INT2 interrupt has timestamped since the last call
+ *  2) If there are any, the flow is the number of pulses over the time since the pulse which ended the last calculation
+ *  3) If there have been none for flow_timeout, the flow is taken as zero
+ *
+ *  This never waits, and massFlow is updated as often as pulses arrive.
  *
  *  @param void
  *  @return void
  */
 void measureFlow(void)
 {
+	uint8_t sreg = SREG;
+	cli();
+	uint16_t pulses = pulse_count;
+	uint32_t last = flowLastPulse;
+	uint32_t now = flowClock();
 	pulse_count = 0;
-
-	EIMSK |= (1 << INT2);    // enable the external interrupts
-	
-	// Now start Timer3 to run for 0.25 sec
-	TCCR3B |= (1 << CS31) | (1 << CS30);
-	
-	while (bit_is_clear(TIFR3, TOV3));       // hog execution until the overflow flag has been set
-	TIFR3 |= (1 << TOV3);                    // clear the interrupt flag
-	
-	// now disable the external interrupt
-	assign_bit(&EIMSK, INT2, 0);
+	SREG = sreg;
 	
-	// Now turn off Timer 3
-	assign_bit(&TCCR3B, CS31, 0);
-	assign_bit(&TCCR3B, CS30, 0);
-	
-	// Now reset the value inside of the TIMER3 register
-	TCNT3 = FlowTime;    // This will allow the timer to run for 0.25 sec once the prescalars are restored
-	
-	// Now need to convert the pulses detected into an actual flow rate
-	//massFlow.f = V_per_pulse * (float) pulse_count;
-	//massFlow.f = (massFlow.f - pump_b) / pump_m;
+	if (pulses){
+		if (flowStarted){
+			massFlow.f = (float) pulses * (flow_clock / pulses_per_gram) / (float) (last - flowPrevPulse);
+		}
+		flowPrevPulse = last;
+		flowStarted = 1;
+	}
+	else if (!flowStarted || now - flowPrevPulse > flow_timeout){
+		massFlow.f = 0;
+	}
+	batLoaded = massFlow.f > 0;          // the pump is running
+}
 
-	// now set the doTransmit flag
-	if (doTransmit < 1){
-		doTransmit++;
+/** @brief Reads Timer 3 extended to 32 bits by the count of its overflows
+ *
+ *  One tick is 4 us, so this wraps after about 4.8 hours.  Must be called with interrupts off.
+ *
+ *  @param void
+ *  @return uint32_t The current timestamp
+ */
+uint32_t flowClock(void)
+{
+	uint16_t count = TCNT3;
+	uint16_t high = flowOverflows;
+	if ((TIFR3 & (1 << TOV3)) && count < 0x8000){
+		high++;                      // the timer has overflowed but TIMER3_OVF_vect has not run yet
 	}
+	return ((uint32_t) high << 16) | count;
 }
 
-/** @brief Interrupt Service Routine which reads in the pulse train and increments a count.
+/** @brief Interrupt Service Routine which timestamps each flow meter pulse
  *
- *  @param[in] pulse_count This is the number which describes how many pulses have been received for the sampling period.  It is an implicit argument as it is a global variable which is not explicitly passed in.
+ *  @param void
  *  @return void
- *  @see flowMeter
+ *  @see measureFlow
  */
 ISR(INT2_vect)
 {
+	flowLastPulse = flowClock();
 	pulse_count++;  // The interrupt flag will automatically be cleared by hardware
 }
 
+/** @brief Interrupt Service Routine which counts the overflows of the free running Timer 3
+ *
+ *  @param void
+ *  @return void
+ */
+ISR(TIMER3_OVF_vect)
+{
+	flowOverflows++;
+}
+
 /** @brief Sets the specified bit to the specified value or does nothing if it already set to that.
  *
  *  @param[out] sfr Pointer to Special Function Register the bit is located in.
@@ -144,90 +156,90 @@ ISR(TIMER5_OVF_vect)
 	connected_ESB = 0;
 }
 
-/** @brief Accesses memory within the MAX6675 and converts the data into a usable temperature.
+/** @brief Points tempScan at the sensor tempSensor
+ *
+ *  The pointer write is left out once the sensor's pointer is on the ambient temperature register, where
+ *  it stays, so that only its first read after power up or a failure costs the extra byte and repeated START.
  *
  *  @param void
  *  @return void
  */
-void readTempSensor(void)
+static void tempTarget(void)
 {
-	i2c_Start(SLA_W);   // this will write the temp address to the register on the sensor
-	i2c_write(0x05);    // this references the temperatures location in memory
-	
-	// now restart I2C so that it will be configured for reading the temperature
-	i2c_Start(SLA_R);
-	
-	// now read the upper and lower bytes
-	unsigned char upper = i2c_read(1);   // this will send the acknowledged bit
-	unsigned char lower = i2c_read(0);   // this will send the not acknowledged bit
-	i2c_Stop();
-	
-	// now process the data into a usable temperature
-	//First Check flag bits
-	if ((upper & 0x80) == 0x80){ //TA >= TCRIT
-	}
-	
-	if ((upper & 0x40) == 0x40){ //TA > TUPPER
-	}
-	
-	if ((upper & 0x20) == 0x20){ //TA < TLOWER
-	}
-	
-	upper = upper & 0x1F; //Clear flag bits
-	uint8_t decimal = (lower & dec_MSK) >> 2;
-	if ((upper & 0x10) == 0x10){ //TA < 0C
-		upper = upper & 0x0F; //Clear SIGN
-		ECU_temp = (float)(256 - ((upper << 4) + (lower >> 4)));
-		ECU_temp -= (0.25 * decimal);
+	tempScan.address = tempAddress[tempSensor];
+	tempScan.wlen = (tempPointed & (1 << tempSensor)) ? 0 : sizeof(tempPointer);
+}
+
+/** @brief Stores the reading of tempSensor once tempScan has ended and sends tempScan on to the next sensor
+ *
+ *  Called from TWI_vect, so it only unpacks the 13 bit two's complement value under the three flag bits and
+ *  leaves turning it into degrees to whoever uses it.  A sensor which failed keeps its last reading, which
+ *  tempReading() stops handing out once it is TEMP_STALE old.
+ *
+ *  @param[in] t The transfer, tempScan
+ *  @return void
+ */
+static void tempDone(struct twi_transfer *t)
+{
+	if (t->state == TWI_DONE){
+		int16_t raw = ((tempData[0] & 0x1F) << 8) | tempData[1];    // clear the flag bits
+		if (raw & 0x1000)              // TA < 0C
+			raw -= 0x2000;
+		temps[tempSensor].temp = raw;
+		temps[tempSensor].stamp = schedTicks;
+		temps[tempSensor].valid = 1;
+		tempPointed |= 1 << tempSensor;
 	}
-	else { //TA >= 0C
-		ECU_temp = (float)((upper << 4) + (lower >> 4));     //Temperature = Ambient Temperature (C)
-		ECU_temp += (0.25 * decimal);
+	else
+		tempPointed &= ~(1 << tempSensor);    // write the pointer again, in case the sensor was reset
+	if (++tempSensor < ECU_temp_sensors){
+		tempTarget();
+		t->state = TWI_QUEUED;         // twiFinish() queues it again
 	}
-
 }
 
-/** @brief Function to calculate the parity byte for a corresponding sequence of 6 bytes
+/** @brief Publishes the temperature of the board sensor and starts reading every sensor again on the TWI
  *
- *  @param[in] message Entire message which a subset will be used in order to calculate the parity byte
- *  @param[in] start_index Starting index within message for which to calculate the parity byte
- *  @return char
+ *  One transfer is queued, which tempDone sends on from one sensor to the next from TWI_vect, so the cost
+ *  to the main loop does not grow with the number of sensors.  The readings land in temps, and the board
+ *  sensor's goes into ECU_temp the next time this is called, one period later.
+ *
+ *  @param void
+ *  @return void
  */
-char calculateParity(char message[], uint8_t start_index)
+void readTempSensor(void)
 {
-	// This will return the parity byte for a message made up of 6 sequential bytes, starting with start_index
-		char parity = 0;
-		
-		// first need to get the number of high bits in the first three bytes in the set
-		for (unsigned set = 0; set < 2; set++){
-			unsigned char count = 0;
-			for (unsigned char i = 0; i < 3; i++){
-				count += countOnes(message[start_index + set*3 + i]);
-			}
-			// now that I have the count for this set, I need to take the modulo
-			count = count % 16;   // Modulo with 16 because I have 4 bits to play with
-			
-			// now add this into the parity byte
-			parity |= count << (4 * set);   // this will make it so that bytes 0-2 will take up the LSB of the parity byte
-		}
-		// now copy this byte into memory
-		return parity;
+	int16_t temp;
+	if (tempReading(0, &temp))
+		ECU_temp = temp * 0.0625;      // sixteenths of a degree
+	if (tempScan.state == TWI_QUEUED || tempScan.state == TWI_BUSY)
+		return;                        // still going, or stuck until twiPoll() times it out
+	tempSensor = 0;
+	tempScan.wdata = tempPointer;
+	tempScan.rdata = tempData;
+	tempScan.rlen = sizeof(tempData);
+	tempScan.done = tempDone;
+	tempTarget();
+	twiQueue(&tempScan);
 }
 
-/** @brief Subroutine to count the number of high bits within a designated byte.
+/** @brief Gets the latest reading of a temperature sensor, if it is not TEMP_STALE old
  *
- *  @param[in] byte The byte by which to calculate the number of high bits within
- *  @return unsigned char
+ *  @param[in] sensor Index of the sensor, below ECU_temp_sensors
+ *  @param[out] temp The reading in sixteenths of a degree C, TEMP_NONE if there is none
+ *  @return uint8_t 1 if there is a reading
  */
-unsigned char countOnes(unsigned char byte)
+uint8_t tempReading(uint8_t sensor, int16_t *temp)
 {
-	unsigned char count = 0;
-	while (byte)
-	{
-		count += byte & 1;    // this was essentially lifted from geeksforgeeks.com
-		byte >>= 1;
-	}
-	return count;
+	volatile struct temp_reading *r = &temps[sensor];
+	uint8_t sreg = SREG;
+	cli();
+	if (r->valid && (uint16_t) (schedTicks - r->stamp) > TEMP_STALE)
+		r->valid = 0;                  // cleared for good, so the stamp cannot wrap around to look new
+	uint8_t valid = r->valid;
+	*temp = valid ? r->temp : TEMP_NONE;
+	SREG = sreg;
+	return valid;
 }
 
 /** @brief Subroutine which will wait for a given number of milliseconds.
@@ -8,6 +8,11 @@
 
 #include <avr/sfr_defs.h>
 #include <float.h>
+#include "hal.h"
+#include "parity.h"
+#include "link.h"
+#include "TWI.h"
+#include "Battery.h"
 
 #ifndef ECU_FUNCS_H_
 #define ECU_FUNCS_H_
@@ -25,7 +30,11 @@
 ///////////////////////////////////////////////////////////////////////////
 //////////////////////// Project Constants ////////////////////////////////
 ///////////////////////////////////////////////////////////////////////////
-#define ECU_temp_sensors 0     // The number of temperature sensors on the ECU
+#ifndef F_CPU
+#define F_CPU 16000000UL       // Clock frequency of the ATmega2561
+#endif
+
+#define ECU_temp_sensors ((uint8_t) sizeof((const uint8_t[]) TEMP_ADDRESSES))    // The number of temperature sensors on the ECU, at most 8
 #define ESB_temp_sensors 0     // The number of temperature sensors on the ESB
 
 
@@ -38,6 +47,18 @@
 //! Maximum amount of time for an 8 bit timer with a prescalar of 1024
 #define max_time 0.25
 
+//! Flow meter pulses per gram of fuel
+#define pulses_per_gram (K_factor / (density * 1000.0))
+
+//! Rate of the free running Timer 3 (prescalar of 64), which timestamps the flow meter pulses
+#define flow_clock (F_CPU / 64)
+
+//! The flow is taken to have stopped once no pulse has been seen for this many Timer 3 ticks (0.5 sec)
+#define flow_timeout (flow_clock / 2)
+
+//! Number of Timer 3 ticks per scheduler tick (1 ms), see Scheduler.h
+#define sched_tick (flow_clock / 1000)
+
 //! Slope for the linear relationship between voltage and mass flow (put in mf, get volts)
 #define pump_m 0.382587
 
@@ -55,11 +76,22 @@
 
 #define SLA_W 0x3E
 #define SLA_R 0x3F
-#define dec_MSK 0x0C     // This extracts the decimal numbers from the temperature sensor
+#ifdef ECU_EXTRA_TEMPS           // Addresses of any sensors wired to the TWI besides the one on the board, e.g. -DECU_EXTRA_TEMPS=0x1E,0x1D
+#define TEMP_ADDRESSES {SLA_W >> 1, ECU_EXTRA_TEMPS}    // Addresses of the ECU temperature sensors, the one on the board first
+#else
+#define TEMP_ADDRESSES {SLA_W >> 1}
+#endif
+#define TA_REG 0x05      // Ambient temperature register of the temperature sensor
+#define TEMP_STALE 1000  // ms after which a temperature reading is no longer used
+#define TEMP_NONE ((int16_t) 0x8000)   // Sent in place of a temperature reading which is missing or stale
 #define SPI_PORT PORTB
-#define normalData 11
+#define ESB_TX_SIZE 32             // Size of the transmit queue to the ESB, must be a power of 2
+#define GUI_TEMPS 24               // Offset of the ECU temperatures in the GUI frame, as int16_t sixteenths of a degree C
+#define GUI_BATTERY (GUI_TEMPS + 6 * ((2 * ECU_temp_sensors + 5) / 6))    // Offset of the state of the battery in the GUI frame, see batPack()
+#define GUI_DATA_LEN (GUI_BATTERY + 6 * ((BAT_PACKED + 5) / 6))   // Data bytes of the GUI frame, a parity byte for every 6
+#define GUI_FRAME_LEN (GUI_DATA_LEN + GUI_DATA_LEN / 6)   // Length of the periodic data frame sent to the GUI, parity bytes included
+#define GUI_REPLY_LEN 4            // Longest reply to a GUI command
 #define ESB_timer_val 3036
-#define FlowTime 3700              // This was found via logic analyzer to have a flow period of exactly 0.25 seconds
 
 ///////////////////////////////////////////////////////////////////////////
 ///////////////////////// Pin Assignments /////////////////////////////////
@@ -70,6 +102,7 @@
 #define HCU_link 1 // Pin assignment for the Command line for the HCU to turn on the ECU
 #define MOSI 2     // Pin within PORTB for MOSI
 #define SCK 1      // Pin within PORTB for SCK
+#define Ethernet_INT 6    // INT6 (PE6), driven low by the INT line of the ENC28J60
 
 
 
@@ -83,22 +116,22 @@ void startup(void);
 void throttle(void);
 void batVoltage(void);
 void assign_bit(volatile uint8_t *sfr,uint8_t bit, uint8_t val);
-void sendToESB(uint8_t len);
+uint8_t sendToESB(uint8_t type, const void *payload, uint8_t len);
 void ESB_Connect(void);
 void measureFlow(void);
+uint32_t flowClock(void);
+const char *packLaptopFrame(void);
+void publishToLaptop(void);
 void sendToLaptop(void);
+void resendToLaptop(void);
+uint8_t replyToLaptop(const char *message, uint8_t len);
 void repeatCommand(void);
 void GUI_Connect(void);
-void i2c_Start(unsigned char address);
-void i2c_Stop(void);
-void i2c_write(unsigned char data);
-unsigned char i2c_read(unsigned char ack);
 void readTempSensor(void);
-char calculateParity(char message[], uint8_t start_index);
-unsigned char countOnes(unsigned char byte);
+uint8_t tempReading(uint8_t sensor, int16_t *temp);
 void packageMessage(void);
 void waitMS(uint16_t msec);
-void loadESBData(void);
+void loadESBData(const uint8_t *payload);
 
 //////////////////////////////////////////////////////////////////////////
 //////////////////////// Global Variables  ///////////////////////////////
@@ -110,8 +143,8 @@ union {
 	unsigned char c[4];
 } voltage;
 
-//! Char which keeps track of which ADC channel we are on
-char batChannel;
+//! Voltage of the Lipo battery in mV, from the ADC sampler
+uint16_t batMillivolts;
 
 //! Holds the current operational mode of the engine
 char opMode;
@@ -134,8 +167,20 @@ float EGT;
 //! unsigned char holding whether or not the glow plug is currently on
 unsigned char glow_plug;
 
-//! This will keep track of how many pulses have been seen in the sampling window
-uint8_t pulse_count;
+//! Number of flow meter pulses which measureFlow has not collected yet
+volatile uint16_t pulse_count;
+
+//! Timestamp of the latest flow meter pulse, see flowClock
+volatile uint32_t flowLastPulse;
+
+//! Timestamp of the pulse which ended the previous flow calculation
+uint32_t flowPrevPulse;
+
+//! Set once flowPrevPulse holds a real pulse
+uint8_t flowStarted;
+
+//! Number of Timer 3 overflows, the upper 16 bits of the flow timestamps
+volatile uint16_t flowOverflows;
 
 //! Variable to convert the pulses into a voltage
 float V_per_pulse;
@@ -155,11 +200,47 @@ uint8_t connected_ESB;
 //! Essentially boolean describing if the ECU is connected to the GUI or not 
 uint8_t connected_GUI;
 
-//! Array of data which will be transmitted to the ESB
-char ESBtransmit[11];
+//! Payload of the normal data message which will be transmitted to the ESB
+uint8_t ESBtransmit[LINK_ECU_DATA_LEN];
+
+//! Sequence number of the next frame sent to the ESB
+uint8_t ESBtxSeq;
+
+//! Bytes waiting to be sent to the ESB by the USART1 data register empty interrupt
+uint8_t ESBtxQueue[ESB_TX_SIZE];
+
+//! Index in ESBtxQueue where the next byte will be queued, only written by sendToESB
+volatile uint8_t ESBtxHead;
+
+//! Index in ESBtxQueue of the next byte to be sent, only written by the USART1 UDRE interrupt
+volatile uint8_t ESBtxTail;
+
+//! Double buffered data frame for the GUI, one is on the line while the other is filled
+char GUIframe[2][GUI_FRAME_LEN];
+
+//! Which of GUIframe is being sent, or was sent last
+volatile uint8_t GUIsending;
 
-//! Array containing the data received from the ESB
-char ESBreceive[14];   // might need to change this number later depending on the number of temperature sensors
+//! Next byte of GUIframe[GUIsending] to send, GUI_FRAME_LEN once the whole frame is out
+volatile uint8_t GUIframeIndex;
+
+//! Set when the other GUIframe holds a new snapshot which has not been sent yet
+volatile uint8_t GUIframeReady;
+
+//! Reply to a GUI command, which is sent between data frames
+char GUIreply[GUI_REPLY_LEN];
+
+//! Length of GUIreply
+volatile uint8_t GUIreplyLen;
+
+//! Next byte of GUIreply to send
+volatile uint8_t GUIreplyIndex;
+
+//! Receiver for the frames coming from the ESB
+struct link_rx ESBlink;
+
+//! Type of the command the ESB acknowledged last
+volatile uint8_t ESBack;
 
 //! Ambient temperature of the ECU
 float ECU_temp;
@@ -167,14 +248,30 @@ float ECU_temp;
 //! Ambient temperature of the ESB
 float ESB_temp;
 
-//! Counter for index into the connection string (The connection string is ACES)
-uint8_t connect_count;
+//! One reading of a temperature sensor
+struct temp_reading {
+	int16_t temp;                      // Sixteenths of a degree C
+	uint16_t stamp;                    // schedTicks when it was read
+	uint8_t valid;                     // Set when it is read, cleared by tempReading() once it is TEMP_STALE old
+};
+
+//! Latest reading of each ECU temperature sensor, written by TWI_vect, see tempReading()
+volatile struct temp_reading temps[ECU_temp_sensors];
+
+//! Read of one temperature sensor after the other, started by readTempSensor every period
+struct twi_transfer tempScan;
+
+//! Sensor tempScan is reading
+uint8_t tempSensor;
 
-//! Flag which describes if the next received command is the beginning of a new command or the continuation of an old command
-uint8_t newCommand_ESB;
+//! Bit for each sensor whose register pointer has been left on the ambient temperature register
+uint8_t tempPointed;
 
-//! Counter for the received byte in the current message
-uint8_t ESBreceiveCount;
+//! The two bytes of the ambient temperature register, as tempScan reads them
+uint8_t tempData[2];
+
+//! Counter for index into the connection string (The connection string is ACES)
+uint8_t connect_count;
 
 //! Flag which is used to synchronize when messages are allowed to be sent to the GUI
 int8_t doTransmit;
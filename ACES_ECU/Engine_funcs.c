@@ -14,7 +14,7 @@
  *
  *  This performs the following functions:
  *  
- *  1) Transmits the char to the ESB for the shutdown sequence
+ *  1) Transmits the LINK_SHUTDOWN frame to the ESB
  *  2) Waits for the appropriate return message
  *  3) If the function was interrupted part way through by an interrupt, it is restarted
  *
@@ -23,19 +23,18 @@
  */
 void shutdown(void)
 {
-	ESBtransmit[0] = 'S';
-	while (ESBreceive[0] != 'K'){                    // Loop until the ESB says K
-		sendToESB(1);
+	ESBack = 0;
+	while (ESBack != LINK_SHUTDOWN){                 // Loop until the ESB acknowledges the shutdown
+		sendToESB(LINK_SHUTDOWN, 0, LINK_SHUTDOWN_LEN);
 		waitMS(5);
 	}
-	ESBreceive[0] = 0;                              // clear out the first char so that it actually transmits
 }
 
 /** @brief Commands the ESB to startup and awaits the confirmation code
  *
  *  This performs the following functions:
  *  
- *  1) Transmits the char to the ESB for the startup sequence
+ *  1) Transmits the LINK_STARTUP frame to the ESB
  *  2) Waits for the appropriate return message
  *  3) If the function was interrupted part way through by an interrupt, it is restarted
  *
@@ -44,12 +43,11 @@ void shutdown(void)
  */
 void startup(void)
 {
-	ESBtransmit[0] = 'r';
-	while (ESBreceive[0] != 'K'){
-		sendToESB(1);
+	ESBack = 0;
+	while (ESBack != LINK_STARTUP){
+		sendToESB(LINK_STARTUP, 0, LINK_STARTUP_LEN);
 		waitMS(5);   
 	}
-	ESBreceive[0] = 0;              // Change this character so I actually have to receive it in the future	
 	
 }
 
@@ -57,21 +55,18 @@ void startup(void)
  *
  *  This performs the following functions:
  *  
- *  1) Transmits the char to the ESB to change the throttle
- *  2) Sends the new value the throttle should be changed to
- *  3) Awaits for the appropriate return message
- *  4) If the function was interrupted part way through by an interrupt, it is restarted
+ *  1) Transmits the LINK_THROTTLE frame with the new throttle value to the ESB
+ *  2) Awaits for the appropriate return message
+ *  3) If the function was interrupted part way through by an interrupt, it is restarted
  *
  *  @param void
  *  @return void
  */
 void throttle(void)
 {
-	ESBtransmit[0] = 't';
-	ESBtransmit[1] = throttle_per;
-	while (ESBreceive[0] != 'K'){
-		sendToESB(2);
+	ESBack = 0;
+	while (ESBack != LINK_THROTTLE){
+		sendToESB(LINK_THROTTLE, &throttle_per, LINK_THROTTLE_LEN);
 		waitMS(5);
 	}
-	ESBreceive[0] = 0;                   // clear out the first char so that it actually transmits
 }
@@ -7,10 +7,11 @@
 
 #include <avr/io.h>
 #include <avr/interrupt.h>
+#include <string.h>
 #include "Ethernet.h"
 #include "ECU_funcs.h"
 
-static uint8_t ECU_mac[] = {0x46,0x55,0x43,0x4B,0x45,0x52};
+uint8_t ECU_mac[] = {0x46,0x55,0x43,0x4B,0x45,0x52};
 static uint8_t ESB_mac[] = {0x41,0x53,0x53,0x48,0x41,0x54};
 
 uint8_t readBasic(uint8_t op, uint8_t address)
@@ -46,56 +47,119 @@ void writeBasic(uint8_t op, uint8_t address, uint8_t data)
 	CSPASSIVE;
 }
 
-void readBuffer(uint8_t len, uint8_t *data)
+// Sends op and then clocks len bytes in within one CS window.  The next byte is started before the
+// previous one is stored, so the bus only idles for as long as it takes to restart SPDR
+void spiReadBlock(uint8_t op, uint8_t *data, uint16_t len)
 {
-	// First pull the CS line low
 	CSACTIVE;
-	// Now issue the read buffer memory command
-	SPDR = READ_BUF_MEM;
-	waitSPI();                // Now wait for the message to be sent
-	
-	while(len)
-	{
-		len--;
-		SPDR = 0;            // Just give the register some data so that it begins the transmission
+	SPDR = op;
+	waitSPI();
+	if (len){
+		SPDR = 0;                 // start the first byte
+		while (--len){
+			waitSPI();
+			uint8_t byte = SPDR;
+			SPDR = 0;             // start the next byte before storing this one
+			*data++ = byte;
+		}
 		waitSPI();
 		*data = SPDR;
-		data++;
 	}
-	*data = 0;               // Conclude the data with a null terminator
-	CSPASSIVE;               // Raise the CS line to stop the transmission  
-	
+	CSPASSIVE;
 }
 
-void writeBuffer(uint8_t len, uint8_t *data)
+// Sends op and then len bytes within one CS window, fetching each byte while the previous one shifts out
+void spiWriteBlock(uint8_t op, const uint8_t *data, uint16_t len)
 {
-	CSACTIVE;                 // First pull the CS line low
-	SPDR = WRITE_BUF_MEM;     // Issue the write buffer command
-	waitSPI();
-	
-	while (len)
-	{
+	spiWriteStart(op);
+	spiWriteBytes(data, len);
+	spiWriteEnd();
+}
+
+// spiWriteBlock in pieces, so that bytes from several places can go out in the one CS window.
+// spiWriteStart drops CS and starts op shifting out
+void spiWriteStart(uint8_t op)
+{
+	CSACTIVE;
+	SPDR = op;
+}
+
+// Sends len more bytes, each one started as soon as the one before it has gone
+void spiWriteBytes(const uint8_t *data, uint16_t len)
+{
+	while (len){
+		uint8_t byte = *data++;   // fetch the next byte while the previous one is shifting out
 		len--;
-		SPDR = *data;         // Send the current byte of data
 		waitSPI();
-		data++;
-		
+		SPDR = byte;
 	}
-	CSPASSIVE;                // Raise the CS line to stop the transmission 
-	
+}
+
+// Waits for the last byte to go and raises CS
+void spiWriteEnd(void)
+{
+	waitSPI();
+	CSPASSIVE;
+}
+
+void readBuffer(uint16_t len, uint8_t *data)
+{
+	spiReadBlock(READ_BUF_MEM, data, len);
+	data[len] = 0;           // Conclude the data with a null terminator
+}
+
+void writeBuffer(uint16_t len, uint8_t *data)
+{
+	spiWriteBlock(WRITE_BUF_MEM, data, len);
 }
 
 void setBank(uint8_t address)
 {
 	// This will set the bank to whichever bank *address* is in
-	if (((address & BANK_MASK) >> 5) != bankNumber){
-		writeBasic(BIT_FIELD_CLR, ECON1, (ECON1_BSEL0 | ECON1_BSEL1));     // First clear the bank from the relevant register
-		writeBasic(BIT_FIELD_SET, ECON1, (address & BANK_MASK) >> 5);      // Get the 2 bits by themselves and then shift to have it read the correct number
-		bankNumber = (address & BANK_MASK) >> 5;                           // Save the bank number for future comparison
+	uint8_t bank = (address & BANK_MASK) >> 5;
+	
+	// EIE through ECON1 are in every bank, so they never need a switch
+	if ((address & ADDR_MSK) >= EIE)
+		return;
+	if (bank != bankNumber){
+		// Only clear and set the bits which actually change, which is a single operation unless going between banks 1 and 2
+		if (bankNumber & ~bank)
+			writeBasic(BIT_FIELD_CLR, ECON1, bankNumber & ~bank);
+		if (bank & ~bankNumber)
+			writeBasic(BIT_FIELD_SET, ECON1, bank & ~bankNumber);
+		bankNumber = bank;                           // Save the bank number for future comparison
 	}
 	
 }
 
+// Writes a register of the current bank, unless it is one of the shadowed pointer registers and already holds data
+static void registerPut(uint8_t address, uint8_t data)
+{
+	uint8_t slot = (address & ~ADDR_MSK) ? SHADOW_LEN : (uint8_t) (address - SHADOW_FIRST);
+	
+	if (slot < SHADOW_LEN){
+		if ((regShadowValid & (1 << slot)) && regShadow[slot] == data)
+			return;
+		regShadow[slot] = data;
+		regShadowValid |= 1 << slot;
+	}
+	writeBasic(WRITE_CONTROL_REG, address, data);
+}
+
+// Masks the receive interrupt so that a sequence of SPI operations from the main loop is not cut into.
+// Returns whether it was enabled, which is what ethUnlock() needs to put it back
+uint8_t ethLock(void)
+{
+	uint8_t enabled = EIMSK & (1 << Ethernet_INT);
+	EIMSK &= ~(1 << Ethernet_INT);
+	return enabled;
+}
+
+void ethUnlock(uint8_t enabled)
+{
+	EIMSK |= enabled;      // an edge which came in the mean time is still latched in EIFR, so nothing is lost
+}
+
 uint8_t RegisterRead(uint8_t address)
 {
 	// first set the bank
@@ -109,42 +173,111 @@ void RegisterWrite(uint8_t address, uint8_t data)
 	// First set the bank
 	setBank(address);
 	// now write the data to the register
-	writeBasic(WRITE_CONTROL_REG, address, data);
+	registerPut(address, data);
 }
 
-uint16_t PhyRead(uint8_t address)
+// Writes a 16 bit pointer to a low/high register pair, low byte first, with one bank check
+void RegisterWrite16(uint8_t address, uint16_t data)
+{
+	setBank(address);
+	registerPut(address, data & 0xFF);
+	registerPut(address + 1, data >> 8);
+}
+
+// Writes a list of 16 bit register pairs.  The pairs in the current bank go first and then those of each
+// other bank in turn, so the bank is changed at most once for each bank in the list whatever the order
+void RegisterWriteBatch(const struct register_pair *pairs, uint8_t count)
+{
+	uint8_t bank = bankNumber;
+	
+	for (uint8_t pass = 0; pass < 4; pass++){
+		for (uint8_t i = 0; i < count; i++){
+			if (((pairs[i].address & BANK_MASK) >> 5) == bank)
+				RegisterWrite16(pairs[i].address, pairs[i].data);
+		}
+		bank = (bank + 1) & 0x03;
+	}
+}
+
+// Waits out the MII read, write or end of scan under way, which takes 10.24 us.  That is only a few reads of
+// MISTAT over SPI, so there is no need for a millisecond wait
+static void phyWait(void)
+{
+	while (RegisterRead(MISTAT) & MISTAT_BUSY);
+}
+
+// Has the MII read PHSTAT2 into MIRDL/MIRDH over and over in the background, so ethLink() can look at the
+// link without waiting on the MII
+static void phyScan(void)
+{
+	RegisterWrite(MIREGADR, PHSTAT2);
+	RegisterWrite(MICMD, MICMD_MIISCAN);
+	phyScanning = 1;
+}
+
+// Stops the background scan, as no other PHY register can be read or written while it runs.  Returns
+// whether it was running, so it can be started again afterwards
+static uint8_t phyScanStop(void)
+{
+	uint8_t scanning = phyScanning;
+	if (scanning){
+		RegisterWrite(MICMD, 0);
+		phyScanning = 0;
+		phyWait();
+	}
+	return scanning;
+}
+
+// Reads a PHY register with the scan stopped and the INT6 ISR kept out.  MICMD is a MAC register, which the
+// bit field instructions do not work on, so it is written whole
+static uint16_t phyGet(uint8_t address)
 {
-	// First I need to set the PHY register address
 	RegisterWrite(MIREGADR, address);
+	RegisterWrite(MICMD, MICMD_MIIRD);
+	phyWait();
+	RegisterWrite(MICMD, 0);
 	
-	// Now set the MICMD.MIIRD bit
-	writeBasic(BIT_FIELD_SET, MICMD, MICMD_MIIRD);
-	
-	// now wait for at least 10.24 us
-	waitMS(15);
-	
-	// Now clear the MIIRD bit
-	writeBasic(BIT_FIELD_CLR, MICMD, MICMD_MIIRD);
-	
-	uint16_t data = 0;
-	data |= RegisterRead(MIRDL);
-	data |= (RegisterRead(MIRDH) << 8);
-	
+	uint16_t data = RegisterRead(MIRDL);
+	data |= RegisterRead(MIRDH) << 8;
+	return data;
+}
+
+uint16_t PhyRead(uint8_t address)
+{
+	uint8_t ethInt = ethLock();
+	uint8_t scanning = phyScanStop();
+	uint16_t data = phyGet(address);
+	if (scanning)
+		phyScan();
+	ethUnlock(ethInt);
 	return data;
 }
 
 void PhyWrite(uint8_t address, uint16_t data)
 {
+	uint8_t ethInt = ethLock();
+	uint8_t scanning = phyScanStop();
 	// first need to set the PHY register address
-	RegisterWrite(MIREGADR, PHLCON);
-	// Write the PHY data
+	RegisterWrite(MIREGADR, address);
+	// Writing the high byte starts the write to the PHY
 	RegisterWrite(MIWRL, data & 0xFF);
 	RegisterWrite(MIWRH, data >> 8);
-		
-	// now need to wait for 10.24 us, but I will just poll for the end of the waiting time after 1 waiting cycle
-	while(RegisterRead(MISTAT) & MISTAT_BUSY)
-		waitMS(15);
-	
+	phyWait();
+	if (scanning)
+		phyScan();
+	ethUnlock(ethInt);
+}
+
+// Returns 1 if the link is up, from the scan of PHSTAT2 in MIRDH: a single register read with no wait on the
+// MII.  ethLinkUp has the same answer without any SPI at all, for as long as the INT6 ISR is let in
+uint8_t ethLink(void)
+{
+	if (!phyScanning)
+		return (PhyRead(PHSTAT2) & PHSTAT2_LSTAT) != 0;
+	uint8_t ethInt = ethLock();
+	uint8_t status = RegisterRead(MIRDH);
+	ethUnlock(ethInt);
+	return (status & (PHSTAT2_LSTAT >> 8)) != 0;
 }
 
 void InitPhy(void)
@@ -171,56 +304,44 @@ void InitPhy(void)
 	waitMS(100);                     // The example code has this in here, don't know if I really need it
 }
 
-void waitMS(uint16_t msec)
-{
-	// This function utilizes timer 0 and a sequence of delay loops to delay for the desired time
-	TCNT0 = 5;
-	// begin the timer
-	TCCR0B |= (1 << CS01) | (1 << CS00);       // this will start the timer with a prescalar of 64
-	for (uint16_t i = 0; i < msec; i++){
-		while(bit_is_clear(TIFR0, TOV0));
-		TIFR0 |= (1 << TOV0);                  // Clear the overflow flag by writing a 1 to it
-	}
-	assign_bit(&TCCR0B, CS01, 0);
-	assign_bit(&TCCR0B, CS00, 0);              // Turn off the timer
-}
-
 void InitEthernet(void)
 {
+	// Keep the receive interrupt out until the chip is set up again
+	EIMSK &= ~(1 << Ethernet_INT);
+	
 	// First perform a system reset.  This will ensure register start with their expected values
 	readBasic(SOFT_RESET,SOFT_RESET);        // normally read returns something but this will serve as a write with fewer operations
 	waitMS(50);                              // give the chip time to restart
+	bankNumber = 0;                          // the reset put the chip back in bank 0
+	phyScanning = 0;                         // and stopped the scan of PHSTAT2
+	regShadowValid = 0;                      // and the shadowed registers back to their reset values
 	
 	////////// Initialize the Receive and Transmit Buffers /////////////////
 	nextPacketPtr = RXSTART_INIT;
-	
-	// Rx start
-	RegisterWrite(ERXSTL, RXSTART_INIT & 0xFF);        // Low byte first and then high byte
-	RegisterWrite(ERXSTH, RXSTART_INIT >> 8);
-	
-	// Now set the current receive pointer address
-	RegisterWrite(ERXRDPTL, RXSTART_INIT & 0xFF);
-	RegisterWrite(ERXRDPTH, RXSTART_INIT >> 8);   // Again, low byte first
-	
-	// RX end
-	RegisterWrite(ERXNDL, RXSTOP_INIT & 0xFF);    // doing the 0xFF will trim off the higher byte
-	RegisterWrite(ERXNDH, RXSTOP_INIT >> 8);
-	
-	// TX Start
-	RegisterWrite(ETXSTL, TXSTART_INIT & 0xFF);
-	RegisterWrite(ETXSTH, TXSTART_INIT >> 8);
-	
-	// TX end
-	RegisterWrite(ETXNDL, TXSTOP_INIT & 0xFF);
-	RegisterWrite(ETXNDH, TXSTOP_INIT >> 8);
-	
-	// Now configure the packet filters
-	// Everything will be filtered with Unicast
-	
-	//RegisterWrite(ERXFCON, ERXFCON_UCEN | ERXFCON_ANDOR); 
-	
-	// The above line will ignore all packets which don't have the destination address
-	// matching this device's MAC address
+	transmitHeader(txHeader);
+	rxHead = 0;
+	rxTail = 0;
+	rxStalled = 0;
+	txOnWire = TX_NONE;
+	txPending = TX_NONE;
+	txBuild = TX_NONE;
+	txLast = TX_NONE;
+	
+	// The buffer pointers and the 16 bit MAC settings, written low byte first
+	const struct register_pair pointers[] = {
+		{ERXSTL, RXSTART_INIT},         // Rx start
+		{ERXRDPTL, RXSTART_INIT},       // the current receive pointer address
+		{ERXNDL, RXSTOP_INIT},          // RX end
+		{ETXSTL, TXSTART_INIT},         // TX Start, moved between the two slots as frames are sent
+		{MAIPGL, 0x0C12},               // Inter-Packet gap (not back-to-back), what the data sheet recommended (p34)
+		{MAMXFLL, MAX_FRAMELEN},        // the maximum packet size
+	};
+	RegisterWriteBatch(pointers, sizeof(pointers) / sizeof(pointers[0]));
+	
+	// Now configure the packet filters.  Only frames with this device's MAC address as the destination are
+	// let in, the network layer adds the ARP requests it has to answer once it has an IP address
+	const struct eth_filter unicast = {ERXFCON_UCEN | ERXFCON_CRCEN};
+	ethFilter(&unicast);
 	
 	// Now enable the MAC and other features
 	// This will enable the MAC to receive packets
@@ -229,15 +350,6 @@ void InitEthernet(void)
 	RegisterWrite(MACON1, MACON1_MARXEN | MACON1_TXPAUS | MACON1_RXPAUS);
 	RegisterWrite(MACON2, 0);     // this will cause the MAC to enter "normal operation" as per the data sheet p61
 	
-	// Now do Inter-Packet gap (not back-to-back)
-	RegisterWrite(MAIPGL, 0x12);      // This was what the data sheet recommended (p34)
-	RegisterWrite(MAIPGH, 0x0C);      // Also what the data sheet recommended
-	
-	// Set the maximum packet size
-	RegisterWrite(MAMXFLL, MAX_FRAMELEN & 0xFF);
-	RegisterWrite(MAMXFLH, MAX_FRAMELEN >> 8);
-	
-	
 	// Now write the MAC Address to the device
 	// Note, the ENC28J60 is byte backwards, at least that is the consensus on the Internet
 	RegisterWrite(MAADR5, ECU_mac[0]);
@@ -247,102 +359,540 @@ void InitEthernet(void)
 	RegisterWrite(MAADR1, ECU_mac[4]);
 	RegisterWrite(MAADR0, ECU_mac[5]);
 	
-	// Now prevent loop back of transmitted frames
-	PhyWrite(PHCON2, PHCON2_HDLDIS | PHCON2_FRCLINK);
+	// Now prevent loop back of transmitted frames.  The link is not forced up, so the PHY can report it going down
+	PhyWrite(PHCON2, PHCON2_HDLDIS);
+	
+	// Have the PHY interrupt on a link change.  Reading PHIR clears anything left over, and the link is then
+	// watched by the scan of PHSTAT2 and the INT6 ISR, without any MII reads from the main loop
+	PhyWrite(PHIE, PHIE_PGEIE | PHIE_PLNKIE);
+	PhyRead(PHIR);
+	ethLinkUp = (PhyRead(PHSTAT2) & PHSTAT2_LSTAT) != 0;
+	linkChanges = 0;
+	phyScan();
 	
 	// enable packet reception
 	writeBasic(BIT_FIELD_SET, ECON1, ECON1_RXEN);
 	
 	// now enable the interrupt flags
-	writeBasic(BIT_FIELD_SET, EIE, EIE_PKTIE | EIE_TXERIE | EIE_RXERIE);
-	// The above line will enable the interrupt flags for Receive Packet Pending, Transmit, Transmit error, and receive packet error	
+	writeBasic(BIT_FIELD_SET, EIE, EIE_INTIE | EIE_PKTIE | EIE_RXERIE | EIE_TXIE | EIE_TXERIE | EIE_LINKIE);
+	// The above line will drive the INT line on Receive Packet Pending, receive packet error, transmit
+	// done, transmit error and link change, so the ISR can start the next frame as soon as the last one
+	// is out and ethLinkUp follows the cable
+	
+	// INT is active low, so take the falling edge on INT6, see page 111 in datasheet
+	DDRE &= ~(1 << Ethernet_INT);
+	EICRB = (EICRB & ~(1 << ISC60)) | (1 << ISC61);
+	EIMSK |= (1 << Ethernet_INT);
 }
 
-void packetSend(uint8_t len, uint8_t* packet)
+// Sets up the receive filters, so frames the ECU has no use for are turned away by the ENC28J60 instead of
+// taking up room in the receive ring and a packetRecieve() over SPI.  Reception is paused while they change
+void ethFilter(const struct eth_filter *filter)
 {
-	// Set the Transmit start pointer to the same location as the write location
-	RegisterWrite(ETXSTL, TXSTART_INIT & 0xFF);
-	RegisterWrite(ETXSTH, TXSTART_INIT >> 8);
-	
-	// Set the write pointer to start of transmit buffer area
-	RegisterWrite(EWRPTL, TXSTART_INIT & 0xFF);
-	RegisterWrite(EWRPTH, TXSTART_INIT >> 8);
+	const struct register_pair pattern[] = {
+		{EPMCSL, filter->patternChecksum},
+		{EPMOL, filter->patternOffset},
+	};
+	uint8_t ethInt = ethLock();
+	uint8_t receiving = RegisterRead(ECON1) & ECON1_RXEN;
+	if (receiving)
+		writeBasic(BIT_FIELD_CLR, ECON1, ECON1_RXEN);
+	for (uint8_t i = 0; i < 8; i++){
+		RegisterWrite(EHT0 + i, filter->hash[i]);
+		RegisterWrite(EPMM0 + i, filter->patternMask[i]);
+	}
+	RegisterWriteBatch(pattern, sizeof(pattern) / sizeof(pattern[0]));
+	RegisterWrite(ERXFCON, filter->enable);
+	if (receiving)
+		writeBasic(BIT_FIELD_SET, ECON1, ECON1_RXEN);
+	ethUnlock(ethInt);
+}
+
+// Has the hash table filter pass frames for a destination address, such as a multicast group.  Bits 28 to 23
+// of the CRC of the address, worked out as for the FCS, pick one of 64 bits, so other addresses which land on
+// the same bit get through as well
+void ethFilterHash(struct eth_filter *filter, const uint8_t *mac)
+{
+	uint32_t crc = 0xFFFFFFFF;
+	for (uint8_t i = 0; i < 6; i++){
+		uint8_t byte = mac[i];
+		for (uint8_t bit = 0; bit < 8; bit++){
+			if ((crc >> 31) ^ (byte & 1))
+				crc = (crc << 1) ^ 0x04C11DB7;
+			else
+				crc <<= 1;
+			byte >>= 1;
+		}
+	}
+	uint8_t pointer = (crc >> 23) & 0x3F;
+	filter->hash[pointer >> 3] |= 1 << (pointer & 7);
+	filter->enable |= ERXFCON_HTEN;
+}
+
+// Has the pattern match filter pass frames which have the same bytes as window at each place set in mask, in
+// the PATTERN_LEN byte window from offset bytes into the frame.  The window has to fit in the frame, CRC
+// included.  window needs to hold the bytes up to the last one set in mask
+void ethFilterPattern(struct eth_filter *filter, uint16_t offset, const uint8_t *window, const uint8_t *mask)
+{
+	uint32_t sum = 0;
+	uint8_t n = 0;
+	
+	// The chip sums the bytes picked out as if they followed on from each other
+	for (uint8_t i = 0; i < PATTERN_LEN; i++){
+		if (mask[i >> 3] & (1 << (i & 7))){
+			sum += (n & 1) ? window[i] : window[i] << 8;
+			n++;
+		}
+	}
+	while (sum >> 16)
+		sum = (sum & 0xFFFF) + (sum >> 16);
+	memcpy(filter->patternMask, mask, sizeof(filter->patternMask));
+	filter->patternOffset = offset;
+	filter->patternChecksum = ~sum;
+	filter->enable |= ERXFCON_PMEN;
+}
+
+// Puts the frame in a transmit slot on the wire.  Called with the INT6 ISR kept out, or from it.
+// ETXST and the high byte of ETXND are shadowed, so they only go over SPI when they change
+static void txLaunch(uint8_t slot)
+{
+	const struct register_pair pointers[] = {
+		{ETXSTL, TX_SLOT(slot)},
+		{ETXNDL, txEnd[slot]},
+	};
+	RegisterWriteBatch(pointers, sizeof(pointers) / sizeof(pointers[0]));
+	writeBasic(BIT_FIELD_CLR, EIR, EIR_TXIF | EIR_TXERIF);     // clear the transmit flags
+	writeBasic(BIT_FIELD_SET, ECON1, ECON1_TXRTS);             // send the slot onto the network
+	txOnWire = slot;
+}
+
+// Finds a free transmit slot for a frame of len bytes, not counting the per-packet control byte in front
+// of it, and opens the buffer memory write which the control byte and the frame go out in.  Returns the
+// slot, or TX_NONE if one frame is on the wire and another is already waiting behind it
+static uint8_t txOpen(uint16_t len)
+{
+	if (txPending != TX_NONE)
+		return(TX_NONE);
+	
+	uint8_t slot = (txOnWire == 0) ? 1 : 0;
+	txEnd[slot] = TX_SLOT(slot) + len;
+	RegisterWrite16(EWRPTL, TX_SLOT(slot));
+	spiWriteStart(WRITE_BUF_MEM);
+	return(slot);
+}
+
+// Puts a frame which is complete in its slot on the wire, or leaves it for the INT6 ISR to start when the
+// frame ahead of it is done
+static void txQueue(uint8_t slot)
+{
+	txLast = slot;
+	if (txOnWire == TX_NONE){
+		txRetries = 0;
+		txLaunch(slot);
+	}
+	else
+		txPending = slot;
+}
+
+// Closes the buffer memory write opened by txOpen and sends the frame
+static void txClose(uint8_t slot)
+{
+	spiWriteEnd();
+	txQueue(slot);
+}
+
+// Address n bytes on from one in the buffer memory.  An address in the receive ring wraps from RXSTOP_INIT
+// back to RXSTART_INIT, as the read pointer and the DMA do
+static uint16_t bufferOffset(uint16_t address, uint16_t n)
+{
+	if (address >= RXSTART_INIT && address <= RXSTOP_INIT && address + n > RXSTOP_INIT)
+		return(address + n - (RXSTOP_INIT - RXSTART_INIT + 1));
+	return(address + n);
+}
+
+// Starts the DMA over the range already set up and waits the 80 ns a byte it takes.  mode is ECON1_CSUMEN
+// for a checksum, or 0 for a copy to EDMADST
+static void dmaRun(uint8_t mode)
+{
+	writeBasic(BIT_FIELD_SET, ECON1, mode | ECON1_DMAST);
+	while (RegisterRead(ECON1) & ECON1_DMAST)
+		;
+	if (mode)
+		writeBasic(BIT_FIELD_CLR, ECON1, mode);
+}
+
+// Has the DMA work out the Internet checksum of len bytes of the buffer memory from start, so the data never
+// crosses the SPI and the MCU never goes through it.  A range in the receive ring wraps around it.
+// Returns the checksum high byte first, ready to go in a header, or 0xFFFF less the sum to check one
+uint16_t dmaChecksum(uint16_t start, uint16_t len)
+{
+	const struct register_pair range[] = {
+		{EDMASTL, start},
+		{EDMANDL, bufferOffset(start, len - 1)},
+	};
+	uint8_t ethInt = ethLock();
+	RegisterWriteBatch(range, sizeof(range) / sizeof(range[0]));
+	dmaRun(ECON1_CSUMEN);
+	uint16_t sum = (RegisterRead(EDMACSH) << 8) | RegisterRead(EDMACSL);
+	ethUnlock(ethInt);
+	return(sum);
+}
+
+// Has the DMA copy len bytes of the buffer memory from start to dest, inside the ENC28J60.  A source or
+// destination in the receive ring wraps around it
+void dmaCopy(uint16_t start, uint16_t len, uint16_t dest)
+{
+	const struct register_pair range[] = {
+		{EDMASTL, start},
+		{EDMANDL, bufferOffset(start, len - 1)},
+		{EDMADSTL, dest},
+	};
+	uint8_t ethInt = ethLock();
+	RegisterWriteBatch(range, sizeof(range) / sizeof(range[0]));
+	dmaRun(0);
+	ethUnlock(ethInt);
+}
+
+// Sends a frame which is already complete in RAM, with the per-packet control byte at packet[0].
+// Returns 1 if the frame was taken, 0 if both transmit slots are busy and it has to be tried again later,
+// or if it is too long for MAX_FRAMELEN once the MAC has added the CRC and never will be
+uint8_t packetSend(uint16_t len, uint8_t* packet)
+{
+	if (len - 1 > MAX_FRAMELEN - 4)
+		return(0);
 	
-	// Set the TXND pointer to correspond to the packet size given
-	RegisterWrite(ETXNDL, (TXSTART_INIT + len) & 0xFF);
-	RegisterWrite(ETXNDH, (TXSTART_INIT + len) >> 8);
-		
-	// copy the packet into the transmit buffer
-	writeBuffer(len, packet);
+	uint8_t ethInt = ethLock();
+	uint8_t slot = txOpen(len - 1);
+	if (slot != TX_NONE){
+		spiWriteBytes(packet, len);        // copy the packet into the transmit buffer
+		txClose(slot);
+	}
+	ethUnlock(ethInt);
+	return(slot != TX_NONE);
+}
+
+// Sends len bytes of data to the ESB.  The control byte, the MAC addresses and the length go out of
+// txHeader and the data straight out of the caller's array, all in one SPI burst, so the frame is never
+// put together in RAM.  The data can be reused as soon as this returns.
+// Returns 1 if the frame was taken, 0 if both transmit slots are busy and it has to be tried again later,
+// or if len is more than MAX_DATA_LEN and never will be
+uint8_t packetSendData(const uint8_t *data, uint16_t len)
+{
+	if (len > MAX_DATA_LEN)
+		return(0);
 	
-	uint8_t len2 = 20;
-	uint8_t test[20];
-	test[0] = 0;
-	RegisterWrite(ERDPTL, TXSTART_INIT & 0xFF);
-	RegisterWrite(ERDPTH, TXSTART_INIT >> 8);
-	readBuffer(len2,test);	
+	txHeader[LEN_INDEX] = len >> 8;    // the 802.3 length field holds the length of the data, high byte first
+	txHeader[LEN_INDEX + 1] = len & 0xFF;
 	
-	// Clear the appropriate interrupt flags
-	writeBasic(BIT_FIELD_CLR, EIR, EIR_TXIF | EIR_TXERIF);     // clear the transmit flags
+	uint8_t ethInt = ethLock();
+	uint8_t slot = txOpen(TX_HEADER_LEN - 1 + len);
+	if (slot != TX_NONE){
+		spiWriteBytes(txHeader, TX_HEADER_LEN);
+		spiWriteBytes(data, len);
+		txClose(slot);
+	}
+	ethUnlock(ethInt);
+	return(slot != TX_NONE);
+}
+
+// Starts a frame which is put together from several pieces, such as the headers of the network layer and
+// the data behind them.  len is the length of the whole frame.  The ISR is kept out from here to
+// packetClose, so follow straight on with packetWrite, packetChecksum and packetPatch as needed.
+// Returns 1 if a transmit slot was taken, 0 if both are busy or the frame and its CRC are longer than MAX_FRAMELEN
+uint8_t packetOpen(uint16_t len)
+{
+	static const uint8_t control = 0x00;     // per-packet control byte, 0x00 means use macon3 settings
 	
-	// send the contents of the transmit buffer onto the network
-	writeBasic(BIT_FIELD_SET, ECON1, ECON1_TXRTS);
+	if (len > MAX_FRAMELEN - 4)
+		return(0);
+	uint8_t ethInt = ethLock();
+	uint8_t slot = txOpen(len);
+	if (slot == TX_NONE){
+		ethUnlock(ethInt);
+		return(0);
+	}
+	spiWriteBytes(&control, 1);
+	txBuild = slot;
+	txBuildLock = ethInt;
+	txWritten = TX_SLOT(slot) + 1;
+	txBurst = 1;
+	return(1);
+}
+
+// Adds the next len bytes to the frame started by packetOpen
+void packetWrite(const uint8_t *data, uint16_t len)
+{
+	if (!txBurst){
+		// a checksum or patch closed the write, so pick up where the frame got to
+		RegisterWrite16(EWRPTL, txWritten);
+		spiWriteStart(WRITE_BUF_MEM);
+		txBurst = 1;
+	}
+	spiWriteBytes(data, len);
+	txWritten += len;
+}
+
+// Has the DMA work out the Internet checksum of len bytes of the frame started by packetOpen, from offset
+// bytes into it, so the MCU never has to go through the data.  The bytes have to have been written already.
+// Returns the checksum high byte first, ready to go in a header
+uint16_t packetChecksum(uint16_t offset, uint16_t len)
+{
+	if (txBurst){
+		spiWriteEnd();
+		txBurst = 0;
+	}
+	return(dmaChecksum(TX_SLOT(txBuild) + 1 + offset, len));
+}
+
+// Overwrites two bytes of the frame started by packetOpen, offset bytes into it, with value high byte first
+void packetPatch(uint16_t offset, uint16_t value)
+{
+	uint8_t bytes[2] = {value >> 8, value & 0xFF};
 	
-	// Reset the transmit logic problem. See Rev. B4 Silicon Errata point 12.
-	if((RegisterRead(EIR) & EIR_TXERIF))
-	{
-		writeBasic(BIT_FIELD_CLR, ECON1, ECON1_TXRTS);
+	if (txBurst){
+		spiWriteEnd();
+		txBurst = 0;
+	}
+	RegisterWrite16(EWRPTL, TX_SLOT(txBuild) + 1 + offset);
+	spiWriteBlock(WRITE_BUF_MEM, bytes, 2);
+}
+
+// Sends the frame started by packetOpen and lets the ISR back in
+void packetClose(void)
+{
+	if (txBurst){
+		spiWriteEnd();
+		txBurst = 0;
+	}
+	txQueue(txBuild);
+	txBuild = TX_NONE;
+	ethUnlock(txBuildLock);
+}
+
+// Sends the last frame queued again, such as telemetry the GUI missed, without it crossing the SPI again.
+// With the transmitter idle the slot it is in is simply put back on the wire, otherwise the DMA copies it
+// from the slot on the wire into the other one, to go out behind it.
+// Returns 1 if it was queued, 0 if nothing has been sent yet or both slots are busy
+uint8_t packetResend(void)
+{
+	uint8_t ethInt = ethLock();
+	uint8_t slot = TX_NONE;
+	if (txLast != TX_NONE && txPending == TX_NONE && txBuild == TX_NONE){
+		if (txOnWire == TX_NONE)
+			slot = txLast;
+		else {
+			// Nothing is waiting, so the frame on the wire is the last one queued
+			uint16_t len = txEnd[txLast] - TX_SLOT(txLast);
+			slot = txLast ^ 1;
+			dmaCopy(TX_SLOT(txLast), len + 1, TX_SLOT(slot));
+			txEnd[slot] = TX_SLOT(slot) + len;
+		}
+		txQueue(slot);
+	}
+	ethUnlock(ethInt);
+	return(slot != TX_NONE);
+}
+
+// Retires the frame on the wire and starts the one waiting behind it, if there is one
+static void txDone(void)
+{
+	txOnWire = TX_NONE;
+	if (txPending != TX_NONE){
+		uint8_t slot = txPending;
+		txPending = TX_NONE;
+		txRetries = 0;
+		txLaunch(slot);
 	}
-				
+	else
+		writeBasic(BIT_FIELD_CLR, EIR, EIR_TXIF | EIR_TXERIF);
+}
+
+// A transmit error can leave TXRTS stuck, so the transmit logic is reset and the frame sent again.
+// See Rev. B4 Silicon Errata point 12.
+static void txError(void)
+{
+	writeBasic(BIT_FIELD_SET, ECON1, ECON1_TXRST);
+	writeBasic(BIT_FIELD_CLR, ECON1, ECON1_TXRST);
+	txErrors++;
+	if (txOnWire != TX_NONE && txRetries < TX_RETRIES){
+		txRetries++;
+		txLaunch(txOnWire);
+	}
+	else
+		txDone();                      // give up on it
+}
+
+// The PHY saw the link go down or come back.  Reading PHIR lets go of LINKIF, and the link is read from
+// PHSTAT2 while the scan is stopped for it anyway.  That keeps the ISR busy for some 80 us, but only
+// when the cable is pulled or plugged in
+static void linkChange(void)
+{
+	phyScanStop();
+	phyGet(PHIR);
+	ethLinkUp = (phyGet(PHSTAT2) & PHSTAT2_LSTAT) != 0;
+	phyScan();
+	linkChanges++;
 }
 
-uint16_t packetRecieve(uint8_t max_len, uint8_t *packets)
+// ISR on the falling edge of the INT line.  A finished transmission is retired and the frame waiting
+// behind it started, and a link change updates ethLinkUp.  Every packet waiting in the receive ring gets a
+// descriptor in rxQueue, while the packet itself stays in the ring until packetRecieve() has read it out
+ISR(INT6_vect)
 {
-	uint16_t rxstat;
-	uint16_t len;
+	uint8_t header[RX_HEADER_LEN];
+	
+	// Let go of the INT line while the flags are handled, so anything which comes in part way through
+	// drives a fresh falling edge when it is enabled again below
+	writeBasic(BIT_FIELD_CLR, EIE, EIE_INTIE);
+	uint8_t flags = RegisterRead(EIR);
+	
+	// An aborted transmission sets TXIF as well, so the error is looked at first
+	if (flags & EIR_TXERIF)
+		txError();
+	else if (flags & EIR_TXIF)
+		txDone();
+	
+	if (flags & EIR_LINKIF)
+		linkChange();
+	
+	// A receive error means the ring was full and a packet was dropped
+	if (flags & EIR_RXERIF){
+		writeBasic(BIT_FIELD_CLR, EIR, EIR_RXERIF);
+		rxOverruns++;
+	}
 	
-	// Check to see if a packet has been received, if not, then return
-	if (!RegisterRead(EPKTCNT))
-		return(0);
+	uint8_t pending = RegisterRead(EPKTCNT);
+	while (pending){
+		if ((uint8_t) (rxHead - rxTail) == RX_QUEUE_LEN){
+			// No room, so leave the rest of the packets counted with only the packet pending interrupt
+			// turned off, as the transmit interrupts still have to come through.  packetRecieve turns it back on
+			writeBasic(BIT_FIELD_CLR, EIE, EIE_PKTIE);
+			rxStalled = 1;
+			break;
+		}
 		
-	// Set the read pointer to the start of the received packet
-	RegisterWrite(ERDPTL, nextPacketPtr);
-	RegisterWrite(ERDPTH, nextPacketPtr >> 8);
-	
-	// Read the next packet pointer (see page 43 in data sheet)
-	nextPacketPtr = readBasic(READ_BUF_MEM, 0);
-	nextPacketPtr |= readBasic(READ_BUF_MEM, 0) << 8;
-	// Reading from the memory buffer automatically increments to the next byte
-	
-	// read the packet length
-	len = readBasic(READ_BUF_MEM, 0);
-	len |= readBasic(READ_BUF_MEM, 0) << 8;
-	// in the example, 4 is subtracted from this but I don't have CRC checking implemented since I don't think it is necessary
+		// Read the next packet pointer, the packet length and the receive status (see page 43 in data sheet)
+		// in one go, reading from the memory buffer automatically increments to the next byte
+		struct rx_packet *p = &rxQueue[rxHead & (RX_QUEUE_LEN - 1)];
+		RegisterWrite16(ERDPTL, nextPacketPtr);
+		spiReadBlock(READ_BUF_MEM, header, RX_HEADER_LEN);
+		p->start = bufferOffset(nextPacketPtr, RX_HEADER_LEN);     // the header can run up to the end of the ring
+		p->next = header[0] | (header[1] << 8);
+		p->len = header[2] | (header[3] << 8);
+		p->status = header[4];
+		nextPacketPtr = p->next;
+		rxHead++;
+		
+		// decrement the packet counter, the memory is only freed once ERXRDPT is moved past the packet
+		writeBasic(BIT_FIELD_SET, ECON2, ECON2_PKTDEC);
+		pending--;
+	}
+	writeBasic(BIT_FIELD_SET, EIE, EIE_INTIE);
+}
+
+// Reads the packet at the front of rxQueue into packets, at most max_len bytes of it, and leaves it there
+// until packetDrop() is called.  Returns the number of bytes read, 0 if nothing is waiting or the packet was
+// received with an error
+uint16_t packetPeek(uint16_t max_len, uint8_t *packets)
+{
+	// Nothing goes over SPI unless the receive ISR has queued a packet
+	if (rxHead == rxTail)
+		return(0);
 	
-	// read the receive status
-	rxstat = readBasic(READ_BUF_MEM, 0);
-	rxstat |= readBasic(READ_BUF_MEM, 0) << 8;
+	struct rx_packet *p = &rxQueue[rxTail & (RX_QUEUE_LEN - 1)];
+	// in the example, 4 is subtracted from this but I don't have CRC checking implemented since I don't think it is necessary
+	uint16_t len = p->len;
 	
 	// limit the receive length
 	if (len > max_len)
 		len = max_len;
 		
 	// check for symbol errors
-	if (!(rxstat & 0x80)){
+	if (!(p->status & 0x80)){
 		// this is an invalid packet
 		len = 0;
 	}
-	else{
+	
+	if (len){
+		uint8_t ethInt = ethLock();
+		// Set the read pointer to the start of the received packet
+		RegisterWrite16(ERDPTL, p->start);
 		readBuffer(len, packets);
+		ethUnlock(ethInt);
 	}
-	
+	return(len);
+}
+
+// Takes the packet at the front of rxQueue out of the receive ring.  Called with the ISR kept out
+static void rxFree(void)
+{
 	// move the RX pointer to the start of the next received packet
 	// This frees the memory we just read out
-	RegisterWrite(ERXRDPTL, nextPacketPtr);
-	RegisterWrite(ERXRDPTH, nextPacketPtr >> 8);
+	RegisterWrite16(ERXRDPTL, rxQueue[rxTail & (RX_QUEUE_LEN - 1)].next);
+	rxTail++;
+	
+	// The ISR turned the packet pending interrupt off when the queue filled up, and now there is room for
+	// the packets behind this one
+	if (rxStalled){
+		rxStalled = 0;
+		writeBasic(BIT_FIELD_SET, EIE, EIE_PKTIE);
+	}
+}
+
+// Takes the packet at the front of rxQueue out of the receive ring, once packetPeek() is done with it
+void packetDrop(void)
+{
+	if (rxHead == rxTail)
+		return;
+	uint8_t ethInt = ethLock();
+	rxFree();
+	ethUnlock(ethInt);
+}
+
+uint16_t packetRecieve(uint16_t max_len, uint8_t *packets)
+{
+	uint16_t len = packetPeek(max_len, packets);
+	packetDrop();
+	return(len);
+}
+
+// Sends the packet at the front of rxQueue back to where it came from, for an echo or an acknowledgement
+// which repeats what it answers, and takes it out of the receive ring.  The DMA copies the frame from the
+// ring into a free transmit slot and only the control byte and the two MAC addresses cross the SPI.
+// Returns the length of the frame sent, or 0 if nothing is waiting, both transmit slots are busy, in which
+// case the packet is left where it is, or the packet was bad or too long and has been dropped
+uint16_t packetEcho(void)
+{
+	uint8_t header[1 + 12];            // the control byte and the two MAC addresses
+	
+	if (rxHead == rxTail)
+		return(0);
+	uint8_t ethInt = ethLock();
+	if (txPending != TX_NONE || txBuild != TX_NONE){
+		ethUnlock(ethInt);
+		return(0);
+	}
+	
+	struct rx_packet *p = &rxQueue[rxTail & (RX_QUEUE_LEN - 1)];
+	uint16_t len = p->len - 4;         // the CRC is worked out again as the frame goes out
+	if (!(p->status & 0x80) || p->len < 4 + 14 || len > MAX_FRAMELEN)
+		len = 0;
+	else {
+		uint8_t slot = (txOnWire == 0) ? 1 : 0;
 		
-	// decrement the packet counter indicate we are done with this packet
-	writeBasic(BIT_FIELD_SET, ECON2, ECON2_PKTDEC);
+		// The sender's address becomes the destination and ours the source, behind the control byte
+		header[0] = 0x00;
+		RegisterWrite16(ERDPTL, bufferOffset(p->start, SRC_MAC));
+		spiReadBlock(READ_BUF_MEM, header + 1, 6);
+		memcpy(header + 7, ECU_mac, 6);
+		dmaCopy(bufferOffset(p->start, 12), len - 12, TX_SLOT(slot) + 1 + 12);
+		RegisterWrite16(EWRPTL, TX_SLOT(slot));
+		spiWriteBlock(WRITE_BUF_MEM, header, sizeof(header));
+		txEnd[slot] = TX_SLOT(slot) + len;
+		txQueue(slot);
+	}
+	rxFree();
+	ethUnlock(ethInt);
 	return(len);
 }
 
@@ -357,30 +907,14 @@ void transmitHeader(uint8_t *buffer)
 		buffer[SRC_MAC + i + 1] = ECU_mac[i];
 		i++;
 	}
-}
-
-uint8_t loadData(uint8_t *fullMessage, uint8_t *message, uint8_t len)
-{
-	uint8_t i = 0;
-	
-	// First load the length of the message
-	fullMessage[LEN_INDEX] = len + 15;   // This does the two MAC addresses, size bytes, and per-packet control byte
-	fullMessage[LEN_INDEX + 1] = 0;    // Since I know the length will be much less than 256
-	
-	// Next load the MAC Addresses into the full message
-	transmitHeader(fullMessage);
-	
-	// Now load the data from the message into the full message
-	while (i < len)
-	{
-		fullMessage[LEN_INDEX + 2 + i] = message[i];
-		i++;
-	}
-	return (15 + len);
+	buffer[LEN_INDEX] = 0;        // The length field, high byte first, which packetSendData fills in
+	buffer[LEN_INDEX + 1] = 0;
 }
 
 void readTX_StatusVec(uint8_t *Status)
 {
+	uint8_t ethInt = ethLock();
+	
 	// This will read the 7 bytes which are located at ETXND+1
 	// First need to save the location of the read pointer
 	uint16_t savePointer = RegisterRead(ERDPTL);
@@ -392,15 +926,12 @@ void readTX_StatusVec(uint8_t *Status)
 	curTX_end++;
 	
 	// Now set the read pointer
-	RegisterWrite(ERDPTL, curTX_end & 0xFF);
-	RegisterWrite(ERDPTH, curTX_end >> 8);
+	RegisterWrite16(ERDPTL, curTX_end);
 	
 	// Now read the buffer 7 times
 	readBuffer(7, Status);
 	
 	// Now put the read pointer back
-	RegisterWrite(ERDPTL, savePointer & 0xFF);
-	RegisterWrite(ERDPTH, savePointer >> 8);	
-	
-
+	RegisterWrite16(ERDPTL, savePointer);
+	ethUnlock(ethInt);
 }
\ No newline at end of file
@@ -9,6 +9,8 @@
 #include <avr/io.h>
 #include <avr/interrupt.h>
 #include "ECU_funcs.h"
+#include "Network.h"
+#include "Scheduler.h"
 
 /** @brief Performs the waiting cycle until the HCU signals to the ECU to being operating
  *
@@ -39,9 +41,11 @@ void pre_Initial(void)
  *
  *  5) Initializes the ADC for the Lipo battery voltage measurements
  *
- *  6) Enable global interrupts
+ *  6) Initializes the ENC28J60 and the network layer on top of it, for the telemetry to the GUI
+ *
+ *  7) Enable global interrupts
  * 
- *  7) Enable a timer for the ECU command cycle and start the timer
+ *  8) Enable a timer for the ECU command cycle and start the timer
  * 
  *  @param void
  *  @return void
@@ -82,10 +86,15 @@ void Initial(void)
 	// 3) 1 Stop bit
 	// 4) 8 bit character size
 	UCSR1C = (1 << UCSZ11) | (1 << UCSZ10);   // Now the USART should be ready to receive
-	newCommand_ESB = 1;
-	ESBreceiveCount = 0;
+	linkInit(&ESBlink);
+	ESBtxHead = 0;
+	ESBtxTail = 0;
+	GUIframeIndex = GUI_FRAME_LEN;
+	GUIframeReady = 0;
+	GUIreplyLen = 0;
+	GUIreplyIndex = 0;
 	waitMS(50);
-	while (!connected){     // wait until connected with the ESB
+	while (!connected_ESB){     // wait until connected with the ESB
 		ESB_Connect();
 		waitMS(10);
 	}
@@ -106,16 +115,22 @@ void Initial(void)
 	
 	/////////////////// Initialize ADC for Battery Voltage ///////////////////////////////
 	
-	// The next things that need to be set are as follows
-	// 1) The reference for the ADC needs to be set to the external AREF
-	// 2) The channel for ADMUX needs to be channel 0
-	// 3) The ADC needs to be enabled without interrupts
-	// 4) Division factor for the ADC needs to be set to 128 to keep the input clock 
-	//    frequency between 50kHz and 200kHz
-	
-	ADMUX = (1 << REFS0);
-	ADCSRA = (1 << ADEN) | (1 << ADPS0) | (1 << ADPS1) | (1 << ADPS2);
-	batChannel = 0;
+	// The ADC runs free from here on, sampling every channel in turn from ADC_vect
+	batInit();
+	adcInit();
+	batMillivolts = 0;
+	
+	
+	/////////////////////// Initialize the Ethernet Controller ////////////////////////////
+	
+	// The ENC28J60 is the only device on the SPI bus, run as master at F_CPU/2
+	static const uint8_t ECUip[4] = NET_ECU_IP;
+	DDRB |= (1 << ESB_SS) | (1 << SCK) | (1 << MOSI);
+	CSPASSIVE;
+	SPCR = (1 << SPE) | (1 << MSTR);
+	SPSR = (1 << SPI2X);
+	InitEthernet();
+	netInit(ECUip);
 
 
 	/////////////////////// Enable global interrupts //////////////////////////////////
@@ -125,10 +140,17 @@ void Initial(void)
 	
 	// The next things that need to be set are as follows
 	// 1) Timer 1 needs a prescalar of 64 and timer register of 3036    for time of 0.25 sec, for regulating communication with the ESB
-	// 2) Timer 3 needs a prescalar of 64 and timer register if 3036
+	// 2) Timer 3 runs free with a prescalar of 64 to timestamp the flow meter pulses, and its compare A
+	//    interrupt is the 1 ms tick of the scheduler
 	// 3) Timer 4 and 5 needs to have interrupts enabled and create a 1 second timer
 	TCNT1 = 3036;
-	TCNT3 = FlowTime;             // The flow meter timer does not need interrupts since it will be polled
+	TCNT3 = 0;
+	OCR3A = sched_tick;
+	flowOverflows = 0;
+	schedTicks = 0;
+	schedTickStamp = 0;
+	TIMSK3 = (1 << TOIE3) | (1 << OCIE3A);
+	TCCR3B = (1 << CS31) | (1 << CS30);    // start timer 3 with prescalar of 64
 	
 	// The TIFR1 register and TOV1 flag are the overflow flag for timer1
 	TCCR1B = (1 << CS11) | (1 << CS10);    // start timer 1 with prescalar of 64
@@ -138,14 +160,14 @@ void Initial(void)
 	TCNT5 = ESB_timer_val;     // loads Timer 5 with a value that will make a 1 second timer
 
 	
-	// Begin the first conversion for the ADC
-	ADCSRA |= (1 << ADSC);
-	
 	massFlow.f = 0.0;
 	 
 	// Now configure the external interrupts for the Flow meters
 	EICRA = (1 << ISC20) | (1 << ISC21);     // This will enable rising edge interrupts on INT2, see page 110 in datasheet
 	assign_bit(&DDRD, INT2, 0);              // Configure the PD2 pin as an input so that it can receive the signals
+	pulse_count = 0;
+	flowStarted = 0;
+	EIMSK |= (1 << INT2);                    // the flow meter pulses are timestamped all the time
 	 
 	 
 	// Now configure the global variables for the flow meter
@@ -162,6 +184,8 @@ void Initial(void)
 	voltage.f = 0;
 	doTransmit = 0;
 	
+	schedInit();
+	
 	
 }
 
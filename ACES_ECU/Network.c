@@ -0,0 +1,353 @@
+/** @file Network.c
+ *  @author Nick Moore
+ *  @date October 15, 2026
+ *  @brief ARP, IPv4 and UDP on top of the ENC28J60 driver, see Network.h
+ *
+ *  @bug No known bugs
+ */
+
+#include <string.h>
+#include "Network.h"
+
+static const uint8_t broadcastMac[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+static const uint8_t broadcastIp[4] = {0xFF, 0xFF, 0xFF, 0xFF};
+
+/** @brief Reads a 16 bit field in network order
+ *
+ *  @param[in] p The first byte of the field
+ *  @return uint16_t
+ */
+static uint16_t get16(const uint8_t *p)
+{
+	return (p[0] << 8) | p[1];
+}
+
+/** @brief Writes a 16 bit field in network order
+ *
+ *  @param[out] p The first byte of the field
+ *  @param[in] value The value to write
+ *  @return void
+ */
+static void put16(uint8_t *p, uint16_t value)
+{
+	p[0] = value >> 8;
+	p[1] = value & 0xFF;
+}
+
+/** @brief Adds a block of 16 bit words in network order to a one's complement sum
+ *
+ *  @param[in] data The words, padded with a 0 byte if there is an odd number of bytes
+ *  @param[in] len Number of bytes
+ *  @param[in] sum The sum so far
+ *  @return uint32_t The sum, still to be folded
+ */
+static uint32_t netSum(const uint8_t *data, uint16_t len, uint32_t sum)
+{
+	uint16_t i;
+	for (i = 0; i + 1 < len; i += 2){
+		sum += get16(data + i);
+	}
+	if (i < len)
+		sum += data[i] << 8;
+	return sum;
+}
+
+/** @brief Folds a one's complement sum into 16 bits
+ *
+ *  @param[in] sum The sum
+ *  @return uint16_t
+ */
+static uint16_t netFold(uint32_t sum)
+{
+	while (sum >> 16){
+		sum = (sum & 0xFFFF) + (sum >> 16);
+	}
+	return sum;
+}
+
+/** @brief Looks an IP address up in the ARP cache
+ *
+ *  @param[in] ip The address
+ *  @return struct arp_entry* The entry, or 0 if the address has not been resolved
+ */
+static struct arp_entry *arpFind(const uint8_t *ip)
+{
+	for (uint8_t i = 0; i < NET_ARP_ENTRIES; i++){
+		if (arpCache[i].valid && !memcmp(arpCache[i].ip, ip, 4))
+			return &arpCache[i];
+	}
+	return 0;
+}
+
+/** @brief Records the MAC address of an IP address, updating its entry or replacing the oldest one
+ *
+ *  @param[in] ip The IP address
+ *  @param[in] mac Its MAC address
+ *  @return void
+ */
+static void arpLearn(const uint8_t *ip, const uint8_t *mac)
+{
+	struct arp_entry *e = arpFind(ip);
+	if (!e){
+		e = &arpCache[arpNext];
+		arpNext = (arpNext + 1) % NET_ARP_ENTRIES;
+		memcpy(e->ip, ip, 4);
+		e->valid = 1;
+	}
+	memcpy(e->mac, mac, 6);
+}
+
+/** @brief Sends an ARP request or reply
+ *
+ *  @param[in] op ARP_REQUEST or ARP_REPLY
+ *  @param[in] mac MAC address to send to, and the target hardware address of a reply
+ *  @param[in] ip Target IP address
+ *  @return void
+ */
+static void arpSend(uint8_t op, const uint8_t *mac, const uint8_t *ip)
+{
+	uint8_t frame[NET_ETH_HEADER + NET_ARP_LEN];
+	uint8_t *arp = frame + NET_ETH_HEADER;
+
+	memcpy(frame, mac, 6);
+	memcpy(frame + 6, ECU_mac, 6);
+	put16(frame + 12, ETHERTYPE_ARP);
+	put16(arp, 1);                     // Ethernet
+	put16(arp + 2, ETHERTYPE_IP);
+	arp[4] = 6;
+	arp[5] = 4;
+	put16(arp + 6, op);
+	memcpy(arp + 8, ECU_mac, 6);
+	memcpy(arp + 14, netIp, 4);
+	if (op == ARP_REPLY)
+		memcpy(arp + 18, mac, 6);
+	else
+		memset(arp + 18, 0, 6);
+	memcpy(arp + 24, ip, 4);
+
+	// A request or reply which finds both transmit slots busy is dropped, the other side asks again
+	if (packetOpen(sizeof(frame))){
+		packetWrite(frame, sizeof(frame));
+		packetClose();
+	}
+}
+
+/** @brief Takes in an ARP packet, answering a request for netIp and learning the sender of either kind
+ *
+ *  @param[in] arp The ARP packet
+ *  @param[in] len Bytes of it which were received
+ *  @return void
+ */
+static void arpInput(const uint8_t *arp, uint16_t len)
+{
+	if (len < NET_ARP_LEN || get16(arp) != 1 || get16(arp + 2) != ETHERTYPE_IP || arp[4] != 6 || arp[5] != 4){
+		netStats.dropped++;
+		return;
+	}
+	uint8_t forUs = !memcmp(arp + 24, netIp, 4);
+	uint16_t op = get16(arp + 6);
+
+	// Only senders which are talking to us, or already in the cache, are learned
+	if (forUs || arpFind(arp + 14))
+		arpLearn(arp + 14, arp + 8);
+	if (op == ARP_REQUEST && forUs)
+		arpSend(ARP_REPLY, arp + 8, arp + 14);
+	netStats.arp++;
+}
+
+/** @brief Takes in an IPv4 packet and hands the data of a UDP datagram for a bound port to its handler
+ *
+ *  Packets with options, fragments, a bad header checksum, or for another address are dropped, and so are
+ *  datagrams with a bad UDP checksum.  That is checked by the DMA over the frame, which is still in the
+ *  receive ring.
+ *
+ *  @param[in] ip The IPv4 header and what follows it
+ *  @param[in] len Bytes of it which were received
+ *  @return void
+ */
+static void ipInput(const uint8_t *ip, uint16_t len)
+{
+	if (len < NET_IP_HEADER + NET_UDP_HEADER || ip[0] != 0x45 || netFold(netSum(ip, NET_IP_HEADER, 0)) != 0xFFFF){
+		netStats.dropped++;
+		return;
+	}
+	uint16_t total = get16(ip + 2);
+	if (total > len || total < NET_IP_HEADER + NET_UDP_HEADER || (get16(ip + 6) & 0x3FFF) || ip[9] != IP_PROTO_UDP ||
+	    (memcmp(ip + 16, netIp, 4) && memcmp(ip + 16, broadcastIp, 4))){
+		netStats.dropped++;
+		return;
+	}
+
+	const uint8_t *udp = ip + NET_IP_HEADER;
+	uint16_t udpLen = get16(udp + 4);
+	uint16_t port = get16(udp + 2);
+	if (udpLen < NET_UDP_HEADER || udpLen > total - NET_IP_HEADER){
+		netStats.dropped++;
+		return;
+	}
+	
+	// The data and the checksum in it sum to 0xFFFF with the pseudo header, unless the sender left it at 0.  It is
+	// summed from the copy in netFrame, as the DMA checksum is not to be trusted in the receive ring, see Network.h
+	if (get16(udp + 6)){
+		uint32_t sum = netSum(udp, udpLen, 0);
+		if (netFold(netSum(ip + 12, 8, sum) + IP_PROTO_UDP + udpLen) != 0xFFFF){
+			netStats.dropped++;
+			return;
+		}
+	}
+	for (uint8_t i = 0; i < NET_SOCKETS; i++){
+		if (udpSockets[i].port && udpSockets[i].port == port){
+			netStats.datagrams++;
+			udpSockets[i].handler(ip + 12, get16(udp), udp + NET_UDP_HEADER, udpLen - NET_UDP_HEADER);
+			return;
+		}
+	}
+	netStats.dropped++;
+}
+
+/** @brief Sets the ECU's IP address, forgets every resolved address and bound port, and sets the receive
+ *  filters to let in only what the network layer needs
+ *
+ *  InitEthernet() has to have been run first.
+ *
+ *  @param[in] ip The ECU's IP address
+ *  @return void
+ */
+void netInit(const uint8_t *ip)
+{
+	// Bytes 12 and 13, 20 and 21, and 38 to 41 of the frame: the EtherType, the ARP operation and the target address
+	static const uint8_t arpMask[8] = {0x00, 0x30, 0x30, 0x00, 0xC0, 0x03, 0x00, 0x00};
+	uint8_t arpRequest[NET_ETH_HEADER + NET_ARP_LEN] = {0};
+	struct eth_filter filter = {ERXFCON_UCEN | ERXFCON_CRCEN};
+	
+	memcpy(netIp, ip, 4);
+	memset(arpCache, 0, sizeof(arpCache));
+	arpNext = 0;
+	memset(udpSockets, 0, sizeof(udpSockets));
+	memset(&netStats, 0, sizeof(netStats));
+	
+	// Other than frames for our MAC address, only the ARP requests for netIp get past the ENC28J60.  They are
+	// broadcast, so the pattern match picks them out, which always fits as they are padded to 60 bytes
+	put16(arpRequest + 12, ETHERTYPE_ARP);
+	put16(arpRequest + NET_ETH_HEADER + 6, ARP_REQUEST);
+	memcpy(arpRequest + NET_ETH_HEADER + 24, ip, 4);
+	ethFilterPattern(&filter, 0, arpRequest, arpMask);
+	ethFilter(&filter);
+}
+
+/** @brief Has the datagrams which arrive for a UDP port handed to a handler
+ *
+ *  @param[in] port The port, not 0
+ *  @param[in] handler Called from netPoll() with each datagram
+ *  @return uint8_t 1 if the port was bound, 0 if every socket is taken
+ */
+uint8_t udpBind(uint16_t port, udp_handler_t handler)
+{
+	for (uint8_t i = 0; i < NET_SOCKETS; i++){
+		if (!udpSockets[i].port){
+			udpSockets[i].port = port;
+			udpSockets[i].handler = handler;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/** @brief Sends a UDP datagram
+ *
+ *  This performs the following functions:
+ *  1) Finds the MAC address of ip, or sends an ARP request for it and gives up for now if it is not known
+ *  2) Takes a transmit slot and writes the headers with the UDP checksum left at 0, and then the data
+ *  3) Has the DMA sum the UDP header and data in the slot, adds the pseudo header to that and patches the
+ *     checksum in, so the data is only ever read once, by the SPI burst
+ *  4) Sends the frame
+ *
+ *  @param[in] ip Address to send to, the limited broadcast address 255.255.255.255 needs no ARP
+ *  @param[in] srcPort UDP port it is sent from
+ *  @param[in] dstPort UDP port it is sent to
+ *  @param[in] data The data, which can be reused as soon as this returns
+ *  @param[in] len Bytes of data, at most NET_MAX_DATA
+ *  @return uint8_t 1 if the datagram was sent, 0 if the link is down, the address is still being resolved,
+ *  both transmit slots are busy, or the data does not fit in one frame
+ */
+uint8_t udpSend(const uint8_t *ip, uint16_t srcPort, uint16_t dstPort, const uint8_t *data, uint16_t len)
+{
+	const uint8_t *mac = broadcastMac;
+	if (len > NET_MAX_DATA)
+		return 0;
+	if (!ethLinkUp){
+		netStats.linkDown++;           // the caller falls back to the serial link straight away
+		return 0;
+	}
+	if (memcmp(ip, broadcastIp, 4)){
+		struct arp_entry *e = arpFind(ip);
+		if (!e){
+			netStats.arpMisses++;
+			arpSend(ARP_REQUEST, broadcastMac, ip);
+			return 0;
+		}
+		mac = e->mac;
+	}
+
+	uint8_t *h = netHeaders;
+	uint16_t udpLen = NET_UDP_HEADER + len;
+	memcpy(h, mac, 6);
+	memcpy(h + 6, ECU_mac, 6);
+	put16(h + 12, ETHERTYPE_IP);
+
+	uint8_t *iph = h + NET_ETH_HEADER;
+	iph[0] = 0x45;                     // version 4, no options
+	iph[1] = 0;
+	put16(iph + 2, NET_IP_HEADER + udpLen);
+	put16(iph + 4, ipIdent);
+	put16(iph + 6, 0x4000);            // don't fragment
+	iph[8] = IP_TTL;
+	iph[9] = IP_PROTO_UDP;
+	put16(iph + 10, 0);
+	memcpy(iph + 12, netIp, 4);
+	memcpy(iph + 16, ip, 4);
+	put16(iph + 10, ~netFold(netSum(iph, NET_IP_HEADER, 0)));
+
+	uint8_t *udp = iph + NET_IP_HEADER;
+	put16(udp, srcPort);
+	put16(udp + 2, dstPort);
+	put16(udp + 4, udpLen);
+	put16(udp + 6, 0);
+
+	if (!packetOpen(NET_HEADERS + len))
+		return 0;
+	ipIdent++;
+	packetWrite(h, NET_HEADERS);
+	packetWrite(data, len);
+
+	// The DMA gives the complement of the sum of the UDP header and data, to which the pseudo header of
+	// both addresses, the protocol and the UDP length is added
+	uint32_t sum = (uint16_t) ~packetChecksum(NET_ETH_HEADER + NET_IP_HEADER, udpLen);
+	sum = netSum(iph + 12, 8, sum) + IP_PROTO_UDP + udpLen;
+	uint16_t csum = ~netFold(sum);
+	packetPatch(NET_UDP_CSUM, csum ? csum : 0xFFFF);      // 0 would mean no checksum
+	packetClose();
+	return 1;
+}
+
+/** @brief Reads every frame the driver has queued and takes in the ARP and IPv4 ones
+ *
+ *  This owns the receive side of the driver, so anything other than ARP and IPv4 is dropped.
+ *
+ *  @param void
+ *  @return void
+ */
+void netPoll(void)
+{
+	while (rxHead != rxTail){
+		uint16_t len = packetRecieve(MAX_FRAMELEN, netFrame);
+		netStats.frames++;
+		uint16_t type = len < NET_ETH_HEADER ? 0 : get16(netFrame + 12);
+		if (type == ETHERTYPE_ARP)
+			arpInput(netFrame + NET_ETH_HEADER, len - NET_ETH_HEADER);
+		else if (type == ETHERTYPE_IP)
+			ipInput(netFrame + NET_ETH_HEADER, len - NET_ETH_HEADER);
+		else
+			netStats.dropped++;
+	}
+}
@@ -0,0 +1,127 @@
+/** @file Network.h
+ *  @author Nick Moore
+ *  @date October 15, 2026
+ *  @brief ARP, IPv4 and UDP on top of the ENC28J60 driver, for streaming telemetry to the GUI over Ethernet
+ *
+ *  Every datagram is sent as one frame, without IP options or fragmentation:
+ *
+ *      Ethernet header (14) | IPv4 header (20) | UDP header (8) | data (at most NET_MAX_DATA bytes)
+ *
+ *  The headers are put together in RAM and the data goes out of the caller's array straight behind them in
+ *  the same transmit slot.  The UDP checksum is worked out by the ENC28J60's DMA over the UDP header and
+ *  data in the slot, with only the 12 byte pseudo header added in by the MCU, and patched in before the frame
+ *  is sent.  The IPv4 header checksum is summed a word at a time in RAM, where the header already is.
+ *
+ *  Received frames are read into RAM whole, and both checksums of a datagram are summed there a word at a
+ *  time.  The DMA is kept off the receive ring, as the silicon errata has its checksum come out wrong at
+ *  times while reception is enabled, which it always is there.
+ *
+ *  Everything is statically allocated.  IP addresses are resolved through a small ARP cache, and a datagram
+ *  for an address which is not in it yet is refused while an ARP request goes out in its place, so the caller
+ *  just tries again with its next datagram.  Received ARP requests for netIp are answered, and UDP datagrams
+ *  for a bound port are handed to its handler from netPoll().  Those, and frames from the ESB, are all the
+ *  ENC28J60's receive filters let in, so other broadcasts never reach the MCU.
+ *
+ *  udpSend() refuses a datagram at once while ethLinkUp is clear, which the driver's ISR sees to within
+ *  100 us of the PHY reporting the link down.  The GUI task then sends the telemetry frame over the serial
+ *  link instead, and goes back to Ethernet as soon as udpSend() takes a datagram again.
+ *
+ *  @bug No known bugs
+ */
+
+#include <stdint.h>
+#include "Ethernet.h"
+
+#ifndef NETWORK_H_
+#define NETWORK_H_
+
+///////////////////////////////////////////////////////////////////////////
+///////////////////////// Frame Layout ////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////
+#define NET_ETH_HEADER 14              // Destination and source MAC addresses and the EtherType
+#define NET_IP_HEADER 20               // IPv4 header without options
+#define NET_UDP_HEADER 8
+#define NET_HEADERS (NET_ETH_HEADER + NET_IP_HEADER + NET_UDP_HEADER)
+#define NET_ARP_LEN 28                 // ARP packet for IPv4 over Ethernet
+#define NET_MAX_DATA (MAX_FRAMELEN - 4 - NET_HEADERS)     // Most data in one datagram, leaving room for the CRC
+#define NET_UDP_CSUM (NET_HEADERS - 2)                     // Offset of the UDP checksum in the frame
+
+#define ETHERTYPE_IP 0x0800
+#define ETHERTYPE_ARP 0x0806
+#define IP_PROTO_UDP 17
+#define IP_TTL 64
+#define ARP_REQUEST 1
+#define ARP_REPLY 2
+
+///////////////////////////////////////////////////////////////////////////
+///////////////////////// Configuration ///////////////////////////////////
+///////////////////////////////////////////////////////////////////////////
+#define NET_ARP_ENTRIES 4              // Addresses the ARP cache holds, the oldest is replaced first
+#define NET_SOCKETS 4                  // UDP ports which can be bound at once
+#define NET_GUI_PORT 5005              // UDP port the GUI listens on for telemetry and sends its commands to
+#define NET_ECU_IP {192, 168, 1, 10}   // The ECU's IP address, set by Initial()
+#define NET_GUI_IP {192, 168, 1, 100}  // Address of the laptop running the GUI, which the telemetry is sent to
+
+//! Handler of a bound UDP port, called from netPoll() with the sender and the data of each datagram
+typedef void (*udp_handler_t)(const uint8_t *ip, uint16_t port, const uint8_t *data, uint16_t len);
+
+//! One resolved address in the ARP cache
+struct arp_entry {
+	uint8_t ip[4];
+	uint8_t mac[6];
+	uint8_t valid;
+};
+
+//! A bound UDP port
+struct udp_socket {
+	uint16_t port;                     // 0 if the socket is free
+	udp_handler_t handler;
+};
+
+//! What netPoll() has done with the frames it read
+struct net_stats {
+	uint16_t frames;                   // Frames read from the driver
+	uint16_t arp;                      // ARP requests and replies taken in
+	uint16_t datagrams;                // UDP datagrams handed to a handler
+	uint16_t dropped;                  // Frames which were malformed, corrupted, not for us, or for a port nobody bound
+	uint16_t arpMisses;                // udpSend() calls refused while the address was being resolved
+	uint16_t linkDown;                 // udpSend() calls refused while the Ethernet link was down
+};
+
+//////////////////////////////////////////////////////////////////////////
+///////////////////////////  Functions  //////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+void netInit(const uint8_t *ip);
+uint8_t udpBind(uint16_t port, udp_handler_t handler);
+uint8_t udpSend(const uint8_t *ip, uint16_t srcPort, uint16_t dstPort, const uint8_t *data, uint16_t len);
+void netPoll(void);
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////// Global Variables  ///////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+//! The ECU's IP address
+uint8_t netIp[4];
+
+//! Addresses resolved so far
+struct arp_entry arpCache[NET_ARP_ENTRIES];
+
+//! Entry of arpCache which is replaced next
+uint8_t arpNext;
+
+//! Bound UDP ports
+struct udp_socket udpSockets[NET_SOCKETS];
+
+//! Identification of the next IPv4 datagram sent
+uint16_t ipIdent;
+
+//! The frame netPoll() is working on, with room for the null terminator readBuffer adds
+uint8_t netFrame[MAX_FRAMELEN + 1];
+
+//! Headers of the datagram being sent
+uint8_t netHeaders[NET_HEADERS];
+
+//! Counts of what netPoll() has done, cleared by netInit()
+struct net_stats netStats;
+
+#endif /* NETWORK_H_ */
@@ -0,0 +1,103 @@
+/** @file Sampler.c
+ *  @author Nick Moore
+ *  @date October 15, 2026
+ *  @brief Free running ADC sampler, see Sampler.h
+ *
+ *  @bug No known bugs
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "Sampler.h"
+#include "Battery.h"
+
+/** @brief Starts the ADC converting every channel in turn without stopping
+ *
+ *  This performs the following functions:
+ *
+ *  1) Clears the samples of every channel
+ *  2) Selects the AVCC reference and channel 0
+ *  3) Enables the ADC in free running mode with its interrupt, at a division factor of 128 to keep the input
+ *     clock between 50kHz and 200kHz, and starts the first conversion
+ *
+ *  @param void
+ *  @return void
+ */
+void adcInit(void)
+{
+	for (uint8_t i = 0; i < ADC_CHANNELS; i++){
+		adcChannels[i].acc = 0;
+		adcChannels[i].count = 0;
+		adcChannels[i].head = 0;
+		adcChannels[i].primed = 0;
+		adcChannels[i].total = 0;
+	}
+	adcConverting = 0;
+	adcNext = 0;                       // ADMUX only moves on once the first result is in
+	adcSamples = 0;
+
+	ADMUX = (1 << REFS0);
+	ADCSRB = 0;                        // free running
+	ADCSRA = (1 << ADEN) | (1 << ADSC) | (1 << ADATE) | (1 << ADIE) | (1 << ADPS0) | (1 << ADPS1) | (1 << ADPS2);
+}
+
+/** @brief Gets the filtered reading of a channel
+ *
+ *  @param[in] channel The channel, below ADC_CHANNELS
+ *  @return uint16_t The input voltage in mV, 0 until the first ADC_OVERSAMPLE samples of it are in
+ */
+uint16_t adcMillivolts(uint8_t channel)
+{
+	uint8_t sreg = SREG;
+	cli();
+	uint32_t total = adcChannels[channel].total;
+	SREG = sreg;
+	return adcScale(total);
+}
+
+/** @brief ISR for the ADC, which takes in each conversion as it finishes
+ *
+ *  This performs the following functions:
+ *
+ *  1) Adds the result to the accumulator of the channel it belongs to
+ *  2) Moves ADMUX on to the next channel, for the conversion after the one which has just started
+ *  3) Every ADC_OVERSAMPLE samples, replaces the oldest decimated sample of the channel with the sum
+ *  4) Once the last channel has a new reading, updates the state of the battery
+ *
+ *  @param void
+ *  @return void
+ */
+ISR(ADC_vect)
+{
+	uint8_t channel = adcConverting;
+	volatile struct adc_channel *c = &adcChannels[channel];
+	uint16_t sample = ADC;
+
+	adcConverting = adcNext;
+	if (++adcNext == ADC_CHANNELS)
+		adcNext = 0;
+	ADMUX = (ADMUX & 0xE0) | adcNext;
+	adcSamples++;
+
+	c->acc += sample;
+	if (++c->count < ADC_OVERSAMPLE)
+		return;
+	uint16_t sum = c->acc;
+	c->acc = 0;
+	c->count = 0;
+	if (!c->primed){
+		for (uint8_t i = 0; i < ADC_RING; i++){
+			c->ring[i] = sum;          // so the first reading is not dragged down by an empty ring
+		}
+		c->total = (uint32_t) sum << ADC_RING_BITS;
+		c->primed = 1;
+	}
+	else{
+		c->total += sum;
+		c->total -= c->ring[c->head];
+		c->ring[c->head] = sum;
+		c->head = (c->head + 1) & (ADC_RING - 1);
+	}
+	if (channel == ADC_CHANNELS - 1)
+		batUpdate();
+}
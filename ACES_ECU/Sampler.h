@@ -0,0 +1,77 @@
+/** @file Sampler.h
+ *  @author Nick Moore
+ *  @date October 15, 2026
+ *  @brief Free running ADC sampler which oversamples and filters every analog channel of the ECU from ADC_vect
+ *
+ *  The ADC converts without stopping, one channel after the other.  ADC_vect adds each sample into its
+ *  channel's accumulator, and every ADC_OVERSAMPLE samples the sum goes into the channel's ring of the last
+ *  ADC_RING sums as one decimated sample.  The ring keeps a running total, so a filtered reading is always
+ *  ready.  Oversampling by 4^n gives n more bits as long as there is at least an LSB of noise on the input,
+ *  and the ring averages over ADC_RING decimated samples on top of that.
+ *
+ *  adcMillivolts() turns a channel's total into millivolts with one multiply and a shift, so the main loop
+ *  gets a filtered reading in constant time without waiting on the ADC or doing any float math.
+ *
+ *  In free running mode the next conversion has started by the time ADC_vect runs, so a new ADMUX only
+ *  applies to the one after it.  ADC_vect keeps track of which channel each result belongs to.  Each time
+ *  the last channel has a new reading, so every channel has, it calls batUpdate() (see Battery.h).
+ *
+ *  @bug No known bugs
+ */
+
+#include <stdint.h>
+
+#ifndef SAMPLER_H_
+#define SAMPLER_H_
+
+///////////////////////////////////////////////////////////////////////////
+///////////////////////// Configuration ///////////////////////////////////
+///////////////////////////////////////////////////////////////////////////
+#define ADC_CHANNELS 3                 // ADC0 to ADC2, each through a 1:3 divider
+#define ADC_PACK 0                     // Channel of the whole LiPo pack
+#define ADC_OVERSAMPLE_BITS 2          // Extra bits from oversampling, 1 to 2 for 4x to 16x
+#define ADC_RING_BITS 3                // log2 of the decimated samples averaged per reading
+#define ADC_FULL_SCALE_MV 14880        // Input at a full scale conversion, 3 x the 4.96 V reference
+
+#define ADC_OVERSAMPLE (1 << (2 * ADC_OVERSAMPLE_BITS))   // Samples summed into one decimated sample
+#define ADC_RING (1 << ADC_RING_BITS)
+#define ADC_TOTAL_BITS (10 + 2 * ADC_OVERSAMPLE_BITS + ADC_RING_BITS)   // Bits of a full scale ring total
+#define ADC_CONVERSION_CYCLES (13 * 128)                  // CPU cycles a conversion takes at the division factor of 128
+#define ADC_READING_CYCLES (ADC_CONVERSION_CYCLES * ADC_CHANNELS * ADC_OVERSAMPLE)   // CPU cycles between readings of a channel
+
+//! Turns the ring total of a channel into its input voltage in mV, rounded
+#define adcScale(total) ((uint16_t) (((uint32_t) (total) * ADC_FULL_SCALE_MV + (1UL << (ADC_TOTAL_BITS - 1))) >> ADC_TOTAL_BITS))
+
+//! Samples of one channel
+struct adc_channel {
+	uint16_t acc;                      // Sum of the samples so far toward the next decimated sample
+	uint8_t count;                     // Samples in acc
+	uint8_t head;                      // Oldest decimated sample in ring, replaced next
+	uint8_t primed;                    // Set once ring has been filled with the first decimated sample
+	uint16_t ring[ADC_RING];           // Last ADC_RING decimated samples
+	uint32_t total;                    // Sum of ring
+};
+
+//////////////////////////////////////////////////////////////////////////
+///////////////////////////  Functions  //////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+void adcInit(void);
+uint16_t adcMillivolts(uint8_t channel);
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////// Global Variables  ///////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+//! Samples of every channel, written by ADC_vect
+volatile struct adc_channel adcChannels[ADC_CHANNELS];
+
+//! Channel of the conversion in progress
+volatile uint8_t adcConverting;
+
+//! Channel in ADMUX, which the conversion after the one in progress will use
+volatile uint8_t adcNext;
+
+//! Number of conversions ADC_vect has taken in
+volatile uint32_t adcSamples;
+
+#endif /* SAMPLER_H_ */
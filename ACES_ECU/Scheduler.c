@@ -0,0 +1,166 @@
+/** @file Scheduler.c
+ *  @author Nick Moore
+ *  @date October 15, 2026
+ *  @brief Cooperative time triggered scheduler which runs the ECU main loop
+ *
+ *  @bug No known bugs
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "ECU_funcs.h"
+#include "Network.h"
+#include "Scheduler.h"
+
+/** @brief Talks to the ESB, sending the connection string until it has answered and the status message after that
+ *
+ *  @param void
+ *  @return void
+ */
+static void ESBtask(void)
+{
+	if (!connected_ESB){
+		ESB_Connect();
+	}
+	else{
+		packageMessage();
+		sendToESB(LINK_ECU_DATA, ESBtransmit, LINK_ECU_DATA_LEN);     // Send the flow data to the ESB
+	}
+}
+
+/** @brief Publishes a telemetry frame for the GUI, skipping the first period after the GUI connects
+ *
+ *  The frame is sent to the GUI as a UDP datagram, and over the serial link instead whenever udpSend()
+ *  refuses it, as it does at once while the Ethernet link is down.  The frames the ENC28J60 has received
+ *  are taken in first, so the GUI's ARP replies and requests are answered every period.
+ *
+ *  @param void
+ *  @return void
+ */
+static void GUItask(void)
+{
+	static const uint8_t GUIip[4] = NET_GUI_IP;
+	netPoll();
+	if (doTransmit < 1){
+		doTransmit++;
+	}
+	if (connected_GUI && doTransmit == 1){
+		const char *frame = packLaptopFrame();
+		if (!udpSend(GUIip, NET_GUI_PORT, NET_GUI_PORT, (const uint8_t *) frame, GUI_FRAME_LEN))
+			publishToLaptop();         // the serial link until the datagrams go out again
+	}
+}
+
+/** @brief Fills in one entry of the task table
+ *
+ *  @param[in] index The TASK_ number of the task
+ *  @param[in] run The task itself
+ *  @param[in] period Ticks between releases
+ *  @param[in] offset Ticks from now until the first release
+ *  @param[in] deadline Ticks after each release by which the task must have finished
+ *  @return void
+ */
+static void addTask(uint8_t index, void (*run)(void), uint16_t period, uint16_t offset, uint16_t deadline)
+{
+	struct task *t = &tasks[index];
+	t->run = run;
+	t->period = period;
+	t->deadline = deadline;
+	t->release = schedTicks + offset;
+	t->runs = 0;
+	t->misses = 0;
+	t->skipped = 0;
+	t->worstLate = 0;
+	t->worstRun = 0;
+	t->totalRun = 0;
+}
+
+/** @brief Sets the rate of every task and clears their run time accounting
+ *
+ *  The 250 ms tasks sit on ticks 1-3 of every 10 so that they never share a tick with the 10 ms tasks.
+ *  The temperature is read ahead of the GUI frame, which carries it.
+ *
+ *  @param void
+ *  @return void
+ */
+void schedInit(void)
+{
+	cli();
+	addTask(TASK_BATTERY, batVoltage, 10, 0, 2);
+	addTask(TASK_FLOW, measureFlow, 10, 5, 2);
+	addTask(TASK_TEMP, readTempSensor, 250, 1, 5);
+	addTask(TASK_ESB, ESBtask, 250, 2, 5);
+	addTask(TASK_GUI, GUItask, 250, 3, 5);
+	sei();
+}
+
+/** @brief Runs the highest priority task which is due
+ *
+ *  This performs the following functions:
+ *  1) Finds the first task in the table whose release tick has come
+ *  2) Moves its release along by one period, dropping any releases it has fallen a whole period behind on
+ *  3) Runs it and records how late it started, how long it took, and whether it made its deadline
+ *
+ *  Only one task is run per call, so a task which becomes due while another is running is picked up in
+ *  priority order by the next call.
+ *
+ *  @param void
+ *  @return uint8_t 1 if a task was run, 0 if nothing was due
+ */
+uint8_t schedule(void)
+{
+	cli();
+	uint16_t now = schedTicks;
+	uint32_t tickStamp = schedTickStamp;
+	sei();
+
+	for (uint8_t i = 0; i < sched_tasks; i++){
+		struct task *t = &tasks[i];
+		uint16_t behind = now - t->release;
+		if (behind & 0x8000){
+			continue;                // not released yet
+		}
+
+		t->release += t->period;
+		while (!((uint16_t) (now - t->release) & 0x8000)){
+			t->release += t->period;
+			t->skipped++;
+		}
+
+		cli();
+		uint32_t start = flowClock();
+		sei();
+		t->run();
+		cli();
+		uint32_t end = flowClock();
+		sei();
+
+		uint32_t late = start - tickStamp + (uint32_t) behind * sched_tick;
+		uint32_t run = end - start;
+		if (late > t->worstLate){
+			t->worstLate = (late > 0xFFFF) ? 0xFFFF : late;
+		}
+		if (run > t->worstRun){
+			t->worstRun = (run > 0xFFFF) ? 0xFFFF : run;
+		}
+		t->totalRun += run;
+		t->runs++;
+		if (late + run > (uint32_t) t->deadline * sched_tick){
+			t->misses++;
+		}
+		return 1;
+	}
+	return 0;
+}
+
+/** @brief Interrupt Service Routine which advances the scheduler by one tick every sched_tick
+ *
+ *  @param void
+ *  @return void
+ */
+ISR(TIMER3_COMPA_vect)
+{
+	OCR3A += sched_tick;       // Timer 3 runs free, so the next compare point is just moved along
+	schedTickStamp += sched_tick;
+	schedTicks++;
+}
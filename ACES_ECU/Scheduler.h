@@ -0,0 +1,62 @@
+/** @file Scheduler.h
+ *  @author Nick Moore
+ *  @date October 15, 2026
+ *  @brief Task table and run time accounting for the cooperative scheduler which runs the ECU main loop
+ *
+ *  Timer 3 compare A ticks every sched_tick (1 ms).  Each task is released every period ticks, starting
+ *  offset ticks after schedInit(), so tasks with the same period can be kept off of each other's ticks.
+ *  Tasks run to completion in the order of the table below whenever more than one is due.
+ *
+ *  @bug No known bugs
+ */
+
+#include <stdint.h>
+#include "ECU_funcs.h"
+
+#ifndef SCHEDULER_H_
+#define SCHEDULER_H_
+
+///////////////////////////////////////////////////////////////////////////
+//////////////////////// Task Numbers /////////////////////////////////////
+///////////////////////////////////////////////////////////////////////////
+#define TASK_BATTERY 0        // Battery voltage sampling
+#define TASK_FLOW 1           // Fuel flow calculation
+#define TASK_TEMP 2           // ECU temperature sensor
+#define TASK_ESB 3            // Status message to the ESB, or the connection string until it answers
+#define TASK_GUI 4            // Telemetry frame to the GUI
+#define sched_tasks 5         // Number of tasks, which is also their priority order
+
+//! One entry of the task table
+struct task {
+	void (*run)(void);        // The task itself, which must not wait on anything for long
+	uint16_t period;          // Ticks between releases
+	uint16_t deadline;        // Ticks after its release by which the task must have finished
+	uint16_t release;         // Tick of the next release
+	uint16_t runs;            // Number of times the task has run
+	uint16_t misses;          // Number of runs which finished after the deadline
+	uint16_t skipped;         // Number of releases which were dropped because the task was a whole period behind
+	uint16_t worstLate;       // Longest time from release to start, in Timer 3 ticks (4 us)
+	uint16_t worstRun;        // Longest run time, in Timer 3 ticks
+	uint32_t totalRun;        // Sum of the run times, in Timer 3 ticks
+};
+
+//////////////////////////////////////////////////////////////////////////
+///////////////////////////  Functions  //////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+void schedInit(void);
+uint8_t schedule(void);
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////// Global Variables  ///////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+//! The task table, indexed by the TASK_ numbers
+struct task tasks[sched_tasks];
+
+//! Number of scheduler ticks since Initial, counted by the Timer 3 compare A interrupt
+volatile uint16_t schedTicks;
+
+//! Timestamp of the latest scheduler tick, see flowClock
+volatile uint32_t schedTickStamp;
+
+#endif /* SCHEDULER_H_ */
@@ -0,0 +1,187 @@
+/** @file TWI.c
+ *  @author Nick Moore
+ *  @date October 15, 2026
+ *  @brief Interrupt driven TWI master, see TWI.h
+ *
+ *  @bug No known bugs
+ */
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/twi.h>
+#include "ECU_funcs.h"
+#include "Scheduler.h"
+#include "TWI.h"
+
+//! TWCR to go on with the transfer: clears TWINT and keeps the TWI and its interrupt enabled
+#define TWI_GO ((1 << TWINT) | (1 << TWEN) | (1 << TWIE))
+
+/** @brief Puts the transfer at twiTail on the bus
+ *
+ *  @param[in] stop 1 to send a STOP first, as the bus is still held after the last transfer
+ *  @return void
+ */
+static void twiStart(uint8_t stop)
+{
+	struct twi_transfer *t = twiQueued[twiTail & (TWI_QUEUE_LEN - 1)];
+	t->state = TWI_BUSY;
+	t->tries = 0;
+	twiIndex = 0;
+	twiReading = 0;
+	twiStarted = schedTicks;
+	TWCR = TWI_GO | (1 << TWSTA) | (stop << TWSTO);
+}
+
+/** @brief Ends the transfer on the bus and starts the next one, or sends a STOP and lets the bus go idle
+ *
+ *  @param[in] state The state the transfer ends in
+ *  @param[in] stop 1 to send a STOP, 0 when the TWI was reset and already let go of the bus
+ *  @return void
+ */
+static void twiFinish(uint8_t state, uint8_t stop)
+{
+	struct twi_transfer *t = twiQueued[twiTail & (TWI_QUEUE_LEN - 1)];
+	twiTail++;
+	t->state = state;
+	if (t->done)
+		t->done(t);
+	if (t->state == TWI_QUEUED){
+		twiQueued[twiHead & (TWI_QUEUE_LEN - 1)] = t;     // sent again by its callback, into the slot it just left
+		twiHead++;
+	}
+	if (twiHead != twiTail)
+		twiStart(stop);
+	else
+		TWCR = (stop << TWINT) | (stop << TWSTO) | (1 << TWEN);   // interrupt off, the bus is idle
+}
+
+/** @brief Starts the transfer on the bus over again, or gives up on it once it has had TWI_RETRIES goes
+ *
+ *  @param void
+ *  @return void
+ */
+static void twiRetry(void)
+{
+	struct twi_transfer *t = twiQueued[twiTail & (TWI_QUEUE_LEN - 1)];
+	if (t->tries >= TWI_RETRIES){
+		twiFinish(TWI_NACK, 1);
+		return;
+	}
+	t->tries++;
+	twiRetries++;
+	twiIndex = 0;
+	twiReading = 0;
+	TWCR = TWI_GO | (1 << TWSTA) | (1 << TWSTO);        // STOP, then START again
+}
+
+/** @brief Queues a transfer, and puts it on the bus straight away if the bus is idle
+ *
+ *  @param[in,out] t The transfer, which must stay in place until it has ended
+ *  @return uint8_t 1 if it was queued, 0 if it is already queued or on the bus, or the queue is full
+ */
+uint8_t twiQueue(struct twi_transfer *t)
+{
+	twiPoll();
+	if (t->state == TWI_QUEUED || t->state == TWI_BUSY)
+		return 0;
+
+	uint8_t sreg = SREG;
+	cli();
+	if ((uint8_t) (twiHead - twiTail) == TWI_QUEUE_LEN){
+		SREG = sreg;
+		return 0;
+	}
+	t->state = TWI_QUEUED;
+	twiQueued[twiHead & (TWI_QUEUE_LEN - 1)] = t;
+	twiHead++;
+	if ((uint8_t) (twiHead - twiTail) == 1)
+		twiStart(0);                   // the bus was idle
+	SREG = sreg;
+	return 1;
+}
+
+/** @brief Gives up on the transfer on the bus if it has taken longer than TWI_TIMEOUT
+ *
+ *  Turning the TWI off lets go of both lines and throws away whatever it was part way through, which is
+ *  the only way out if a device holds the clock low.  Called by twiQueue(), so a sensor task which queues
+ *  its reads every period never needs to call it itself.
+ *
+ *  @param void
+ *  @return void
+ */
+void twiPoll(void)
+{
+	uint8_t sreg = SREG;
+	cli();
+	if (twiHead != twiTail && (uint16_t) (schedTicks - twiStarted) > TWI_TIMEOUT){
+		TWCR = 0;
+		TWCR = (1 << TWEN);
+		twiTimeouts++;
+		twiFinish(TWI_STUCK, 0);
+	}
+	SREG = sreg;
+}
+
+/** @brief ISR for the TWI, which moves the transfer on the bus along one step each time the last one is done
+ *
+ *  This performs the following functions:
+ *  1) After a START, addresses the device to write the register pointer, or to read if there is nothing to write
+ *  2) Writes the bytes to write one at a time, then sends a repeated START to read, or ends the transfer
+ *  3) Reads the bytes back, ACKing all but the last, and ends the transfer after it
+ *  4) Starts the transfer over again after a NACK, lost arbitration or bus error
+ *
+ *  @param void
+ *  @return void
+ */
+ISR(TWI_vect)
+{
+	if (twiHead == twiTail){
+		TWCR = (1 << TWINT) | (1 << TWEN);        // nothing on the bus, so only let go of the flag
+		return;
+	}
+	struct twi_transfer *t = twiQueued[twiTail & (TWI_QUEUE_LEN - 1)];
+
+	switch (TW_STATUS){
+		case TW_START:
+		case TW_REP_START:
+			if ((t->wlen || !t->rlen) && !twiReading)
+				TWDR = t->address << 1;       // a transfer with nothing to read or write only checks the device is there
+			else{
+				TWDR = (t->address << 1) | 0x01;
+				twiReading = 1;
+			}
+			TWCR = TWI_GO;
+			break;
+		case TW_MT_SLA_ACK:
+		case TW_MT_DATA_ACK:
+			if (twiIndex < t->wlen){
+				TWDR = t->wdata[twiIndex++];
+				TWCR = TWI_GO;
+			}
+			else if (t->rlen){
+				twiIndex = 0;
+				twiReading = 1;
+				TWCR = TWI_GO | (1 << TWSTA);     // repeated START to read
+			}
+			else
+				twiFinish(TWI_DONE, 1);
+			break;
+		case TW_MR_DATA_ACK:
+			t->rdata[twiIndex++] = TWDR;
+			// fall through to ask for the next byte
+		case TW_MR_SLA_ACK:
+			if (twiIndex + 1 < t->rlen)
+				TWCR = TWI_GO | (1 << TWEA);
+			else
+				TWCR = TWI_GO;                    // NACK the last byte
+			break;
+		case TW_MR_DATA_NACK:
+			t->rdata[twiIndex++] = TWDR;
+			twiFinish(TWI_DONE, 1);
+			break;
+		case TW_MT_ARB_LOST:           // the same code as TW_MR_ARB_LOST
+		default:                               // NACKs and bus errors
+			twiRetry();
+			break;
+	}
+}
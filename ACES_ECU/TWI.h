@@ -0,0 +1,89 @@
+/** @file TWI.h
+ *  @author Nick Moore
+ *  @date October 15, 2026
+ *  @brief Interrupt driven TWI (I2C) master which runs a queue of transfers, for the temperature sensors
+ *
+ *  A transfer writes wlen bytes to a device and then, if rlen is not 0, reads rlen bytes back after a
+ *  repeated START, which is the register pointer write and read every sensor register takes.  Transfers are
+ *  owned by the caller and queued by pointer, so nothing is copied.  They are run one after the other by
+ *  TWI_vect, which calls the callback of each as it finishes, so queueing one is all the main loop pays for.
+ *  A callback can change the transfer, to the next device say, and set its state back to TWI_QUEUED to have
+ *  it go again at the back of the queue, so a whole series of reads costs the main loop a single twiQueue().
+ *
+ *  A NACK, lost arbitration or bus error starts the transfer again, at most TWI_RETRIES times, after which
+ *  it ends with TWI_NACK.  A transfer still on the bus TWI_TIMEOUT scheduler ticks after it started, as when
+ *  a sensor holds the clock low, is ended with TWI_STUCK by twiPoll(), which resets the TWI to let go of the
+ *  bus and moves on to the next one.  Either way no device can hang the ECU.
+ *
+ *  @bug No known bugs
+ */
+
+#include <stdint.h>
+
+#ifndef TWI_H_
+#define TWI_H_
+
+///////////////////////////////////////////////////////////////////////////
+///////////////////////// Configuration ///////////////////////////////////
+///////////////////////////////////////////////////////////////////////////
+#define TWI_QUEUE_LEN 8                // Transfers which can wait for the bus at once, must be a power of 2
+#define TWI_RETRIES 3                  // Times a transfer is started again before it is given up on
+#define TWI_TIMEOUT 5                  // Scheduler ticks (ms) a transfer can take, retries included
+
+///////////////////////////////////////////////////////////////////////////
+///////////////////////// Transfer States /////////////////////////////////
+///////////////////////////////////////////////////////////////////////////
+#define TWI_IDLE 0                     // Never queued
+#define TWI_QUEUED 1                   // Waiting for the bus
+#define TWI_BUSY 2                     // On the bus
+#define TWI_DONE 3                     // Finished, rdata holds what was read
+#define TWI_NACK 4                     // The device did not answer, or the bus failed, TWI_RETRIES + 1 times
+#define TWI_STUCK 5                    // Timed out and the bus was reset
+
+//! One transfer, see the top of this file
+struct twi_transfer {
+	uint8_t address;                   // 7 bit address of the device
+	const uint8_t *wdata;              // Bytes written first, usually the register pointer
+	uint8_t wlen;
+	uint8_t *rdata;                    // Where the bytes read back go
+	uint8_t rlen;
+	void (*done)(struct twi_transfer *t);   // Called from TWI_vect, or twiPoll() on a timeout, when it ends.  May be 0
+	volatile uint8_t state;            // One of the transfer states above
+	uint8_t tries;                     // Times it has been started again
+};
+
+//////////////////////////////////////////////////////////////////////////
+///////////////////////////  Functions  //////////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+uint8_t twiQueue(struct twi_transfer *t);
+void twiPoll(void);
+
+//////////////////////////////////////////////////////////////////////////
+//////////////////////// Global Variables  ///////////////////////////////
+//////////////////////////////////////////////////////////////////////////
+
+//! Transfers waiting for the bus, the one at twiTail is the one on it
+struct twi_transfer *twiQueued[TWI_QUEUE_LEN];
+
+//! Number of transfers queued, only changed by twiQueue, and by TWI_vect and twiPoll when a callback queues one again
+volatile uint8_t twiHead;
+
+//! Number of transfers finished, only changed by TWI_vect and twiPoll
+volatile uint8_t twiTail;
+
+//! Next byte of the transfer on the bus to write or read
+uint8_t twiIndex;
+
+//! Set once the transfer on the bus has moved on to reading
+uint8_t twiReading;
+
+//! Scheduler tick the transfer on the bus started on, for the timeout
+uint16_t twiStarted;
+
+//! Number of times a transfer was started again after a NACK, lost arbitration or bus error
+volatile uint16_t twiRetries;
+
+//! Number of transfers which timed out, each of which reset the TWI
+volatile uint16_t twiTimeouts;
+
+#endif /* TWI_H_ */
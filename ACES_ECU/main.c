@@ -9,6 +9,7 @@
 
 #include <avr/io.h>
 #include "ECU_funcs.h"
+#include "Scheduler.h"
 
 int main(void)
 {
@@ -18,26 +19,7 @@ int main(void)
 	Initial();
 	while (1) 
     {
-		if (!connected_ESB){
-			ESB_Connect();
-		}
-
-		batVoltage();       // This is the battery voltage measurement function
-		measureFlow();      // This is the flow calculation function
-		readTempSensor();
-		massFlow.f += 0.05;
-		if (massFlow.f > 4.8) {
-			massFlow.f = 0;
-		}
-		
-		if (connected_ESB){
-			packageMessage();
-			sendToESB(normalData);           // Send the flow data to the ESB
-		}
-		if (connected_GUI && doTransmit == 1){
-			sendToLaptop();
-		}
-		
+		schedule();         // Runs whichever task is due, see Scheduler.c for the rate of each one
     }
 }
 
@@ -27,204 +27,154 @@ ISR(TIMER5_OVF_vect)   // This means that it has been too long since data has be
 
 /** @brief Packages the message to later be sent to the ECU
  *
- *	This function loads the message into the array and then calculates the corresponding parity bytes to append 
- *	to the end of the array.
+ *	This function loads the payload of the LINK_ESB_DATA frame into ECUtransmit.  sendToECU adds the
+ *	framing and CRC.
  *
  *  @param void
  *  @return void
  */
 void package_message(void)
 {
-	hallEffect = 34567;
-	EGT = 12345;
 	glowPlug = 1;
 	ref_temp = 23456;
 	
 	ECUtransmit[0] = opMode;
-	memcpy(ECUtransmit + 1, &hallEffect, sizeof(uint16_t));
-	memcpy(ECUtransmit + 3, &EGT, sizeof(float));
+	cli();
+	uint16_t rpm = hallEffect;
+	uint16_t egt = EGT;
+	sei();
+	float egtC = (float) egt / (1 << egt_frac);   // the ECU takes the EGT as a float
+	memcpy(ECUtransmit + 1, &rpm, sizeof(uint16_t));
+	memcpy(ECUtransmit + 3, &egtC, sizeof(float));
 	memcpy(ECUtransmit + 7, &glowPlug, sizeof(uint8_t));
 	memcpy(ECUtransmit + 8, &ref_temp, sizeof(float));
-	ECUtransmit[12] = calculateParity(ECUtransmit, 0);
-	ECUtransmit[13] = calculateParity(ECUtransmit, 6);
 	
 	hallDone = 0;                          // reset this we have already used the new data
 }
 
-/** @brief ISR for the reception of data from the ECU
+/** @brief Acts on a frame received from the ECU
  *
- *  @param void
+ *  Commands are acknowledged with a LINK_ACK frame carrying the command's type.  Every good frame from a
+ *  connected ECU restarts the Timer 5 connection watchdog.
+ *
+ *  @param[in] frame The frame, which has already passed its CRC
  *  @return void
  */
-ISR(USART0_RX_vect)
+static void ECUframe(const struct link_frame *frame)
 {
-	uint8_t data = UDR0;
-	hasInterrupted = 1;            // set this flag so other functions will know if they have been interrupted
-	if (!commandCode)
-	{
-		
-		if (data == 'S' && connected){          // Handles if the ECU wants a shutdown
-			//shutdown();
-			ECUtransmit[0] = 'K';
-			sendToECU(1);
-		}
-		else if (data == 'r' && connected){     // Handles if the ECU wants an engine startup
-			startup();
-			ECUtransmit[0] = 'K';
-			sendToECU(1);
-		}
-		else if (data == 't' && connected){     // Handles if the ECU wants a specific throttle
-			commandCode = 1;
+	if (frame->type == LINK_CONNECT){           // Handles if the ECU wants to connect with the ESB
+		if (!memcmp(frame->payload, "ACES", LINK_CONNECT_LEN)){
+			connected = 1;
+			opMode = 6;                // Indicate that the engine is sitting there doing nothing
+			sendToECU(LINK_WELCOME, "DALE", LINK_WELCOME_LEN);
+			OCR4A = TCNT4 + hall_phase;    // This will put the comm lines on off phases
+			TCNT5 = ECU_timer_val;
+			TCCR5B = (1 << CS52);    // This will start timer 5 with a prescalar of 256, makes 1 second timer
+			// This will set a maximum time limit until another message is received from the ECU before assuming a disconnect
 		}
-		else if (data == 'N' && connected){     // Handles if the ECU is sending the normal data
-			commandCode = 2;
-			ECUreceive[0] = data;
-			ECUreceiveCount = 1;
-			TCNT5 = ECU_timer_val;              // phew, made it before the timer overflow
+		else{
+			connected = 0;           // Handles extraneous cases, will assume that the devices have been disconnected
 		}
-		else if (data == 'A'){     // Handles if the ECU wants to connect with the ESB
-			commandCode = 3;
-		}	
+		return;
 	}
-	else if (commandCode == 1){
-		throttle_val = data;
-		ECUtransmit[0] = 'K';
-		sendToECU(1);
-		commandCode = 0;
+	if (!connected){
+		return;
 	}
-	else if (commandCode == 2){              // This means the ESB is receiving the normal data from the ECU
-		if (ECUreceiveCount < normalDataIn){
-			ECUreceive[ECUreceiveCount] = data;
-		}
-		ECUreceiveCount++;
-		if (ECUreceiveCount == normalDataIn){    // This means that the end of the message has been reached
-			ECUreceiveCount = 0;
-			commandCode = 0;
-			if (!checkParity()){   // If the result of this is 0 then it is false and the parity check has failed
-				opMode = 11;
-			}
-		}
-	}
-	else if (commandCode == 3){         // This means that the ECU is trying to connect with the ESB
-		ECUreceiveCount++;
-		switch (ECUreceiveCount)
-		{
-			case 1:
-				if (data != 'C'){                // Second letter of the connection string
-					commandCode = 0;
-					connected = 0;
-					ECUreceiveCount = 0;
-				}
-				break;
-				
-			case 2:
-				if (data != 'E'){              // Third letter of the connection string
-					commandCode = 0;
-					connected = 0;
-					ECUreceiveCount = 0;
-				}
-				break;
-				
-			case 3:
-				if (data == 'S'){              // Final letter of the connection string
-					connected = 1;
-					opMode = 6;                // Indicate that the engine is sitting there doing nothing
-					ECUtransmit[0] = 'D';
-					ECUtransmit[1] = 'A';
-					ECUtransmit[2] = 'L';
-					ECUtransmit[3] = 'E';
-					sendToECU(4);
-					TCNT4 = HallTime * 11;    // This will put the comm lines on off phases, the multiplier was found experimentally
-					TCCR5B = (1 << CS52);    // This will start timer 5 with a prescalar of 256, makes 1 second timer
-					// This will set a maximum time limit until another message is received from the ECU before assuming a disconnect
-					
-				}
-				else{
-					connected = 0;           // Handles extraneous cases, will assume that the devices have been disconnected
-				}
-				commandCode = 0;
-				ECUreceiveCount = 0;
-				break;
-		}
+	
+	TCNT5 = ECU_timer_val;              // phew, made it before the timer overflow
+	switch (frame->type){
+		case LINK_SHUTDOWN:             // Handles if the ECU wants a shutdown
+			//shutdown();
+			sendToECU(LINK_ACK, &frame->type, LINK_ACK_LEN);
+			break;
+		
+		case LINK_STARTUP:              // Handles if the ECU wants an engine startup
+			opMode = 2;                 // the main loop steps the startup sequence from here
+			sendToECU(LINK_ACK, &frame->type, LINK_ACK_LEN);
+			break;
+		
+		case LINK_THROTTLE:             // Handles if the ECU wants a specific throttle
+			throttle_val = frame->payload[0];
+			sendToECU(LINK_ACK, &frame->type, LINK_ACK_LEN);
+			break;
+		
+		case LINK_ECU_DATA:             // Handles if the ECU is sending the normal data
+			memcpy(ECUreceive, frame->payload, LINK_ECU_DATA_LEN);
+			break;
 	}
 }
 
-/** @brief Routine to send a number of bytes to the ECU over RS232
+/** @brief ISR for the reception of data from the ECU
+ *
+ *  Each byte is handed to the link receiver, which checks the CRC as the frame comes in and finds the start
+ *  of the next frame on its own after a bad one.
  *
- *  @param[in] len The number of bytes from ECUtransmit to send to the ECU
+ *  @param void
  *  @return void
  */
-void sendToECU(uint8_t len)
+ISR(USART0_RX_vect)
 {
-	// this will send the number of character in ESBmessage up to len
-	cli();
-	for(uint8_t i = 0; i < len; i++)
-	{
-		while ( !( UCSR0A & (1<<UDRE0)) );
-		/* Put data into buffer, sends the data */
-		UDR0 = ECUtransmit[i];
+	uint8_t data = UDR0;
+	hasInterrupted = 1;            // set this flag so other functions will know if they have been interrupted
+	linkPush(&ECUlink, data);
+	while (linkPoll(&ECUlink)){
+		ECUframe(&ECUlink.frame);
 	}
-	sei();
 }
 
-/** @brief Calculates the parity bytes for a set of 6 bytes.
+/** @brief Queues a frame for transmission to the ECU
  *
- *  @param[in] message Array of bytes which contains all the data to be sent to the ECU
- *	@param[in] start_index Starting index for the six bytes by which to calculate the parity byte
- *  @return uint8_t
- */
-uint8_t calculateParity(uint8_t message[], uint8_t start_index)
-{
-	// This will return the parity byte for a message made up of 6 sequential bytes, starting with start_index
-	uint8_t parity = 0;
-	
-	// first need to get the number of high bits in the first three bytes in the set
-	for (unsigned set = 0; set < 2; set++){
-		unsigned char count = 0;
-		for (unsigned char i = 0; i < 3; i++){
-			count += countOnes(message[start_index + set*3 + i]);
-		}
-		// now that I have the count for this set, I need to take the modulo
-		count = count % 16;   // Modulo with 16 because I have 4 bits to play with
-		
-		// now add this into the parity byte
-		parity |= count << (4 * set);   // this will make it so that bytes 0-2 will take up the LSB of the parity byte
-	}
-	// now copy this byte into memory
-	return parity;
-}
-
-/** @brief Counts the number of high bits in a given byte.
+ *  This performs the following functions:
+ *  
+ *  1) Builds the frame around the payload with the next sequence number and its CRC
+ *  2) Copies the frame into the transmit queue
+ *  3) Enables the USART0 data register empty interrupt, which sends the queue in the background
  *
- *  @param[in] byte The byte in question to perform the calculation on
- *  @return unsigned char
+ *  A frame which does not fit in the free space of the queue is dropped whole rather than sent in part, and
+ *  does not use up a sequence number.  This is also called from USART0_RX_vect to acknowledge commands, so
+ *  the interrupt flag is put back the way it was found rather than set.
+ *
+ *  @param[in] type One of the LINK_ frame types
+ *  @param[in] payload The payload of the frame
+ *  @param[in] len The length of the payload, which must be linkLength(type)
+ *  @return uint8_t 1 if the frame was queued, 0 if it was dropped
  */
-unsigned char countOnes(unsigned char byte)
+uint8_t sendToECU(uint8_t type, const void *payload, uint8_t len)
 {
-	unsigned char count = 0;
-	while (byte)
-	{
-		count += byte & 1;    // this was essentially lifted from geeksforgeeks.com
-		byte >>= 1;
+	uint8_t frame[LINK_FRAME_MAX];
+	uint8_t queued = 0;
+	uint8_t sreg = SREG;
+	cli();
+	uint8_t size = linkBuild(frame, type, ECUtxSeq, payload, len);
+	uint8_t head = ECUtxHead;
+	if (size <= ((ECUtxTail - head - 1) & (ECU_TX_SIZE - 1))){      // one slot is kept empty to tell full from empty
+		for (uint8_t i = 0; i < size; i++){
+			ECUtxQueue[head] = frame[i];
+			head = (head + 1) & (ECU_TX_SIZE - 1);
+		}
+		ECUtxHead = head;
+		ECUtxSeq++;
+		UCSR0B |= (1 << UDRIE0);     // start sending
+		queued = 1;
 	}
-	return count;
+	SREG = sreg;
+	return queued;
 }
 
-/** @brief  This function checks that the parity bytes sent by the ECU match what the 
- *			ESB generates.
+/** @brief Interrupt Service Routine which sends the next queued byte to the ECU
  *
+ *  When the queue is empty the interrupt disables itself until sendToECU queues another frame.
  *
- *  @param[in] void
- *  @return unsigned char
+ *  @param void
+ *  @return void
  */
-uint8_t checkParity(void)
+ISR(USART0_UDRE_vect)
 {
-	uint8_t result = 0;
-	uint8_t parity1 = calculateParity(ECUreceive, 0);
-	uint8_t parity2 = calculateParity(ECUreceive, 3);
-	
-	if (parity1 == ECUreceive[9] && parity2 == ECUreceive[10]){
-		result = 1;
+	if (ECUtxTail == ECUtxHead){
+		assign_bit(&UCSR0B, UDRIE0, 0);      // nothing left to send
 	}
-	return result;
-}
\ No newline at end of file
+	else{
+		UDR0 = ECUtxQueue[ECUtxTail];
+		ECUtxTail = (ECUtxTail + 1) & (ECU_TX_SIZE - 1);
+	}
+}
@@ -9,6 +9,7 @@
 #include <avr/io.h>
 #include <avr/interrupt.h>
 #include "ESB_funcs.h"
+#include "Ethernet.h"
 
 
 /** @brief Sets the specified bit to the specified value or does nothing if it already set to that.
@@ -32,100 +33,163 @@ void assign_bit(volatile uint8_t *sfr,uint8_t bit, uint8_t val)
 	}
 }
 
-/** @brief Collects the temperature from the Exhaust Gas Thermocouple and then packages/send data to the ECU
+/** @brief Starts a read of the Exhaust Gas Thermocouple, which SPI_STC_vect carries on with.  Called from TIMER4_COMPA_vect
+ *
+ *  The read is skipped, keeping the last EGT, while the MAX6675 may still be busy with the conversion it
+ *  started when the last read ended, since reading any sooner cuts the conversion short.  That only
+ *  happens when an ECU connection moves the sampling period.
+ *
+ *  The Ethernet receive interrupt is masked until the read ends so that the ENC28J60 is not selected while
+ *  the CJC has the bus, and ethLock() waits out a read on the bus before the main loop takes it.
  *
  *  @param[in] void
  *  @return void
  */
 void EGT_collect(void)
 {
-	// Now loop through 4 bytes for the receive message
-	uint8_t tempString[2];
-	SSACTIVE;       // drop the SS line for the CJC
-	for (int i = 0; i < 2; i++){
-		tempString[i] = SPI_Receive();
+	if ((SPCR & (1 << SPIE)) || hallClock() - tcStamp < tc_conversion){
+		tcSkipped++;
+		return;
 	}
-	SSPASSIVE;       // raise the SS line again since we are done
-	
-	// Now interpret this data string into an actual temperature
-
-	getTemp(tempString);
-			
-	// Now package the message
-	package_message();
+	tcInt = EIMSK & (1 << Ethernet_INT);
+	EIMSK &= ~(1 << Ethernet_INT);
+	tcIndex = 0;
+	SSACTIVE;       // drop the SS line for the CJC
+	(void) SPSR;    // along with the write of SPDR, clears SPIF if the ENC28J60 left it set
+	SPCR |= (1 << SPIE);
+	hal_spi_write(0);   // Since the CJC doesn't receive, we can put anything we want into the buffer
 }
 
-/** @brief Performs the operations needed to communicate with the CJC via SPI
+/** @brief ISR for the SPI, which takes in the bytes of the thermocouple read
+ *
+ *  This performs the following functions:
+ *  1) Stores the byte and starts the next one until all tc_bytes are in
+ *  2) Raises the SS line of the CJC, which starts its next conversion, and lets the Ethernet receive ISR back in
+ *  3) Converts the reading to EGT and shuts the engine down if it is too hot
  *
  *  @param[in] void
- *  @return uint8_t
+ *  @return void
  */
-uint8_t SPI_Receive( void )   // This is copied from the datasheet page 193
+ISR(SPI_STC_vect)
 {
-	cli();
-	/* Put data into buffer and start the transmission */
-	SPDR = 0;   // Since the CJC doesn't receive, we can put anything we want into the buffer
-	
-	/* Wait for data to be received */
-	while ( !(SPSR & (1<<SPIF)) );
-	
-	/* Enable interrupts again */
-	sei();
+	tcBytes[tcIndex++] = SPDR;
+	if (tcIndex < tc_bytes){
+		hal_spi_write(0);
+		return;
+	}
+	SPCR &= ~(1 << SPIE);             // the ENC28J60 is run by polling SPIF
+	SSPASSIVE;       // raise the SS line again since we are done
+	tcStamp = hallClock();
+	EIMSK |= tcInt;
 	
-	/* Get and return received data from buffer */
-	return SPDR;
+	getTemp(tcBytes);
+	if (EGT > egt_limit){             // if the engine is too hot, shut it down
+		shutdown();
+	}
 }
 
 /** @brief Converts the bytes received from the CJC into a usable temperature
+ *
+ *  The MAX6675 sends a dummy zero, 12 bits of temperature in quarter degrees, then the open thermocouple
+ *  flag, so the temperature is already EGT with egt_frac fraction bits.
  *
  *  @param[in] tempString Array of chars which contains all the data received by the CJC
  *  @return void
  */
-void getTemp(uint8_t *tempString)     // This is definitely Wrong but will fix it later
+void getTemp(const uint8_t *tempString)
 {
 	// First check to see if there is a fault
 	if (tempString[1] & 0x04)
 		EGT = 0;               // This means that the Thermocouple is open, check connection
 	else {                     // If it makes it to here then there are no faults
-		int val = (tempString[0] << 5) | (tempString[1] >> 3);
-		if (!val)
-			val = 1;   // set the value to this for anything that is less than 3
-		EGT = ((float) val / 4095.0) * 1023.75;        // Since the temperature is on the scale of 0->1023.75 and it has 12 bit resolution
-		ref_temp = 0;                                  // This is unimplemented at this time as the MAX6675 does not transmit the reference temperature
-		
+		uint16_t val = (((uint16_t) tempString[0] << 5) | (tempString[1] >> 3)) & 0x0FFF;
+		EGT = val ? val : 1;   // 0 is kept for an open thermocouple
 	}
 }
 
-/** @brief Increments the hall effect counter when a pulse is received
+/** @brief Reads Timer 4 extended to 32 bits by the count of its overflows
+ *
+ *  One tick is 4 us, so this wraps after about 4.8 hours.  Must be called with interrupts off.
+ *
+ *  @param[in] void
+ *  @return uint32_t The current timestamp
+ */
+uint32_t hallClock(void)
+{
+	uint16_t count = TCNT4;
+	uint16_t high = hallOverflows;
+	if ((TIFR4 & (1 << TOV4)) && count < 0x8000){
+		high++;                      // the timer has overflowed but TIMER4_OVF_vect has not run yet
+	}
+	return ((uint32_t) high << 16) | count;
+}
+
+/** @brief Timestamps each hall effect pulse and publishes a new RPM
+ *
+ *  This performs the following functions:
+ *  1) Measures the time spanned by the last hall_avg_depth pulse periods (fewer right after the engine starts
+ *     turning), which is the moving average of the period without having to sum anything
+ *  2) Converts that into RPM and publishes it in hallEffect
+ *  3) Shuts the engine down as soon as the RPM limit is passed rather than at the end of a sampling period
  *
  *  @param[in] void
  *  @return void
  */
 ISR(INT2_vect)
 {
-	hallCount++;
+	uint32_t now = hallClock();
+	uint32_t span = now - hallPulses[(hallIndex + hall_avg_depth - hallFill) % hall_avg_depth];
+	
+	if (hallFill && span){
+		uint32_t rpm = (60UL * hall_clock / hall_per_rev) * hallFill / span;
+		hallEffect = (rpm > 0xFFFF) ? 0xFFFF : rpm;
+		hallStamp = now;
+		hallUpdated = 1;
+		
+		if (rpm > rpm_limit){        // spinning too fast, shut it down
+			shutdown();
+		}
+	}
+	
+	hallPulses[hallIndex] = now;
+	hallIndex = (hallIndex + 1) % hall_avg_depth;
+	if (hallFill < hall_avg_depth){
+		hallFill++;
+	}
 }
 
-/** @brief Signals that the sampling time for the Hall effect sensor is over
+/** @brief Counts the overflows of the free running Timer 4
  *
  *  @param[in] void
  *  @return void
  */
 ISR(TIMER4_OVF_vect)
 {
-	hallEffect = hallCount * 120;  // this gets the number of pulses per 30 seconds
+	hallOverflows++;
+}
+
+/** @brief Signals that the 0.25 sec sampling period is over
+ *
+ *  This performs the following functions:
+ *  1) Starts a read of the EGT, which SPI_STC_vect finishes
+ *  2) Zeros the RPM if the hall effect sensor has gone quiet, since no pulse will come to do it
+ *
+ *  @param[in] void
+ *  @return void
+ */
+ISR(TIMER4_COMPA_vect)
+{
+	OCR4A += hall_window;                 // schedule the next sampling period
 	EGT_collect();
 	
-	if (hallEffect > 65000 || EGT > 700) { // if either the engine is too hot or spinning too fast, shut it down
-		shutdown();
+	uint32_t now = hallClock();
+	if (!hallFill || now - hallPulses[(hallIndex + hall_avg_depth - 1) % hall_avg_depth] > hall_timeout){
+		hallFill = 0;                     // the engine has stopped, start the average over with the next pulse
+		hallEffect = 0;
+		hallStamp = now;
+		hallUpdated = 1;
 	}
 	hallDone = 1;
-	hallCount = 0;                        // reset the hall effect counter
-	
-	// reload the new value into the timer register
-	TCNT4 = HallTime;
-
-	
 }
 
 /** @brief Sets all of the Initializations for the PWMs for the Fuel Pump, Solenoids, and Starter Motor
@@ -8,6 +8,8 @@
 
 #include <avr/sfr_defs.h>
 #include <float.h>
+#include "hal.h"
+#include "link.h"
 
 #ifndef ESB_FUNCS_H_
 #define ESB_FUNCS_H_
@@ -24,7 +26,8 @@
  *  OpMode 8: Engine is operating at the desired throttle, within the designated error tolerance
  *  OpMode 9: Fuel is not flowing when it should be flowing
  *  OpMode 10: Engine has reached idle
- *  OpMode 11: Messages sent from the ECU have failed the parity check
+ *  OpMode 11: No longer used, frames from the ECU which fail their CRC are dropped by the link receiver and a
+ *             lost connection is shut down by TIMER5_OVF_vect
  *  OpMode 12: Engine Temperature limit has been reached, shutting down
  *  OpMode 13: RPM limit has been reached, shutting down
 **/
@@ -39,13 +42,17 @@
 #define bit_is_clear(sfr,bit) \
 (!(_SFR_BYTE(sfr) & _BV(bit)))
 
-#define SSACTIVE assign_bit(&SPI_PORT, CJC_SS, 0)
-#define SSPASSIVE assign_bit(&SPI_PORT, CJC_SS, 1)  // These two defines will control the operation of the Slave Select line
+#define SSACTIVE hal_cs_low(SPI_PORT, CJC_SS)
+#define SSPASSIVE hal_cs_high(SPI_PORT, CJC_SS)  // These two defines will control the operation of the Slave Select line
 
 
 ///////////////////////////////////////////////////////////////////////////
 //////////////////////// Project Constants ////////////////////////////////
 ///////////////////////////////////////////////////////////////////////////
+#ifndef F_CPU
+#define F_CPU 16000000UL       // Clock frequency of the ATmega2561
+#endif
+
 #define K_factor 91387
 #define density 0.81
 #define pump_m 0.382587   // slope for the linear relationship between voltage and mf (put in mf, get volts)
@@ -58,12 +65,32 @@
 #define lube_factor 3     // this multiple of how much less fuel the lubrication solenoid will allow let pass when compared to the fuel solenoid
 #define sMotor 5.0        // this is the desired voltage on the starter motor for startup and cooling
 #define errorAllow 0.2    // this is the error allowed in g/s
+#define max_flow 4.8      // fuel flow in g/s at full throttle, only valid for the P90-RXI
+#define flow_frac 12      // fuel flows in throttle() are fixed point with this many fraction bits (1/4096 g/s)
+#define flow_pulses (K_factor * max_time / (density * 1000.0))   // flow meter pulses per 0.25 sec for each g/s of fuel flow
+#define volts_per_pulse (pump_m / flow_pulses)                    // fuel pump volts for each pulse of flow error
+#define throttle_flow ((uint16_t) (max_flow / 255.0 * (1L << 20) + 0.5))   // flow per count of throttle_val, 20 fraction bits
+#define flow_allow ((int32_t) (errorAllow * (1L << flow_frac)))       // errorAllow in fixed point
+#define pump_counts ((uint16_t) (flow_pulses * volts_per_pulse / pump_tot_V * (1L << 20) + 0.5))   // fraction of ICR3 per g/s of flow error, 20 fraction bits
 #define max_len 50        // This is the maximum number of bytes which will be read from the ECU
-#define allData 9
+#define allData LINK_ESB_DATA_LEN   // Length of the status message payload sent to the ECU
 #define ECU_timer_val 3036    // This is the reload value for the ECU connection timer
-#define HallTime 2760         // This was found experimentally to cause the space between the message to be exactly 0.25 sec (by logic analyzer)
+#define ECU_TX_SIZE 64        // Size of the transmit queue to the ECU, must be a power of 2
+#define hall_clock (F_CPU / 64)   // Rate of the free running Timer 4 (prescalar of 64), which timestamps the hall effect pulses
+#define hall_window (hall_clock / 4)   // Timer 4 ticks between the EGT samples and status messages to the ECU (0.25 sec)
+#define hall_phase 35176      // Ticks until the next window after an ECU connection (0.14 sec), the offset the experimentally found TCNT4 reload used to give
+#define hall_timeout (hall_clock / 2)   // The engine is taken to have stopped once no pulse has been seen for this many ticks (0.5 sec)
+#define hall_per_rev 2        // Hall effect pulses per revolution of the shaft
+#define hall_avg_depth 8      // Number of pulse periods averaged into each RPM value, 1 publishes every period unfiltered
+#define rpm_limit 65000       // The engine is shut down above this RPM
+#define fuel_steps 20         // Number of 5% steps the fuel solenoid is opened in during startup
+#define fuel_puff_time (hall_clock / 2)   // Timer 4 ticks each step of the fuel solenoid lasts (0.5 sec)
+#define heat_soak_time (15UL * hall_clock)   // Timer 4 ticks the engine is left to heat soak after ignition (15 sec)
 #define CJC_MSK 0x7           // This is the mask will will separate the MSB's of the temperature from the dummy sign bit, probably not needed
-#define normalDataIn 11         // This the length of a normal data message coming from the ECU
+#define egt_frac 2            // EGT is fixed point with this many fraction bits (1/4 C), the resolution of the MAX6675
+#define egt_limit (700 << egt_frac)   // The engine is shut down above this EGT
+#define tc_bytes 2            // Bytes in a read of the MAX6675
+#define tc_conversion (hall_clock / 1000 * 220)   // Timer 4 ticks a conversion of the MAX6675 can take (220 ms), a read any sooner cuts it short
 
 
 ///////////////////////////////////////////////////////////////////////////
@@ -79,6 +106,18 @@
 #define startPin 7
 #define pumpPin 4
 #define SPI_PORT PORTB
+#define Ethernet_SS 7          // Pin assignment in PORT D for the SS line of the ENC28J60, every pin on PORT B is taken
+#define Ethernet_PORT PORTD
+#define Ethernet_INT 6         // INT6 (PE6), driven low by the INT line of the ENC28J60
+
+///////////////////////////////////////////////////////////////////////////
+/////////////////////////// Startup Stages ////////////////////////////////
+///////////////////////////////////////////////////////////////////////////
+#define START_IDLE 0          // No startup in progress
+#define START_LOCKOUT 1       // Waiting for the engine to stop from the last run before starting again
+#define START_COMPRESSOR 2    // Spinning the compressor up to speed with the starter motor
+#define START_FUEL 3          // Opening the fuel solenoid a step at a time until ignition
+#define START_SOAK 4          // Letting the combustion chamber heat soak before reporting idle
 
 //////////////////////////////////////////////////////////////////////////
 ///////////////////////////  Functions  //////////////////////////////////
@@ -89,21 +128,19 @@ void assign_bit(volatile uint8_t *sfr,uint8_t bit, uint8_t val);
 void shutdown(void);
 void startup(void);
 void throttle(void);
+uint16_t flowToFixed(void);
 void EGT_collect(void);
-uint8_t SPI_Receive(void);
-void getTemp(uint8_t *tempString);
+void getTemp(const uint8_t *tempString);
 void package_message(void);
-void compressor(void);
-void fuel_puffs(void);
-void heatSoaking(void);
+uint8_t compressor(void);
+uint8_t fuel_puffs(void);
+uint8_t heatSoaking(void);
 void setPWM(void);
 void coolingMode(void);
-void sendToECU(uint8_t len);
+uint8_t sendToECU(uint8_t type, const void *payload, uint8_t len);
 void waitMS(uint16_t msec);
 void ECUconnect(void);
-uint8_t calculateParity(uint8_t message[], uint8_t start_index);
-uint8_t countOnes(uint8_t byte);
-uint8_t checkParity(void);
+uint32_t hallClock(void);
 
 
 
@@ -120,50 +157,103 @@ uint8_t opMode;
 //! Value 1-100 for the the user wants to set the throttle to
 uint8_t throttle_val;
 
-//! Flag which describes if the current hall effect sampling period has concluded
+//! Flag which describes if the current 0.25 sec sampling period has concluded
 uint8_t hallDone;
 
+//! Flag which is set every time a new value of hallEffect is published
+volatile uint8_t hallUpdated;
+
 //! Flag which determines if an engine startup will currently be prevented
-uint8_t startUpLockOut;
+volatile uint8_t startUpLockOut;
+
+//! Current stage of the startup sequence, one of the START_ stages
+uint8_t startState;
+
+//! Set when startState has just changed, so that the next step runs the set up for the new stage
+uint8_t startEntry;
+
+//! Number of steps the fuel solenoid has been opened by during startup
+uint8_t startStep;
+
+//! Timestamp the current startup stage measures its time from, in Timer 4 ticks
+uint32_t startTimer;
+
+//! RPM at the previous step of the compressor control law
+uint16_t startRPM;
+
+//! Rate of change of the RPM at the previous step of the compressor control law, in RPM per second
+float startSlope;
+
+//! Timestamps of the most recent hall effect pulses in Timer 4 ticks, used as a ring buffer
+uint32_t hallPulses[hall_avg_depth];
+
+//! Index in hallPulses which the next pulse will be stored at
+uint8_t hallIndex;
 
-//! The number of pulses recorded in the current sampling period
-uint16_t hallCount;
+//! Number of valid timestamps in hallPulses, reset when the engine stops
+uint8_t hallFill;
+
+//! Time at which hallEffect was last published, in Timer 4 ticks
+volatile uint32_t hallStamp;
+
+//! Number of times the free running Timer 4 has overflowed, the high word of the hall effect timestamps
+volatile uint16_t hallOverflows;
 
 //! Flag which describes whether the current data transmission has been interrupted by an ISR
 uint8_t hasInterrupted;
 
-//! Describes which type of information the ESB is receiving from the ECU, either normal data or a command
-uint8_t commandCode;
+//! Receiver for the frames coming from the ECU
+struct link_rx ECUlink;
 
-//! Counter to keep track of the current index in a message received from the ECU
-uint8_t ECUreceiveCount;
+//! Sequence number of the next frame sent to the ECU
+uint8_t ECUtxSeq;
 
-//! Flag for if the glow plug is on or off
-unsigned char glowPlug;
+//! Bytes waiting to be sent to the ECU by the USART0 data register empty interrupt
+uint8_t ECUtxQueue[ECU_TX_SIZE];
+
+//! Index in ECUtxQueue where the next byte will be queued, only written by sendToECU
+volatile uint8_t ECUtxHead;
 
-//! Value of the desired amount of fuel flow
-float desMFlow;
+//! Index in ECUtxQueue of the next byte to be sent, only written by the USART0 UDRE interrupt
+volatile uint8_t ECUtxTail;
 
-//! Value for how much voltage applied to the fuel pump corresponds to a single pulse from the flow meter
-float V_per_pulse;
+//! Flag for if the glow plug is on or off
+unsigned char glowPlug;
 
-//! The amount of pulses expected per each g/sec of fuel flow
-float pulse_flow;    
+//! Value of the desired amount of fuel flow, with flow_frac fraction bits
+uint16_t desFlow;
 
 //! Value of the current lipo battery voltage
 float bat_voltage;
 
-//! Array for the message to send to the ECU
-uint8_t ECUtransmit[14];
+//! Payload of the status message to send to the ECU
+uint8_t ECUtransmit[allData];
+
+//! Payload of the latest normal data message received from the ECU
+uint8_t ECUreceive[LINK_ECU_DATA_LEN];
+
+//! Current RPM recorded by the hall effect sensor, averaged over the last hall_avg_depth pulse periods.
+//! Written by INT2_vect and TIMER4_COMPA_vect, so the main loop reads it with interrupts off
+volatile uint16_t hallEffect;
+
+//! The current exhaust gas temperature with egt_frac fraction bits, 0 while the thermocouple is open.
+//! Written by SPI_STC_vect, so the main loop reads it with interrupts off
+volatile uint16_t EGT;
+
+//! Bytes of the thermocouple read on the SPI bus, filled in by SPI_STC_vect
+uint8_t tcBytes[tc_bytes];
+
+//! Number of bytes of the thermocouple read which are in
+uint8_t tcIndex;
 
-//! Array for the message received from the ECU
-uint8_t ECUreceive[7];
+//! Whether the Ethernet receive interrupt was enabled before the thermocouple read masked it
+uint8_t tcInt;
 
-//! Current RPM of recorded by the hall effect sensor
-uint16_t hallEffect;
+//! Time the last thermocouple read ended and the MAX6675 started its next conversion, in Timer 4 ticks
+uint32_t tcStamp;
 
-//! The current exhaust gas temperature
-float EGT;
+//! Number of thermocouple reads skipped to let the MAX6675 finish a conversion
+volatile uint16_t tcSkipped;
 
 //! Ambient temperature recorded on the ESB.  This is currently unimplemented
 float ref_temp;
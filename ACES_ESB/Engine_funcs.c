@@ -8,6 +8,7 @@
 
 #include <avr/io.h>
 #include <avr/interrupt.h>
+#include <string.h>
 #include "ESB_funcs.h"
 
 /** @brief Forces an engine shutdown and closes all output ports which could actuate the engine.
@@ -44,81 +45,138 @@ void shutdown(void)
 	TCCR3A = 0;  // make sure the PWM loses authority
 	assign_bit(&PORTB, pumpPin, 0);
 	
-	// now the fuel solenoid
-	TCCR5B = 0;
-	TCCR5A = 0;
+	// now the fuel solenoid, Timer 5 is left alone as it is the ECU connection watchdog
+	TCCR1B = 0;
+	TCCR1A = 0;
+	OCR1B = ICR1;
 	assign_bit(&PORTB, solePin, 0);
 	
 	// now the lube solenoid
 	assign_bit(&PORTB, lubePin, 0);
 	
 	startUpLockOut = 1;
+	startState = START_IDLE;    // abandon any startup in progress
 	opMode = 4;    // An opMode of 4 means that the engine will enter the cooling mode
 }
 
-/** @brief Performs the function calls in order such that and engine startup would occur.
+/** @brief Steps the engine startup sequence, it is called from the main loop until the sequence is over
  *
- *	1)	This function checks to make sure that there is not a lockout which prevents the engine from starting.
- *	These engine lockouts are put in place such that the engine cannot be started until it has fully stopped.
- *	This is to prevent a startup in an unsafe situation.
+ *	The sequence used to run start to finish from inside the USART receive interrupt.  Now every call does
+ *	whatever the current stage has to do right now and returns, so commands from the ECU, the connection watchdog
+ *	and the telemetry keep going during the tens of seconds a start takes.  The stages are:
  *
- *	2)	If a lockout is not present then the next set is set the various PWM lines such that the designates I/O
- *		pins can drive the hardware vital to the engine.
+ *	1)	START_LOCKOUT: Checks to make sure that there is not a lockout which prevents the engine from starting.
+ *	These engine lockouts are put in place such that the engine cannot be started until it has fully stopped.
+ *	This is to prevent a startup in an unsafe situation.  Once there is no lockout, the various PWM lines are set
+ *	such that the designated I/O pins can drive the hardware vital to the engine.
  *
- *	3)	The function invokes the compressor function which will begin spinning up the starter motor until it 
- *		reaches the point at which the air is sufficiently compressed for combustion to occur.  Meanwhile, the
- *		glow plug is turned on so that it can begin heating up.
+ *	2)	START_COMPRESSOR: The compressor function spins up the starter motor until it reaches the point at which
+ *		the air is sufficiently compressed for combustion to occur.  Meanwhile, the glow plug is turned on so that
+ *		it can begin heating up.
  *
- *	4)	The function begins injecting small puffs of fuel into the combustion chamber so that combustion will
+ *	3)	START_FUEL: Small puffs of fuel are injected into the combustion chamber so that combustion will
  *		begin taking place and become self-sufficient.
  * 
- *	5)	Assuming there are no issues with the engine operation so far, a heat soaking procedure will then take
- *		place.  This is essentially a process where the engine is just allowed to run without being interfered
- *		with so that the combustion chamber can reach a more optimal temperature.
+ *	4)	START_SOAK: Assuming there are no issues with the engine operation so far, a heat soaking procedure will
+ *		then take place.  This is essentially a process where the engine is just allowed to run without being
+ *		interfered with so that the combustion chamber can reach a more optimal temperature.
+ *
+ *	A shutdown at any point (overspeed, EGT, lost connection) sets the startup lockout, which ends the sequence.
  *
  *  @param void
  *  @return void
  */
 void startup(void)
 {
-	if (startUpLockOut){
-		if (hallEffect < 10 && EGT < 50){
-			startUpLockOut = 0;
-			startup();              // restart the function so that it has the opportunity to restart
-		}
+	if (startState > START_LOCKOUT && (startUpLockOut || opMode == 1)){
+		shutdown();               // something shut the engine down since the last step, make sure it stays down
+		return;
 	}
-	else{
-		setPWM();
-		compressor();
-		if (opMode == 1)
-			return;
+	
+	cli();
+	uint16_t rpm = hallEffect;    // both are written by interrupts, so they are read with them off
+	uint16_t egt = EGT;
+	sei();
+	
+	switch (startState)
+	{
+		case START_IDLE:
+			startState = START_LOCKOUT;
+			break;
 			
-		fuel_puffs();
-		if (opMode == 1)
-			return;
+		case START_LOCKOUT:
+			if (startUpLockOut && !(rpm < 10 && egt < (50 << egt_frac))){
+				break;                // still waiting for the engine to stop from the last run
+			}
+			startUpLockOut = 0;
+			setPWM();
+			startState = START_COMPRESSOR;
+			startEntry = 1;
+			break;
 			
-		if (hallEffect < 35000){  // This means that start up was not achieved
-			shutdown();     // 35,000 RPM is the minimum required for startup
-		}
-		else{
-			heatSoaking();	
-		}
+		case START_COMPRESSOR:
+			if (compressor()){
+				startState = START_FUEL;
+				startEntry = 1;
+			}
+			break;
+			
+		case START_FUEL:
+			if (fuel_puffs()){
+				if (rpm < 35000){  // This means that start up was not achieved
+					shutdown();     // 35,000 RPM is the minimum required for startup
+				}
+				else{
+					startState = START_SOAK;
+					startEntry = 1;
+				}
+			}
+			break;
+			
+		case START_SOAK:
+			if (heatSoaking()){
+				startState = START_IDLE;
+			}
+			break;
 	}
 }
 
+/** @brief Converts the mass flow received from the ECU into the fixed point format used by throttle()
+ *
+ *  The ECU sends the flow as an IEEE float, so this takes the mantissa and shifts it by the exponent
+ *  rather than pulling in the soft float library for a single conversion.
+ *
+ *  @param void
+ *  @return uint16_t The mass flow with flow_frac fraction bits, 0 if negative and 0xFFFF (16 g/s) at most
+ */
+uint16_t flowToFixed(void)
+{
+	uint32_t bits;
+	memcpy(&bits, massFlow.c, sizeof(bits));
+	int16_t exponent = (int16_t) ((bits >> 23) & 0xFF) - 127;
+	
+	if ((bits & 0x80000000UL) || exponent < -flow_frac){
+		return 0;                                // negative, or less than the resolution of the fixed point
+	}
+	if (exponent >= 16 - flow_frac){
+		return 0xFFFF;                           // saturate, this is well above what the engine can burn
+	}
+	uint32_t mantissa = (bits & 0x7FFFFFUL) | 0x800000UL;   // 1.23 fixed point
+	return mantissa >> (23 - flow_frac - exponent);
+}
+
 /** @brief Sets the fuel flow rate such that the engine would operate at a desired throttle value
  *
  *	1)	This function converts the desired throttle value into a mass flow rate.  THIS MASS FLOW RATE IS
  *		DETERMINED ONLY FOR THE P90-RXI!
  *
- *	2)	This mass flow rate is then converted into a number of flow rate pulses bases on the known linear 
- *		relationship.  See the published document for more explanation on this relationship.
+ *	2)	The error is then determined between the actual and desired flow rate of fuel.
  *
- *	3)	The error, in terms of pulses, is then determined between the actual and desired flow rate of fuel.
+ *	3)	The error is then converted into how many counts to move the output compare register by.  This directly
+ *		correlates to the duty cycle for the PWM signal which powers the fuel pump.  The conversion goes through
+ *		flow meter pulses and then volts (see pump_counts), and all of its factors are worked out at compile time.
  *
- *	4)	The error is then converted into volts, which then can be used to directly translated into how many 
- *		counts by which the input capture control register.  This directly correlates to the duty cycle for
- *		the PWM signal which powers the fuel pump.
+ *	Everything is done in fixed point with flow_frac fraction bits, there is no floating point math in here.
  *
  *  @param void
  *  @return Void
@@ -126,22 +184,17 @@ void startup(void)
 void throttle(void)   // I only want this function to be called after a new 
 {
 	// first I need to figure out what mass flow rate is desired for the requested throttle
-	desMFlow = 4.8*((float) throttle_val / 255.0);
-	uint8_t desPulses = (uint8_t) desMFlow*pulse_flow;
+	desFlow = ((uint32_t) throttle_val * throttle_flow) >> (20 - flow_frac);
 	
 	// Now I need to increase the duty cycle depending in the difference from the expected flow rate
-	uint8_t pulse_error = desPulses - (uint8_t) pulse_flow * massFlow.f;
-	
-	float difference = massFlow.f - desMFlow;
-	if (difference < 0)
-		difference = -difference;
+	int32_t error = (int32_t) desFlow - flowToFixed();
 	
-	if (difference < errorAllow){
+	if (error < flow_allow && error > -flow_allow){
 		opMode = 8;                                 // this means that the desired throttle has been reached
 	}
 	
-	float change = (float) pulse_error * V_per_pulse * ((float) ICR3 / pump_tot_V);
-	OCR3B -= (uint16_t) change;
+	int32_t counts = ((uint32_t) ICR3 * pump_counts) >> 16;   // counts of OCR3B per g/s of error, 4 fraction bits
+	OCR3B -= (int16_t) ((error * counts) >> (flow_frac + 4));
 	if (opMode != 8)
 		opMode = 4;                 // change the opMode so that it doesn't go through this again until there is a new flow measurement
 }
@@ -157,52 +210,69 @@ void throttle(void)   // I only want this function to be called after a new
  *	3)	If would be recommend that instead of using a fixed value for the voltage that can be supplied to the motor
  *		(see pump_tot_V) 	 
  *
+ *	4)	The control law is stepped every time the hall effect sensor publishes a new RPM, which is every pulse once
+ *		the shaft is turning, so the slope is taken over the actual time between the two measurements.
+ *
  *  @param void
- *  @return void
+ *  @return uint8_t 1 once the compressor has settled at the desired RPM, 0 while it is still spinning up
  */
-void compressor(void)
+uint8_t compressor(void)
 {
 	// For this function, the PD control law needs to be implemented
 	//so that the engine gets to 10,000 RPM as quickly as possible
-	char slope = 0;     // this will be a linear slope for the current rate of change of RPM
-	
-	// first turn on the glow plug
-	OCR2A = 255 - ((uint8_t) (gVolts / pump_tot_V * 255.0));
-	// now turn on the prescalar
-	TCCR2B |= (1 << CS22) | (1 << CS20);   // this is a prescalar of 1024
-	glowPlug = 1;   // so that the PC can also record that the glow plug is on
-	
-	// now turn on the starter motor
-	OCR0A = 255 - ((uint8_t) (sMotor / pump_tot_V * 255.0));
-	TCCR0B |= (1 << CS02) | (1 << CS00);	
-	
-	while (!(hallEffect < 10500 && hallEffect > 9500 && slope < 10 && slope > -10))
-	{
-		// now need to find new voltage
-		float voltage = Kp*(hallEffect - 10000) + Kd*slope;
-		if (voltage > 6.0)               // Cap the voltage at the maximum the motor is rated for
-			voltage = 6.0;
-		else if (voltage < 0.0)
-			voltage = 0.0;         // some error checking to make sure that things to not get unbounded
-		// now convert this into a duty cycle 
-		float duty = voltage / pump_tot_V;
-		
-		// now change the duty cycle on the starter motor
-		OCR0A = 255 - ((uint8_t) (duty * 255.5));
-		hallDone = 0;
-		uint16_t hallPrev = hallEffect;
-		// now wait for the next hall effect sensor measurement
-		while (!hallDone);
+	if (startEntry){
+		startEntry = 0;
 		
-		if (opMode == 1){  // This means that a shutdown has been invoked
-			return;
-		}
+		// first turn on the glow plug
+		OCR2A = 255 - ((uint8_t) (gVolts / pump_tot_V * 255.0));
+		// now turn on the prescalar
+		TCCR2B |= (1 << CS22) | (1 << CS20);   // this is a prescalar of 1024
+		glowPlug = 1;   // so that the PC can also record that the glow plug is on
 		
-		// now calculate the new slope
-		slope = (hallPrev - hallEffect) / 0.25;
+		// now turn on the starter motor
+		OCR0A = 255 - ((uint8_t) (sMotor / pump_tot_V * 255.0));
+		TCCR0B |= (1 << CS02) | (1 << CS00);	
 		
+		cli();
+		hallUpdated = 1;          // run the control law once on the current RPM
+		startRPM = hallEffect;
+		startTimer = hallStamp;
+		sei();
+		startSlope = 0;
 	}
 	
+	if (!hallUpdated){
+		return 0;                 // wait for the next hall effect sensor measurement
+	}
+	
+	// now calculate the new slope
+	cli();
+	hallUpdated = 0;
+	uint16_t hallNow = hallEffect;
+	uint32_t elapsed = hallStamp - startTimer;
+	startTimer = hallStamp;
+	sei();
+	if (elapsed){
+		startSlope = ((float) startRPM - hallNow) * hall_clock / elapsed;   // this is a linear slope for the current rate of change of RPM, in RPM per second
+	}
+	startRPM = hallNow;
+	
+	if (hallNow < 10500 && hallNow > 9500 && startSlope < 10 && startSlope > -10){
+		return 1;
+	}
+	
+	// now need to find new voltage
+	float voltage = Kp*((float) hallNow - 10000) + Kd*startSlope;
+	if (voltage > 6.0)               // Cap the voltage at the maximum the motor is rated for
+		voltage = 6.0;
+	else if (voltage < 0.0)
+		voltage = 0.0;         // some error checking to make sure that things to not get unbounded
+	// now convert this into a duty cycle 
+	float duty = voltage / pump_tot_V;
+	
+	// now change the duty cycle on the starter motor
+	OCR0A = 255 - ((uint8_t) (duty * 255.5));
+	return 0;
 }
 
 /** @brief Operates the fuel pump and fuel/lubrication solenoids such that ignition begins in the combustion chamber.
@@ -210,8 +280,8 @@ void compressor(void)
  *	1)	This function starts by first applying voltage so that there will be some fuel pressure on the back of the 
  *		closed fuel and lubrication solenoids.
  *
- *	2)	Then the solenoid will begin opening with a duty cycle of 5% and increase by 5% every iteration in the loop.
- *		Each iteration of the loop will occupy 0.25 secs of time.  
+ *	2)	Then the solenoid will begin opening with a duty cycle of 5% and increase by 5% every fuel_puff_time,
+ *		until it is fully open.
  *
  *	3)	The Lubrication solenoid will then be toggled at an interval as specified by lube_factor (see header file).
  *		This value corresponds to the factor by which the lubrication solenoid is slower than the fuel solenoid.
@@ -220,84 +290,98 @@ void compressor(void)
 		can be assumed that the ignition has been seeded.
  *
  *  @param void
- *  @return void
+ *  @return uint8_t 1 once the fuel solenoid is fully open, 0 before that
  */
-void fuel_puffs(void)
+uint8_t fuel_puffs(void)
 {
-	// If the code has made it this far then the compressor is up to speed 
-	// first I need to apply 2 volts of pressure with the fuel pump
-	OCR3B = ICR3 - (unsigned int)(ICR3 * 2.0 / pump_tot_V);          // This will set the duty cycle so that there is 2 volts received by the pump
-	
-	// now change the prescalar so the pump will turn on, prescalar of 8
-	TCCR3B |= (1 << CS31);
-	
-	// Now begin with increasing the duty cycle
-	float duty = 0.0;
-	OCR1B = ICR1 - (unsigned int)(ICR1 * duty);
-	// now turn on the fuel solenoid with a prescalar of 256
-	TCCR4B |= (1 << CS42);
+	if (startEntry){
+		startEntry = 0;
+		
+		// If the code has made it this far then the compressor is up to speed 
+		// first I need to apply 2 volts of pressure with the fuel pump
+		OCR3B = ICR3 - (unsigned int)(ICR3 * 2.0 / pump_tot_V);          // This will set the duty cycle so that there is 2 volts received by the pump
+		
+		// now change the prescalar so the pump will turn on, prescalar of 8
+		TCCR3B |= (1 << CS31);
+		
+		// Now begin with increasing the duty cycle
+		startStep = 0;
+		OCR1B = ICR1;
+		// now turn on the fuel solenoid with a prescalar of 256
+		TCCR1B |= (1 << CS12);
+		
+		// NOTE: It would be beneficial to have the output line for the fuel solenoid tied to a PCINT pin (such as PB6) and then
+		// toggle the lubrication solenoid through the use of an interrupt.  Becuase of this the actuation of the lubrication 
+		// solenoid will be left unimplemented. 
+		
+		cli();
+		startTimer = hallClock();
+		sei();
+		return 0;
+	}
 	
-	// NOTE: It would be beneficial to have the output line for the fuel solenoid tied to a PCINT pin (such as PB6) and then
-	// toggle the lubrication solenoid through the use of an interrupt.  Becuase of this the actuation of the lubrication 
-	// solenoid will be left unimplemented. 
+	// wait for the new value of Hall effect and EGT, each step of the duty cycle lasts fuel_puff_time
+	cli();
+	uint32_t now = hallClock();
+	uint16_t egt = EGT;
+	sei();
+	if (now - startTimer < fuel_puff_time){
+		return 0;
+	}
+	startTimer += fuel_puff_time;
 	
-	while (duty != 1)
-	{
-		// now wait for the new value of Hall effect and EGT, wait for 2 cycles so that 0.5 seconds will elapse
-		hallDone = 0;
-		while (!hallDone);
-		hallDone = 0;
-		while (!hallDone);
-		
-		if (opMode == 1)    // This means that a shutdown has been invoked
-			return;
-			
-		if (EGT > 200) {  // if true, turn off the starter motor and glow plug.  Do your own check to make sure that 200C is a good temp to turn this off at
-			TCCR2A = 0;      // this will return the pin to its normal state
-			TCCR2B &= 0xF8;  // this will turn off the glow plug
-			assign_bit(&PORTB, glowPin, 0);   // force the pin low
-			TCCR0A = 0;
-			TCCR0B &= 0xF8;  // this will turn off the starter motor
-			assign_bit(&PORTB, startPin, 0);    // for the pin low
-		}
+	if (egt > (200 << egt_frac)) {  // if true, turn off the starter motor and glow plug.  Do your own check to make sure that 200C is a good temp to turn this off at
+		TCCR2A = 0;      // this will return the pin to its normal state
+		TCCR2B &= 0xF8;  // this will turn off the glow plug
+		assign_bit(&PORTB, glowPin, 0);   // force the pin low
+		TCCR0A = 0;
+		TCCR0B &= 0xF8;  // this will turn off the starter motor
+		assign_bit(&PORTB, startPin, 0);    // for the pin low
+	}
 
-		duty += 0.05;
-		OCR4B = ICR4 - (unsigned int)(ICR4 * duty);
+	startStep++;
+	OCR1B = ICR1 - (unsigned int)(ICR1 * (startStep / (float) fuel_steps));
+	if (startStep < fuel_steps){
+		return 0;
 	}
+	
 	if (!massFlow.f)
 		opMode = 9;      // This is the opMode for if the fuel is not flowing
-	
+	return 1;
 }
 
 /** @brief Prevents interruptions from the operation of the engine so that the temperature of the combustion can will increase.
  *
- *	1)	This function is pretty simple, it sets a timer for 15 seconds and hogs execution until the timer has completed.
+ *	1)	This function is pretty simple, it waits for heat_soak_time before reporting that the engine is at idle.
 		During this time, the throttle is not allowed to be changed.
  
 	2)	If this step is completed then it can be said that the engine has reached idle*
  *
  *  @param void
- *  @return void
+ *  @return uint8_t 1 once the engine has reached idle, 0 while it is still soaking
  */
-void heatSoaking(void)
+uint8_t heatSoaking(void)
 {
-
-	// during this time the starter motor will not be using its PWM, timer0 (8 bit)
-	TCCR0A = 0;    // make this work as a normal timer
-	TCCR0B = 0;    // reset everything to 0
+	cli();
+	uint32_t now = hallClock();
+	sei();
 	
-	// Now figure out the prescalars
-	TCNT0 = 100;
-	assign_bit(&TIMSK0, TOIE0, 0);  // make sure there are not any overflow interrupts
-	TCCR0B |= (1 << CS02) | (1 << CS00);   // have a prescalar of 1024 and starts the timer
+	if (startEntry){
+		startEntry = 0;
+		
+		// during this time the starter motor will not be using its PWM, timer0 (8 bit)
+		TCCR0A = 0;
+		TCCR0B = 0;    // reset everything to 0
+		startTimer = now;
+		return 0;
+	}
 	
-	for (uint16_t i = 0; i < 1500; i++){
-		while (bit_is_clear(TIFR0,TOV0));
-		assign_bit(&TIFR0, TOV0, 1);    // clear by writing a 1 to it
-		TCNT0 = 100;    // This will have the timer run for 0.1 seconds
+	if (now - startTimer < heat_soak_time){
+		return 0;
 	}
 	// If it has made it to here then the engine has reached idle
 	opMode = 10;
+	return 1;
 }
 
 /** @brief Shuts off the engine with the exception of the starter motor to force cool air through the engine.
@@ -310,7 +394,10 @@ void coolingMode(void)
 	// for this I will make sure that the starter motor receives 4V 
 	// This will force cool air through the engine
 	
-	if (EGT > 100){
+	cli();
+	uint16_t egt = EGT;
+	sei();
+	if (egt > (100 << egt_frac)){
 		// first need to make sure that the PWM is working 
 		TCCR0A |= (1 << WGM01) | (1 << WGM00) | (1 << COM0A0) | (1 << COM0A1);
 		TCCR0B |= (1 << WGM02);
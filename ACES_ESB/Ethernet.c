@@ -9,6 +9,7 @@
 
 #include <avr/io.h>
 #include <avr/interrupt.h>
+#include <string.h>
 #include "Ethernet.h"
 #include "ESB_funcs.h"
 
@@ -62,58 +63,117 @@ void writeBasic(uint8_t op, uint8_t address, uint8_t data)
 	CSPASSIVE;
 }
 
-/** @brief Reads a specified number of bytes from the buffer and stores them in an array
+/** @brief Sends an SPI opcode and then clocks a block of bytes in, all in one CS window
  *
- *  @param[in] len The number of bytes to be read from the buffer
- *  @param[out] data pointer to the location data should be written to
+ *  The next byte is started as soon as the previous one has come in, and the previous one is stored while
+ *  the next is on the wire, so the bus is only idle for the few cycles it takes to restart SPDR.
+ *
+ *  @param[in] op The SPI opcode to send first
+ *  @param[out] data Where to store the bytes clocked in
+ *  @param[in] len The number of bytes to clock in
  *  @return void
  */
-void readBuffer(uint8_t len, uint8_t *data)
+void spiReadBlock(uint8_t op, uint8_t *data, uint16_t len)
 {
-	// First pull the CS line low
 	CSACTIVE;
-	// Now issue the read buffer memory command
-	SPDR = READ_BUF_MEM;
-	waitSPI();                // Now wait for the message to be sent
-	
-	while(len)
-	{
-		len--;
-		SPDR = 0;            // Just give the register some data so that it begins the transmission
+	SPDR = op;
+	waitSPI();
+	if (len){
+		SPDR = 0;                 // start the first byte
+		while (--len){
+			waitSPI();
+			uint8_t byte = SPDR;
+			SPDR = 0;             // start the next byte before storing this one
+			*data++ = byte;
+		}
 		waitSPI();
 		*data = SPDR;
-		data++;
 	}
-	*data = 0;               // Conclude the data with a null terminator
-	CSPASSIVE;               // Raise the CS line to stop the transmission  
-	
+	CSPASSIVE;
 }
 
-/** @brief Writes a specified number of bytes into the buffer memory
+/** @brief Sends an SPI opcode and then a block of bytes, all in one CS window
  *
- *  @param[in] len Number of bytes to be written into the buffer memory
- *  @param[in] data Array of the data to write into the buffer
+ *  The next byte is fetched while the previous one is on the wire, so SPDR is reloaded as soon as it is free.
+ *
+ *  @param[in] op The SPI opcode to send first
+ *  @param[in] data The bytes to send
+ *  @param[in] len The number of bytes to send
  *  @return void
  */
-void writeBuffer(uint8_t len, uint8_t *data)
+void spiWriteBlock(uint8_t op, const uint8_t *data, uint16_t len)
 {
-	CSACTIVE;                 // First pull the CS line low
-	SPDR = WRITE_BUF_MEM;     // Issue the write buffer command
-	waitSPI();
-	
-	while (len)
-	{
+	spiWriteStart(op);
+	spiWriteBytes(data, len);
+	spiWriteEnd();
+}
+
+/** @brief Drops CS and starts an SPI opcode shifting out, for a write made of several blocks
+ *
+ *  Follow with any number of spiWriteBytes() and then spiWriteEnd(), and everything goes out in one CS window.
+ *
+ *  @param[in] op The SPI opcode to send first
+ *  @return void
+ */
+void spiWriteStart(uint8_t op)
+{
+	CSACTIVE;
+	SPDR = op;
+}
+
+/** @brief Sends a block of bytes within a write opened by spiWriteStart()
+ *
+ *  @param[in] data The bytes to send
+ *  @param[in] len The number of bytes to send
+ *  @return void
+ */
+void spiWriteBytes(const uint8_t *data, uint16_t len)
+{
+	while (len){
+		uint8_t byte = *data++;   // fetch the next byte while the previous one is shifting out
 		len--;
-		SPDR = *data;         // Send the current byte of data
 		waitSPI();
-		data++;
-		
+		SPDR = byte;
 	}
-	CSPASSIVE;                // Raise the CS line to stop the transmission 
-	
+}
+
+/** @brief Waits for the last byte of a write opened by spiWriteStart() and raises CS
+ *
+ *  @return void
+ */
+void spiWriteEnd(void)
+{
+	waitSPI();
+	CSPASSIVE;
+}
+
+/** @brief Reads a specified number of bytes from the buffer and stores them in an array
+ *
+ *  @param[in] len The number of bytes to be read from the buffer
+ *  @param[out] data pointer to the location data should be written to, which needs room for a null terminator
+ *  @return void
+ */
+void readBuffer(uint16_t len, uint8_t *data)
+{
+	spiReadBlock(READ_BUF_MEM, data, len);
+	data[len] = 0;           // Conclude the data with a null terminator
+}
+
+/** @brief Writes a specified number of bytes into the buffer memory
+ *
+ *  @param[in] len Number of bytes to be written into the buffer memory
+ *  @param[in] data Array of the data to write into the buffer
+ *  @return void
+ */
+void writeBuffer(uint16_t len, uint8_t *data)
+{
+	spiWriteBlock(WRITE_BUF_MEM, data, len);
 }
 
 /** @brief Set the current bank to that which corresponds to that of a specified register for the ENC28J60
+ *
+ *  Registers common to all banks leave the bank alone, and only the bank select bits which change are
+ *  cleared or set, so a switch is a single operation unless it is between banks 1 and 2.
  *
  *  @param[in] address Name of the register by which to change the bank to
  *  @return void
@@ -121,14 +181,69 @@ void writeBuffer(uint8_t len, uint8_t *data)
 void setBank(uint8_t address)
 {
 	// This will set the bank to whichever bank *address* is in
-	if (((address & BANK_MASK) >> 5) != bankNumber){
-		writeBasic(BIT_FIELD_CLR, ECON1, (ECON1_BSEL0 | ECON1_BSEL1));     // First clear the bank from the relevant register
-		writeBasic(BIT_FIELD_SET, ECON1, (address & BANK_MASK) >> 5);      // Get the 2 bits by themselves and then shift to have it read the correct number
-		bankNumber = (address & BANK_MASK) >> 5;                           // Save the bank number for future comparison
+	uint8_t bank = (address & BANK_MASK) >> 5;
+	
+	// EIE through ECON1 are in every bank, so they never need a switch
+	if ((address & ADDR_MSK) >= EIE)
+		return;
+	if (bank != bankNumber){
+		if (bankNumber & ~bank)
+			writeBasic(BIT_FIELD_CLR, ECON1, bankNumber & ~bank);
+		if (bank & ~bankNumber)
+			writeBasic(BIT_FIELD_SET, ECON1, bank & ~bankNumber);
+		bankNumber = bank;                           // Save the bank number for future comparison
 	}
 	
 }
 
+/** @brief Writes a register of the current bank, skipping shadowed pointer registers which already hold the value
+ *
+ *  @param[in] address Name of the register to write
+ *  @param[in] data Value to write
+ *  @return void
+ */
+static void registerPut(uint8_t address, uint8_t data)
+{
+	uint8_t slot = (address & ~ADDR_MSK) ? SHADOW_LEN : (uint8_t) (address - SHADOW_FIRST);
+	
+	if (slot < SHADOW_LEN){
+		if ((regShadowValid & (1 << slot)) && regShadow[slot] == data)
+			return;
+		regShadow[slot] = data;
+		regShadowValid |= 1 << slot;
+	}
+	writeBasic(WRITE_CONTROL_REG, address, data);
+}
+
+/** @brief Masks the interrupts which use the SPI bus so that a sequence of SPI operations is not cut into
+ *
+ *  These are the Ethernet receive interrupt and the Timer 4 compare interrupt, which starts the EGT reads.
+ *  A read already on the bus is let finish first, which takes SPI_STC_vect at most two bytes, so outside of
+ *  the INT6 ISR, which a read keeps out, this must not be called with interrupts off.
+ *
+ *  @return uint8_t Which of them were enabled, to be handed to ethUnlock()
+ */
+uint8_t ethLock(void)
+{
+	uint8_t enabled = TIMSK4 & (1 << OCIE4A);
+	TIMSK4 &= ~(1 << OCIE4A);
+	loop_until_bit_is_clear(SPCR, SPIE);  // the read masks INT6 itself until it is done
+	enabled |= EIMSK & (1 << Ethernet_INT);                // the two bits do not overlap
+	EIMSK &= ~(1 << Ethernet_INT);
+	return enabled;
+}
+
+/** @brief Undoes ethLock().  Anything which came in the mean time is still latched in EIFR or TIFR4, so nothing is lost
+ *
+ *  @param[in] enabled What ethLock() returned
+ *  @return void
+ */
+void ethUnlock(uint8_t enabled)
+{
+	EIMSK |= enabled & (1 << Ethernet_INT);
+	TIMSK4 |= enabled & (1 << OCIE4A);
+}
+
 /** @brief Reads the value for a specified register in memory for the ENC28J60
  *
  *  @param[in] address the memory register by which to do the read operation
@@ -153,32 +268,116 @@ void RegisterWrite(uint8_t address, uint8_t data)
 	// First set the bank
 	setBank(address);
 	// now write the data to the register
-	writeBasic(WRITE_CONTROL_REG, address, data);
+	registerPut(address, data);
 }
 
-/** @brief Reads from a register location from the PHY module within the ENC28J60
+/** @brief Writes a 16 bit value to a low/high register pair, low byte first, with a single bank check
+ *
+ *  @param[in] address Name of the low register of the pair
+ *  @param[in] data The value to write
+ *  @return void
+ */
+void RegisterWrite16(uint8_t address, uint16_t data)
+{
+	setBank(address);
+	registerPut(address, data & 0xFF);
+	registerPut(address + 1, data >> 8);
+}
+
+/** @brief Writes a list of 16 bit register pairs, grouped by bank
+ *
+ *  The pairs in the current bank are written first and then those of each other bank in turn, so the
+ *  bank is changed at most once for each bank in the list whatever order the list is in.
+ *
+ *  @param[in] pairs The register pairs and their values
+ *  @param[in] count Number of entries in pairs
+ *  @return void
+ */
+void RegisterWriteBatch(const struct register_pair *pairs, uint8_t count)
+{
+	uint8_t bank = bankNumber;
+	
+	for (uint8_t pass = 0; pass < 4; pass++){
+		for (uint8_t i = 0; i < count; i++){
+			if (((pairs[i].address & BANK_MASK) >> 5) == bank)
+				RegisterWrite16(pairs[i].address, pairs[i].data);
+		}
+		bank = (bank + 1) & 0x03;
+	}
+}
+
+/** @brief Waits out the MII read, write or end of scan under way
+ *
+ *  That takes 10.24 us, which is only a few reads of MISTAT over SPI, so there is no need for a millisecond wait.
+ *
+ *  @param void
+ *  @return void
+ */
+static void phyWait(void)
+{
+	while (RegisterRead(MISTAT) & MISTAT_BUSY);
+}
+
+/** @brief Has the MII read PHSTAT2 into MIRDL/MIRDH over and over in the background
+ *
+ *  @param void
+ *  @return void
+ */
+static void phyScan(void)
+{
+	RegisterWrite(MIREGADR, PHSTAT2);
+	RegisterWrite(MICMD, MICMD_MIISCAN);
+	phyScanning = 1;
+}
+
+/** @brief Stops the background scan, as no other PHY register can be read or written while it runs
+ *
+ *  @param void
+ *  @return uint8_t 1 if the scan was running, so it can be started again afterwards
+ */
+static uint8_t phyScanStop(void)
+{
+	uint8_t scanning = phyScanning;
+	if (scanning){
+		RegisterWrite(MICMD, 0);
+		phyScanning = 0;
+		phyWait();
+	}
+	return scanning;
+}
+
+/** @brief Reads a PHY register with the scan stopped and the INT6 ISR kept out
+ *
+ *  MICMD is a MAC register, which the bit field instructions do not work on, so it is written whole.
  *
  *  @param[in] address Name of the register to read from
  *  @return uint16_t The value within the specified register
  */
-uint16_t PhyRead(uint8_t address)
+static uint16_t phyGet(uint8_t address)
 {
-	// First I need to set the PHY register address
 	RegisterWrite(MIREGADR, address);
+	RegisterWrite(MICMD, MICMD_MIIRD);
+	phyWait();
+	RegisterWrite(MICMD, 0);
 	
-	// Now set the MICMD.MIIRD bit
-	writeBasic(BIT_FIELD_SET, MICMD, MICMD_MIIRD);
-	
-	// now wait for at least 10.24 us
-	waitMS(15);
-	
-	// Now clear the MIIRD bit
-	writeBasic(BIT_FIELD_CLR, MICMD, MICMD_MIIRD);
-	
-	uint16_t data = 0;
-	data |= RegisterRead(MIRDL);
-	data |= (RegisterRead(MIRDH) << 8);
-	
+	uint16_t data = RegisterRead(MIRDL);
+	data |= RegisterRead(MIRDH) << 8;
+	return data;
+}
+
+/** @brief Reads from a register location from the PHY module within the ENC28J60
+ *
+ *  @param[in] address Name of the register to read from
+ *  @return uint16_t The value within the specified register
+ */
+uint16_t PhyRead(uint8_t address)
+{
+	uint8_t ethInt = ethLock();
+	uint8_t scanning = phyScanStop();
+	uint16_t data = phyGet(address);
+	if (scanning)
+		phyScan();
+	ethUnlock(ethInt);
 	return data;
 }
 
@@ -190,16 +389,35 @@ uint16_t PhyRead(uint8_t address)
  */
 void PhyWrite(uint8_t address, uint16_t data)
 {
+	uint8_t ethInt = ethLock();
+	uint8_t scanning = phyScanStop();
 	// first need to set the PHY register address
-	RegisterWrite(MIREGADR, PHLCON);
-	// Write the PHY data
+	RegisterWrite(MIREGADR, address);
+	// Writing the high byte starts the write to the PHY
 	RegisterWrite(MIWRL, data & 0xFF);
 	RegisterWrite(MIWRH, data >> 8);
-		
-	// now need to wait for 10.24 us, but I will just poll for the end of the waiting time after 1 waiting cycle
-	while(RegisterRead(MISTAT) & MISTAT_BUSY)
-		waitMS(15);
-	
+	phyWait();
+	if (scanning)
+		phyScan();
+	ethUnlock(ethInt);
+}
+
+/** @brief Looks at the link without waiting on the MII
+ *
+ *  The scan of PHSTAT2 keeps its high byte in MIRDH, so this is a single register read.  ethLinkUp has the
+ *  same answer without any SPI at all, for as long as the INT6 ISR is let in.
+ *
+ *  @param void
+ *  @return uint8_t 1 if the link is up
+ */
+uint8_t ethLink(void)
+{
+	if (!phyScanning)
+		return (PhyRead(PHSTAT2) & PHSTAT2_LSTAT) != 0;
+	uint8_t ethInt = ethLock();
+	uint8_t status = RegisterRead(MIRDH);
+	ethUnlock(ethInt);
+	return (status & (PHSTAT2_LSTAT >> 8)) != 0;
 }
 
 /** @brief Initialization routine for using the PHY module of the ENC18J60, mostly sets LED blink patterns
@@ -230,64 +448,46 @@ void InitPhy(void)
 	waitMS(100);                     // The example code has this in here, don't know if I really need it
 }
 
-/** @brief Delay loop for a desired amount of milliseconds
- *
- *  @param[in] msec Number of milliseconds that are desired to be delayed for
- *  @return void
- */
-void waitMS(uint16_t msec)
-{
-	// This function utilizes timer 0 and a sequence of delay loops to delay for the desired time
-	TCNT0 = 5;
-	// begin the timer
-	TCCR0B |= (1 << CS01) | (1 << CS00);       // this will start the timer with a prescalar of 64
-	for (uint16_t i = 0; i < msec; i++){
-		while(bit_is_clear(TIFR0, TOV0));
-		TIFR0 |= (1 << TOV0);                  // Clear the overflow flag by writing a 1 to it
-	}
-	assign_bit(&TCCR0B, CS01, 0);
-	assign_bit(&TCCR0B, CS00, 0);              // Turn off the timer
-}
-
 /** @brief Initialization routine for use of the ENC28J60 in this project
  *
  *  @return void
  */
 void InitEthernet(void)
 {
+	// Keep the receive interrupt out until the chip is set up again
+	EIMSK &= ~(1 << Ethernet_INT);
+	
 	// First perform a system reset.  This will ensure register start with their expected values
 	readBasic(SOFT_RESET,SOFT_RESET);        // normally read returns something but this will serve as a write with fewer operations
 	waitMS(50);                              // give the chip time to restart
+	bankNumber = 0;                          // the reset put the chip back in bank 0
+	phyScanning = 0;                         // and stopped the scan of PHSTAT2
+	regShadowValid = 0;                      // and the shadowed registers back to their reset values
 	
 	////////// Initialize the Receive and Transmit Buffers /////////////////
 	nextPacketPtr = RXSTART_INIT;
+	transmitHeader(txHeader);
+	rxHead = 0;
+	rxTail = 0;
+	rxStalled = 0;
+	txOnWire = TX_NONE;
+	txPending = TX_NONE;
+	txLast = TX_NONE;
 	
-	// Rx start
-	RegisterWrite(ERXSTL, RXSTART_INIT);        // Low byte first and then high byte
-	RegisterWrite(ERXSTH, RXSTART_INIT >> 8);
-	
-	// Now set the current receive pointer address
-	RegisterWrite(ERDPTL, RXSTART_INIT);
-	RegisterWrite(ERDPTH, RXSTART_INIT >> 8);   // Again, low byte first
-	
-	// RX end
-	RegisterWrite(ERXNDL, RXSTOP_INIT & 0xFF);    // doing the 0xFF will trim off the higher byte
-	RegisterWrite(ERXNDH, RXSTOP_INIT >> 8);
-	
-	// TX Start
-	RegisterWrite(ETXSTL, TXSTART_INIT & 0xFF);
-	RegisterWrite(ETXSTH, TXSTART_INIT >> 8);
+	// The buffer pointers, the inter-packet gap and the maximum frame length, written low byte first
+	const struct register_pair pointers[] = {
+		{ERXSTL, RXSTART_INIT},         // Rx start
+		{ERDPTL, RXSTART_INIT},         // the current receive pointer address
+		{ERXNDL, RXSTOP_INIT},          // RX end
+		{MAIPGL, 0x0C12},               // Inter-Packet gap (not back-to-back), what the data sheet recommended (p34)
+		{MAMXFLL, MAX_FRAMELEN},        // the maximum packet size
+	};
+	RegisterWriteBatch(pointers, sizeof(pointers) / sizeof(pointers[0]));
 	
-	// TX end
-	RegisterWrite(ETXNDL, TXSTOP_INIT & 0xFF);
-	RegisterWrite(ETXNDH, TXSTOP_INIT >> 8);
-	
-	// Now configure the packet filters
-	// Everything will be filtered with Unicast
-	RegisterWrite(ERXFCON, ERXFCON_ANDOR);      // have no filters for now
-	//RegisterWrite(ERXFCON, ERXFCON_UCEN | ERXFCON_ANDOR);
-	// The above line will ignore all packets which don't have the destination address
-	// matching this device's MAC address
+	// Now configure the packet filters.  Only frames with this device's MAC address as the destination are
+	// let in, which is everything the ECU sends
+	const struct eth_filter unicast = {ERXFCON_UCEN | ERXFCON_CRCEN};
+	ethFilter(&unicast);
 	
 	// Now enable the MAC and other features
 	// This will enable the MAC to receive packets
@@ -297,10 +497,6 @@ void InitEthernet(void)
 	RegisterWrite(MACON2, 0);     // this will cause the MAC to enter "normal operation" as per the data sheet p61
 	//writeBasic(BIT_FIELD_SET, MACON3,MACON3_FRMLNEN);     // This will check to make sure that the frame length is what it said it was going to be and not impact the others
 	
-	// Now do Inter-Packet gap (not back-to-back)
-	RegisterWrite(MAIPGL, 0x12);      // This was what the data sheet recommended (p34)
-	RegisterWrite(MAIPGH, 0x0C);      // Also what the data sheet recommended
-	
 	// Now write the MAC Address to the device
 	// Note, the ENC28J60 is byte backwards, at least that is the consensus on the Internet
 	RegisterWrite(MAADR5, ESB_mac[0]);
@@ -310,103 +506,563 @@ void InitEthernet(void)
 	RegisterWrite(MAADR1, ESB_mac[4]);
 	RegisterWrite(MAADR0, ESB_mac[5]);
 	
-	// Now prevent loop back of transmitted frames
-	PhyWrite(PHCON2, PHCON2_HDLDIS | PHCON2_FRCLINK);
+	// Now prevent loop back of transmitted frames.  The link is not forced up, so the PHY can report it going down
+	PhyWrite(PHCON2, PHCON2_HDLDIS);
+	
+	// Have the PHY interrupt on a link change.  Reading PHIR clears anything left over, and the link is then
+	// watched by the scan of PHSTAT2 and the INT6 ISR, without any MII reads from the main loop
+	PhyWrite(PHIE, PHIE_PGEIE | PHIE_PLNKIE);
+	PhyRead(PHIR);
+	ethLinkUp = (PhyRead(PHSTAT2) & PHSTAT2_LSTAT) != 0;
+	linkChanges = 0;
+	phyScan();
 	
 	// enable packet reception
 	writeBasic(BIT_FIELD_SET, ECON1, ECON1_RXEN);
 	
 	// now enable the interrupt flags
-	writeBasic(BIT_FIELD_SET, EIE, EIE_PKTIE | EIE_TXIE | EIE_TXERIE | EIE_RXERIE);
-	// The above line will enable the interrupt flags for Receive Packet Pending, Transmit, Transmit error, and receive packet error
+	writeBasic(BIT_FIELD_SET, EIE, EIE_INTIE | EIE_PKTIE | EIE_RXERIE | EIE_TXIE | EIE_TXERIE | EIE_LINKIE);
+	// The above line will drive the INT line on Receive Packet Pending, receive packet error, transmit done,
+	// transmit error and link change, so the ISR can start the next frame as soon as the last one is out and
+	// ethLinkUp follows the cable
+	
+	// INT is active low, so take the falling edge on INT6, see page 111 in datasheet
+	DDRE &= ~(1 << Ethernet_INT);
+	EICRB = (EICRB & ~(1 << ISC60)) | (1 << ISC61);
+	EIMSK |= (1 << Ethernet_INT);
+}
+
+/** @brief Sets up the receive filters
+ *
+ *  Frames the ESB has no use for are turned away by the ENC28J60 instead of taking up room in the receive
+ *  ring and a packetRecieve() over SPI.  Reception is paused while the filters change.
+ *
+ *  @param[in] filter The filter settings
+ *  @return void
+ */
+void ethFilter(const struct eth_filter *filter)
+{
+	const struct register_pair pattern[] = {
+		{EPMCSL, filter->patternChecksum},
+		{EPMOL, filter->patternOffset},
+	};
+	uint8_t ethInt = ethLock();
+	uint8_t receiving = RegisterRead(ECON1) & ECON1_RXEN;
+	if (receiving)
+		writeBasic(BIT_FIELD_CLR, ECON1, ECON1_RXEN);
+	for (uint8_t i = 0; i < 8; i++){
+		RegisterWrite(EHT0 + i, filter->hash[i]);
+		RegisterWrite(EPMM0 + i, filter->patternMask[i]);
+	}
+	RegisterWriteBatch(pattern, sizeof(pattern) / sizeof(pattern[0]));
+	RegisterWrite(ERXFCON, filter->enable);
+	if (receiving)
+		writeBasic(BIT_FIELD_SET, ECON1, ECON1_RXEN);
+	ethUnlock(ethInt);
+}
+
+/** @brief Has the hash table filter pass frames for a destination address, such as a multicast group
+ *
+ *  Bits 28 to 23 of the CRC of the address, worked out as for the FCS, pick one of 64 bits, so other
+ *  addresses which land on the same bit get through as well.
+ *
+ *  @param[in,out] filter The filter settings, which are only written to the chip by ethFilter()
+ *  @param[in] mac The destination address
+ *  @return void
+ */
+void ethFilterHash(struct eth_filter *filter, const uint8_t *mac)
+{
+	uint32_t crc = 0xFFFFFFFF;
+	for (uint8_t i = 0; i < 6; i++){
+		uint8_t byte = mac[i];
+		for (uint8_t bit = 0; bit < 8; bit++){
+			if ((crc >> 31) ^ (byte & 1))
+				crc = (crc << 1) ^ 0x04C11DB7;
+			else
+				crc <<= 1;
+			byte >>= 1;
+		}
+	}
+	uint8_t pointer = (crc >> 23) & 0x3F;
+	filter->hash[pointer >> 3] |= 1 << (pointer & 7);
+	filter->enable |= ERXFCON_HTEN;
+}
+
+/** @brief Has the pattern match filter pass frames with given bytes at given places
+ *
+ *  The places are those set in mask, in the PATTERN_LEN byte window from offset bytes into the frame, which
+ *  has to fit in the frame with its CRC.
+ *
+ *  @param[in,out] filter The filter settings, which are only written to the chip by ethFilter()
+ *  @param[in] offset Start of the window from the destination address
+ *  @param[in] window The bytes, up to at least the last one set in mask
+ *  @param[in] mask Bit n of byte n / 8 set for each byte of the window to match
+ *  @return void
+ */
+void ethFilterPattern(struct eth_filter *filter, uint16_t offset, const uint8_t *window, const uint8_t *mask)
+{
+	uint32_t sum = 0;
+	uint8_t n = 0;
+	
+	// The chip sums the bytes picked out as if they followed on from each other
+	for (uint8_t i = 0; i < PATTERN_LEN; i++){
+		if (mask[i >> 3] & (1 << (i & 7))){
+			sum += (n & 1) ? window[i] : window[i] << 8;
+			n++;
+		}
+	}
+	while (sum >> 16)
+		sum = (sum & 0xFFFF) + (sum >> 16);
+	memcpy(filter->patternMask, mask, sizeof(filter->patternMask));
+	filter->patternOffset = offset;
+	filter->patternChecksum = ~sum;
+	filter->enable |= ERXFCON_PMEN;
+}
+
+/** @brief Puts the frame in a transmit slot on the wire
+ *
+ *  Only called with the INT6 ISR kept out, or from it.  ETXST and ETXND are shadowed, so their bytes only
+ *  go over SPI when they change.
+ *
+ *  @param[in] slot The transmit slot
+ *  @return void
+ */
+static void txLaunch(uint8_t slot)
+{
+	const struct register_pair pointers[] = {
+		{ETXSTL, TX_SLOT(slot)},
+		{ETXNDL, txEnd[slot]},
+	};
+	RegisterWriteBatch(pointers, sizeof(pointers) / sizeof(pointers[0]));
+	writeBasic(BIT_FIELD_CLR, EIR, EIR_TXIF | EIR_TXERIF);     // clear the transmit flags
+	writeBasic(BIT_FIELD_SET, ECON1, ECON1_TXRTS);             // send the slot onto the network
+	txOnWire = slot;
+}
+
+/** @brief Finds a free transmit slot for a frame and opens the buffer memory write it goes out in
+ *
+ *  The per-packet control byte is written here, so the caller follows with the frame itself and then txClose().
+ *
+ *  @param[in] len Length of the frame
+ *  @return uint8_t The slot, or TX_NONE if one frame is on the wire and another is already waiting behind it
+ */
+static uint8_t txOpen(uint16_t len)
+{
+	static const uint8_t control = 0x00;     // per-packet control byte, 0x00 means use macon3 settings
 	
+	if (txPending != TX_NONE)
+		return(TX_NONE);
+	
+	uint8_t slot = (txOnWire == 0) ? 1 : 0;
+	txEnd[slot] = TX_SLOT(slot) + len;
+	RegisterWrite16(EWRPTL, TX_SLOT(slot));
+	
+	spiWriteStart(WRITE_BUF_MEM);
+	spiWriteBytes(&control, 1);
+	return(slot);
+}
+
+/** @brief Puts a frame which is complete in its slot on the wire
+ *
+ *  If the other slot is still going out, the frame is left for the INT6 ISR to start when it is done.
+ *
+ *  @param[in] slot The transmit slot
+ *  @return void
+ */
+static void txQueue(uint8_t slot)
+{
+	txLast = slot;
+	if (txOnWire == TX_NONE){
+		txRetries = 0;
+		txLaunch(slot);
+	}
+	else
+		txPending = slot;
+}
+
+/** @brief Closes the buffer memory write opened by txOpen() and puts the frame on the wire
+ *
+ *  @param[in] slot The slot returned by txOpen()
+ *  @return void
+ */
+static void txClose(uint8_t slot)
+{
+	spiWriteEnd();
+	txQueue(slot);
 }
 
 /** @brief Sends a packet of information using the Ethernet module
  *
  *  @param[in] len Entire length of the packet
  *  @param[in] packet Array containing the data for the packet
+ *  @return uint8_t 1 if the packet was taken, 0 if both transmit slots are busy and it has to be tried again later,
+ *  or if it is too long for MAX_FRAMELEN once the MAC has added the CRC and never will be
+ */
+uint8_t packetSend(uint16_t len, uint8_t* packet)
+{
+	if (len > MAX_FRAMELEN - 4)
+		return(0);
+	
+	uint8_t ethInt = ethLock();
+	uint8_t slot = txOpen(len);
+	if (slot != TX_NONE){
+		spiWriteBytes(packet, len);        // copy the packet into the transmit buffer
+		txClose(slot);
+	}
+	ethUnlock(ethInt);
+	return(slot != TX_NONE);
+}
+
+/** @brief Sends data to the ECU without putting the frame together in RAM first
+ *
+ *  The control byte, the MAC addresses and the length come from txHeader and the data straight from the
+ *  caller's array, all in the one SPI burst.  The data can be reused as soon as this returns.
+ *
+ *  @param[in] data The data to send
+ *  @param[in] len Number of bytes of data
+ *  @return uint8_t 1 if the frame was taken, 0 if both transmit slots are busy and it has to be tried again later,
+ *  or if len is more than MAX_DATA_LEN and never will be
+ */
+uint8_t packetSendData(const uint8_t *data, uint16_t len)
+{
+	if (len > MAX_DATA_LEN)
+		return(0);
+	
+	txHeader[LEN_INDEX] = len >> 8;    // the 802.3 length field holds the length of the data, high byte first
+	txHeader[LEN_INDEX + 1] = len & 0xFF;
+	
+	uint8_t ethInt = ethLock();
+	uint8_t slot = txOpen(TX_HEADER_LEN + len);
+	if (slot != TX_NONE){
+		spiWriteBytes(txHeader, TX_HEADER_LEN);
+		spiWriteBytes(data, len);
+		txClose(slot);
+	}
+	ethUnlock(ethInt);
+	return(slot != TX_NONE);
+}
+
+/** @brief Address a number of bytes on from one in the buffer memory
+ *
+ *  An address in the receive ring wraps from RXSTOP_INIT back to RXSTART_INIT, as the read pointer and the DMA do.
+ *
+ *  @param[in] address The address
+ *  @param[in] n Number of bytes on from it
+ *  @return uint16_t
+ */
+static uint16_t bufferOffset(uint16_t address, uint16_t n)
+{
+	if (address >= RXSTART_INIT && address <= RXSTOP_INIT && address + n > RXSTOP_INIT)
+		return(address + n - (RXSTOP_INIT - RXSTART_INIT + 1));
+	return(address + n);
+}
+
+/** @brief Starts the DMA over the range already set up and waits the 80 ns a byte it takes
+ *
+ *  @param[in] mode ECON1_CSUMEN for a checksum, or 0 for a copy to EDMADST
+ *  @return void
+ */
+static void dmaRun(uint8_t mode)
+{
+	writeBasic(BIT_FIELD_SET, ECON1, mode | ECON1_DMAST);
+	while (RegisterRead(ECON1) & ECON1_DMAST)
+		;
+	if (mode)
+		writeBasic(BIT_FIELD_CLR, ECON1, mode);
+}
+
+/** @brief Has the DMA work out the Internet checksum of part of the buffer memory
+ *
+ *  The data never crosses the SPI and the MCU never goes through it.  A range in the receive ring wraps around it.
+ *
+ *  @param[in] start Address of the first byte
+ *  @param[in] len Number of bytes
+ *  @return uint16_t The checksum high byte first, ready to go in a header, or 0xFFFF less the sum to check one
+ */
+uint16_t dmaChecksum(uint16_t start, uint16_t len)
+{
+	const struct register_pair range[] = {
+		{EDMASTL, start},
+		{EDMANDL, bufferOffset(start, len - 1)},
+	};
+	uint8_t ethInt = ethLock();
+	RegisterWriteBatch(range, sizeof(range) / sizeof(range[0]));
+	dmaRun(ECON1_CSUMEN);
+	uint16_t sum = (RegisterRead(EDMACSH) << 8) | RegisterRead(EDMACSL);
+	ethUnlock(ethInt);
+	return(sum);
+}
+
+/** @brief Has the DMA copy part of the buffer memory to somewhere else in it, inside the ENC28J60
+ *
+ *  A source or destination in the receive ring wraps around it.
+ *
+ *  @param[in] start Address of the first byte
+ *  @param[in] len Number of bytes
+ *  @param[in] dest Address the first byte is copied to
+ *  @return void
+ */
+void dmaCopy(uint16_t start, uint16_t len, uint16_t dest)
+{
+	const struct register_pair range[] = {
+		{EDMASTL, start},
+		{EDMANDL, bufferOffset(start, len - 1)},
+		{EDMADSTL, dest},
+	};
+	uint8_t ethInt = ethLock();
+	RegisterWriteBatch(range, sizeof(range) / sizeof(range[0]));
+	dmaRun(0);
+	ethUnlock(ethInt);
+}
+
+/** @brief Sends the last frame queued again, without it crossing the SPI again
+ *
+ *  With the transmitter idle the slot it is in is simply put back on the wire, otherwise the DMA copies it
+ *  from the slot on the wire into the other one, to go out behind it.
+ *
+ *  @param void
+ *  @return uint8_t 1 if it was queued, 0 if nothing has been sent yet or both slots are busy
+ */
+uint8_t packetResend(void)
+{
+	uint8_t ethInt = ethLock();
+	uint8_t slot = TX_NONE;
+	if (txLast != TX_NONE && txPending == TX_NONE){
+		if (txOnWire == TX_NONE)
+			slot = txLast;
+		else {
+			// Nothing is waiting, so the frame on the wire is the last one queued
+			uint16_t len = txEnd[txLast] - TX_SLOT(txLast);
+			slot = txLast ^ 1;
+			dmaCopy(TX_SLOT(txLast), len + 1, TX_SLOT(slot));
+			txEnd[slot] = TX_SLOT(slot) + len;
+		}
+		txQueue(slot);
+	}
+	ethUnlock(ethInt);
+	return(slot != TX_NONE);
+}
+
+/** @brief Retires the frame on the wire and starts the one waiting behind it, if there is one
+ *
+ *  @param void
+ *  @return void
+ */
+static void txDone(void)
+{
+	txOnWire = TX_NONE;
+	if (txPending != TX_NONE){
+		uint8_t slot = txPending;
+		txPending = TX_NONE;
+		txRetries = 0;
+		txLaunch(slot);
+	}
+	else
+		writeBasic(BIT_FIELD_CLR, EIR, EIR_TXIF | EIR_TXERIF);
+}
+
+/** @brief Recovers from a transmit error, which can leave TXRTS stuck
+ *
+ *  The transmit logic is reset as in Rev. B4 Silicon Errata point 12 and the frame sent again, up to
+ *  TX_RETRIES times before it is dropped.
+ *
+ *  @param void
+ *  @return void
+ */
+static void txError(void)
+{
+	writeBasic(BIT_FIELD_SET, ECON1, ECON1_TXRST);
+	writeBasic(BIT_FIELD_CLR, ECON1, ECON1_TXRST);
+	txErrors++;
+	if (txOnWire != TX_NONE && txRetries < TX_RETRIES){
+		txRetries++;
+		txLaunch(txOnWire);
+	}
+	else
+		txDone();
+}
+
+/** @brief Takes in a link change reported by the PHY
+ *
+ *  Reading PHIR lets go of LINKIF, and the link is read from PHSTAT2 while the scan is stopped for it anyway.
+ *  That keeps the ISR busy for some 80 us, but only when the cable is pulled or plugged in.
+ *
+ *  @param void
+ *  @return void
+ */
+static void linkChange(void)
+{
+	phyScanStop();
+	phyGet(PHIR);
+	ethLinkUp = (phyGet(PHSTAT2) & PHSTAT2_LSTAT) != 0;
+	phyScan();
+	linkChanges++;
+}
+
+/** @brief ISR on the falling edge of the INT line, which keeps the transmitter busy and queues every received packet
+ *
+ *  This performs the following functions:
+ *  1) Lets go of the INT line, so anything which happens part way through drives a fresh edge at the end
+ *  2) Retires a finished transmission and starts the frame waiting behind it, or sends a frame again after
+ *     a transmit error
+ *  3) Updates ethLinkUp when the PHY reports a link change
+ *  4) Counts a receive error, which means the ring was full and a packet was dropped
+ *  5) Reads the header of each packet and puts a descriptor for it in rxQueue, turning the packet pending
+ *     interrupt off if rxQueue fills up.  The packet itself stays in the ring until packetRecieve has read it out
+ *
+ *  @param void
  *  @return void
  */
-void packetSend(uint8_t len, uint8_t* packet)
+ISR(INT6_vect)
 {
-	// Set the write pointer to start of transmit buffer area
-	RegisterWrite(EWRPTL, TXSTART_INIT & 0xFF);
-	RegisterWrite(EWRPTH, TXSTART_INIT >> 8);
+	uint8_t header[RX_HEADER_LEN];
 	
-	// Set the TXND pointer to correspond to the packet size given
-	RegisterWrite(ETXNDL, (TXSTART_INIT + len) & 0xFF);
-	RegisterWrite(ETXNDH, (TXSTART_INIT + len) >> 8);
+	writeBasic(BIT_FIELD_CLR, EIE, EIE_INTIE);
+	uint8_t flags = RegisterRead(EIR);
 	
-	// write per-packet control byte (0x00 means use macon3 settings)
-	writeBasic(WRITE_BUF_MEM, 0, 0x00);   // 0 for address because 0x7A is already in the first argument
+	if (flags & EIR_TXERIF)            // an aborted transmission sets TXIF as well
+		txError();
+	else if (flags & EIR_TXIF)
+		txDone();
 	
-	// copy the packet into the transmit buffer
-	writeBuffer(len, packet);
+	if (flags & EIR_LINKIF)
+		linkChange();
 	
-	// send the contents of the transmit buffer onto the network
-	writeBasic(BIT_FIELD_SET, ECON1, ECON1_TXRTS);
+	if (flags & EIR_RXERIF){
+		writeBasic(BIT_FIELD_CLR, EIR, EIR_RXERIF);
+		rxOverruns++;
+	}
 	
-	// Reset the transmit logic problem. See Rev. B4 Silicon Errata point 12.
-	if((RegisterRead(EIR) & EIR_TXERIF))
-	{
-		writeBasic(BIT_FIELD_CLR, ECON1, ECON1_TXRTS);
+	uint8_t pending = RegisterRead(EPKTCNT);
+	while (pending){
+		if ((uint8_t) (rxHead - rxTail) == RX_QUEUE_LEN){
+			// packetRecieve turns the packet pending interrupt back on once it has made room.  INT itself
+			// stays on for the transmit interrupts
+			writeBasic(BIT_FIELD_CLR, EIE, EIE_PKTIE);
+			rxStalled = 1;
+			break;
+		}
+		
+		// Read the next packet pointer, the packet length and the receive status (see page 43 in data sheet)
+		// in one go, reading from the memory buffer automatically increments to the next byte
+		struct rx_packet *p = &rxQueue[rxHead & (RX_QUEUE_LEN - 1)];
+		RegisterWrite16(ERDPTL, nextPacketPtr);
+		spiReadBlock(READ_BUF_MEM, header, RX_HEADER_LEN);
+		p->start = bufferOffset(nextPacketPtr, RX_HEADER_LEN);     // the header can run up to the end of the ring
+		p->next = header[0] | (header[1] << 8);
+		p->len = header[2] | (header[3] << 8);
+		p->status = header[4];
+		nextPacketPtr = p->next;
+		rxHead++;
+		
+		// decrement the packet counter, the memory is only freed once ERXRDPT is moved past the packet
+		writeBasic(BIT_FIELD_SET, ECON2, ECON2_PKTDEC);
+		pending--;
 	}
+	writeBasic(BIT_FIELD_SET, EIE, EIE_INTIE);
 }
 
-/** @brief Receives packet of information which is waiting in the buffer
+/** @brief Takes the oldest packet queued by the receive ISR out of the receive ring
  *
- *  @param[in] max_length The maximum length (in bytes) that will be read
- *  @param[out] packets Array for where to place the data which is sitting in the buffer
+ *  Only called with the INT6 ISR kept out.
+ *
+ *  @param void
  *  @return void
  */
-uint16_t packetRecieve(uint8_t max_length, uint8_t *packets)
+static void rxFree(void)
 {
-	uint16_t rxstat;
-	uint16_t len;
+	// move the RX pointer to the start of the next received packet
+	// This frees the memory we just read out
+	RegisterWrite16(ERXRDPTL, rxQueue[rxTail & (RX_QUEUE_LEN - 1)].next);
+	rxTail++;
 	
-	// Check to see if a packet has been received, if not, then return
-	if (!RegisterRead(EPKTCNT))
+	// The ISR turned the packet pending interrupt off when the queue filled up, and now there is room for
+	// the packets behind this one
+	if (rxStalled){
+		rxStalled = 0;
+		writeBasic(BIT_FIELD_SET, EIE, EIE_PKTIE);
+	}
+}
+
+/** @brief Receives the oldest packet queued by the receive ISR
+ *
+ *  Nothing goes over SPI when the queue is empty, so this can be polled as often as is convenient.
+ *
+ *  @param[in] max_length The maximum length (in bytes) that will be read
+ *  @param[out] packets Array for where to place the data which is sitting in the buffer
+ *  @return uint16_t Number of bytes read, 0 if there was no packet or it was received with errors
+ */
+uint16_t packetRecieve(uint16_t max_length, uint8_t *packets)
+{
+	if (rxHead == rxTail)
 		return(0);
-		
-	// Set the read pointer to the start of the received packet
-	RegisterWrite(ERDPTL, nextPacketPtr);
-	RegisterWrite(ERDPTH, nextPacketPtr >> 8);
-	
-	// Read the next packet pointer (see page 43 in data sheet)
-	nextPacketPtr = readBasic(READ_BUF_MEM, 0);
-	nextPacketPtr |= readBasic(READ_BUF_MEM, 0) << 8;
-	// Reading from the memory buffer automatically increments to the next byte
-	
-	// read the packet length
-	len = readBasic(READ_BUF_MEM, 0);
-	len |= readBasic(READ_BUF_MEM, 0) << 8;
-	// in the example, 4 is subtracted from this but I don't have CRC checking implemented since I don't think it is necessary
 	
-	// read the receive status
-	rxstat = readBasic(READ_BUF_MEM, 0);
-	rxstat |= readBasic(READ_BUF_MEM, 0) << 8;
+	struct rx_packet *p = &rxQueue[rxTail & (RX_QUEUE_LEN - 1)];
+	// in the example, 4 is subtracted from this but I don't have CRC checking implemented since I don't think it is necessary
+	uint16_t len = p->len;
 	
 	// limit the receive length
 	if (len > max_length)
 		len = max_length;
 		
 	// check for symbol errors
-	if (!(rxstat & 0x80)){
+	if (!(p->status & 0x80)){
 		// this is an invalid packet
 		len = 0;
 	}
-	else{
+	
+	uint8_t ethInt = ethLock();
+	if (len){
+		// Set the read pointer to the start of the received packet
+		RegisterWrite16(ERDPTL, p->start);
 		readBuffer(len, packets);
 	}
+	rxFree();
+	ethUnlock(ethInt);
+	return(len);
+}
+
+/** @brief Sends the oldest packet queued by the receive ISR back to where it came from and takes it out of the ring
+ *
+ *  For an echo, or an acknowledgement which repeats what it answers.  The DMA copies the frame from the ring
+ *  into a free transmit slot and only the control byte and the two MAC addresses cross the SPI.
+ *
+ *  @param void
+ *  @return uint16_t Length of the frame sent, or 0 if nothing is waiting, both transmit slots are busy, in which
+ *  case the packet is left where it is, or the packet was bad or too long and has been dropped
+ */
+uint16_t packetEcho(void)
+{
+	uint8_t header[1 + 12];            // the control byte and the two MAC addresses
 	
-	// move the RX pointer to the start of the next received packet
-	// This frees the memory we just read out
-	RegisterWrite(ERXRDPTL, nextPacketPtr);
-	RegisterWrite(ERXRDPTH, nextPacketPtr >> 8);
+	if (rxHead == rxTail)
+		return(0);
+	uint8_t ethInt = ethLock();
+	if (txPending != TX_NONE){
+		ethUnlock(ethInt);
+		return(0);
+	}
+	
+	struct rx_packet *p = &rxQueue[rxTail & (RX_QUEUE_LEN - 1)];
+	uint16_t len = p->len - 4;         // the CRC is worked out again as the frame goes out
+	if (!(p->status & 0x80) || p->len < 4 + 14 || len > MAX_FRAMELEN)
+		len = 0;
+	else {
+		uint8_t slot = (txOnWire == 0) ? 1 : 0;
 		
-	// decrement the packet counter indicate we are done with this packet
-	writeBasic(BIT_FIELD_SET, ECON2, ECON2_PKTDEC);
+		// The sender's address becomes the destination and ours the source, behind the control byte
+		header[0] = 0x00;
+		RegisterWrite16(ERDPTL, bufferOffset(p->start, SRC_MAC));
+		spiReadBlock(READ_BUF_MEM, header + 1, 6);
+		memcpy(header + 7, ESB_mac, 6);
+		dmaCopy(bufferOffset(p->start, 12), len - 12, TX_SLOT(slot) + 1 + 12);
+		RegisterWrite16(EWRPTL, TX_SLOT(slot));
+		spiWriteBlock(WRITE_BUF_MEM, header, sizeof(header));
+		txEnd[slot] = TX_SLOT(slot) + len;
+		txQueue(slot);
+	}
+	rxFree();
+	ethUnlock(ethInt);
 	return(len);
 }
 
@@ -422,37 +1078,12 @@ void transmitHeader(uint8_t *buffer)
 	//copy the destination mac from the source and fill my mac into src
 	while(i < 6)
 	{
-		buffer[DEST_MAC + i] = ECU_mac[SRC_MAC + i];
+		buffer[DEST_MAC + i] = ECU_mac[i];
 		buffer[SRC_MAC + i] = ESB_mac[i];
 		i++;
 	}
-}
-
-/** @brief Places data from temporary string into the final array which will be sent to the ENC28J60
- *
- *  @param[in] fullMessage Final array which will be sent to the ENC28J60
- *  @param[in] message Original and temporary array containing the user's message to sent
- *  @param[in] len The length of the sub array of message that is wanting to be sent
- *  @return void
- */
-uint8_t loadData(uint8_t *fullMessage, uint8_t *message, uint8_t len)
-{
-	uint8_t i = 0;
-	
-	// First load the length of the message
-	fullMessage[LEN_INDEX] = len + 14;
-	fullMessage[LEN_INDEX + 1] = 0;    // Since I know the length will be much less than 256
-	
-	// Next load the MAC Addresses into the full message
-	transmitHeader(fullMessage);
-	
-	// Now load the data from the message into the full message
-	while (i < len)
-	{
-		fullMessage[LEN_INDEX + 2 + i] = message[i];
-		i++;
-	}
-	return (14 + len);
+	buffer[LEN_INDEX] = 0;        // The length field, high byte first, which packetSendData fills in
+	buffer[LEN_INDEX + 1] = 0;
 }
 
 /** @brief Reads the transmit status vector from the address which is the end of the transmit buffer + 1
@@ -461,6 +1092,8 @@ uint8_t loadData(uint8_t *fullMessage, uint8_t *message, uint8_t len)
  */
 void readTX_StatusVec(uint8_t *Status)
 {
+	uint8_t ethInt = ethLock();
+	
 	// This will read the 7 bytes which are located at ETXND+1
 	// First need to save the location of the read pointer
 	uint16_t savePointer = RegisterRead(ERDPTL);
@@ -472,15 +1105,12 @@ void readTX_StatusVec(uint8_t *Status)
 	curTX_end++;
 	
 	// Now set the read pointer
-	RegisterWrite(ERDPTL, curTX_end & 0xFF);
-	RegisterWrite(ERDPTH, curTX_end >> 8);
+	RegisterWrite16(ERDPTL, curTX_end);
 	
 	// Now read the buffer 7 times
 	readBuffer(7, Status);
 	
 	// Now put the read pointer back
-	RegisterWrite(ERDPTL, savePointer & 0xFF);
-	RegisterWrite(ERDPTH, savePointer >> 8);
-	
-
+	RegisterWrite16(ERDPTL, savePointer);
+	ethUnlock(ethInt);
 }
\ No newline at end of file
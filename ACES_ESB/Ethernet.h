@@ -7,6 +7,7 @@
  */ 
 
 #include <avr/sfr_defs.h>
+#include "hal.h"
 #include "ESB_funcs.h"
 
 #ifndef ENC28J60_H
@@ -17,9 +18,9 @@
 ///////////////////////////////////////////////////////////////////////////
 #define ADDR_MSK 0x1F      // This will extract the argument so that it can be used in conjunction with the opcode
 
-#define CSACTIVE assign_bit(&SPI_PORT, Ethernet_SS, 0)     // This will drop the SS line
-#define CSPASSIVE assign_bit(&SPI_PORT, Ethernet_SS, 1)    // This will raise the SS line
-#define waitSPI() while(!(SPSR & (1<<SPIF)))
+#define CSACTIVE hal_cs_low(Ethernet_PORT, Ethernet_SS)     // This will drop the SS line
+#define CSPASSIVE hal_cs_high(Ethernet_PORT, Ethernet_SS)   // This will raise the SS line
+#define waitSPI() loop_until_bit_is_set(SPSR, SPIF)
 #define LED_on 0x0880
 #define LED_off 0x0990
 #define LED_normal 0x0476
@@ -27,6 +28,16 @@
 #define DEST_MAC 0
 #define SRC_MAC 6
 #define LEN_INDEX 12
+#define TX_HEADER_LEN (LEN_INDEX + 2)   // Both MAC addresses and the length, as kept in txHeader
+#define RX_HEADER_LEN 6     // Next packet pointer, length and receive status in front of every received packet
+#define SHADOW_FIRST ETXSTL  // First of the bank 0 pointer registers which are shadowed
+#define SHADOW_LEN 10        // ETXST, ETXND, ERXST, ERXND and ERXRDPT, none of which the chip changes by itself
+#define RX_QUEUE_LEN 8       // Received packets which can wait for packetRecieve, must be a power of 2
+#define PATTERN_LEN 64       // Bytes in the window of the pattern match filter
+#define TX_SLOT_LEN (1 + MAX_FRAMELEN + 7)    // Control byte, the longest frame and the transmit status vector
+#define TX_SLOT(n) (TXSTART_INIT + (n) * TX_SLOT_LEN)   // Start of transmit slot n, which holds its control byte
+#define TX_NONE 0xFF         // No transmit slot, for txOnWire and txPending
+#define TX_RETRIES 3         // Times a frame is sent again after a transmit error before it is dropped
 
 // SPI Operational Codes
 #define READ_CONTROL_REG 0x00
@@ -248,6 +259,14 @@
 #define PHCON2_TXDIS     0x2000
 #define PHCON2_JABBER    0x0400
 #define PHCON2_HDLDIS    0x0100
+// ENC28J60 PHY PHSTAT2 Register Bit Definitions
+#define PHSTAT2_LSTAT    0x0400
+// ENC28J60 PHY PHIE Register Bit Definitions
+#define PHIE_PLNKIE      0x0010
+#define PHIE_PGEIE       0x0002
+// ENC28J60 PHY PHIR Register Bit Definitions
+#define PHIR_PLNKIF      0x0010
+#define PHIR_PGIF        0x0004
 
 // ENC28J60 Packet Control Byte Bit Definitions
 #define PKTCTRL_PHUGEEN  0x08
@@ -262,13 +281,21 @@
 // start with receive buffer at 0/
 #define RXSTART_INIT     0x0
 // receive buffer end
-#define RXSTOP_INIT      (0x1FFF-0x0600-1)    // this will give the largest possible receive and transmit buffer
-// start TX buffer at 0x1FFF-0x0600, pace for one full Ethernet frame (~1500 bytes)
-#define TXSTART_INIT     (0x1FFF-0x0600)
+#define RXSTOP_INIT      (TXSTART_INIT - 1)    // this will give the largest possible receive and transmit buffer
+// start TX buffer with space for two full frames, so one can be written while the other is on the wire
+#define TXSTART_INIT     (0x2000 - 2 * TX_SLOT_LEN)
 // stop TX buffer at end of memory
 #define TXSTOP_INIT      0x1FFF
-// max frame length which the controller will accept:
+// max frame length which the controller will accept, which the build can set with -DMAX_FRAMELEN.  The
+// transmit slots are sized for it and the receive buffer gets whatever is left, so the RX/TX split follows
+#ifndef MAX_FRAMELEN
 #define MAX_FRAMELEN        1500        // (note: maximum Ethernet frame length would be 1518)
+#endif
+#if MAX_FRAMELEN > 1518 || MAX_FRAMELEN < 64
+#error "MAX_FRAMELEN must be between 64 and 1518, the shortest and longest Ethernet frames"
+#endif
+// most data packetSendData can put in one frame, after the MAC addresses and the length and before the CRC
+#define MAX_DATA_LEN        (MAX_FRAMELEN - 18)
 
 ///////////////////////////////////////////////////////////////////////////
 //////////////////////// Global Variables /////////////////////////////////
@@ -279,26 +306,117 @@ uint16_t nextPacketPtr;                   // This will hold the address of the n
 //static uint8_t mymac[6] = {0x46,0x55,0x43,0x4B,0x45,0x52};
 uint8_t trash;
 
+//! A 16 bit value for a low/high register pair, given by the address of the low register
+struct register_pair {
+	uint8_t address;
+	uint16_t data;
+};
+
+//! Receive filter settings for ethFilter, see section 8 of the data sheet
+struct eth_filter {
+	uint8_t enable;                   // ERXFCON, the filters used and whether a frame has to pass all of them
+	uint8_t hash[8];                  // EHT0 to EHT7, destination addresses passed by the hash table filter
+	uint8_t patternMask[8];           // EPMM0 to EPMM7, bytes of the window summed by the pattern match filter
+	uint16_t patternOffset;           // EPMO, start of the window from the destination address
+	uint16_t patternChecksum;         // EPMCS, checksum the bytes picked out of the window have to have
+};
+
+//! Header of every frame sent with packetSendData, filled in by InitEthernet apart from the length
+uint8_t txHeader[TX_HEADER_LEN];
+
+//! Last value written to each of the shadowed pointer registers, from SHADOW_FIRST up
+uint8_t regShadow[SHADOW_LEN];
+
+//! Bit n is set once regShadow[n] is known to match the register, cleared by the soft reset in InitEthernet
+uint16_t regShadowValid;
+
+//! A packet which the receive ISR has found in the receive ring and which is waiting for packetRecieve
+struct rx_packet {
+	uint16_t start;           // Address of the first byte of the packet in the buffer memory
+	uint16_t len;             // Length of the packet including its CRC, from the receive status vector
+	uint16_t next;            // Address of the next packet, which ERXRDPT is moved to once this one is read
+	uint8_t status;           // Low byte of the receive status vector, bit 7 is set if it was received OK
+};
+
+//! Packets waiting to be read, filled by the receive ISR and emptied by packetRecieve
+struct rx_packet rxQueue[RX_QUEUE_LEN];
+
+//! Number of packets put in rxQueue, only changed by the receive ISR
+volatile uint8_t rxHead;
+
+//! Number of packets taken out of rxQueue, only changed by packetRecieve
+volatile uint8_t rxTail;
+
+//! Set by the receive ISR when it turned the packet pending interrupt off because rxQueue was full
+volatile uint8_t rxStalled;
+
+//! Number of times the receive ring filled up and the ENC28J60 dropped a packet
+volatile uint16_t rxOverruns;
+
+//! Transmit slot whose frame is on the wire, or TX_NONE when the transmitter is idle
+volatile uint8_t txOnWire;
+
+//! Transmit slot whose frame is waiting for the one on the wire to finish, or TX_NONE
+volatile uint8_t txPending;
+
+//! ETXND of the frame in each transmit slot
+uint16_t txEnd[2];
+
+//! Number of times the frame on the wire has been sent again so far
+uint8_t txRetries;
+
+//! Number of transmissions which ended in a transmit error, each of which is sent again up to TX_RETRIES times
+volatile uint16_t txErrors;
+
+//! Transmit slot holding the last frame queued, which packetResend sends again, or TX_NONE
+uint8_t txLast;
+
+//! Set while the PHY reports a link, kept up to date by the INT6 ISR on the PHY's link change interrupt
+volatile uint8_t ethLinkUp;
+
+//! Number of times the link has gone down or come back up since InitEthernet
+volatile uint16_t linkChanges;
+
+//! Set while the MII is scanning PHSTAT2 into MIRDL/MIRDH in the background
+uint8_t phyScanning;
+
 ///////////////////////////////////////////////////////////////////////////
 /////////////////////// Function Prototypes ///////////////////////////////
 ///////////////////////////////////////////////////////////////////////////
 
 uint8_t readBasic(uint8_t op, uint8_t address); 
 void writeBasic(uint8_t op, uint8_t address, uint8_t data);
-void readBuffer(uint8_t len, uint8_t *data);
-void writeBuffer(uint8_t len, uint8_t *data);
+void spiReadBlock(uint8_t op, uint8_t *data, uint16_t len);
+void spiWriteBlock(uint8_t op, const uint8_t *data, uint16_t len);
+void spiWriteStart(uint8_t op);
+void spiWriteBytes(const uint8_t *data, uint16_t len);
+void spiWriteEnd(void);
+void readBuffer(uint16_t len, uint8_t *data);
+void writeBuffer(uint16_t len, uint8_t *data);
 void setBank(uint8_t address);
+uint8_t ethLock(void);
+void ethUnlock(uint8_t enabled);
 uint8_t RegisterRead(uint8_t address);
 void RegisterWrite(uint8_t address, uint8_t data);
+void RegisterWrite16(uint8_t address, uint16_t data);
+void RegisterWriteBatch(const struct register_pair *pairs, uint8_t count);
 uint16_t PhyRead(uint8_t address);
 void PhyWrite(uint8_t address, uint16_t data);
+uint8_t ethLink(void);
 void InitPhy(void);
 void InitEthernet(void);
+void ethFilter(const struct eth_filter *filter);
+void ethFilterHash(struct eth_filter *filter, const uint8_t *mac);
+void ethFilterPattern(struct eth_filter *filter, uint16_t offset, const uint8_t *window, const uint8_t *mask);
 void waitMS(uint16_t msec);
-void packetSend(uint8_t len, uint8_t* packet);
-uint16_t packetRecieve(uint8_t max_length, uint8_t *packets);
+uint8_t packetSend(uint16_t len, uint8_t* packet);
+uint8_t packetSendData(const uint8_t *data, uint16_t len);
+uint16_t dmaChecksum(uint16_t start, uint16_t len);
+void dmaCopy(uint16_t start, uint16_t len, uint16_t dest);
+uint8_t packetResend(void);
+uint16_t packetRecieve(uint16_t max_length, uint8_t *packets);
+uint16_t packetEcho(void);
 void transmitHeader(uint8_t* buffer);
-uint8_t loadData(uint8_t *fullMessage, uint8_t *message, uint8_t len);
 void readTX_StatusVec(uint8_t *Status);
    
 #endif
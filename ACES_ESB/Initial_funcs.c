@@ -25,7 +25,7 @@
  *
  *  5) Initializes the SPI communication with the ECU
  *
- *  6) Enable a timer for use by the Hall effect sensor
+ *  6) Enable a free running timer which timestamps the Hall effect pulses and marks the 0.25 sec sampling periods
  * 
  *  7) Enable a timer to determine if ignition is taking too long
  *
@@ -50,14 +50,16 @@ void Initial(void)
 	DDRB = (1 << MOSI) | (1 << SCK) | (1 << CJC_SS) | (0 << MISO);
 	SPCR = (1 << SPE) | (1 << MSTR) | (1 << SPR0);   // This will enable SPI mode 0 with a clock rate of Fosc/16
 	
-	// The CJC will be sampled at the end of the Hall Effect Sampling period
+	// The CJC will be sampled at the end of the Hall Effect Sampling period, through SPI_STC_vect
 
 	
 	///////////////////  Step 3: Initialize External Interrupt line  ////////////////////////
 	// This will be used with the Hall effect sensor
 	assign_bit(&DDRD, INT2, 0);              // Configure the PD2 pin as an input so that it can receive the signals
-	hallCount = 0;
+	hallFill = 0;
+	hallIndex = 0;
 	EICRA = (1 << ISC20) | (1 << ISC21);     // This will enable rising edge interrupts on INT2, see page 110 in datasheet
+	EIMSK |= (1 << INT2);                    // Pulses are timestamped from the moment the ESB is powered
 
 	
 	/////////////////  Step 5: Initialize UART Communication with ECU  ////////////////////////
@@ -84,23 +86,20 @@ void Initial(void)
 	TIMSK5 = (1 << TOIE5);     // enable overflow interrupts on this mode of timer 5
 		
 	///////////////////////  Step 6: Enable Hall Effect Timer  //////////////////////////////
-	// This will be set to 0.25 seconds so there is a reasonable sampling period
-	TCNT4 = HallTime;
-	TIMSK4 = (1 << TOIE4);                 // enable overflow interrupts for the Hall effect sensor timer
+	// Timer 4 runs free with a 4 us tick to timestamp the pulses, and compare A marks every 0.25 seconds
+	TCNT4 = 0;
+	hallOverflows = 0;
+	OCR4A = hall_window;
+	TIMSK4 = (1 << TOIE4) | (1 << OCIE4A);   // overflows extend the timestamps, compare A ends a sampling period
 	waitMS(195);                           // wait this portion of time so that the ECU comm and Hall effect interrupts are off phase
 	TCCR4B = (1 << CS41) | (1 << CS40);    // start timer 4 with prescalar of 64
 
 
-	////////////////////  Step 8: Fuel Flow Calculation factors  /////////////////////////////
-	pulse_flow = (1.0 / density) * K_factor * max_time / 1000;   // this is the pulses expected per g/s in 0.25 sec
-	V_per_pulse = pump_m / pulse_flow;	
-
 	
 	//////////////////////  Step 9: Enable Global Interrupts  //////////////////////////////
 	sei();
 	
 	hasInterrupted = 0;
-	commandCode = 0;        // This means that that the next received char is a new command
-	ECUreceiveCount = 0;
+	linkInit(&ECUlink);     // This means that the next received byte has to start a new frame
 	
 }
\ No newline at end of file
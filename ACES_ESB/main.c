@@ -13,9 +13,6 @@
 int main(void)
 {
     Initial();
-	while (1){
-		EGT_collect();
-	}
 	while (1) 
     {	
 		connected++;
@@ -24,18 +21,17 @@ int main(void)
 		if (connected){
 			if (opMode == 1){}
 				//shutdown();
-			else if (opMode == 2)
-				startup();
+			else if (opMode == 2 || startState)
+				startup();                // one step of the startup sequence, see Engine_funcs.c
 			else if (opMode == 3)
 				throttle();
 			else if (opMode == 5)
 				coolingMode();
-			else if (hallDone){
+			
+			if (hallDone){
 				package_message();
-				sendToECU(allData);
+				sendToECU(LINK_ESB_DATA, ECUtransmit, allData);
 			}
-			else if (opMode == 11)
-				shutdown();               // needs to shutdown because the engine has been disconnected from the ECU
 		}		
     }
 }
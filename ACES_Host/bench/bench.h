@@ -0,0 +1,126 @@
+/** @file bench.h
+ *  @author Nick Moore
+ *  @date October 15, 2026
+ *  @brief Timing helpers shared by the host benchmarks
+ *
+ *  Every benchmark reports two numbers per operation:
+ *  1) Host nanoseconds, which is what the code costs in raw computation (scaled by however much faster
+ *     the host is than a 16 MHz AVR, so only useful for comparing two versions of the same code)
+ *  2) Simulated AVR cycles, which is the time spent waiting on peripherals as the simulator models them
+ *
+ *  Checks of behaviour go through bench_check(), and main() returns the number which failed so that
+ *  ctest fails the run.
+ *
+ *  @bug No known bugs
+ */
+
+#ifndef BENCH_H_
+#define BENCH_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include "avr_sim.h"
+
+//! State of one running benchmark
+struct bench {
+	const char *name;
+	uint64_t host_ns;
+	uint64_t cycles;
+	uint64_t wait_cycles;
+};
+
+//! Number of checks which have failed so far
+static unsigned bench_failures;
+
+static inline uint64_t bench_now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/** @brief Starts timing a benchmark
+ *
+ *  @param[out] b The benchmark
+ *  @param[in] name Name printed in the report
+ *  @return void
+ */
+static inline void bench_begin(struct bench *b, const char *name)
+{
+	b->name = name;
+	b->cycles = avr_sim_cycles;
+	b->wait_cycles = avr_sim_wait_cycles;
+	b->host_ns = bench_now_ns();
+}
+
+/** @brief Stops the clocks of a benchmark, for set up work between operations which should not count
+ *
+ *  @param[in,out] b The benchmark
+ *  @return void
+ */
+static inline void bench_pause(struct bench *b)
+{
+	b->host_ns = bench_now_ns() - b->host_ns;
+	b->cycles = avr_sim_cycles - b->cycles;
+	b->wait_cycles = avr_sim_wait_cycles - b->wait_cycles;
+}
+
+/** @brief Restarts the clocks of a benchmark stopped with bench_pause()
+ *
+ *  @param[in,out] b The benchmark
+ *  @return void
+ */
+static inline void bench_resume(struct bench *b)
+{
+	b->host_ns = bench_now_ns() - b->host_ns;
+	b->cycles = avr_sim_cycles - b->cycles;
+	b->wait_cycles = avr_sim_wait_cycles - b->wait_cycles;
+}
+
+/** @brief Stops timing a benchmark and prints the per operation figures
+ *
+ *  @param[in] b The benchmark
+ *  @param[in] ops Number of operations which were timed
+ *  @return double Simulated cycles per operation
+ */
+static inline double bench_end(struct bench *b, uint32_t ops)
+{
+	double ns = (double) (bench_now_ns() - b->host_ns) / ops;
+	double cycles = (double) (avr_sim_cycles - b->cycles) / ops;
+	double wait = (double) (avr_sim_wait_cycles - b->wait_cycles) / ops;
+	printf("%-36s %9u ops %10.1f host ns/op %12.1f sim cycles/op %12.1f wait cycles/op %10.1f us/op\n",
+	       b->name, ops, ns, cycles, wait, cycles * 1e6 / F_CPU);
+	return cycles;
+}
+
+/** @brief Records the result of a check
+ *
+ *  @param[in] ok Non-zero if the check passed
+ *  @return const char* "PASS" or "FAIL", for the report
+ */
+static inline const char *bench_check(int ok)
+{
+	if (!ok)
+		bench_failures++;
+	return ok ? "PASS" : "FAIL";
+}
+
+/** @brief Prints how many checks failed, for the end of main()
+ *
+ *  @param void
+ *  @return int 0 if every check passed, 1 otherwise
+ */
+static inline int bench_result(void)
+{
+	printf("\n%u check%s failed\n", bench_failures, bench_failures == 1 ? "" : "s");
+	return bench_failures != 0;
+}
+
+//! Prints a section heading
+static inline void bench_section(const char *title)
+{
+	printf("\n== %s ==\n", title);
+}
+
+#endif /* BENCH_H_ */
@@ -0,0 +1,717 @@
+/** @file ecu_bench.c
+ *  @author Nick Moore
+ *  @date October 15, 2026
+ *  @brief Host benchmarks of the ECU firmware running against the simulated ATmega2561
+ *
+ *  @bug No known bugs
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <stdlib.h>
+#include "ECU_funcs.h"
+#include "Ethernet.h"
+#include "Network.h"
+#include "Scheduler.h"
+#include "avr_sim.h"
+#include "enc28j60_sim.h"
+#include "mcp9808_sim.h"
+#include "bench.h"
+#include "parity_ref.h"
+#include "link_test.h"
+#include "eth_test.h"
+#include "net_test.h"
+
+void INT2_vect(void);
+void TIMER3_OVF_vect(void);
+void TIMER3_COMPA_vect(void);
+void USART0_RX_vect(void);
+void USART1_RX_vect(void);
+void USART0_UDRE_vect(void);
+void USART1_UDRE_vect(void);
+void TWI_vect(void);
+void ADC_vect(void);
+
+//! Flow meter pulse period at a given flow in g/s of kerosene, 91387 pulses per liter at 0.81 g/ml
+#define FLOW_PULSE_CYCLES(flow) ((uint64_t) (F_CPU * 0.81 * 1000 / (91387 * (flow))))
+
+static struct mcp9808_sim temp_sensor[ECU_temp_sensors];
+static uint8_t wire[1600];
+static int flow_meter;                      // interrupt source driving INT2
+
+/** @brief Brings the simulated ECU up to the point where the main loop would start
+ *
+ *  @param void
+ *  @return void
+ */
+static void boot(void)
+{
+	avr_sim_reset();
+	static const uint8_t addresses[ECU_temp_sensors] = TEMP_ADDRESSES;
+	for (uint8_t i = 0; i < ECU_temp_sensors; i++){
+		mcp9808_sim_init(&temp_sensor[i], addresses[i], (25 + 5 * i) * 16);
+		avr_sim_attach_twi(&temp_sensor[i].dev);
+	}
+	avr_sim_twi_isr(TWI_vect);
+	avr_sim_set_adc(ADC_PACK, 764);        // a 3S pack at 11.1 V, through the 1:3 dividers
+	avr_sim_set_adc(1, 255);
+	avr_sim_set_adc(2, 509);
+	avr_sim_adc_isr(ADC_vect);
+	avr_sim_usart_udre(0, USART0_UDRE_vect);
+	avr_sim_usart_udre(1, USART1_UDRE_vect);
+	avr_sim_timer_isr(3, TOV3, TIMER3_OVF_vect);
+	avr_sim_timer_isr(3, OCF3A, TIMER3_COMPA_vect);
+	enc28j60_sim_init();                   // with the link up and nothing on the other end of it
+	avr_sim_ext_isr(Ethernet_INT, INT6_vect);
+	enc28j60_sim_attach_int(Ethernet_INT);
+
+	connected_ESB = 1;                 // skip the handshake, there is no ESB on the other end
+	Initial();
+	connected_GUI = 1;
+	flow_meter = avr_sim_add_source(INT2_vect, FLOW_PULSE_CYCLES(2.0), &EIMSK, INT2);
+}
+
+/** @brief Lets the simulation run until a USART's data register empty interrupt has nothing left to send
+ *
+ *  @param[in] ucsrb UCSRnB of the USART
+ *  @return void
+ */
+static void drain_tx(volatile uint8_t *ucsrb)
+{
+	while (*ucsrb & (1 << UDRIE0))
+		avr_sim_advance(64);
+}
+
+static void bench_parity(void)
+{
+	struct bench b;
+	volatile char sink = 0;
+	char message[24];
+	for (uint8_t i = 0; i < sizeof(message); i++){
+		message[i] = i * 37;
+	}
+
+	bench_section("Parity and framing");
+	uint8_t GUIstarts[GUI_DATA_LEN / 6];
+	for (uint8_t i = 0; i < sizeof(GUIstarts); i++){
+		GUIstarts[i] = 6 * i;
+	}
+	bench_parity_frame("GUI frame", GUI_DATA_LEN, GUIstarts, sizeof(GUIstarts));
+
+	bench_begin(&b, "calculateParity (6 bytes)");
+	for (uint32_t i = 0; i < 1000000; i++){
+		message[0] = i;
+		sink ^= calculateParity(message, 0);
+	}
+	bench_end(&b, 1000000);
+
+	bench_begin(&b, "packageMessage (normal data payload)");
+	for (uint32_t i = 0; i < 1000000; i++){
+		massFlow.c[0] = i;
+		packageMessage();
+	}
+	bench_end(&b, 1000000);
+	(void) sink;
+}
+
+static void bench_links(void)
+{
+	struct bench b;
+
+	bench_section("Serial links");
+	struct link_rx ESBside;
+	packageMessage();
+	avr_sim_usart_log(1, wire, sizeof(wire));
+	linkInit(&ESBside);
+	uint16_t intact = 0;
+	bench_begin(&b, "sendToESB (normal data frame)");
+	for (uint32_t i = 0; i < 1000; i++){
+		sendToESB(LINK_ECU_DATA, ESBtransmit, LINK_ECU_DATA_LEN);
+		bench_pause(&b);
+		drain_tx(&UCSR1B);
+		uint16_t len = avr_sim_usart_log(1, wire, sizeof(wire));
+		for (uint16_t j = 0; j < len; j++){
+			linkPush(&ESBside, wire[j]);
+			if (linkPoll(&ESBside) && ESBside.frame.type == LINK_ECU_DATA &&
+			    !memcmp(ESBside.frame.payload, ESBtransmit, LINK_ECU_DATA_LEN))
+				intact++;
+		}
+		bench_resume(&b);
+	}
+	bench_end(&b, 1000);
+	printf("    %u of 1000 frames reached the ESB intact, %u lost by sequence\n", intact, ESBside.stats.lost);
+
+	bench_link_stream("USART1_RX_vect (ESB status frames)", 1, USART1_RX_vect, &ESBlink, LINK_ESB_DATA);
+
+	uint8_t frame[GUI_FRAME_LEN];
+	avr_sim_usart_log(0, wire, sizeof(wire));
+	intact = 0;
+	bench_begin(&b, "sendToLaptop (GUI frame)");
+	for (uint32_t i = 0; i < 1000; i++){
+		massFlow.c[0] = i;
+		sendToLaptop();
+		bench_pause(&b);
+		drain_tx(&UCSR0B);
+		if (avr_sim_usart_log(0, wire, sizeof(wire)) == sizeof(frame) && wire[1] == (uint8_t) i)
+			intact++;
+		memcpy(frame, wire, sizeof(frame));
+		bench_resume(&b);
+	}
+	bench_end(&b, 1000);
+	printf("    %u of 1000 frames carried the latest snapshot\n", intact);
+
+	newCommand = 1;
+	intact = 0;
+	bench_begin(&b, "USART0_RX_vect ('R' resend request)");
+	for (uint32_t i = 0; i < 1000; i++){
+		avr_sim_usart_rx(0, 'R', USART0_RX_vect);
+		bench_pause(&b);
+		drain_tx(&UCSR0B);
+		if (avr_sim_usart_log(0, wire, sizeof(wire)) == sizeof(frame) && !memcmp(wire, frame, sizeof(frame)))
+			intact++;
+		bench_resume(&b);
+	}
+	bench_end(&b, 1000);
+	printf("    %u of 1000 resends repeated the last frame\n", intact);
+}
+
+/** @brief Sends the GUI telemetry frame over the serial link
+ *
+ *  @param void
+ *  @return uint8_t 1 if a whole frame went out
+ */
+static uint8_t serial_telemetry(void)
+{
+	avr_sim_usart_log(0, wire, sizeof(wire));
+	sendToLaptop();
+	drain_tx(&UCSR0B);
+	return avr_sim_usart_log(0, wire, sizeof(wire)) == GUI_FRAME_LEN;
+}
+
+/** @brief Reads the temperature sensors once a millisecond, as readTempSensor is called every period
+ *
+ *  @param void
+ *  @return void
+ */
+static void temp_period(void)
+{
+	readTempSensor();
+	avr_sim_advance(F_CPU / 1000);
+}
+
+/** @brief Sets every simulated temperature sensor to the same temperature
+ *
+ *  @param[in] temp Sixteenths of a degree C
+ *  @return void
+ */
+static void temp_set(int16_t temp)
+{
+	for (uint8_t i = 0; i < ECU_temp_sensors; i++){
+		temp_sensor[i].temperature = temp;
+	}
+}
+
+/** @brief Checks the reading of every temperature sensor, and that the GUI frame carries them
+ *
+ *  @param[in] expected Reading each sensor should have, TEMP_NONE for none, or 0 to take the simulated sensor's
+ *  @return uint8_t 1 if all of them match
+ */
+static uint8_t temp_check(const int16_t *expected)
+{
+	uint8_t ok = 1;
+	serial_telemetry();
+	for (uint8_t i = 0; i < GUI_DATA_LEN; i += 6){
+		ok &= wire[GUI_DATA_LEN + i / 6] == calculateParity(wire, i);
+	}
+	for (uint8_t i = 0; i < ECU_temp_sensors; i++){
+		int16_t temp, gui;
+		int16_t want = expected ? expected[i] : temp_sensor[i].temperature;
+		tempReading(i, &temp);
+		memcpy(&gui, wire + GUI_TEMPS + 2 * i, sizeof(gui));
+		ok &= temp == want && gui == want;
+	}
+	return ok;
+}
+
+/** @brief Times the temperature scan and checks it over the sensors' range, with a sensor gone and with the bus stuck
+ *
+ *  @param void
+ *  @return void
+ */
+static void bench_temperature(void)
+{
+	struct bench b;
+	char name[48];
+
+	snprintf(name, sizeof(name), "readTempSensor (%u sensors queued on the TWI)", (unsigned) ECU_temp_sensors);
+	bench_begin(&b, name);
+	for (uint32_t i = 0; i < 1000; i++){
+		readTempSensor();
+		bench_pause(&b);
+		avr_sim_advance(F_CPU / 1000);
+		bench_resume(&b);
+	}
+	bench_end(&b, 1000);
+	double scan[2];
+	for (uint8_t pointed = 0; pointed < 2; pointed++){
+		tempPointed = pointed ? tempPointed : 0;
+		readTempSensor();
+		uint64_t start = avr_sim_cycles;
+		while (tempScan.state == TWI_QUEUED || tempScan.state == TWI_BUSY)
+			avr_sim_advance(16);
+		scan[pointed] = (avr_sim_cycles - start) / (F_CPU / 1e6);
+	}
+	uint16_t age = 0;
+	for (uint8_t i = 0; i < ECU_temp_sensors; i++){
+		uint16_t a = schedTicks - temps[i].stamp;
+		age = a > age ? a : age;
+	}
+	uint8_t ok = temp_check(0) && age <= 1;
+	printf("    ECU_temp = %.2f C, sensors at", ECU_temp);
+	for (uint8_t i = 0; i < ECU_temp_sensors; i++){
+		printf(" %.2f", temps[i].temp / 16.0);
+	}
+	printf(" C stamped within %u ms, in the GUI frame: %s\n", age, bench_check(ok));
+	printf("    %.1f us on the bus a scan run by TWI_vect with the main loop free, %.1f us with the pointer writes\n",
+	       scan[1], scan[0]);
+
+	uint16_t wrong = 0;
+	for (int16_t t = -40 * 16; t <= 125 * 16; t++){
+		temp_set(t);
+		temp_period();
+		temp_period();                 // published one period after it was read
+		wrong += ECU_temp != t / 16.0 || !temp_check(0);
+	}
+	printf("    readings wrong at %u of %u sixteenths of a degree from -40 to 125 C: %s\n", wrong, 165 * 16 + 1,
+	       bench_check(!wrong));
+
+	temp_set(25 * 16);
+	temp_period();
+	temp_period();
+	temp_sensor[1].dev.address ^= 0x40;    // nothing answers the second sensor's address
+	uint16_t retries = twiRetries;
+	temp_set(30 * 16);
+	temp_period();
+	temp_period();
+	int16_t kept[ECU_temp_sensors] = {30 * 16, 25 * 16, 30 * 16};
+	uint8_t gone = temp_check(kept);
+	retries = twiRetries - retries;
+	while ((uint16_t) (schedTicks - temps[1].stamp) <= TEMP_STALE)
+		temp_period();
+	kept[1] = TEMP_NONE;
+	gone &= temp_check(kept);
+	temp_sensor[1].dev.address ^= 0x40;
+	temp_period();
+	temp_period();
+	gone &= temp_check(0);
+	printf("    sensor gone: %u retries a scan, the others read and its last reading sent until it was stale: %s\n",
+	       retries / 2, bench_check(gone && retries == 2 * TWI_RETRIES));
+
+	uint16_t timeouts = twiTimeouts;
+	avr_sim_twi_stall(1);                  // a sensor holds the clock low
+	temp_set(20 * 16);
+	readTempSensor();
+	uint16_t ticks = schedTicks;
+	while (twiTimeouts == timeouts){
+		avr_sim_advance(F_CPU / 10000);
+		twiPoll();
+	}
+	ticks = schedTicks - ticks;
+	uint8_t stuck = ECU_temp == 30.0;
+	avr_sim_twi_stall(0);
+	temp_period();                         // the rest of the scan
+	temp_period();
+	temp_period();
+	stuck &= ECU_temp == 20.0 && temp_check(0);
+	printf("    bus held low: given up on and the TWI reset after %u ms, read again once it was let go: %s\n", ticks,
+	       bench_check(stuck && ticks <= TWI_TIMEOUT + 1));
+}
+
+/** @brief Input of ADC_PACK which dithers between two codes, for the extra bits oversampling buys
+ *
+ *  @param void
+ *  @return void
+ */
+static void adc_dither(void)
+{
+	avr_sim_set_adc(ADC_PACK, 764 + (rand() & 1));
+}
+
+/** @brief Times batVoltage and checks the ADC sampler's rate, channel order and resolution
+ *
+ *  @param void
+ *  @return void
+ */
+static void bench_battery(void)
+{
+	struct bench b;
+	static const uint16_t codes[ADC_CHANNELS] = {764, 255, 509};
+
+	bench_begin(&b, "batVoltage (filtered by ADC_vect)");
+	for (uint32_t i = 0; i < 100000; i++){
+		batVoltage();
+		bench_pause(&b);
+		avr_sim_advance(100);
+		bench_resume(&b);
+	}
+	bench_end(&b, 100000);
+
+	uint32_t samples = adcSamples;
+	avr_sim_advance(F_CPU);
+	samples = adcSamples - samples;
+	uint8_t ok = 1;
+	for (uint8_t i = 0; i < ADC_CHANNELS; i++){
+		ok &= adcMillivolts(i) == ((uint32_t) codes[i] * ADC_FULL_SCALE_MV + 512) >> 10;
+	}
+	batVoltage();
+	ok &= batMillivolts == adcMillivolts(ADC_PACK);
+	printf("    %u conversions/s, %u readings/s a channel, %u mV of pack and every channel where it belongs: %s\n",
+	       samples, samples / (ADC_CHANNELS * ADC_OVERSAMPLE), batMillivolts, bench_check(ok));
+
+	srand(1);
+	int dither = avr_sim_add_source(adc_dither, 997, 0, 0);
+	avr_sim_advance(F_CPU / 5);
+	batVoltage();
+	double exact = 764.5 * ADC_FULL_SCALE_MV / 1024;
+	double lsb = ADC_FULL_SCALE_MV / 1024.0;
+	avr_sim_remove_source(dither);
+	avr_sim_set_adc(ADC_PACK, codes[ADC_PACK]);
+	avr_sim_advance(F_CPU / 5);
+	printf("    input half way between two codes: %u mV for %.1f mV, %.1f mV a code: %s\n", batMillivolts, exact, lsb,
+	       bench_check(batMillivolts > exact - lsb / 4 && batMillivolts < exact + lsb / 4));
+}
+
+//! mV on each ADC input, held by adc_cells
+static double cell_input[ADC_CHANNELS];
+
+/** @brief Inputs of every ADC channel, dithered between the two codes either side of cell_input
+ *
+ *  @param void
+ *  @return void
+ */
+static void adc_cells(void)
+{
+	for (uint8_t i = 0; i < ADC_CHANNELS; i++){
+		double code = cell_input[i] * 1024 / ADC_FULL_SCALE_MV;
+		uint16_t whole = code;
+		avr_sim_set_adc(i, whole + (rand() < (code - whole) * RAND_MAX));
+	}
+}
+
+/** @brief Sets the voltage of each cell of the simulated pack
+ *
+ *  @param[in] c1 mV of cell 1, at the negative end
+ *  @param[in] c2 mV of cell 2
+ *  @param[in] c3 mV of cell 3
+ *  @return void
+ */
+static void cell_set(double c1, double c2, double c3)
+{
+	cell_input[BAT_TAP1] = c1;
+	cell_input[BAT_TAP2] = c1 + c2;
+	cell_input[ADC_PACK] = c1 + c2 + c3;
+}
+
+/** @brief Times batUpdate and checks the cells, their sag under pump load, the discharge rate and the brown-out warning
+ *
+ *  @param void
+ *  @return void
+ */
+static void bench_cells(void)
+{
+	struct bench b;
+
+	bench_begin(&b, "batUpdate (run by ADC_vect every reading)");
+	for (uint32_t i = 0; i < 100000; i++){
+		batUpdate();
+	}
+	bench_end(&b, 100000);
+	batInit();
+	avr_sim_advance(F_CPU / 10);
+	uint16_t pack = adcMillivolts(ADC_PACK);
+	uint16_t tap1 = adcMillivolts(BAT_TAP1);
+	uint16_t tap2 = adcMillivolts(BAT_TAP2);
+	uint8_t ok = bat.cell[0] == tap1 && bat.cell[1] == tap2 - tap1 && bat.cell[2] == pack - tap2 && bat.pack == pack;
+	ok &= !bat.warning && bat.secondsLeft == BAT_NO_PREDICTION;
+	printf("    cells at %u, %u and %u mV from the taps on a %u mV pack: %s\n", bat.cell[0], bat.cell[1], bat.cell[2],
+	       bat.pack, bench_check(ok));
+
+	srand(2);
+	static const double rest[BAT_CELLS] = {3800, 3780, 3790};
+	static const double sag[BAT_CELLS] = {150, 140, 160};
+	cell_set(rest[0], rest[1], rest[2]);
+	int cells = avr_sim_add_source(adc_cells, 997, 0, 0);
+	avr_sim_advance(F_CPU / 5);
+	batInit();                             // a new pack, so the jump from the last is not taken for it charging
+	avr_sim_advance(F_CPU / 5);
+	batLoaded = 1;                         // as measureFlow does while fuel is flowing
+	cell_set(rest[0] - sag[0], rest[1] - sag[1], rest[2] - sag[2]);
+	avr_sim_advance(F_CPU / 5);
+	ok = 1;
+	for (uint8_t i = 0; i < BAT_CELLS; i++){
+		ok &= bat.sag[i] >= sag[i] - 4 && bat.sag[i] <= sag[i] + 4;
+	}
+	printf("    sag under pump load of %u, %u and %u mV for %.0f, %.0f and %.0f mV: %s\n", bat.sag[0], bat.sag[1],
+	       bat.sag[2], sag[0], sag[1], sag[2], bench_check(ok));
+
+	for (uint8_t s = 0; s < 40; s++){      // the pump switching on and off every half second
+		batLoaded = s & 1;
+		cell_set(rest[0] - batLoaded * sag[0], rest[1] - batLoaded * sag[1], rest[2] - batLoaded * sag[2]);
+		avr_sim_advance(F_CPU / 2);
+	}
+	int16_t rate = bat.rate;
+	ok = rate >= -10 && rate <= 10 && (bat.secondsLeft == BAT_NO_PREDICTION || bat.secondsLeft > 3600);
+	printf("    pump switching on and off every 0.5 s with the pack steady: %d mV/min, not taken for a discharge: %s\n",
+	       rate, bench_check(ok));
+
+	// Running down at 200 mV/min a cell under load, cell 3 reaches BAT_CELL_LOW_MV at 69 s and the pack
+	// BAT_PACK_MIN_MV at 132 s
+	double t = 0, cellLow = 0, soon = 0;
+	uint16_t predicted = BAT_NO_PREDICTION;
+	batLoaded = 1;
+	while (bat.pack > BAT_PACK_MIN_MV && t < 200){
+		double drop = 200 * t / 60;
+		cell_set(3750 - drop, 3740 - drop, 3730 - drop);
+		avr_sim_advance(F_CPU / 100);
+		t += 0.01;
+		if (!cellLow && (bat.warning & BAT_WARN_CELL))
+			cellLow = t;
+		if (!soon && (bat.warning & BAT_WARN_SOON)){
+			soon = t;
+			predicted = bat.secondsLeft;
+		}
+	}
+	rate = bat.rate;
+	ok = rate >= 570 && rate <= 630;
+	printf("    running down at %d mV/min for 600 mV/min: %s\n", rate, bench_check(ok));
+	ok = cellLow > 68.8 && cellLow < 69.2;
+	printf("    cell 3 warned about below %u mV at %.2f s for 69 s: %s\n", BAT_CELL_LOW_MV, cellLow, bench_check(ok));
+	ok = t - soon >= BAT_WARN_SECONDS - 10 && t - soon <= BAT_WARN_SECONDS + 5;
+	printf("    brown-out warned %.1f s ahead, %u s predicted, the pack reaching %u mV at %.1f s: %s\n", t - soon,
+	       predicted, BAT_PACK_MIN_MV, t, bench_check(ok));
+
+	avr_sim_remove_source(cells);
+	avr_sim_set_adc(ADC_PACK, 764);
+	avr_sim_set_adc(BAT_TAP1, 255);
+	avr_sim_set_adc(BAT_TAP2, 509);
+	batLoaded = 0;
+	avr_sim_advance(F_CPU / 5);
+	uint8_t packed[BAT_PACKED];
+	serial_telemetry();
+	batPack(packed);
+	ok = !memcmp(wire + GUI_BATTERY, packed, BAT_PACKED);
+	for (uint8_t i = 0; i < GUI_DATA_LEN; i += 6){
+		ok &= wire[GUI_DATA_LEN + i / 6] == calculateParity(wire, i);
+	}
+	int16_t sent;
+	memcpy(&sent, wire + GUI_BATTERY + 12, sizeof(sent));
+	ok &= sent == bat.rate;
+	printf("    cells, sag, rate, time left and warnings in the GUI frame at byte %u: %s\n", GUI_BATTERY,
+	       bench_check(ok));
+	batInit();
+}
+
+static void bench_sensors(void)
+{
+	struct bench b;
+
+	bench_section("Sensors");
+	bench_temperature();
+
+	bench_battery();
+	bench_cells();
+
+	static const float flows[] = {2.0, 0.5, 4.5, 0.1};
+	for (uint8_t i = 0; i < sizeof(flows) / sizeof(flows[0]); i++){
+		avr_sim_set_period(flow_meter, FLOW_PULSE_CYCLES(flows[i]));
+		avr_sim_advance(F_CPU / 2);        // let the pulse train settle to the new rate
+		measureFlow();
+		bench_begin(&b, "measureFlow");
+		for (uint32_t j = 0; j < 1000; j++){
+			measureFlow();
+			bench_pause(&b);
+			avr_sim_advance(F_CPU / 1000);
+			bench_resume(&b);
+		}
+		bench_end(&b, 1000);
+		printf("    massFlow = %.3f g/s with the flow meter at %.3f g/s\n", massFlow.f, flows[i]);
+	}
+	avr_sim_set_period(flow_meter, FLOW_PULSE_CYCLES(2.0));
+}
+
+//! Longest synthetic run time of each task in cycles, on top of what the task itself takes
+static const uint16_t sched_load[sched_tasks] = {800, 1600, 4800, 6400, 12800};
+
+//! Synthetic run time accounting of the tasks, and the task to make overrun its deadline
+static struct {
+	void (*run[sched_tasks])(void);    // the real tasks
+	uint64_t total[sched_tasks];       // cycles each task took, its own and the synthetic ones
+	uint32_t worst[sched_tasks];       // longest single run of each task
+	uint8_t overrun;                   // task which takes longer than its deadline every 4th run, sched_tasks for none
+	uint16_t overruns;                 // number of runs it did so on
+} sched_bench;
+
+/** @brief Runs a task and then lets a random part of its synthetic run time pass, as if its work took that long
+ *
+ *  The time the task itself takes, waiting on the SPI bus for one, is counted along with the synthetic time.
+ *
+ *  @param[in] i The TASK_ number of the task
+ *  @return void
+ */
+static void sched_bench_task(uint8_t i)
+{
+	uint64_t start = avr_sim_cycles;
+	sched_bench.run[i]();
+	uint32_t cycles = rand() % sched_load[i];
+	if (i == sched_bench.overrun && tasks[i].runs % 4 == 0){
+		cycles = (uint32_t) (tasks[i].deadline + 1) * sched_tick * 64;
+		sched_bench.overruns++;
+	}
+	avr_sim_advance(cycles);
+	cycles = avr_sim_cycles - start;
+	sched_bench.total[i] += cycles;
+	if (cycles > sched_bench.worst[i])
+		sched_bench.worst[i] = cycles;
+}
+
+#define SCHED_BENCH_TASK(i) static void sched_bench_task##i(void) { sched_bench_task(i); }
+SCHED_BENCH_TASK(0)
+SCHED_BENCH_TASK(1)
+SCHED_BENCH_TASK(2)
+SCHED_BENCH_TASK(3)
+SCHED_BENCH_TASK(4)
+static void (*const sched_bench_tasks[sched_tasks])(void) = {sched_bench_task0, sched_bench_task1, sched_bench_task2,
+                                                             sched_bench_task3, sched_bench_task4};
+
+/** @brief Runs the scheduler for 10 simulated seconds and checks every task against its period, deadline and jitter
+ *
+ *  Every task is given a random synthetic run time of up to sched_load cycles on top of its own, and up to
+ *  max_load cycles are let pass after every call to schedule(), as if interrupts had taken that long.  The run
+ *  times the scheduler recorded have to match the ones the bench timed to within a Timer 3 tick per run.
+ *
+ *  With no overrun, no task should ever start later than the worst run time of all of the other tasks plus
+ *  one load step per task, since a task can wait on at most one run of each of the others.  With one, every
+ *  run which overran has to show up as a deadline miss and in the worst run time of that task.
+ *
+ *  @param[in] title Heading for the report
+ *  @param[in] max_load Longest synthetic load step between calls in cycles, 0 for none
+ *  @param[in] overrun TASK_ number of the task which overruns its deadline every 4th run, sched_tasks for none
+ *  @return void
+ */
+static void bench_scheduler_run(const char *title, uint32_t max_load, uint8_t overrun)
+{
+	struct bench b;
+	static const char *names[sched_tasks] = {"battery", "flow", "temperature", "ESB link", "GUI telemetry"};
+
+	bench_section(title);
+	srand(1);
+	uint16_t tick = schedTicks;
+	while (schedTicks == tick)
+		avr_sim_advance(16);               // start on a tick, as the tasks released at once would be late otherwise
+	schedInit();
+	memset(&sched_bench, 0, sizeof(sched_bench));
+	sched_bench.overrun = overrun;
+	for (uint8_t i = 0; i < sched_tasks; i++){
+		sched_bench.run[i] = tasks[i].run;
+		tasks[i].run = sched_bench_tasks[i];
+	}
+	uint32_t calls = 0;
+	uint64_t end = avr_sim_cycles + 10 * F_CPU;
+	bench_begin(&b, "schedule");
+	while (avr_sim_cycles < end){
+		if (!schedule())
+			avr_sim_advance(16);           // idle until the next tick
+		calls++;
+		if (max_load){
+			bench_pause(&b);
+			avr_sim_advance(rand() % max_load);
+			bench_resume(&b);
+		}
+	}
+	bench_end(&b, calls);
+	for (uint8_t i = 0; i < sched_tasks; i++){
+		tasks[i].run = sched_bench.run[i];
+	}
+
+	uint32_t others = 0;
+	for (uint8_t i = 0; i < sched_tasks; i++){
+		others += tasks[i].worstRun;
+	}
+	uint8_t pass = 1;
+	printf("    %-14s %6s %8s %6s %7s %11s %11s %11s %11s\n", "task", "period", "runs", "misses", "skipped",
+	       "worst late", "jitter max", "worst run", "mean run");
+	for (uint8_t i = 0; i < sched_tasks; i++){
+		struct task *t = &tasks[i];
+		uint32_t bound = (others - t->worstRun) + sched_tasks * (max_load / 64 + 1);   // in Timer 3 ticks
+		uint32_t expected = 10000 / t->period;
+		int64_t total = (int64_t) t->totalRun * 64 - sched_bench.total[i];
+		int32_t worst = (int32_t) t->worstRun * 64 - sched_bench.worst[i];
+		uint8_t ok = t->runs + 1 >= expected && total > -64 * (int64_t) t->runs && total < 64 * (int64_t) t->runs &&
+		             worst > -64 && worst < 2 * 64;
+		if (overrun == sched_tasks)
+			ok &= t->misses == 0 && t->skipped == 0 && t->worstLate <= bound;
+		pass &= ok;
+		printf("    %-14s %4u ms %8u %6u %7u %8.0f us %8.0f us %8.0f us %8.1f us %s\n", names[i], t->period, t->runs,
+		       t->misses, t->skipped, t->worstLate * 4.0, bound * 4.0, t->worstRun * 4.0,
+		       t->runs ? t->totalRun * 4.0 / t->runs : 0.0, ok ? "" : "<- out of bounds");
+	}
+	if (overrun == sched_tasks){
+		printf("    run times recorded, jitter and deadlines: %s\n", bench_check(pass));
+	}
+	else{
+		struct task *t = &tasks[overrun];
+		printf("    %s overran its %u ms deadline %u times, %u misses recorded: %s\n", names[overrun], t->deadline,
+		       sched_bench.overruns, t->misses,
+		       bench_check(pass && sched_bench.overruns && t->misses == sched_bench.overruns &&
+		                   t->worstRun > t->deadline * sched_tick));
+	}
+}
+
+static void bench_scheduler(void)
+{
+	bench_scheduler_run("Scheduler, task run times only", 0, sched_tasks);
+	bench_scheduler_run("Scheduler, synthetic load of up to 200 us between calls", 3200, sched_tasks);
+	bench_scheduler_run("Scheduler, temperature task overrunning every 4th run", 0, TASK_TEMP);
+}
+
+static void bench_ethernet(void)
+{
+	static uint8_t payload[MAX_DATA_LEN];
+
+	for (uint16_t i = 0; i < sizeof(payload); i++){
+		payload[i] = i;
+	}
+
+	enc28j60_sim_init();
+	SPCR = (1 << SPE) | (1 << MSTR);
+	SPSR = (1 << SPI2X);                   // full speed SPI, F_CPU / 2
+	CSPASSIVE;
+	InitEthernet();
+
+	bench_section("Ethernet (ENC28J60, SPI at F_CPU/2)");
+	bench_eth_send(payload, 100);
+	memcpy(wire, eth_test_sent, eth_test_sent_len);
+	bench_eth_receive(wire, eth_test_sent_len);
+	bench_eth_bulk(payload);
+	bench_eth_dma(payload);
+	bench_eth_filter();
+	bench_eth_link();
+
+	bench_section("UDP telemetry to the GUI (ENC28J60 DMA checksums)");
+	bench_network((const uint8_t *) GUIframe[0], GUI_FRAME_LEN);
+	doTransmit = 1;
+	bench_failover(tasks[TASK_GUI].run, GUI_FRAME_LEN);
+}
+
+int main(void)
+{
+	boot();
+	bench_parity();
+	bench_links();
+	bench_sensors();
+	bench_scheduler();
+	bench_ethernet();
+	return bench_result();
+}
@@ -0,0 +1,510 @@
+/** @file esb_bench.c
+ *  @author Nick Moore
+ *  @date October 15, 2026
+ *  @brief Host benchmarks of the ESB firmware running against the simulated ATmega2561
+ *
+ *  @bug No known bugs
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "ESB_funcs.h"
+#include "Ethernet.h"
+#include "avr_sim.h"
+#include "enc28j60_sim.h"
+#include "max6675_sim.h"
+#include "bench.h"
+#include "link_test.h"
+#include "eth_test.h"
+
+void INT2_vect(void);
+void TIMER4_OVF_vect(void);
+void TIMER4_COMPA_vect(void);
+void TIMER5_OVF_vect(void);
+void SPI_STC_vect(void);
+void USART0_RX_vect(void);
+void USART0_UDRE_vect(void);
+
+//! Hall effect pulse period at a given RPM, two pulses per revolution
+#define HALL_PULSE_CYCLES(rpm) ((uint64_t) (F_CPU * 60.0 / (2 * (rpm))))
+
+static int hall_sensor;                     // interrupt source driving INT2
+static uint8_t wire[4096];
+
+/** @brief Brings the simulated ESB up to the point where the main loop would start
+ *
+ *  @param void
+ *  @return void
+ */
+static void boot(void)
+{
+	avr_sim_reset();
+	max6675_sim_init(500 * 4);
+	avr_sim_timer_isr(4, TOV4, TIMER4_OVF_vect);
+	avr_sim_timer_isr(4, OCF4A, TIMER4_COMPA_vect);
+	avr_sim_timer_isr(5, TOV5, TIMER5_OVF_vect);
+	avr_sim_spi_isr(SPI_STC_vect);
+	avr_sim_usart_udre(0, USART0_UDRE_vect);
+	Initial();
+	connected = 1;
+	hall_sensor = avr_sim_add_source(INT2_vect, HALL_PULSE_CYCLES(10000), &EIMSK, INT2);
+}
+
+/** @brief Lets the simulation run until a USART's data register empty interrupt has nothing left to send
+ *
+ *  @param[in] ucsrb UCSRnB of the USART
+ *  @return void
+ */
+static void drain_tx(volatile uint8_t *ucsrb)
+{
+	while (*ucsrb & (1 << UDRIE0))
+		avr_sim_advance(64);
+}
+
+/** @brief Opens the fuel solenoid half way and starts the connection watchdog, so a shutdown has something to stop
+ *
+ *  @param void
+ *  @return void
+ */
+static void engine_running(void)
+{
+	setPWM();
+	OCR1B = ICR1 / 2;
+	TCCR1B |= (1 << CS12);                 // the fuel solenoid PWM, as fuel_puffs() starts it
+	TCNT5 = ECU_timer_val;
+	TCCR5B = (1 << CS52);                  // the connection watchdog, as started by the ECU handshake
+}
+
+/** @brief Checks that a shutdown stopped the fuel solenoid PWM and left the connection watchdog running
+ *
+ *  @param void
+ *  @return uint8_t 1 if it did
+ */
+static uint8_t engine_stopped(void)
+{
+	uint8_t ok = !(TCCR1B & 0x07) && !(TCCR1A & ((1 << COM1B1) | (1 << COM1B0))) && (TCCR5B & (1 << CS52));
+	TCCR5B = 0;
+	return ok;
+}
+
+static void bench_link(void)
+{
+	struct bench b;
+
+	bench_section("Serial link");
+	bench_begin(&b, "package_message (status payload)");
+	for (uint32_t i = 0; i < 1000000; i++){
+		opMode = i;
+		package_message();
+	}
+	bench_end(&b, 1000000);
+
+	struct link_rx ECUside;
+	avr_sim_usart_log(0, wire, sizeof(wire));
+	linkInit(&ECUside);
+	uint16_t intact = 0;
+	bench_begin(&b, "sendToECU (18 byte status frame)");
+	for (uint32_t i = 0; i < 1000; i++){
+		sendToECU(LINK_ESB_DATA, ECUtransmit, allData);
+		bench_pause(&b);
+		drain_tx(&UCSR0B);
+		uint16_t len = avr_sim_usart_log(0, wire, sizeof(wire));
+		for (uint16_t j = 0; j < len; j++){
+			linkPush(&ECUside, wire[j]);
+			if (linkPoll(&ECUside) && ECUside.frame.type == LINK_ESB_DATA &&
+			    !memcmp(ECUside.frame.payload, ECUtransmit, allData))
+				intact++;
+		}
+		bench_resume(&b);
+	}
+	bench_end(&b, 1000);
+	printf("    %u of 1000 frames reached the ECU intact, %u lost by sequence\n", intact, ECUside.stats.lost);
+
+	uint8_t on = (sendToECU(LINK_ESB_DATA, ECUtransmit, allData), SREG & 0x80);   // the I bit
+	cli();
+	sendToECU(LINK_ACK, &intact, LINK_ACK_LEN);      // as USART0_RX_vect acknowledges a command
+	uint8_t off = !(SREG & 0x80);
+	sei();
+	drain_tx(&UCSR0B);
+	avr_sim_usart_log(0, wire, sizeof(wire));
+	printf("    sent from the UDRE interrupt, interrupts left as they were found: %s\n",
+	       bench_check(intact == 1000 && on && off));
+
+	bench_link_stream("USART0_RX_vect (ECU data frames)", 0, USART0_RX_vect, &ECUlink, LINK_ECU_DATA);
+}
+
+/** @brief Floating point version of throttle(), the reference for the fixed point one
+ *
+ *  This is the original float math with its integer casts taken out, which wrapped the flow error to 8 bits.
+ *
+ *  @param[in] throttle Throttle value 0-255
+ *  @param[in] flow Measured mass flow in g/s
+ *  @param[out] reached Set to 1 when the flow is within errorAllow of the desired flow
+ *  @return int16_t Counts OCR3B is moved down by
+ */
+static int16_t throttle_float(uint8_t throttle, float flow, uint8_t *reached)
+{
+	float pulse_flow = (1.0 / density) * K_factor * max_time / 1000;
+	float V_per_pulse = pump_m / pulse_flow;
+	float desMFlow = 4.8 * ((float) throttle / 255.0);
+	float pulse_error = (desMFlow - flow) * pulse_flow;
+	float difference = flow - desMFlow;
+	if (difference < 0)
+		difference = -difference;
+	*reached = difference < errorAllow;
+	return (int16_t) (pulse_error * V_per_pulse * ((float) ICR3 / pump_tot_V));
+}
+
+static void bench_control(void)
+{
+	struct bench b;
+	volatile int16_t sink = 0;
+	uint8_t reached;
+
+	bench_section("Control");
+	setPWM();
+	OCR3B = ICR3 / 2;
+	massFlow.f = 1.2;
+	bench_begin(&b, "throttle (fixed point)");
+	for (uint32_t i = 0; i < 1000000; i++){
+		throttle_val = i;
+		massFlow.c[0] = i >> 8;
+		throttle();
+	}
+	bench_end(&b, 1000000);
+
+	bench_begin(&b, "throttle reference (float)");
+	for (uint32_t i = 0; i < 1000000; i++){
+		massFlow.c[0] = i >> 8;
+		sink += throttle_float(i, massFlow.f, &reached);
+	}
+	bench_end(&b, 1000000);
+	(void) sink;
+
+	// every throttle setting against flows from 0 to 6 g/s in 1 mg/s steps.  The counts have to agree to within
+	// 2 counts or 0.05%, as the float version truncates toward zero and the fixed point one truncates the flow
+	// and floors the result, and the in-tolerance decision has to agree everywhere but within 1 mg/s of errorAllow
+	int32_t worst = 0;
+	uint32_t mismatched = 0, out = 0, cases = 0;
+	for (uint16_t t = 0; t < 256; t++){
+		for (uint16_t mg = 0; mg <= 6000; mg++){
+			massFlow.f = mg / 1000.0;
+			throttle_val = t;
+			opMode = 3;
+			uint16_t before = OCR3B = 20000;
+			throttle();
+			int16_t reference = throttle_float(t, massFlow.f, &reached);
+			int32_t diff = (int16_t) (before - OCR3B) - reference;
+			if (diff < 0)
+				diff = -diff;
+			if (diff > worst)
+				worst = diff;
+			if (diff > 2 && diff > abs(reference) / 2000)
+				out++;
+			float margin = fabsf(massFlow.f - 4.8f * t / 255) - errorAllow;
+			if ((opMode == 8) != reached && fabsf(margin) > 0.001)
+				mismatched++;
+			cases++;
+		}
+	}
+	printf("    against the float reference over %u cases: worst difference %d OCR3B counts of %u, %u outside tolerance, %u decisions differ\n",
+	       cases, worst, ICR3, out, mismatched);
+	printf("    fixed point matches the reference: %s\n", bench_check(!out && !mismatched));
+	shutdown();
+}
+
+/** @brief Reads the thermocouple once, a conversion after the last read, as TIMER4_COMPA_vect does every period
+ *
+ *  @param void
+ *  @return void
+ */
+static void egt_read(void)
+{
+	avr_sim_advance(tc_conversion * 64);
+	EGT_collect();
+	while (SPCR & (1 << SPIE))
+		avr_sim_advance(16);
+}
+
+/** @brief Times the thermocouple read and checks it over the MAX6675's range, open, over temperature and moved by a connection
+ *
+ *  @param void
+ *  @return void
+ */
+static void bench_egt(void)
+{
+	struct bench b;
+	uint8_t raw[2] = {0x3E, 0x80};
+
+	bench_section("Exhaust gas temperature");
+	bench_begin(&b, "getTemp");
+	for (uint32_t i = 0; i < 1000000; i++){
+		raw[1] = i & 0xF8;
+		getTemp(raw);
+	}
+	bench_end(&b, 1000000);
+
+	TIMSK4 &= ~(1 << OCIE4A);              // the reads are started here rather than by the sampling period
+	uint16_t skipped = tcSkipped;
+	max6675_sim_init(500 * 4);
+	bench_begin(&b, "EGT_collect (starts the read for SPI_STC_vect)");
+	for (uint32_t i = 0; i < 1000; i++){
+		bench_pause(&b);
+		avr_sim_advance(tc_conversion * 64);
+		bench_resume(&b);
+		EGT_collect();
+		bench_pause(&b);
+		while (SPCR & (1 << SPIE))
+			avr_sim_advance(16);
+		bench_resume(&b);
+	}
+	bench_end(&b, 1000);
+	uint8_t ok = max6675_sim_stats.reads == 1000 && !max6675_sim_stats.early_reads && tcSkipped == skipped;
+	printf("    EGT = %u.%02u C, %u reads and none cut a conversion short, no waiting on SPIF: %s\n", EGT >> egt_frac,
+	       (EGT & 3) * 25, max6675_sim_stats.reads, bench_check(ok && EGT == 500 * 4));
+
+	uint16_t wrong = 0;
+	for (uint16_t t = 0; t < 4096; t++){
+		max6675_sim_set(t, 0);
+		egt_read();
+		package_message();
+		float sent;
+		memcpy(&sent, ECUtransmit + 3, sizeof(sent));
+		uint16_t want = t ? t : 1;
+		wrong += EGT != want || sent != want / 4.0f;
+	}
+	max6675_sim_set(300 * 4, 1);
+	egt_read();
+	uint8_t open = EGT == 0;
+	printf("    readings wrong at %u of 4096 quarter degrees from 0 to 1023.75 C, open thermocouple read as 0: %s\n",
+	       wrong, bench_check(!wrong && open));
+
+	startUpLockOut = 0;
+	opMode = 3;
+	engine_running();
+	max6675_sim_set(701 * 4, 0);
+	egt_read();
+	ok = startUpLockOut && opMode == 4;
+	uint8_t stopped = engine_stopped();
+	max6675_sim_set(500 * 4, 0);
+	egt_read();
+	printf("    701 C shuts the engine down as soon as it is read: %s\n", bench_check(ok));
+	printf("    fuel solenoid PWM stopped and connection watchdog left running: %s\n", bench_check(stopped));
+
+	uint32_t reads = max6675_sim_stats.reads;
+	skipped = tcSkipped;
+	OCR4A = TCNT4 + hall_window;           // back to a period a whole window after the last read
+	TIFR4 &= ~(1 << OCF4A);
+	TIMSK4 |= (1 << OCIE4A);
+	for (uint8_t i = 0; i < 40; i++){
+		avr_sim_advance(F_CPU / 4);
+		if (i % 10 == 5){
+			uint32_t stamp = tcStamp;
+			while (tcStamp == stamp)
+				avr_sim_advance(64);       // right after a read, as the phase can be moved at any time
+			cli();
+			OCR4A = TCNT4 + hall_phase;    // moved by an ECU connection, as ECUframe() does
+			sei();
+		}
+	}
+	reads = max6675_sim_stats.reads - reads;
+	skipped = tcSkipped - skipped;
+	ok = !max6675_sim_stats.early_reads && skipped == 4 && reads >= 35;
+	printf("    10 s of sampling periods moved 4 times by a connection: %u reads, %u skipped, none cut short: %s\n",
+	       reads, skipped, bench_check(ok));
+}
+
+static void bench_hall(void)
+{
+	bench_section("Hall effect RPM");
+	static const uint16_t speeds[] = {10000, 35000, 60000, 1000};
+	for (uint8_t i = 0; i < sizeof(speeds) / sizeof(speeds[0]); i++){
+		avr_sim_set_period(hall_sensor, HALL_PULSE_CYCLES(speeds[i]));
+		avr_sim_advance(F_CPU / 2);        // let the moving average fill at the new speed
+		double error = 0;
+		for (uint32_t j = 0; j < 1000; j++){
+			avr_sim_advance(F_CPU / 1000);
+			double e = (double) hallEffect - speeds[i];
+			if (e < 0)
+				e = -e;
+			if (e > error)
+				error = e;
+		}
+		printf("    %5u RPM: hallEffect = %5u, worst error %.0f RPM over 1 s, a new value every %.2f ms\n",
+		       speeds[i], hallEffect, error, HALL_PULSE_CYCLES(speeds[i]) * 1e3 / F_CPU);
+	}
+
+	avr_sim_set_period(hall_sensor, HALL_PULSE_CYCLES(60000));
+	avr_sim_advance(F_CPU / 2);
+	startUpLockOut = 0;
+	opMode = 3;
+	engine_running();
+	uint64_t start = avr_sim_cycles;
+	avr_sim_set_period(hall_sensor, HALL_PULSE_CYCLES(70000));
+	while (!startUpLockOut && avr_sim_cycles - start < F_CPU)
+		avr_sim_advance(16);
+	printf("    overspeed trip 60000 -> 70000 RPM: shut down after %.2f ms (the 0.25 s window took up to 250 ms)\n",
+	       (avr_sim_cycles - start) * 1e3 / F_CPU);
+	printf("    fuel solenoid PWM stopped and connection watchdog left running: %s\n",
+	       bench_check(startUpLockOut && engine_stopped()));
+
+	avr_sim_remove_source(hall_sensor);
+	start = avr_sim_cycles;
+	while (hallEffect && avr_sim_cycles - start < 2 * F_CPU)
+		avr_sim_advance(16);
+	printf("    shaft stopped: hallEffect = %u after %.0f ms\n", hallEffect, (avr_sim_cycles - start) * 1e3 / F_CPU);
+	hall_sensor = avr_sim_add_source(INT2_vect, HALL_PULSE_CYCLES(10000), &EIMSK, INT2);
+}
+
+/** @brief One pass through the while (1) in ACES_ESB/main.c
+ *
+ *  @param void
+ *  @return void
+ */
+static void main_loop_iteration(void)
+{
+	if (connected){
+		if (opMode == 1){}
+		else if (opMode == 2 || startState)
+			startup();
+		else if (opMode == 3)
+			throttle();
+		else if (opMode == 5)
+			coolingMode();
+
+		if (hallDone){
+			package_message();
+			sendToECU(LINK_ESB_DATA, ECUtransmit, allData);
+		}
+	}
+}
+
+/** @brief Runs a whole engine start from the main loop while the ECU keeps sending its normal data
+ *
+ *  The engine is modelled by setting the hall effect rate and EGT as each stage is entered: the starter motor
+ *  holds the compressor at 10000 RPM, ignition brings the EGT to 300 C, and the engine is at 40000 RPM once
+ *  the fuel solenoid is open.
+ *
+ *  @param void
+ *  @return void
+ */
+static void bench_startup(void)
+{
+	static const uint8_t data[LINK_ECU_DATA_LEN] = {0x00, 0x00, 0x40, 0x66, 0x66, 0x26, 0x41, 0x00};
+	uint8_t frame[LINK_FRAME_MAX];
+	uint8_t seq = 0;
+
+	bench_section("Startup sequence (main loop with the ECU link running)");
+	avr_sim_remove_source(hall_sensor);
+	max6675_sim_set(20 * 4, 0);
+	avr_sim_advance(F_CPU);                // the engine is stopped and cold
+	connected = 1;
+	opMode = 6;
+	TCNT5 = ECU_timer_val;
+	TCCR5B = (1 << CS52);                  // the connection watchdog, as started by the ECU handshake
+	uint8_t size = linkBuild(frame, LINK_STARTUP, seq++, 0, LINK_STARTUP_LEN);
+	for (uint8_t j = 0; j < size; j++){
+		avr_sim_usart_rx(0, frame[j], USART0_RX_vect);
+	}
+	avr_sim_usart_log(0, wire, sizeof(wire));
+
+	uint64_t start = avr_sim_cycles;
+	uint64_t next_frame = start;
+	uint64_t worst_pass = 0;
+	uint64_t worst_step = 0;
+	uint32_t frames = 0;
+	uint16_t telemetry = 0;
+	struct link_rx ECUside;
+	linkInit(&ECUside);
+	uint8_t stage = START_IDLE;
+	while ((opMode == 2 || startState) && avr_sim_cycles - start < 60 * F_CPU){
+		if (startState != stage){
+			stage = startState;
+			if (stage == START_COMPRESSOR){
+				hall_sensor = avr_sim_add_source(INT2_vect, HALL_PULSE_CYCLES(10000), &EIMSK, INT2);
+			}
+			else if (stage == START_FUEL){
+				max6675_sim_set(300 * 4, 0);
+			}
+			else if (stage == START_SOAK){
+				avr_sim_set_period(hall_sensor, HALL_PULSE_CYCLES(40000));
+			}
+		}
+		if (stage == START_FUEL && startStep == fuel_steps - 1){
+			avr_sim_set_period(hall_sensor, HALL_PULSE_CYCLES(40000));
+		}
+
+		uint64_t pass = avr_sim_cycles;
+		uint8_t sends = hallDone;
+		main_loop_iteration();
+		pass = avr_sim_cycles - pass;
+		if (pass > worst_pass)
+			worst_pass = pass;
+		if (!sends && pass > worst_step)
+			worst_step = pass;
+
+		if (avr_sim_cycles >= next_frame){
+			size = linkBuild(frame, LINK_ECU_DATA, seq++, data, LINK_ECU_DATA_LEN);
+			for (uint8_t j = 0; j < size; j++){
+				avr_sim_usart_rx(0, frame[j], USART0_RX_vect);
+			}
+			frames++;
+			next_frame += F_CPU / 4;
+		}
+		uint16_t len = avr_sim_usart_log(0, wire, sizeof(wire));
+		for (uint16_t j = 0; j < len; j++){
+			linkPush(&ECUside, wire[j]);
+			if (linkPoll(&ECUside) && ECUside.frame.type == LINK_ESB_DATA)
+				telemetry++;
+		}
+		avr_sim_advance(F_CPU / 10000);
+	}
+	printf("    start took %.1f s and ended with opMode %u (10 is idle), connected = %u\n",
+	       (double) (avr_sim_cycles - start) / F_CPU, opMode, connected);
+	printf("    %u ECU frames received and %u telemetry frames sent during the start\n", frames, telemetry);
+	printf("    longest main loop pass %.1f us (sending telemetry), longest startup step %.1f us\n",
+	       worst_pass * 1e6 / F_CPU, worst_step * 1e6 / F_CPU);
+	TCCR5B = 0;
+	shutdown();
+}
+
+static void bench_ethernet(void)
+{
+	static uint8_t payload[MAX_DATA_LEN];
+
+	for (uint16_t i = 0; i < sizeof(payload); i++){
+		payload[i] = i;
+	}
+
+	TIMSK4 &= ~(1 << OCIE4A);              // no EGT reads, the ENC28J60 is the only slave on the simulated bus
+	enc28j60_sim_init();
+	SPCR = (1 << SPE) | (1 << MSTR);
+	SPSR = (1 << SPI2X);                   // full speed SPI, F_CPU / 2
+	CSPASSIVE;
+	InitEthernet();
+
+	bench_section("Ethernet (ENC28J60, SPI at F_CPU/2)");
+	bench_eth_send(payload, 100);
+	memcpy(wire, eth_test_sent, eth_test_sent_len);
+	bench_eth_receive(wire, eth_test_sent_len);
+	bench_eth_bulk(payload);
+	bench_eth_dma(payload);
+	bench_eth_filter();
+	bench_eth_link();
+}
+
+int main(void)
+{
+	boot();
+	bench_link();
+	bench_control();
+	bench_egt();
+	bench_hall();
+	bench_startup();
+	bench_ethernet();
+	return bench_result();
+}
@@ -0,0 +1,670 @@
+/** @file eth_test.h
+ *  @author Nick Moore
+ *  @date October 15, 2026
+ *  @brief Benchmarks of the ENC28J60 transmit and receive paths shared by the ECU and ESB benchmarks
+ *
+ *  Expects the firmware's Ethernet.h to have been included and InitEthernet() to have been run against
+ *  the ENC28J60 model.
+ *
+ *  @bug No known bugs
+ */
+
+#ifndef ETH_TEST_H_
+#define ETH_TEST_H_
+
+#include <stdio.h>
+#include <string.h>
+#include "enc28j60_sim.h"
+#include "bench.h"
+
+void INT6_vect(void);
+
+#define ETH_TEST_BURST (3 * RX_QUEUE_LEN)     // more than the queue holds, so the ISR has to stall and resume
+#define ETH_TEST_HEADER 14                    // both MAC addresses and the length field
+#define ETH_TEST_CONTROL (TX_HEADER_LEN - ETH_TEST_HEADER)   // 1 if packetSend takes the control byte in front
+#define ETH_TEST_FULL (ETH_TEST_HEADER + MAX_DATA_LEN)       // longest frame, which with its CRC is MAX_FRAMELEN
+
+#define ETH_TEST_STREAM 1000                  // frames in each of the streaming runs
+#define ETH_TEST_BULK 32768                   // bytes of data in the bulk transfers
+#define ETH_TEST_SMALL 64                     // data in each frame of the small frame bulk transfer
+
+static uint8_t eth_test_sent[1600];
+static uint16_t eth_test_sent_len;
+static uint16_t eth_test_lens[ETH_TEST_STREAM]; // data length of each frame of a streaming run
+static const uint8_t *eth_test_data;            // data the frames of a streaming run were made from
+static uint16_t eth_test_next;                  // number of the next frame expected on the wire
+static uint16_t eth_test_good;                  // frames which came out whole and in order
+static uint8_t eth_test_mac[6];                 // the board's MAC address, as it sends it
+static const uint8_t eth_test_peer[6] = {0x02, 0x50, 0x45, 0x45, 0x52, 0x00};
+
+//! Keeps the last frame the simulated ENC28J60 put on the wire, and checks it against the streaming run
+static void eth_test_capture(const uint8_t *frame, uint16_t len)
+{
+	memcpy(eth_test_sent, frame, len);
+	eth_test_sent_len = len;
+	if (eth_test_next < ETH_TEST_STREAM){
+		uint16_t n = eth_test_lens[eth_test_next];
+		if (len == ETH_TEST_HEADER + n && frame[ETH_TEST_HEADER] == (uint8_t) eth_test_next &&
+		    !memcmp(frame + ETH_TEST_HEADER + 1, eth_test_data + 1, n - 1))
+			eth_test_good++;
+	}
+	eth_test_next++;
+}
+
+//! Checks frames sent by packetEcho() went back to the peer from the board, and then as eth_test_capture does
+static void eth_test_echoed(const uint8_t *frame, uint16_t len)
+{
+	if (!memcmp(frame, eth_test_peer, 6) && !memcmp(frame + 6, eth_test_mac, 6))
+		eth_test_capture(frame, len);
+	else
+		eth_test_next++;
+}
+
+//! Counts frames which are the same as the one in eth_test_sent
+static void eth_test_repeat(const uint8_t *frame, uint16_t len)
+{
+	if (len == eth_test_sent_len && !memcmp(frame, eth_test_sent, len))
+		eth_test_good++;
+	eth_test_next++;
+}
+
+/** @brief Reference Internet checksum, a byte at a time
+ *
+ *  @param[in] data The bytes
+ *  @param[in] len Number of bytes
+ *  @return uint16_t The checksum, as the DMA gives it
+ */
+static uint16_t eth_test_checksum(const uint8_t *data, uint16_t len)
+{
+	uint32_t sum = 0;
+	for (uint16_t i = 0; i < len; i++){
+		sum += (i & 1) ? data[i] : data[i] << 8;
+	}
+	while (sum >> 16)
+		sum = (sum & 0xFFFF) + (sum >> 16);
+	return ~sum & 0xFFFF;
+}
+
+/** @brief Lets the simulation run until both transmit slots are empty
+ *
+ *  @param void
+ *  @return void
+ */
+static void eth_test_flush(void)
+{
+	while (txOnWire != TX_NONE || txPending != TX_NONE)
+		avr_sim_advance(64);
+}
+
+/** @brief Sends a frame with packetSendData(), waiting for a free transmit slot if both are busy
+ *
+ *  @param[in] data The data to send
+ *  @param[in] len Number of bytes of data
+ *  @return void
+ */
+static void eth_test_send(const uint8_t *data, uint16_t len)
+{
+	while (!packetSendData(data, len))
+		avr_sim_advance(64);
+}
+
+/** @brief Streams frames of random length back to back, numbering each in its first data byte
+ *
+ *  The frame is rewritten in the same buffer as soon as packetSendData() has taken the last one.
+ *
+ *  @param[in] data The data to send, at least len bytes of buffer
+ *  @param[in] len Longest frame data
+ *  @return uint16_t Number of frames which reached the wire whole and in order
+ */
+static uint16_t eth_test_stream(uint8_t *data, uint16_t len)
+{
+	uint8_t first = data[0];
+
+	eth_test_data = data;
+	eth_test_next = 0;
+	eth_test_good = 0;
+	enc28j60_sim_on_transmit(eth_test_capture);
+	for (uint16_t i = 0; i < ETH_TEST_STREAM; i++){
+		eth_test_lens[i] = 1 + rand() % len;
+		data[0] = i;
+		eth_test_send(data, eth_test_lens[i]);
+	}
+	eth_test_flush();
+	enc28j60_sim_on_transmit(0);
+	data[0] = first;
+	return eth_test_good;
+}
+
+/** @brief Measures and checks the transmit path
+ *
+ *  This performs the following functions:
+ *  1) Times single frames from packetSendData() to the end of their time on the wire
+ *  2) Times a stream of frames sent back to back, which the second transmit slot lets overlap the wire
+ *  3) Streams frames of random length and checks they all go out whole and in order, so the slots'
+ *     ETXST and ETXND have to keep up with every send
+ *  4) Streams them again with transmit errors injected, which the ISR has to recover from and resend
+ *
+ *  The last frame sent is the full length one, and is left in eth_test_sent for the receive benchmark.
+ *
+ *  @param[in,out] data The data to send, whose first byte is used as a frame number in the checks
+ *  @param[in] len Number of bytes of data
+ *  @return void
+ */
+static void bench_eth_send(uint8_t *data, uint16_t len)
+{
+	struct bench b;
+	char name[48];
+
+	avr_sim_ext_isr(Ethernet_INT, INT6_vect);
+	enc28j60_sim_attach_int(Ethernet_INT);
+
+	uint32_t transactions = enc28j60_sim_stats.transactions;
+	snprintf(name, sizeof(name), "packetSendData (%u byte frame, one at a time)", ETH_TEST_HEADER + len);
+	bench_begin(&b, name);
+	for (uint32_t i = 0; i < 1000; i++){
+		eth_test_send(data, len);
+		eth_test_flush();
+	}
+	double single = bench_end(&b, 1000);
+	printf("    %.0f frames/s, %.1f SPI transactions/frame\n", F_CPU / single,
+	       (enc28j60_sim_stats.transactions - transactions) / 1000.0);
+
+	transactions = enc28j60_sim_stats.transactions;
+	snprintf(name, sizeof(name), "packetSendData (%u byte frame, streamed)", ETH_TEST_HEADER + len);
+	bench_begin(&b, name);
+	for (uint32_t i = 0; i < 1000; i++){
+		eth_test_send(data, len);
+	}
+	eth_test_flush();
+	double streamed = bench_end(&b, 1000);
+	printf("    %.0f frames/s, %.1f SPI transactions/frame, %.2fx one at a time\n", F_CPU / streamed,
+	       (enc28j60_sim_stats.transactions - transactions) / 1000.0, single / streamed);
+
+	uint16_t correct = eth_test_stream(data, len);
+	printf("    %u of %u streamed frames of random length sent whole and in order: %s\n", correct, ETH_TEST_STREAM,
+	       bench_check(correct == ETH_TEST_STREAM));
+
+	uint16_t errors = txErrors;
+	uint32_t aborted = enc28j60_sim_stats.frames_aborted;
+	enc28j60_sim_fail_tx(7);
+	correct = eth_test_stream(data, len);
+	enc28j60_sim_fail_tx(0);
+	errors = txErrors - errors;
+	aborted = enc28j60_sim_stats.frames_aborted - aborted;
+	printf("    %u of %u transmit errors recovered, %u of %u frames sent whole and in order: %s\n", errors,
+	       (uint16_t) aborted, correct, ETH_TEST_STREAM, bench_check(correct == ETH_TEST_STREAM && errors && errors == aborted));
+
+	eth_test_next = ETH_TEST_STREAM;       // leave a full length frame in eth_test_sent, unchecked
+	enc28j60_sim_on_transmit(eth_test_capture);
+	eth_test_send(data, len);
+	eth_test_flush();
+	enc28j60_sim_on_transmit(0);
+}
+
+/** @brief Times a bulk transfer sent in frames of one size, as a long log download would be
+ *
+ *  @param[in] data The data to send, at least chunk bytes of it
+ *  @param[in] chunk Bytes of data in each frame
+ *  @return double Simulated cycles per byte of data
+ */
+static double eth_test_bulk(const uint8_t *data, uint16_t chunk)
+{
+	struct bench b;
+	char name[48];
+	uint16_t frames = (ETH_TEST_BULK + chunk - 1) / chunk;
+	uint16_t wire = (ETH_TEST_HEADER + chunk < 60 ? 60 : ETH_TEST_HEADER + chunk) + 4 + 8 + 12;
+
+	snprintf(name, sizeof(name), "bulk transfer (%u byte frames)", ETH_TEST_HEADER + chunk);
+	bench_begin(&b, name);
+	for (uint16_t i = 0; i < frames; i++){
+		eth_test_send(data, chunk);
+	}
+	eth_test_flush();
+	double cycles = bench_end(&b, frames) / chunk;
+	printf("    %.0f bytes/s of data, %.1f%% of the wire spent on framing\n", F_CPU / cycles,
+	       100.0 * (wire - chunk) / wire);
+	return cycles;
+}
+
+/** @brief Measures bulk transfers in full length frames against small ones, and checks a full length frame
+ *  makes it through the receive path in one piece
+ *
+ *  @param[in,out] data MAX_DATA_LEN bytes to send, whose first byte is changed
+ *  @return void
+ */
+static void bench_eth_bulk(uint8_t *data)
+{
+	static uint8_t received[MAX_FRAMELEN + 1];      // room for the null terminator readBuffer adds
+
+	double small = eth_test_bulk(data, ETH_TEST_SMALL);
+	double full = eth_test_bulk(data, MAX_DATA_LEN);
+	printf("    %.2fx the throughput of %u byte frames with MAX_FRAMELEN at %u\n", small / full,
+	       ETH_TEST_HEADER + ETH_TEST_SMALL, MAX_FRAMELEN);
+
+	eth_test_next = ETH_TEST_STREAM;       // capture without checking
+	enc28j60_sim_on_transmit(eth_test_capture);
+	data[0] = 0x5A;
+	eth_test_send(data, MAX_DATA_LEN);
+	eth_test_flush();
+	enc28j60_sim_on_transmit(0);
+	memcpy(eth_test_sent, eth_test_sent + 6, 6);     // back to the board, past its unicast filter
+	enc28j60_sim_inject(eth_test_sent, eth_test_sent_len);
+	avr_sim_advance(0);
+	uint16_t got = packetRecieve(MAX_FRAMELEN, received);
+	uint16_t field = eth_test_sent[ETH_TEST_HEADER - 2] << 8 | eth_test_sent[ETH_TEST_HEADER - 1];
+	uint8_t ok = got >= eth_test_sent_len && !memcmp(received, eth_test_sent, eth_test_sent_len) && field == MAX_DATA_LEN;
+	printf("    length field %u for %u bytes of data\n", field, MAX_DATA_LEN);
+	printf("    %u byte frame sent and received in one piece, %u too long refused: %s\n", eth_test_sent_len,
+	       !packetSendData(data, MAX_DATA_LEN + 1), bench_check(ok && !packetSendData(data, MAX_DATA_LEN + 1)));
+}
+
+/** @brief Measures and checks the paths which have the ENC28J60's DMA keep the data of a frame inside it
+ *
+ *  This performs the following functions:
+ *  1) Checks dmaChecksum() over a frame in its transmit slot, of even and odd length, against a byte at a
+ *     time reference
+ *  2) Times packetResend() of a full length frame streamed against sending it again with packetSendData(),
+ *     and checks every copy on the wire
+ *  3) Times packetEcho() of full length frames against reading each one out and sending it back, then echoes
+ *     frames of random length as the receive ring wraps and checks each went back whole and in order
+ *
+ *  @param[in,out] data MAX_DATA_LEN bytes to send, whose first byte is changed
+ *  @return void
+ */
+static void bench_eth_dma(uint8_t *data)
+{
+	struct bench b;
+	char name[48];
+	static uint8_t frame[MAX_FRAMELEN];
+	static uint8_t echo[ETH_TEST_CONTROL + MAX_FRAMELEN + 4 + 1];     // control byte, CRC and null terminator
+	const uint16_t repeats = 200;
+
+	eth_test_next = ETH_TEST_STREAM;       // capture without checking
+	enc28j60_sim_on_transmit(eth_test_capture);
+	data[0] = 0xA5;
+	eth_test_send(data, MAX_DATA_LEN);
+	eth_test_flush();
+	memcpy(eth_test_mac, eth_test_sent + 6, 6);
+	uint16_t start = TX_SLOT(txLast) + 1;
+	uint8_t ok = dmaChecksum(start, eth_test_sent_len) == eth_test_checksum(eth_test_sent, eth_test_sent_len) &&
+	             dmaChecksum(start, eth_test_sent_len - 1) == eth_test_checksum(eth_test_sent, eth_test_sent_len - 1);
+	printf("    dmaChecksum over a %u byte frame in its transmit slot: %s\n", eth_test_sent_len, bench_check(ok));
+
+	// Resending, against sending the same data again
+	uint32_t transactions = enc28j60_sim_stats.transactions;
+	uint32_t bytes = enc28j60_sim_stats.bytes;
+	snprintf(name, sizeof(name), "packetSendData (%u byte frame, streamed)", eth_test_sent_len);
+	bench_begin(&b, name);
+	for (uint16_t i = 0; i < repeats; i++){
+		eth_test_send(data, MAX_DATA_LEN);
+	}
+	eth_test_flush();
+	double sent = bench_end(&b, repeats);
+	uint32_t spi = enc28j60_sim_stats.bytes - bytes;
+	printf("    %.1f SPI transactions/frame, %.0f SPI bytes/frame\n", (enc28j60_sim_stats.transactions - transactions) /
+	       (double) repeats, spi / (double) repeats);
+
+	eth_test_good = 0;
+	enc28j60_sim_on_transmit(eth_test_repeat);
+	transactions = enc28j60_sim_stats.transactions;
+	bytes = enc28j60_sim_stats.bytes;
+	snprintf(name, sizeof(name), "packetResend (%u byte frame, streamed)", eth_test_sent_len);
+	bench_begin(&b, name);
+	for (uint16_t i = 0; i < repeats; i++){
+		while (!packetResend())
+			avr_sim_advance(64);
+	}
+	eth_test_flush();
+	double resent = bench_end(&b, repeats);
+	bytes = enc28j60_sim_stats.bytes - bytes;
+	printf("    %.1f SPI transactions/frame, %.0f SPI bytes/frame, %.2fx packetSendData, %u of %u repeated on the wire: %s\n",
+	       (enc28j60_sim_stats.transactions - transactions) / (double) repeats, bytes / (double) repeats, sent / resent,
+	       eth_test_good, repeats, bench_check(eth_test_good == repeats && bytes < spi));
+
+	// Echoing full length frames, against reading them out and sending them back
+	memcpy(frame, eth_test_mac, 6);
+	memcpy(frame + 6, eth_test_peer, 6);
+	frame[12] = eth_test_sent[12];
+	frame[13] = eth_test_sent[13];
+	memcpy(frame + ETH_TEST_HEADER, data, MAX_DATA_LEN);
+	memcpy(eth_test_sent, frame, ETH_TEST_FULL);
+	memcpy(eth_test_sent, eth_test_peer, 6);
+	memcpy(eth_test_sent + 6, eth_test_mac, 6);
+	eth_test_sent_len = ETH_TEST_FULL;
+	eth_test_good = 0;
+	bench_begin(&b, "packetRecieve and packetSend (echo)");
+	for (uint16_t i = 0; i < repeats; i++){
+		bench_pause(&b);
+		enc28j60_sim_inject(frame, ETH_TEST_FULL);
+		bench_resume(&b);
+		avr_sim_advance(0);
+		uint8_t *f = echo + ETH_TEST_CONTROL;      // echo[0] stays 0 when it is the control byte
+		uint16_t len = packetRecieve(MAX_FRAMELEN + 4, f) - 4;
+		memcpy(f, f + 6, 6);
+		memcpy(f + 6, eth_test_mac, 6);
+		while (!packetSend(len + ETH_TEST_CONTROL, echo))
+			avr_sim_advance(64);
+	}
+	eth_test_flush();
+	double copied = bench_end(&b, repeats);
+	uint16_t good = eth_test_good;
+	eth_test_good = 0;
+	bench_begin(&b, "packetEcho");
+	for (uint16_t i = 0; i < repeats; i++){
+		bench_pause(&b);
+		enc28j60_sim_inject(frame, ETH_TEST_FULL);
+		bench_resume(&b);
+		avr_sim_advance(0);
+		while (rxHead != rxTail && !packetEcho())
+			avr_sim_advance(64);
+	}
+	eth_test_flush();
+	double echoed = bench_end(&b, repeats);
+	printf("    %.2fx reading the frame out and sending it back, %u and %u of %u frames echoed: %s\n", copied / echoed,
+	       good, eth_test_good, repeats, bench_check(good == repeats && eth_test_good == repeats));
+
+	// Frames of random length, numbered in their first data byte
+	eth_test_data = data;
+	eth_test_next = 0;
+	eth_test_good = 0;
+	enc28j60_sim_on_transmit(eth_test_echoed);
+	for (uint16_t i = 0; i < ETH_TEST_STREAM; i++){
+		uint16_t n = 1 + rand() % MAX_DATA_LEN;
+		eth_test_lens[i] = n;
+		frame[ETH_TEST_HEADER] = i;
+		enc28j60_sim_inject(frame, ETH_TEST_HEADER + n);
+		avr_sim_advance(0);
+		while (rxHead != rxTail && !packetEcho())
+			avr_sim_advance(64);
+	}
+	eth_test_flush();
+	enc28j60_sim_on_transmit(0);
+	printf("    %u of %u frames of random length echoed whole and in order as the ring wrapped: %s\n", eth_test_good,
+	       ETH_TEST_STREAM, bench_check(eth_test_good == ETH_TEST_STREAM));
+	data[0] = 0;
+}
+
+//! Kinds of frame in the mixed traffic of bench_eth_filter(), the kind is carried in the last byte
+enum {ETH_TEST_OURS, ETH_TEST_UNICAST, ETH_TEST_ARP_US, ETH_TEST_ARP_OTHER, ETH_TEST_BROADCAST, ETH_TEST_GROUP,
+      ETH_TEST_OTHER_GROUP, ETH_TEST_KINDS};
+
+/** @brief Builds a minimum length frame of one kind of the mixed traffic
+ *
+ *  @param[out] frame 60 bytes for the frame
+ *  @param[in] kind One of the ETH_TEST_ kinds
+ *  @param[in] groups The multicast group passed by the hash table, then one which is not
+ *  @return void
+ */
+static void eth_test_mixed(uint8_t *frame, uint8_t kind, const uint8_t groups[2][6])
+{
+	static const uint8_t other[6] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x99};
+	static const uint8_t arp[8] = {0x08, 0x06, 0x00, 0x01, 0x08, 0x00, 0x06, 0x04};
+
+	memset(frame, 0, 60);
+	memset(frame, 0xFF, 6);
+	if (kind == ETH_TEST_OURS)
+		memcpy(frame, eth_test_mac, 6);
+	else if (kind == ETH_TEST_UNICAST)
+		memcpy(frame, other, 6);
+	else if (kind == ETH_TEST_GROUP || kind == ETH_TEST_OTHER_GROUP)
+		memcpy(frame, groups[kind - ETH_TEST_GROUP], 6);
+	memcpy(frame + 6, eth_test_peer, 6);
+	frame[12] = 0x08;                      // IPv4, unless it is ARP
+	if (kind == ETH_TEST_ARP_US || kind == ETH_TEST_ARP_OTHER){
+		memcpy(frame + 12, arp, 6);
+		memcpy(frame + 18, arp + 6, 2);
+		frame[21] = 1;                     // request
+		frame[38] = 10;
+		frame[41] = kind == ETH_TEST_ARP_US ? 2 : 3;     // target 10.0.0.2 or 10.0.0.3
+	}
+	frame[59] = kind;
+}
+
+/** @brief Checks the receive filters against mixed traffic and counts the frames which reach the MCU
+ *
+ *  The same 200 frames of every kind in ETH_TEST_ kinds are injected under each filter setting, and every
+ *  frame packetRecieve() gets has to be of a kind the setting lets in.  The MCU's time and SPI transactions
+ *  are per frame on the wire.  The board is left with the unicast filter InitEthernet() sets.
+ *
+ *  @param void
+ *  @return void
+ */
+static void bench_eth_filter(void)
+{
+	struct bench b;
+	uint8_t frame[60];
+	static uint8_t received[1600];
+	uint8_t groups[2][6] = {{0x01, 0x00, 0x5E, 0x00, 0x00, 0x01}, {0x01, 0x00, 0x5E, 0x00, 0x00, 0x02}};
+	const uint16_t count = 200;
+
+	// The second group has to land on another bit of the hash table than the first
+	struct eth_filter first = {0}, second;
+	ethFilterHash(&first, groups[0]);
+	do {
+		groups[1][5]++;
+		memset(&second, 0, sizeof(second));
+		ethFilterHash(&second, groups[1]);
+	} while (!memcmp(first.hash, second.hash, sizeof(first.hash)));
+
+	struct {
+		const char *name;
+		struct eth_filter filter;
+		uint8_t passed;                    // bit n set if kind n gets through
+	} runs[] = {
+		{"no filters", {0}, 0x7F},
+		{"unicast and broadcast", {ERXFCON_UCEN | ERXFCON_CRCEN | ERXFCON_BCEN}, 0x1D},
+		{"unicast and ARP for us", {ERXFCON_UCEN | ERXFCON_CRCEN}, 0x05},
+		{"unicast and hashed group", {ERXFCON_UCEN | ERXFCON_CRCEN}, 0x21},
+		{"broadcast AND ARP for us", {ERXFCON_BCEN | ERXFCON_ANDOR}, 0x04},
+	};
+	static const uint8_t arpMask[8] = {0x00, 0x30, 0x30, 0x00, 0xC0, 0x03, 0x00, 0x00};
+	eth_test_mixed(frame, ETH_TEST_ARP_US, groups);
+	ethFilterPattern(&runs[2].filter, 0, frame, arpMask);
+	ethFilterPattern(&runs[4].filter, 0, frame, arpMask);
+	ethFilterHash(&runs[3].filter, groups[0]);
+
+	for (uint8_t r = 0; r < sizeof(runs) / sizeof(runs[0]); r++){
+		uint16_t expected = 0, seen = 0, wrong = 0;
+		char name[48];
+
+		ethFilter(&runs[r].filter);
+		srand(7);
+		uint32_t transactions = enc28j60_sim_stats.transactions;
+		snprintf(name, sizeof(name), "mixed traffic, %s", runs[r].name);
+		bench_begin(&b, name);
+		for (uint16_t i = 0; i < count; i++){
+			uint8_t kind = rand() % ETH_TEST_KINDS;
+			expected += (runs[r].passed >> kind) & 1;
+			bench_pause(&b);
+			eth_test_mixed(frame, kind, groups);
+			enc28j60_sim_inject(frame, sizeof(frame));
+			bench_resume(&b);
+			avr_sim_advance(0);
+			while (rxHead != rxTail){
+				if (packetRecieve(sizeof(frame), received) == sizeof(frame)){
+					seen++;
+					wrong += !((runs[r].passed >> received[59]) & 1);
+				}
+				avr_sim_advance(0);
+			}
+		}
+		bench_end(&b, count);
+		printf("    %u of %u frames reached the MCU, %.1f SPI transactions/frame on the wire: %s\n", seen, count,
+		       (enc28j60_sim_stats.transactions - transactions) / (double) count,
+		       bench_check(seen == expected && !wrong));
+	}
+	const struct eth_filter unicast = {ERXFCON_UCEN | ERXFCON_CRCEN};
+	ethFilter(&unicast);
+}
+
+/** @brief Checks that the INT6 ISR follows the link as the cable is pulled and plugged back in
+ *
+ *  This performs the following functions:
+ *  1) Times a look at the link through the scan of PHSTAT2 against a full MII read of it
+ *  2) Pulls the cable and plugs it back in 100 times, with nothing in the main loop looking at the PHY, and
+ *     times how long ethLinkUp takes to follow from when the PHY reports the change
+ *  3) Checks a PHY register can still be read with the scan running, and a frame goes out once the link is back
+ *
+ *  @param void
+ *  @return void
+ */
+static void bench_eth_link(void)
+{
+	struct bench b;
+	const uint16_t count = 1000, flaps = 100;
+	uint16_t up = 0, down = 0, restored = 0;
+	uint64_t worst = 0, total = 0;
+
+	uint32_t transactions = enc28j60_sim_stats.transactions;
+	bench_begin(&b, "ethLink (scanned PHSTAT2)");
+	for (uint16_t i = 0; i < count; i++){
+		up += ethLink();
+	}
+	double scanned = bench_end(&b, count);
+	printf("    %.1f SPI transactions/call\n", (enc28j60_sim_stats.transactions - transactions) / (double) count);
+	transactions = enc28j60_sim_stats.transactions;
+	bench_begin(&b, "PhyRead (PHSTAT2)");
+	for (uint16_t i = 0; i < count; i++){
+		up += (PhyRead(PHSTAT2) & PHSTAT2_LSTAT) != 0;
+	}
+	double read = bench_end(&b, count);
+	printf("    %.1f SPI transactions/call, %.1fx the scanned read, both saw the link up: %s\n",
+	       (enc28j60_sim_stats.transactions - transactions) / (double) count, read / scanned,
+	       bench_check(up == 2 * count));
+
+	uint16_t changes = linkChanges;
+	for (uint16_t i = 0; i < flaps; i++){
+		uint64_t start = avr_sim_cycles;
+		enc28j60_sim_set_link(0);
+		while (ethLinkUp && avr_sim_cycles - start < F_CPU / 1000)
+			avr_sim_advance(16);
+		if (!ethLinkUp && !ethLink()){
+			down++;
+			total += avr_sim_cycles - start;
+			if (avr_sim_cycles - start > worst)
+				worst = avr_sim_cycles - start;
+		}
+		avr_sim_advance(F_CPU / 1000);
+		enc28j60_sim_set_link(1);
+		start = avr_sim_cycles;
+		while (!ethLinkUp && avr_sim_cycles - start < F_CPU / 1000)
+			avr_sim_advance(16);
+		restored += ethLinkUp && ethLink();
+	}
+	printf("    %u of %u drops and %u restores seen by the ISR, %.1f us mean and %.1f us worst to ethLinkUp: %s\n",
+	       down, flaps, restored, total * 1e6 / F_CPU / flaps, worst * 1e6 / F_CPU,
+	       bench_check(down == flaps && restored == flaps && linkChanges - changes == 2 * flaps));
+
+	uint8_t data[46] = {0};
+	enc28j60_sim_set_link(0);
+	avr_sim_advance(F_CPU / 1000);
+	enc28j60_sim_on_transmit(eth_test_capture);
+	eth_test_sent_len = 0;
+	eth_test_send(data, 46);
+	eth_test_flush();
+	uint16_t lost = eth_test_sent_len;
+	enc28j60_sim_set_link(1);
+	avr_sim_advance(F_CPU / 1000);
+	eth_test_send(data, 46);
+	eth_test_flush();
+	enc28j60_sim_on_transmit(0);
+	uint16_t id = PhyRead(PHHID1);
+	printf("    PHHID1 read with the scan running, frame lost while the link was down and sent once it was back: %s\n",
+	       bench_check(id == 0x0083 && phyScanning && ethLink() && !lost && eth_test_sent_len));
+}
+
+/** @brief Reads everything queued so far, letting the receive ISR run in between, and checks each packet
+ *
+ *  The first data byte of every frame carries its number, which must follow on from the last one read.
+ *
+ *  @param[in] wire The frame as injected, apart from its first data byte
+ *  @param[in] len Length of the frame
+ *  @param[in,out] expect Number of the next frame
+ *  @return uint16_t Number of frames read intact and in order
+ */
+static uint16_t eth_test_drain(const uint8_t *wire, uint16_t len, uint8_t *expect)
+{
+	static uint8_t received[1600];
+	uint16_t intact = 0;
+
+	avr_sim_advance(0);
+	while (rxHead != rxTail){
+		uint16_t got = packetRecieve(len + 4, received);
+		if (got >= len && received[ETH_TEST_HEADER] == *expect && !memcmp(received, wire, ETH_TEST_HEADER) &&
+		    !memcmp(received + ETH_TEST_HEADER + 1, wire + ETH_TEST_HEADER + 1, len - ETH_TEST_HEADER - 1))
+			intact++;
+		(*expect)++;
+		avr_sim_advance(0);
+	}
+	return intact;
+}
+
+/** @brief Measures and checks the receive path from the INT line to packetRecieve()
+ *
+ *  This performs the following functions:
+ *  1) Times packetRecieve() with nothing waiting, which must not touch the SPI bus
+ *  2) Times single frames from their arrival to being read out, and the part of that spent in the ISR
+ *  3) Delivers a burst of frames larger than the descriptor queue and checks they all come out in order
+ *  4) Overflows the receive ring and checks the overrun is counted and every frame which fit is read
+ *
+ *  @param[in,out] wire A frame as it arrives off the wire, whose first data byte is used as a frame number
+ *  @param[in] len Length of the frame
+ *  @return void
+ */
+static void bench_eth_receive(uint8_t *wire, uint16_t len)
+{
+	struct bench b;
+	char name[40];
+	static uint8_t received[1600];
+	uint8_t number = 0, expect = 0;
+
+	memcpy(wire, wire + 6, 6);             // addressed back to the board, which its unicast filter lets in
+	uint32_t transactions = enc28j60_sim_stats.transactions;
+	bench_begin(&b, "packetRecieve (nothing waiting)");
+	for (uint32_t i = 0; i < 100000; i++){
+		packetRecieve(len + 4, received);
+	}
+	bench_end(&b, 100000);
+	printf("    %.1f SPI transactions/call\n", (enc28j60_sim_stats.transactions - transactions) / 100000.0);
+
+	uint64_t isr = 0;
+	uint16_t intact = 0;
+	transactions = enc28j60_sim_stats.transactions;
+	snprintf(name, sizeof(name), "packetRecieve (%u byte frame)", len);
+	bench_begin(&b, name);
+	for (uint32_t i = 0; i < 1000; i++){
+		wire[ETH_TEST_HEADER] = number++;
+		enc28j60_sim_inject(wire, len);
+		uint64_t arrived = avr_sim_cycles;
+		avr_sim_advance(0);                // the INT edge is taken as soon as the CPU looks
+		isr += avr_sim_cycles - arrived;
+		intact += eth_test_drain(wire, len, &expect);
+	}
+	double cycles = bench_end(&b, 1000);
+	printf("    %.0f frames/s SPI bound, %.1f SPI transactions/frame, %u of 1000 frames intact\n",
+	       F_CPU / cycles, (enc28j60_sim_stats.transactions - transactions) / 1000.0, intact);
+	printf("    %.1f us from arrival to queued by the ISR\n", isr / 1000.0 * 1e6 / F_CPU);
+
+	for (uint8_t i = 0; i < ETH_TEST_BURST; i++){
+		wire[ETH_TEST_HEADER] = number++;
+		enc28j60_sim_inject(wire, len);
+	}
+	intact = eth_test_drain(wire, len, &expect);
+	printf("    burst of %u frames with a %u packet queue: %u read in order: %s\n", ETH_TEST_BURST, RX_QUEUE_LEN,
+	       intact, bench_check(intact == ETH_TEST_BURST));
+
+	// Nothing is read until the ring has filled up and a frame has been dropped
+	uint16_t overruns = rxOverruns;
+	uint32_t accepted = enc28j60_sim_stats.frames_rx;
+	uint16_t sent = 0;
+	do {
+		wire[ETH_TEST_HEADER] = number++;
+		sent++;
+	} while (enc28j60_sim_inject(wire, len));
+	accepted = enc28j60_sim_stats.frames_rx - accepted;
+	intact = eth_test_drain(wire, len, &expect);
+	printf("    ring overflow: %u of %u frames fit, %u read in order, %u overruns counted: %s\n", (uint16_t) accepted,
+	       sent, intact, rxOverruns - overruns, bench_check(intact == accepted && rxOverruns != overruns));
+}
+
+#endif /* ETH_TEST_H_ */
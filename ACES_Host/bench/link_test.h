@@ -0,0 +1,111 @@
+/** @file link_test.h
+ *  @author Nick Moore
+ *  @date October 15, 2026
+ *  @brief Benchmark of the ECU/ESB link receiver shared by the ECU and ESB benchmarks
+ *
+ *  @bug No known bugs
+ */
+
+#ifndef LINK_TEST_H_
+#define LINK_TEST_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "link.h"
+#include "bench.h"
+
+#define LINK_TEST_FRAMES 10000
+
+/** @brief Streams frames through a receive interrupt, first clean and then with faults, and checks what gets through
+ *
+ *  One frame in ten gets one fault: a flipped bit, a dropped byte or an extra byte.  No frame may come out
+ *  of the receiver with the wrong payload, and no more frames may be lost than there were faults.  A fault
+ *  nearly always costs the frame it landed in, but a frame whose last CRC byte is dropped while it happens
+ *  to equal LINK_SOF takes the next frame's start delimiter in its place and costs that frame instead.
+ *
+ *  @param[in] name Name of the receiver in the report
+ *  @param[in] port USART the frames arrive on
+ *  @param[in] isr The USART's receive interrupt
+ *  @param[in] rx The receiver the interrupt feeds
+ *  @param[in] type Type of the frames to send
+ *  @return void
+ */
+static void bench_link_stream(const char *name, uint8_t port, avr_sim_isr_t isr, struct link_rx *rx, uint8_t type)
+{
+	static uint8_t delivered[LINK_TEST_FRAMES];
+	struct bench b;
+	uint8_t len = linkLength(type);
+	uint8_t frame[LINK_FRAME_MAX + 1];
+	uint8_t payload[2][LINK_MAX_PAYLOAD];
+
+	srand(type);
+	linkInit(rx);
+	bench_begin(&b, name);
+	for (uint32_t i = 0; i < LINK_TEST_FRAMES; i++){
+		for (uint8_t j = 0; j < len; j++){
+			payload[0][j] = rand();
+		}
+		uint8_t size = linkBuild(frame, type, i, payload[0], len);
+		for (uint8_t j = 0; j < size; j++){
+			avr_sim_usart_rx(port, frame[j], isr);
+		}
+	}
+	bench_end(&b, LINK_TEST_FRAMES);
+	printf("    clean stream: %u of %u frames received\n", rx->stats.frames, LINK_TEST_FRAMES);
+	uint8_t pass = rx->stats.frames == LINK_TEST_FRAMES;
+
+	linkInit(rx);
+	memset(delivered, 0, sizeof(delivered));
+	uint32_t faults = 0, lost = 0, intact = 0, wrong = 0;
+	for (uint32_t i = 0; i < LINK_TEST_FRAMES; i++){
+		uint8_t *now = payload[i & 1];
+		for (uint8_t j = 0; j < len; j++){
+			now[j] = rand();
+		}
+		uint8_t size = linkBuild(frame, type, i, now, len);
+		uint8_t faulty = rand() % 10 == 0;
+		if (faulty){
+			uint8_t at = rand() % size;
+			switch (rand() % 3){
+				case 0:
+					frame[at] ^= 1 << (rand() % 8);
+					break;
+				case 1:
+					memmove(frame + at, frame + at + 1, size - at - 1);
+					size--;
+					break;
+				case 2:
+					memmove(frame + at + 1, frame + at, size - at);
+					frame[at] = rand();
+					size++;
+					break;
+			}
+			faults++;
+		}
+		delivered[i] = faulty ? 2 : 0;         // 2 marks a frame which was sent with a fault
+		for (uint8_t j = 0; j < size; j++){
+			uint16_t frames = rx->stats.frames;
+			avr_sim_usart_rx(port, frame[j], isr);
+			if (rx->stats.frames == frames)
+				continue;
+			// a frame can only come out while its own bytes or those of the frame after it arrive
+			uint32_t k = rx->frame.seq == (uint8_t) i ? i : i - 1;
+			if (rx->frame.seq != (uint8_t) k || memcmp(rx->frame.payload, payload[k & 1], len))
+				wrong++;
+			else
+				delivered[k] = 1;
+		}
+	}
+	for (uint32_t i = 0; i < LINK_TEST_FRAMES; i++){
+		lost += delivered[i] != 1;
+		intact += !delivered[i];
+	}
+	printf("    %u faults: %u frames received, %u CRC errors, %u length errors, %u lost by sequence, %u bytes skipped\n",
+	       faults, rx->stats.frames, rx->stats.crcErrors, rx->stats.lengthErrors, rx->stats.lost, rx->stats.skipped);
+	printf("    %u frames lost to %u faults (%u of them sent intact), bad frames let through %u: %s\n", lost, faults, intact,
+	       wrong, bench_check(pass && lost <= faults && !wrong));
+	linkInit(rx);
+}
+
+#endif /* LINK_TEST_H_ */
@@ -0,0 +1,394 @@
+/** @file net_test.h
+ *  @author Nick Moore
+ *  @date October 15, 2026
+ *  @brief A stand-in for the GUI's end of the Ethernet link, for checking and timing the ECU's network layer
+ *
+ *  The stand-in sees every frame the simulated ENC28J60 puts on the wire, the way a TAP device would.  It
+ *  answers ARP requests for its address and checks every UDP datagram sent to it as a host's IP stack would,
+ *  with its own byte at a time checksums.  It can also send datagrams and ARP requests to the ECU.  Frames
+ *  for the ECU are queued and only injected by net_test_deliver(), outside of the firmware's SPI transactions.
+ *
+ *  Expects Network.h to have been included and InitEthernet() to have been run against the ENC28J60 model
+ *  with its INT line attached.
+ *
+ *  @bug No known bugs
+ */
+
+#ifndef NET_TEST_H_
+#define NET_TEST_H_
+
+#include <stdio.h>
+#include <string.h>
+#include "enc28j60_sim.h"
+#include "bench.h"
+
+#define NET_TEST_QUEUE 10                     // frames the stand-in can have waiting for the ECU
+#define NET_TEST_PORT 6000                    // UDP port the stand-in sends from
+#define NET_TEST_BAUD 76800                   // the serial link to the GUI, for comparison
+
+static const uint8_t net_test_mac[6] = {0x02, 0x47, 0x55, 0x49, 0x00, 0x01};
+static const uint8_t net_test_ip[4] = NET_GUI_IP;
+static const uint8_t net_test_ecu_ip[4] = NET_ECU_IP;
+
+//! What the stand-in has seen on the wire
+static struct {
+	uint16_t arp_requests;                    // ARP requests for the stand-in's address
+	uint16_t arp_replies;                     // ARP replies to the stand-in which were correct
+	uint16_t datagrams;                       // UDP datagrams for the stand-in
+	uint16_t good;                            // of which had both checksums right, were in order and carried the data
+	uint16_t expect;                          // number of the next datagram, carried in its first data byte
+	const uint8_t *data;                      // data the datagrams should carry after their first byte
+	uint16_t len;
+} net_test;
+
+static uint8_t net_test_queue[NET_TEST_QUEUE][1600];
+static uint16_t net_test_queue_len[NET_TEST_QUEUE];
+static uint8_t net_test_queued;
+
+//! Datagrams the ECU handed to the handler bound to NET_GUI_PORT, and those which came from the stand-in intact
+static uint16_t net_test_received, net_test_intact;
+
+/** @brief Reference Internet checksum, a byte at a time
+ *
+ *  @param[in] data The bytes
+ *  @param[in] len Number of bytes
+ *  @param[in] sum Sum of what came before, unfolded
+ *  @return uint32_t The sum, still to be folded
+ */
+static uint32_t net_test_sum(const uint8_t *data, uint16_t len, uint32_t sum)
+{
+	for (uint16_t i = 0; i < len; i++){
+		sum += (i & 1) ? data[i] : data[i] << 8;
+	}
+	return sum;
+}
+
+static uint16_t net_test_fold(uint32_t sum)
+{
+	while (sum >> 16)
+		sum = (sum & 0xFFFF) + (sum >> 16);
+	return sum;
+}
+
+/** @brief Puts an Ethernet header on a frame from the stand-in to the ECU
+ *
+ *  @param[out] frame The frame
+ *  @param[in] type EtherType
+ *  @return uint8_t* Where the payload goes
+ */
+static uint8_t *net_test_header(uint8_t *frame, uint16_t type)
+{
+	memcpy(frame, ECU_mac, 6);
+	memcpy(frame + 6, net_test_mac, 6);
+	frame[12] = type >> 8;
+	frame[13] = type & 0xFF;
+	return frame + NET_ETH_HEADER;
+}
+
+/** @brief Builds an ARP packet from the stand-in
+ *
+ *  @param[out] frame The frame
+ *  @param[in] op ARP_REQUEST or ARP_REPLY
+ *  @param[in] ip Target IP address
+ *  @return uint16_t Length of the frame, padded to 60 bytes
+ */
+static uint16_t net_test_arp(uint8_t *frame, uint8_t op, const uint8_t *ip)
+{
+	static const uint8_t head[8] = {0, 1, 0x08, 0x00, 6, 4, 0, 0};
+	uint8_t *arp = net_test_header(frame, ETHERTYPE_ARP);
+	memcpy(arp, head, 8);
+	arp[7] = op;
+	memcpy(arp + 8, net_test_mac, 6);
+	memcpy(arp + 14, net_test_ip, 4);
+	memcpy(arp + 18, op == ARP_REPLY ? ECU_mac : (const uint8_t *) "\0\0\0\0\0\0", 6);
+	memcpy(arp + 24, ip, 4);
+	if (op == ARP_REQUEST)
+		memset(frame, 0xFF, 6);            // broadcast, so the ECU's receive filters have to pick it out
+	memset(arp + NET_ARP_LEN, 0, 60 - NET_ETH_HEADER - NET_ARP_LEN);
+	return 60;                             // padded to the shortest frame, as on the wire
+}
+
+/** @brief Builds a UDP datagram from the stand-in to the ECU, with both checksums right
+ *
+ *  @param[out] frame The frame
+ *  @param[in] port UDP port it is sent to
+ *  @param[in] data The data
+ *  @param[in] len Bytes of data
+ *  @return uint16_t Length of the frame
+ */
+static uint16_t net_test_udp(uint8_t *frame, uint16_t port, const uint8_t *data, uint16_t len)
+{
+	uint8_t *ip = net_test_header(frame, ETHERTYPE_IP);
+	uint8_t *udp = ip + NET_IP_HEADER;
+	uint16_t udp_len = NET_UDP_HEADER + len;
+	uint16_t total = NET_IP_HEADER + udp_len;
+	const uint8_t head[12] = {0x45, 0, total >> 8, total & 0xFF, 0, 0, 0, 0, 64, IP_PROTO_UDP, 0, 0};
+
+	memcpy(ip, head, 12);
+	memcpy(ip + 12, net_test_ip, 4);
+	memcpy(ip + 16, net_test_ecu_ip, 4);
+	uint16_t csum = ~net_test_fold(net_test_sum(ip, NET_IP_HEADER, 0));
+	ip[10] = csum >> 8;
+	ip[11] = csum & 0xFF;
+
+	udp[0] = NET_TEST_PORT >> 8;
+	udp[1] = NET_TEST_PORT & 0xFF;
+	udp[2] = port >> 8;
+	udp[3] = port & 0xFF;
+	udp[4] = udp_len >> 8;
+	udp[5] = udp_len & 0xFF;
+	udp[6] = 0;
+	udp[7] = 0;
+	memcpy(udp + NET_UDP_HEADER, data, len);
+	csum = ~net_test_fold(net_test_sum(udp, udp_len, net_test_sum(ip + 12, 8, IP_PROTO_UDP + udp_len)));
+	udp[6] = csum >> 8;
+	udp[7] = csum & 0xFF;
+	return NET_ETH_HEADER + total;
+}
+
+/** @brief Queues a frame for the ECU
+ *
+ *  @param[in] frame The frame
+ *  @param[in] len Its length
+ *  @return void
+ */
+static void net_test_queue_frame(const uint8_t *frame, uint16_t len)
+{
+	if (net_test_queued < NET_TEST_QUEUE){
+		memcpy(net_test_queue[net_test_queued], frame, len);
+		net_test_queue_len[net_test_queued++] = len;
+	}
+}
+
+/** @brief Injects the queued frames into the ENC28J60 and lets the ECU's ISR and netPoll() take them in
+ *
+ *  @param void
+ *  @return void
+ */
+static void net_test_deliver(void)
+{
+	for (uint8_t i = 0; i < net_test_queued; i++){
+		enc28j60_sim_inject(net_test_queue[i], net_test_queue_len[i]);
+	}
+	net_test_queued = 0;
+	avr_sim_advance(0);
+	while (rxHead != rxTail){
+		netPoll();
+		avr_sim_advance(0);            // lets the ISR queue anything it left while rxQueue was full
+	}
+}
+
+/** @brief The stand-in's side of the wire, called with every frame the ECU sends
+ *
+ *  @param[in] frame The frame
+ *  @param[in] len Its length
+ *  @return void
+ */
+static void net_test_capture(const uint8_t *frame, uint16_t len)
+{
+	uint16_t type = (frame[12] << 8) | frame[13];
+	const uint8_t *p = frame + NET_ETH_HEADER;
+
+	if (type == ETHERTYPE_ARP && len >= NET_ETH_HEADER + NET_ARP_LEN){
+		if (p[7] == ARP_REQUEST && !memcmp(p + 24, net_test_ip, 4)){
+			uint8_t reply[64];
+			net_test.arp_requests++;
+			net_test_queue_frame(reply, net_test_arp(reply, ARP_REPLY, net_test_ecu_ip));
+		}
+		else if (p[7] == ARP_REPLY && !memcmp(frame, net_test_mac, 6) && !memcmp(p + 8, ECU_mac, 6) &&
+		         !memcmp(p + 14, net_test_ecu_ip, 4) && !memcmp(p + 18, net_test_mac, 6) && !memcmp(p + 24, net_test_ip, 4))
+			net_test.arp_replies++;
+		return;
+	}
+	if (type != ETHERTYPE_IP || len < NET_HEADERS || memcmp(p + 16, net_test_ip, 4))
+		return;
+
+	const uint8_t *udp = p + NET_IP_HEADER;
+	uint16_t total = (p[2] << 8) | p[3];
+	uint16_t udp_len = (udp[4] << 8) | udp[5];
+	net_test.datagrams++;
+	uint8_t ok = !memcmp(frame, net_test_mac, 6) && p[0] == 0x45 && p[9] == IP_PROTO_UDP &&
+	             net_test_fold(net_test_sum(p, NET_IP_HEADER, 0)) == 0xFFFF && total == NET_IP_HEADER + udp_len &&
+	             NET_ETH_HEADER + total == len && udp[6] | udp[7] &&
+	             net_test_fold(net_test_sum(udp, udp_len, net_test_sum(p + 12, 8, IP_PROTO_UDP + udp_len))) == 0xFFFF;
+	if (ok && net_test.data && udp_len == NET_UDP_HEADER + net_test.len && udp[NET_UDP_HEADER] == (uint8_t) net_test.expect &&
+	    !memcmp(udp + NET_UDP_HEADER + 1, net_test.data + 1, net_test.len - 1))
+		net_test.good++;
+	net_test.expect++;
+}
+
+//! Handler bound to NET_GUI_PORT, which counts the datagrams from the stand-in which carry "CMD" and their number
+static void net_test_handler(const uint8_t *ip, uint16_t port, const uint8_t *data, uint16_t len)
+{
+	net_test_received++;
+	if (!memcmp(ip, net_test_ip, 4) && port == NET_TEST_PORT && (len == 3 || len == 4) && !memcmp(data, "CMD", 3))
+		net_test_intact++;
+}
+
+/** @brief Sends datagrams of one length to the stand-in back to back and checks each one it gets
+ *
+ *  @param[in,out] data The data, whose first byte is used as a datagram number
+ *  @param[in] len Bytes of data in each datagram
+ *  @param[in] count Number of datagrams
+ *  @return double Simulated cycles per datagram
+ */
+static double net_test_stream(uint8_t *data, uint16_t len, uint16_t count)
+{
+	struct bench b;
+	char name[48];
+
+	net_test.data = data;
+	net_test.len = len;
+	net_test.expect = 0;
+	net_test.good = 0;
+	net_test.datagrams = 0;
+	snprintf(name, sizeof(name), "udpSend (%u bytes of data)", len);
+	bench_begin(&b, name);
+	for (uint16_t i = 0; i < count; i++){
+		data[0] = i;
+		while (!udpSend(net_test_ip, NET_GUI_PORT, NET_GUI_PORT, data, len))
+			avr_sim_advance(64);
+	}
+	while (txOnWire != TX_NONE || txPending != TX_NONE)
+		avr_sim_advance(64);
+	double cycles = bench_end(&b, count);
+	printf("    %.0f datagrams/s, %.0f bytes/s of data, %u of %u checked out: %s\n", F_CPU / cycles,
+	       len * F_CPU / cycles, net_test.good, count, bench_check(net_test.good == count && net_test.datagrams == count));
+	net_test.data = 0;
+	return cycles;
+}
+
+/** @brief Checks and times the ECU's ARP, IPv4 and UDP layer against the stand-in
+ *
+ *  This performs the following functions:
+ *  1) Sends a datagram to the stand-in before its address is known, which must be refused while the
+ *     ARP request goes out, and then goes through once the stand-in's reply has been taken in
+ *  2) Streams GUI telemetry frames and then the longest datagrams which fit, checking every datagram, and
+ *     compares the rate with the serial link to the GUI
+ *  3) Sends the ECU a mix of good datagrams, ones it has to drop and an ARP request, and checks only the
+ *     good ones reach the handler and the ARP request gets the right reply
+ *
+ *  @param[in] telemetry A GUI telemetry frame
+ *  @param[in] telemetry_len Its length
+ *  @return void
+ */
+static void bench_network(const uint8_t *telemetry, uint16_t telemetry_len)
+{
+	static uint8_t data[NET_MAX_DATA];
+	uint8_t frame[128];
+
+	netInit(net_test_ecu_ip);
+	udpBind(NET_GUI_PORT, net_test_handler);
+	enc28j60_sim_on_transmit(net_test_capture);
+
+	uint8_t first = udpSend(net_test_ip, NET_GUI_PORT, NET_GUI_PORT, telemetry, telemetry_len);
+	while (txOnWire != TX_NONE)
+		avr_sim_advance(64);
+	net_test_deliver();
+	uint8_t second = udpSend(net_test_ip, NET_GUI_PORT, NET_GUI_PORT, telemetry, telemetry_len);
+	printf("    refused before the stand-in's address was known, sent after %u ARP request: %s\n", net_test.arp_requests,
+	       bench_check(!first && second && net_test.arp_requests == 1));
+
+	memcpy(data, telemetry, telemetry_len);
+	double cycles = net_test_stream(data, telemetry_len, 1000);
+	double serial = 10.0 * F_CPU * telemetry_len / NET_TEST_BAUD;
+	printf("    %.0fx the frame rate of the %u baud serial link (%.0f frames/s)\n", serial / cycles, NET_TEST_BAUD,
+	       F_CPU / serial);
+	for (uint16_t i = 0; i < sizeof(data); i++){
+		data[i] = i * 7;
+	}
+	cycles = net_test_stream(data, NET_MAX_DATA, 1000);
+	printf("    %.0fx the data rate of the serial link\n", NET_MAX_DATA * 10.0 * F_CPU / NET_TEST_BAUD / cycles);
+
+	// 4 good datagrams, the last of an odd length, then one each with a bad IP checksum, a bad UDP checksum,
+	// for a port nobody bound, and fragmented
+	uint16_t dropped = netStats.dropped;
+	net_test_received = 0;
+	net_test_intact = 0;
+	for (uint8_t i = 0; i < 4; i++){
+		uint8_t cmd[4] = {'C', 'M', 'D', i};
+		net_test_queue_frame(frame, net_test_udp(frame, NET_GUI_PORT, cmd, i == 3 ? 3 : 4));
+	}
+	uint16_t len = net_test_udp(frame, NET_GUI_PORT, (const uint8_t *) "CMDx", 4);
+	frame[NET_ETH_HEADER + 10] ^= 0x01;
+	net_test_queue_frame(frame, len);
+	len = net_test_udp(frame, NET_GUI_PORT, (const uint8_t *) "CMDx", 4);
+	frame[len - 1] ^= 0x01;
+	net_test_queue_frame(frame, len);
+	net_test_queue_frame(frame, net_test_udp(frame, NET_GUI_PORT + 1, (const uint8_t *) "CMDx", 4));
+	len = net_test_udp(frame, NET_GUI_PORT, (const uint8_t *) "CMDx", 4);
+	frame[NET_ETH_HEADER + 6] |= 0x20;                     // more fragments, with the header checksum fixed up
+	frame[NET_ETH_HEADER + 10] = 0;
+	frame[NET_ETH_HEADER + 11] = 0;
+	uint16_t csum = ~net_test_fold(net_test_sum(frame + NET_ETH_HEADER, NET_IP_HEADER, 0));
+	frame[NET_ETH_HEADER + 10] = csum >> 8;
+	frame[NET_ETH_HEADER + 11] = csum & 0xFF;
+	net_test_queue_frame(frame, len);
+	net_test_queue_frame(frame, net_test_arp(frame, ARP_REQUEST, net_test_ecu_ip));
+	net_test.arp_replies = 0;
+	net_test_deliver();
+	while (txOnWire != TX_NONE)
+		avr_sim_advance(64);
+	printf("    %u of 4 good datagrams handed over, %u dropped, ARP request answered %u time: %s\n", net_test_intact,
+	       netStats.dropped - dropped, net_test.arp_replies,
+	       bench_check(net_test_intact == 4 && net_test_received == 4 && netStats.dropped - dropped == 4 &&
+	                   net_test.arp_replies == 1));
+	enc28j60_sim_on_transmit(0);
+}
+
+static void net_test_unplug(void)
+{
+	enc28j60_sim_set_link(0);
+}
+
+static void net_test_plug(void)
+{
+	enc28j60_sim_set_link(1);
+}
+
+/** @brief Runs the firmware's GUI task with the cable pulled part way through, which falls back to the serial link
+ *
+ *  The task is run once every 10 ms.  It sends the telemetry frame by udpSend(), and over the serial link
+ *  whenever udpSend() refuses it.  The cable is pulled in the middle of one period and plugged back in the
+ *  middle of another.  Every period in between has to have gone over the serial link, with none lost on the
+ *  dead wire, and none of the others.
+ *
+ *  @param[in] task The GUI task
+ *  @param[in] telemetry_len Length of the telemetry frame
+ *  @return void
+ */
+static void bench_failover(void (*task)(void), uint16_t telemetry_len)
+{
+	const uint16_t periods = 300, pulled = 100, plugged = 200;
+	const uint64_t period = F_CPU / 100;               // 10 ms, longer than a frame takes at NET_TEST_BAUD
+	uint16_t fallback = 0, partial = 0;
+	static uint8_t serial[1600];
+
+	enc28j60_sim_on_transmit(net_test_capture);
+	net_test.datagrams = 0;
+	uint16_t refused = netStats.linkDown;
+	uint64_t start = avr_sim_cycles;
+	for (uint16_t i = 0; i < periods; i++){
+		if (i == pulled)
+			avr_sim_at(start + period / 2, net_test_unplug);
+		else if (i == plugged)
+			avr_sim_at(start + period / 2, net_test_plug);
+		avr_sim_usart_log(0, serial, sizeof(serial));
+		task();
+		start += period;
+		if (avr_sim_cycles < start)
+			avr_sim_advance(start - avr_sim_cycles);
+		uint16_t len = avr_sim_usart_log(0, serial, sizeof(serial));
+		fallback += len == telemetry_len;
+		partial += len && len != telemetry_len;
+	}
+	while (txOnWire != TX_NONE)
+		avr_sim_advance(64);
+	enc28j60_sim_on_transmit(0);
+	printf("    cable pulled for %u of %u periods: %u datagrams reached the stand-in, %u frames went over the serial link: %s\n",
+	       plugged - pulled, periods, net_test.datagrams, fallback,
+	       bench_check(net_test.datagrams == periods - (plugged - pulled) && fallback == plugged - pulled &&
+	                   !partial && netStats.linkDown - refused == fallback));
+}
+
+#endif /* NET_TEST_H_ */
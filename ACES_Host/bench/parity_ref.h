@@ -0,0 +1,139 @@
+/** @file parity_ref.h
+ *  @author Nick Moore
+ *  @date October 15, 2026
+ *  @brief Bit by bit parity reference and the parity benchmark of the GUI frame
+ *
+ *  parity_ref() is the loop calculateParity() used before the table in parity.c, kept here so that the
+ *  table can be checked against it and timed next to it for each frame size.
+ *
+ *  The simulator does not time instructions, so the AVR cycles of the bit loop are estimated by adding up the
+ *  instructions of the optimised listing of it in ACES_ESB/Debug/ACES_ESB.lss, with the 4 cycle rcall and
+ *  5 cycle ret of the ATmega2561.  There is no listing of the table version, so it only gets host timings.
+ *
+ *  @bug No known bugs
+ */
+
+#ifndef PARITY_REF_H_
+#define PARITY_REF_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "parity.h"
+#include "bench.h"
+
+/** @brief Parity byte of 6 bytes, counting the high bits one at a time
+ *
+ *  @param[in] message Frame holding the 6 bytes
+ *  @param[in] start_index Index of the first of the 6 bytes
+ *  @return uint8_t
+ */
+static inline uint8_t parity_ref(const uint8_t *message, uint8_t start_index)
+{
+	uint8_t parity = 0;
+	for (uint8_t set = 0; set < 2; set++){
+		uint8_t count = 0;
+		for (uint8_t i = 0; i < 3; i++){
+			uint8_t byte = message[start_index + set * 3 + i];
+			while (byte){
+				count += byte & 1;
+				byte >>= 1;
+			}
+		}
+		parity |= (count % 16) << (4 * set);
+	}
+	return parity;
+}
+
+//! AVR cycles of a calculateParity() call with the bit loop, apart from its countOnes() calls
+#define PARITY_REF_CALL_CYCLES 70
+
+/** @brief Estimated AVR cycles the bit loop takes for the parity byte of 6 bytes
+ *
+ *  Each byte costs 12 cycles in calculateParity() and 10 in countOnes(), plus 6 for every bit up to its
+ *  highest high bit.
+ *
+ *  @param[in] message Frame holding the 6 bytes
+ *  @param[in] start_index Index of the first of the 6 bytes
+ *  @return uint16_t
+ */
+static inline uint16_t parity_ref_cycles(const uint8_t *message, uint8_t start_index)
+{
+	uint16_t cycles = PARITY_REF_CALL_CYCLES;
+	for (uint8_t i = 0; i < 6; i++){
+		uint8_t byte = message[start_index + i];
+		cycles += 12 + 10;
+		while (byte){
+			cycles += 6;
+			byte >>= 1;
+		}
+	}
+	return cycles;
+}
+
+/** @brief Times the bit loop and the table on the parity bytes of one kind of frame and checks that they agree
+ *
+ *  @param[in] name Name of the frame in the report
+ *  @param[in] len Number of data bytes in the frame
+ *  @param[in] starts Start index of each parity byte
+ *  @param[in] count Number of parity bytes
+ *  @return void
+ */
+static void bench_parity_frame(const char *name, uint8_t len, const uint8_t *starts, uint8_t count)
+{
+	struct bench b;
+	uint8_t frame[256];
+	volatile uint8_t sink = 0;
+	char label[64];
+
+	srand(len);
+	for (uint8_t i = 0; i < len; i++){
+		frame[i] = rand();
+	}
+
+	snprintf(label, sizeof(label), "bit loop (%s)", name);
+	bench_begin(&b, label);
+	for (uint32_t i = 0; i < 1000000; i++){
+		frame[0] = i;
+		for (uint8_t j = 0; j < count; j++){
+			sink ^= parity_ref(frame, starts[j]);
+		}
+	}
+	bench_end(&b, 1000000);
+
+	snprintf(label, sizeof(label), "calculateParity (%s)", name);
+	bench_begin(&b, label);
+	for (uint32_t i = 0; i < 1000000; i++){
+		frame[0] = i;
+		for (uint8_t j = 0; j < count; j++){
+			sink ^= calculateParity(frame, starts[j]);
+		}
+	}
+	bench_end(&b, 1000000);
+
+	uint32_t mismatches = 0;
+	uint64_t cycles = 0;
+	for (uint32_t i = 0; i < 100000; i++){
+		for (uint8_t j = 0; j < len; j++){
+			frame[j] = rand();
+		}
+		for (uint8_t j = 0; j < count; j++){
+			uint8_t expected = parity_ref(frame, starts[j]);
+			cycles += parity_ref_cycles(frame, starts[j]);
+			if (calculateParity(frame, starts[j]) != expected)
+				mismatches++;
+		}
+	}
+	memset(frame, 0xFF, len);
+	uint32_t worst = 0;
+	for (uint8_t j = 0; j < count; j++){
+		worst += parity_ref_cycles(frame, starts[j]);
+	}
+	printf("    bit loop estimated from the ESB listing: %.0f AVR cycles per frame on average, %u at worst\n",
+	       cycles / 100000.0, worst);
+	printf("    %u mismatches against the bit loop in 100000 random frames: %s\n", mismatches,
+	       bench_check(!mismatches));
+	(void) sink;
+}
+
+#endif /* PARITY_REF_H_ */
@@ -0,0 +1,24 @@
+/** @file interrupt.h
+ *  @author Nick Moore
+ *  @date October 15, 2026
+ *  @brief Host stand-in for <avr/interrupt.h>
+ *
+ *  An ISR becomes an ordinary function named after its vector, so the simulator (or a benchmark) can
+ *  call it.  cli() and sei() drive the I bit of the simulated SREG.
+ *
+ *  @bug No known bugs
+ */
+
+#ifndef AVR_INTERRUPT_H_HOST
+#define AVR_INTERRUPT_H_HOST
+
+#include <avr/io.h>
+
+void avr_sim_cli(void);
+void avr_sim_sei(void);
+
+#define ISR(vector, ...) void vector(void); void vector(void)
+#define cli() avr_sim_cli()
+#define sei() avr_sim_sei()
+
+#endif /* AVR_INTERRUPT_H_HOST */
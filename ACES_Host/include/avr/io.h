@@ -0,0 +1,369 @@
+/** @file io.h
+ *  @author Nick Moore
+ *  @date October 15, 2026
+ *  @brief Host stand-in for <avr/io.h>.  Declares the ATmega2561 register file used by the ECU and ESB
+ *         as plain globals owned by the simulator (see avr_sim.c)
+ *
+ *  Only the registers and bit positions the firmware actually touches are listed.  Bit positions are
+ *  taken from iomxx0_1.h so the firmware compiles unchanged against either header.
+ *
+ *  @bug No known bugs
+ */
+
+#ifndef AVR_IO_H_HOST
+#define AVR_IO_H_HOST
+
+#include <stdint.h>
+#include <avr/sfr_defs.h>
+
+///////////////////////////////////////////////////////////////////////////
+/////////////////////////// Register File /////////////////////////////////
+///////////////////////////////////////////////////////////////////////////
+
+//! X-macro list of every simulated register, R8 for 8 bit and R16 for 16 bit registers
+#define AVR_SIM_REGISTERS(R8, R16) \
+	R8(PINA)   R8(DDRA)   R8(PORTA)  \
+	R8(PINB)   R8(DDRB)   R8(PORTB)  \
+	R8(PINC)   R8(DDRC)   R8(PORTC)  \
+	R8(PIND)   R8(DDRD)   R8(PORTD)  \
+	R8(PINE)   R8(DDRE)   R8(PORTE)  \
+	R8(PINF)   R8(DDRF)   R8(PORTF)  \
+	R8(PING)   R8(DDRG)   R8(PORTG)  \
+	R8(TIFR0)  R8(TIFR1)  R8(TIFR2)  R8(TIFR3)  R8(TIFR4)  R8(TIFR5)  \
+	R8(TIMSK0) R8(TIMSK1) R8(TIMSK2) R8(TIMSK3) R8(TIMSK4) R8(TIMSK5) \
+	R8(EIFR)   R8(EIMSK)  R8(EICRA)  R8(EICRB)  \
+	R8(SREG)   R8(MCUCR)  R8(GPIOR0) \
+	R8(TCCR0A) R8(TCCR0B) R8(TCNT0)  R8(OCR0A)  R8(OCR0B)  \
+	R8(TCCR2A) R8(TCCR2B) R8(TCNT2)  R8(OCR2A)  R8(OCR2B)  R8(ASSR) \
+	R8(TCCR1A) R8(TCCR1B) R8(TCCR1C) R16(TCNT1) R16(ICR1) R16(OCR1A) R16(OCR1B) R16(OCR1C) \
+	R8(TCCR3A) R8(TCCR3B) R8(TCCR3C) R16(TCNT3) R16(ICR3) R16(OCR3A) R16(OCR3B) R16(OCR3C) \
+	R8(TCCR4A) R8(TCCR4B) R8(TCCR4C) R16(TCNT4) R16(ICR4) R16(OCR4A) R16(OCR4B) R16(OCR4C) \
+	R8(TCCR5A) R8(TCCR5B) R8(TCCR5C) R16(TCNT5) R16(ICR5) R16(OCR5A) R16(OCR5B) R16(OCR5C) \
+	R8(SPCR)   R8(SPSR)   R8(SPDR)   \
+	R8(TWBR)   R8(TWSR)   R8(TWAR)   R8(TWDR)   R8(TWCR)   R8(TWAMR) \
+	R16(ADCW)  R8(ADCSRA) R8(ADCSRB) R8(ADMUX)  R8(DIDR0)  \
+	R8(UCSR0A) R8(UCSR0B) R8(UCSR0C) R16(UBRR0) R8(UDR0)   \
+	R8(UCSR1A) R8(UCSR1B) R8(UCSR1C) R16(UBRR1) R8(UDR1)
+
+#define AVR_SIM_DECLARE8(name)  extern volatile uint8_t name;
+#define AVR_SIM_DECLARE16(name) extern volatile uint16_t name;
+AVR_SIM_REGISTERS(AVR_SIM_DECLARE8, AVR_SIM_DECLARE16)
+#undef AVR_SIM_DECLARE8
+#undef AVR_SIM_DECLARE16
+
+// The ADC data register is one 16 bit register with byte views, same as on the chip (little endian host)
+#define ADC   ADCW
+#define ADCL  (((volatile uint8_t *) &ADCW)[0])
+#define ADCH  (((volatile uint8_t *) &ADCW)[1])
+
+///////////////////////////////////////////////////////////////////////////
+//////////////////////// Register Bit Definitions /////////////////////////
+///////////////////////////////////////////////////////////////////////////
+
+// Port pins
+#define PA0 0
+#define PA1 1
+#define PA2 2
+#define PA3 3
+#define PA4 4
+#define PA5 5
+#define PA6 6
+#define PA7 7
+#define PB0 0
+#define PB1 1
+#define PB2 2
+#define PB3 3
+#define PB4 4
+#define PB5 5
+#define PB6 6
+#define PB7 7
+#define PC0 0
+#define PC1 1
+#define PC2 2
+#define PC3 3
+#define PC4 4
+#define PC5 5
+#define PC6 6
+#define PC7 7
+#define PD0 0
+#define PD1 1
+#define PD2 2
+#define PD3 3
+#define PD4 4
+#define PD5 5
+#define PD6 6
+#define PD7 7
+#define PE0 0
+#define PE1 1
+#define PE2 2
+#define PE3 3
+#define PE4 4
+#define PE5 5
+#define PE6 6
+#define PE7 7
+
+// Timer interrupt flag and mask registers (same layout for timers 0-5)
+#define TOV0   0
+#define OCF0A  1
+#define OCF0B  2
+#define TOV1   0
+#define OCF1A  1
+#define OCF1B  2
+#define OCF1C  3
+#define ICF1   5
+#define TOV2   0
+#define OCF2A  1
+#define OCF2B  2
+#define TOV3   0
+#define OCF3A  1
+#define OCF3B  2
+#define OCF3C  3
+#define ICF3   5
+#define TOV4   0
+#define OCF4A  1
+#define OCF4B  2
+#define OCF4C  3
+#define ICF4   5
+#define TOV5   0
+#define OCF5A  1
+#define OCF5B  2
+#define OCF5C  3
+#define ICF5   5
+#define TOIE0  0
+#define OCIE0A 1
+#define OCIE0B 2
+#define TOIE1  0
+#define OCIE1A 1
+#define OCIE1B 2
+#define OCIE1C 3
+#define ICIE1  5
+#define TOIE2  0
+#define OCIE2A 1
+#define OCIE2B 2
+#define TOIE3  0
+#define OCIE3A 1
+#define OCIE3B 2
+#define OCIE3C 3
+#define ICIE3  5
+#define TOIE4  0
+#define OCIE4A 1
+#define OCIE4B 2
+#define OCIE4C 3
+#define ICIE4  5
+#define TOIE5  0
+#define OCIE5A 1
+#define OCIE5B 2
+#define OCIE5C 3
+#define ICIE5  5
+
+// 8 bit timer control registers (timers 0 and 2)
+#define WGM00  0
+#define WGM01  1
+#define COM0B0 4
+#define COM0B1 5
+#define COM0A0 6
+#define COM0A1 7
+#define CS00   0
+#define CS01   1
+#define CS02   2
+#define WGM02  3
+#define WGM20  0
+#define WGM21  1
+#define COM2B0 4
+#define COM2B1 5
+#define COM2A0 6
+#define COM2A1 7
+#define CS20   0
+#define CS21   1
+#define CS22   2
+#define WGM22  3
+
+// 16 bit timer control registers (timers 1, 3, 4 and 5)
+#define WGM10  0
+#define WGM11  1
+#define COM1C0 2
+#define COM1C1 3
+#define COM1B0 4
+#define COM1B1 5
+#define COM1A0 6
+#define COM1A1 7
+#define CS10   0
+#define CS11   1
+#define CS12   2
+#define WGM12  3
+#define WGM13  4
+#define ICES1  6
+#define ICNC1  7
+#define WGM30  0
+#define WGM31  1
+#define COM3C0 2
+#define COM3C1 3
+#define COM3B0 4
+#define COM3B1 5
+#define COM3A0 6
+#define COM3A1 7
+#define CS30   0
+#define CS31   1
+#define CS32   2
+#define WGM32  3
+#define WGM33  4
+#define ICES3  6
+#define ICNC3  7
+#define WGM40  0
+#define WGM41  1
+#define COM4C0 2
+#define COM4C1 3
+#define COM4B0 4
+#define COM4B1 5
+#define COM4A0 6
+#define COM4A1 7
+#define CS40   0
+#define CS41   1
+#define CS42   2
+#define WGM42  3
+#define WGM43  4
+#define ICES4  6
+#define ICNC4  7
+#define WGM50  0
+#define WGM51  1
+#define COM5C0 2
+#define COM5C1 3
+#define COM5B0 4
+#define COM5B1 5
+#define COM5A0 6
+#define COM5A1 7
+#define CS50   0
+#define CS51   1
+#define CS52   2
+#define WGM52  3
+#define WGM53  4
+#define ICES5  6
+#define ICNC5  7
+
+// External interrupts
+#define INT0   0
+#define INT1   1
+#define INT2   2
+#define INT3   3
+#define INT4   4
+#define INT5   5
+#define INT6   6
+#define INT7   7
+#define INTF0  0
+#define INTF1  1
+#define INTF2  2
+#define INTF3  3
+#define INTF4  4
+#define INTF5  5
+#define INTF6  6
+#define INTF7  7
+#define ISC00  0
+#define ISC01  1
+#define ISC10  2
+#define ISC11  3
+#define ISC20  4
+#define ISC21  5
+#define ISC30  6
+#define ISC31  7
+#define ISC40  0
+#define ISC41  1
+#define ISC50  2
+#define ISC51  3
+#define ISC60  4
+#define ISC61  5
+#define ISC70  6
+#define ISC71  7
+
+// SPI
+#define SPR0   0
+#define SPR1   1
+#define CPHA   2
+#define CPOL   3
+#define MSTR   4
+#define DORD   5
+#define SPE    6
+#define SPIE   7
+#define SPI2X  0
+#define WCOL   6
+#define SPIF   7
+
+// TWI
+#define TWIE   0
+#define TWEN   2
+#define TWWC   3
+#define TWSTO  4
+#define TWSTA  5
+#define TWEA   6
+#define TWINT  7
+#define TWPS0  0
+#define TWPS1  1
+
+// ADC
+#define ADPS0  0
+#define ADPS1  1
+#define ADPS2  2
+#define ADIE   3
+#define ADIF   4
+#define ADATE  5
+#define ADSC   6
+#define ADEN   7
+#define MUX0   0
+#define MUX1   1
+#define MUX2   2
+#define MUX3   3
+#define MUX4   4
+#define ADLAR  5
+#define REFS0  6
+#define REFS1  7
+#define ADTS0  0
+#define ADTS1  1
+#define ADTS2  2
+#define MUX5   3
+
+// USART0 and USART1
+#define MPCM0  0
+#define U2X0   1
+#define UPE0   2
+#define DOR0   3
+#define FE0    4
+#define UDRE0  5
+#define TXC0   6
+#define RXC0   7
+#define TXB80  0
+#define RXB80  1
+#define UCSZ02 2
+#define TXEN0  3
+#define RXEN0  4
+#define UDRIE0 5
+#define TXCIE0 6
+#define RXCIE0 7
+#define UCPOL0 0
+#define UCSZ00 1
+#define UCSZ01 2
+#define USBS0  3
+#define UPM00  4
+#define UPM01  5
+#define MPCM1  0
+#define U2X1   1
+#define UPE1   2
+#define DOR1   3
+#define FE1    4
+#define UDRE1  5
+#define TXC1   6
+#define RXC1   7
+#define TXB81  0
+#define RXB81  1
+#define UCSZ12 2
+#define TXEN1  3
+#define RXEN1  4
+#define UDRIE1 5
+#define TXCIE1 6
+#define RXCIE1 7
+#define UCPOL1 0
+#define UCSZ10 1
+#define UCSZ11 2
+#define USBS1  3
+#define UPM10  4
+#define UPM11  5
+
+#endif /* AVR_IO_H_HOST */
@@ -0,0 +1,21 @@
+/** @file pgmspace.h
+ *  @author Nick Moore
+ *  @date October 15, 2026
+ *  @brief Host stand-in for <avr/pgmspace.h>
+ *
+ *  The host has a single address space, so tables placed in flash are ordinary constant data and reading
+ *  them back is a plain load.
+ *
+ *  @bug No known bugs
+ */
+
+#ifndef AVR_PGMSPACE_H_HOST
+#define AVR_PGMSPACE_H_HOST
+
+#include <stdint.h>
+
+#define PROGMEM
+#define pgm_read_byte(address) (*(const uint8_t *) (address))
+#define pgm_read_word(address) (*(const uint16_t *) (address))
+
+#endif /* AVR_PGMSPACE_H_HOST */
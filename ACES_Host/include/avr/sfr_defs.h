@@ -0,0 +1,29 @@
+/** @file sfr_defs.h
+ *  @author Nick Moore
+ *  @date October 15, 2026
+ *  @brief Host stand-in for <avr/sfr_defs.h>
+ *
+ *  Every bit test the firmware does goes through _SFR_BYTE, so on the host that is where the simulator
+ *  gets to run its peripheral models.  A poll of a status register advances simulated time to the point
+ *  where the hardware would have raised the flag, instead of spinning.
+ *
+ *  @bug No known bugs
+ */
+
+#ifndef AVR_SFR_DEFS_H_HOST
+#define AVR_SFR_DEFS_H_HOST
+
+#include <stdint.h>
+#include <inttypes.h>
+
+uint8_t avr_sim_read8(volatile uint8_t *reg);
+
+#define _BV(bit) (1 << (bit))
+#define _SFR_BYTE(sfr) avr_sim_read8(&(sfr))
+
+#define bit_is_set(sfr, bit) (_SFR_BYTE(sfr) & _BV(bit))
+#define bit_is_clear(sfr, bit) (!(_SFR_BYTE(sfr) & _BV(bit)))
+#define loop_until_bit_is_set(sfr, bit) do { } while (bit_is_clear(sfr, bit))
+#define loop_until_bit_is_clear(sfr, bit) do { } while (bit_is_set(sfr, bit))
+
+#endif /* AVR_SFR_DEFS_H_HOST */
@@ -0,0 +1,35 @@
+/** @file twi.h
+ *  @author Nick Moore
+ *  @date October 16, 2026
+ *  @brief Host stand-in for <util/twi.h>
+ *
+ *  The status codes of the TWI in master mode, which are all the simulated TWI reports, with the values the
+ *  ATmega2561 data sheet gives them.
+ *
+ *  @bug No known bugs
+ */
+
+#ifndef UTIL_TWI_H_HOST
+#define UTIL_TWI_H_HOST
+
+#include <avr/io.h>
+
+#define TW_START 0x08
+#define TW_REP_START 0x10
+#define TW_MT_SLA_ACK 0x18
+#define TW_MT_SLA_NACK 0x20
+#define TW_MT_DATA_ACK 0x28
+#define TW_MT_DATA_NACK 0x30
+#define TW_MT_ARB_LOST 0x38
+#define TW_MR_ARB_LOST 0x38
+#define TW_MR_SLA_ACK 0x40
+#define TW_MR_SLA_NACK 0x48
+#define TW_MR_DATA_ACK 0x50
+#define TW_MR_DATA_NACK 0x58
+#define TW_NO_INFO 0xF8
+#define TW_BUS_ERROR 0x00
+
+#define TW_STATUS_MASK 0xF8
+#define TW_STATUS (TWSR & TW_STATUS_MASK)
+
+#endif /* UTIL_TWI_H_HOST */
@@ -0,0 +1,1123 @@
+/** @file avr_sim.c
+ *  @author Nick Moore
+ *  @date October 15, 2026
+ *  @brief Implementation of the simulated ATmega2561 peripherals used by the host build
+ *
+ *  @bug Interrupt flags of masked sources are dropped rather than latched, which only matters for code
+ *       that enables an interrupt and expects an edge that happened while it was masked
+ *  @bug Timers always count up, so phase correct PWM modes run at twice their real frequency
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "avr_sim.h"
+
+// The register file itself
+#define AVR_SIM_DEFINE8(name)  volatile uint8_t name;
+#define AVR_SIM_DEFINE16(name) volatile uint16_t name;
+AVR_SIM_REGISTERS(AVR_SIM_DEFINE8, AVR_SIM_DEFINE16)
+
+#define SREG_I       0x80
+#define USART_LOG    4096
+#define TWI_IDLE     0
+#define TWI_ADDRESS  1
+#define TWI_WRITE    2
+#define TWI_READ     3
+#define TWI_NO_STATUS 0xFF                              // a STOP on its own, which does not set TWINT
+
+uint64_t avr_sim_cycles;
+uint64_t avr_sim_wait_cycles;
+
+//! Periodic interrupt source, see avr_sim_add_source()
+struct avr_sim_source {
+	avr_sim_isr_t isr;
+	uint64_t period;
+	uint64_t next;
+	volatile uint8_t *mask;
+	uint8_t bit;
+	uint8_t pending;
+};
+
+//! Transmit side of one USART
+struct avr_sim_usart {
+	volatile uint8_t *udr;
+	volatile uint16_t *ubrr;
+	volatile uint8_t *ucsrb;
+	avr_sim_isr_t udre_isr;          // USARTn_UDRE_vect, see avr_sim_usart_udre()
+	uint64_t busy_until;
+	uint8_t pending;                 // a character was granted the data register and has not been logged yet
+	uint8_t log[USART_LOG];
+	uint16_t log_len;
+};
+
+//! Device model callback due at a given time, see avr_sim_at()
+struct avr_sim_event {
+	avr_sim_event_t run;                 // 0 if the slot is free
+	uint64_t when;
+};
+
+//! One of the six timer/counters
+struct avr_sim_timer {
+	volatile uint8_t *tccra;
+	volatile uint8_t *tccrb;
+	volatile uint8_t *tifr;
+	volatile uint8_t *timsk;
+	volatile uint16_t *tcnt16;       // 16 bit timers
+	volatile uint16_t *icr;
+	volatile uint16_t *ocr16[2];
+	volatile uint8_t *tcnt8;         // 8 bit timers
+	volatile uint8_t *ocr8[2];
+	uint32_t residue;                // CPU cycles already counted toward the next timer tick
+	avr_sim_isr_t isr[3];            // overflow, compare A and compare B, see avr_sim_timer_isr()
+};
+
+static struct avr_sim_source sources[AVR_SIM_MAX_SOURCES];
+static struct avr_sim_timer timers[6] = {
+	{ &TCCR0A, &TCCR0B, &TIFR0, &TIMSK0, 0, 0, { 0, 0 }, &TCNT0, { &OCR0A, &OCR0B } },
+	{ &TCCR1A, &TCCR1B, &TIFR1, &TIMSK1, &TCNT1, &ICR1, { &OCR1A, &OCR1B } },
+	{ &TCCR2A, &TCCR2B, &TIFR2, &TIMSK2, 0, 0, { 0, 0 }, &TCNT2, { &OCR2A, &OCR2B } },
+	{ &TCCR3A, &TCCR3B, &TIFR3, &TIMSK3, &TCNT3, &ICR3, { &OCR3A, &OCR3B } },
+	{ &TCCR4A, &TCCR4B, &TIFR4, &TIMSK4, &TCNT4, &ICR4, { &OCR4A, &OCR4B } },
+	{ &TCCR5A, &TCCR5B, &TIFR5, &TIMSK5, &TCNT5, &ICR5, { &OCR5A, &OCR5B } },
+};
+static struct avr_sim_usart usart[2] = { { &UDR0, &UBRR0, &UCSR0B }, { &UDR1, &UBRR1, &UCSR1B } };
+static avr_sim_isr_t ext_isr[8];                      // INT0_vect to INT7_vect, see avr_sim_ext_isr()
+static struct avr_sim_event events[AVR_SIM_MAX_EVENTS];
+static const struct avr_sim_spi_dev *spi_dev;
+static avr_sim_isr_t spi_isr;                         // SPI_STC_vect, see avr_sim_spi_isr()
+static uint8_t spi_busy;                              // a byte started by avr_sim_spi_start() is on the bus
+static uint8_t spi_flagged;                           // SPIF was set by the model and SPI_STC_vect has not run yet
+static uint8_t spi_miso;                              // byte clocked in by the transfer on the bus
+static uint64_t spi_until;                            // end of the transfer on the bus
+static const struct avr_sim_twi_dev *twi_bus[AVR_SIM_MAX_TWI];
+static const struct avr_sim_twi_dev *twi_dev;        // slave addressed by the current transaction
+static uint8_t twi_state;
+static avr_sim_isr_t twi_isr;                         // TWI_vect, see avr_sim_twi_isr()
+static uint8_t twi_busy;                              // an action is on the bus
+static uint8_t twi_flagged;                           // TWINT was set by the model and TWI_vect has not run yet
+static uint8_t twi_stalled;                           // a slave holds the clock low, see avr_sim_twi_stall()
+static uint8_t twi_status;                            // TWSR once the action on the bus is done
+static uint8_t twi_cr;                                // TWCR as the model last left it, to catch the firmware writing it
+static uint32_t twi_cycles;                           // length of the action on the bus
+static uint16_t adc_value[32];
+static uint8_t adc_busy;
+static uint64_t adc_start;
+static avr_sim_isr_t adc_isr;                         // ADC_vect, see avr_sim_adc_isr()
+static uint8_t adc_mux;                               // channel of the conversion in the background
+
+/** @brief Calls an ISR the way the AVR does, with the I bit cleared for the duration
+ *
+ *  @param[in] isr The interrupt service routine to run
+ *  @return void
+ */
+static void dispatch(avr_sim_isr_t isr)
+{
+	SREG &= ~SREG_I;
+	isr();
+	SREG |= SREG_I;
+}
+
+/** @brief Returns to the simulator a count of cycles which the firmware spent waiting on hardware
+ *
+ *  @param[in] cycles Number of cycles to wait
+ *  @return void
+ */
+static void wait(uint64_t cycles)
+{
+	avr_sim_wait_cycles += cycles;
+	avr_sim_advance(cycles);
+}
+
+/** @brief Resets the register file and every peripheral model to its power on state
+ *
+ *  @param void
+ *  @return void
+ */
+void avr_sim_reset(void)
+{
+	#define AVR_SIM_CLEAR(name) name = 0;
+	AVR_SIM_REGISTERS(AVR_SIM_CLEAR, AVR_SIM_CLEAR)
+	#undef AVR_SIM_CLEAR
+
+	UCSR0A = (1 << UDRE0);
+	UCSR1A = (1 << UDRE1);
+
+	avr_sim_cycles = 0;
+	avr_sim_wait_cycles = 0;
+	for (uint8_t i = 0; i < AVR_SIM_MAX_SOURCES; i++){
+		sources[i].isr = 0;
+	}
+	for (uint8_t i = 0; i < 8; i++){
+		ext_isr[i] = 0;
+	}
+	for (uint8_t i = 0; i < AVR_SIM_MAX_EVENTS; i++){
+		events[i].run = 0;
+	}
+	for (uint8_t i = 0; i < 6; i++){
+		timers[i].residue = 0;
+		for (uint8_t j = 0; j < 3; j++){
+			timers[i].isr[j] = 0;
+		}
+	}
+	for (uint8_t i = 0; i < 2; i++){
+		usart[i].udre_isr = 0;
+		usart[i].busy_until = 0;
+		usart[i].pending = 0;
+		usart[i].log_len = 0;
+	}
+	spi_dev = 0;
+	spi_isr = 0;
+	spi_busy = 0;
+	spi_flagged = 0;
+	for (uint8_t i = 0; i < AVR_SIM_MAX_TWI; i++){
+		twi_bus[i] = 0;
+	}
+	twi_dev = 0;
+	twi_state = TWI_IDLE;
+	twi_isr = 0;
+	twi_busy = 0;
+	twi_flagged = 0;
+	twi_stalled = 0;
+	adc_busy = 0;
+	adc_isr = 0;
+	for (uint8_t i = 0; i < 32; i++){
+		adc_value[i] = 0;
+	}
+}
+
+/** @brief Number of CPU cycles per tick of a timer, 0 when it is stopped or clocked externally
+ *
+ *  @param[in] t The timer
+ *  @return uint32_t
+ */
+static uint32_t timer_prescale(struct avr_sim_timer *t)
+{
+	static const uint32_t prescale[8] = {0, 1, 8, 64, 256, 1024, 0, 0};
+	static const uint32_t prescale2[8] = {0, 1, 8, 32, 64, 128, 256, 1024};
+	uint8_t cs = *t->tccrb & 0x07;
+	return (t == &timers[2]) ? prescale2[cs] : prescale[cs];
+}
+
+/** @brief Value at which a timer wraps back to 0 for its waveform generation mode
+ *
+ *  Every mode is treated as counting up, and the overflow flag is set at TOP, which is only wrong for
+ *  the CTC modes (the AVR sets it at MAX there).
+ *
+ *  @param[in] t The timer
+ *  @return uint32_t
+ */
+static uint32_t timer_top(struct avr_sim_timer *t)
+{
+	if (t->tcnt16){
+		uint8_t wgm = (*t->tccra & 0x03) | ((*t->tccrb >> 1) & 0x0C);
+		switch (wgm){
+			case 1: case 5: return 0x00FF;
+			case 2: case 6: return 0x01FF;
+			case 3: case 7: return 0x03FF;
+			case 8: case 10: case 12: case 14: return *t->icr;
+			case 4: case 9: case 11: case 15: return *t->ocr16[0];
+			default: return 0xFFFF;
+		}
+	}
+	uint8_t wgm = (*t->tccra & 0x03) | ((*t->tccrb >> 1) & 0x04);
+	return (wgm == 2 || wgm == 5 || wgm == 7) ? *t->ocr8[0] : 0xFF;
+}
+
+static uint32_t timer_count(struct avr_sim_timer *t)
+{
+	return t->tcnt16 ? *t->tcnt16 : *t->tcnt8;
+}
+
+static uint32_t timer_ocr(struct avr_sim_timer *t, uint8_t channel)
+{
+	return t->tcnt16 ? *t->ocr16[channel] : *t->ocr8[channel];
+}
+
+/** @brief Number of timer ticks until the counter next reaches a given value
+ *
+ *  @param[in] t The timer
+ *  @param[in] value Counter value of interest, top + 1 for the overflow
+ *  @return uint32_t Ticks, never 0 since a match at the current count has already happened
+ */
+static uint32_t timer_ticks_to(struct avr_sim_timer *t, uint32_t value)
+{
+	uint32_t top = timer_top(t);
+	uint32_t count = timer_count(t);
+	uint32_t max = t->tcnt16 ? 0xFFFF : 0xFF;
+	if (count > top){                                    // written past TOP, runs on to MAX first
+		uint32_t wrap = max + 1 - count;
+		return (value > top) ? wrap : wrap + value;
+	}
+	if (value > top)
+		return top + 1 - count;
+	return value > count ? value - count : top + 1 - count + value;
+}
+
+/** @brief Counts a timer forward, setting the overflow and compare flags it passes
+ *
+ *  @param[in] t The timer
+ *  @param[in] cycles CPU cycles which have passed
+ *  @return void
+ */
+static void timer_run(struct avr_sim_timer *t, uint64_t cycles)
+{
+	uint32_t prescale = timer_prescale(t);
+	if (!prescale){
+		t->residue = 0;
+		return;
+	}
+	uint64_t ticks = (t->residue + cycles) / prescale;
+	t->residue = (t->residue + cycles) % prescale;
+	if (!ticks)
+		return;
+
+	uint32_t top = timer_top(t);
+	for (uint8_t channel = 0; channel < 2; channel++){
+		uint32_t ocr = timer_ocr(t, channel);
+		if (ocr <= top && ticks >= timer_ticks_to(t, ocr))
+			*t->tifr |= (1 << (OCF0A + channel));
+	}
+	uint32_t count = timer_count(t);
+	uint32_t wrap = timer_ticks_to(t, top + 1);
+	if (ticks >= wrap){
+		*t->tifr |= (1 << TOV0);
+		count = (ticks - wrap) % (top + 1);
+	}
+	else{
+		count += ticks;
+	}
+	if (t->tcnt16)
+		*t->tcnt16 = count;
+	else
+		*t->tcnt8 = count;
+}
+
+/** @brief Number of CPU cycles until a timer next sets a flag whose interrupt is enabled and has an ISR
+ *
+ *  @param[in] t The timer
+ *  @return uint64_t Cycles, or UINT64_MAX if there is no such event
+ */
+static uint64_t timer_next_event(struct avr_sim_timer *t)
+{
+	uint32_t prescale = timer_prescale(t);
+	uint64_t next = UINT64_MAX;
+	if (!prescale)
+		return next;
+	uint32_t top = timer_top(t);
+	for (uint8_t flag = 0; flag < 3; flag++){
+		if (!t->isr[flag] || !(*t->timsk & (1 << flag)))
+			continue;
+		uint32_t value = flag ? timer_ocr(t, flag - 1) : top + 1;
+		if (flag && value > top)
+			continue;                                    // compare value is never reached
+		uint64_t cycles = (uint64_t) timer_ticks_to(t, value) * prescale - t->residue;
+		if (cycles < next)
+			next = cycles;
+	}
+	return next;
+}
+
+/** @brief Moves the clock to a later time, counting every running timer along
+ *
+ *  @param[in] when The new time
+ *  @return void
+ */
+static void move_to(uint64_t when)
+{
+	if (when <= avr_sim_cycles)
+		return;
+	for (uint8_t i = 0; i < 6; i++){
+		timer_run(&timers[i], when - avr_sim_cycles);
+	}
+	avr_sim_cycles = when;
+}
+
+/** @brief Runs the highest priority interrupt which is flagged, enabled and allowed by the I bit
+ *
+ *  @param void
+ *  @return uint8_t 1 if an ISR was run
+ */
+static uint8_t service_pending(void)
+{
+	if (!(SREG & SREG_I))
+		return 0;
+	for (uint8_t i = 0; i < 8; i++){
+		if (ext_isr[i] && (EIMSK & EIFR & (1 << i))){
+			EIFR &= ~(1 << i);                           // cleared by hardware when the vector runs
+			dispatch(ext_isr[i]);
+			return 1;
+		}
+	}
+	for (uint8_t i = 0; i < AVR_SIM_MAX_SOURCES; i++){
+		if (sources[i].isr && sources[i].pending){
+			sources[i].pending = 0;
+			dispatch(sources[i].isr);
+			return 1;
+		}
+	}
+	for (uint8_t i = 0; i < 6; i++){
+		struct avr_sim_timer *t = &timers[i];
+		for (uint8_t flag = 0; flag < 3; flag++){
+			if (t->isr[flag] && (*t->timsk & *t->tifr & (1 << flag))){
+				*t->tifr &= ~(1 << flag);                // cleared by hardware when the vector runs
+				dispatch(t->isr[flag]);
+				return 1;
+			}
+		}
+	}
+	if (spi_isr && spi_flagged && (SPCR & (1 << SPIE))){
+		spi_flagged = 0;
+		SPSR &= ~(1 << SPIF);                            // cleared by hardware when the vector runs
+		dispatch(spi_isr);
+		return 1;
+	}
+	if (adc_isr && (ADCSRA & (1 << ADIF)) && (ADCSRA & (1 << ADIE))){
+		ADCSRA &= ~(1 << ADIF);                          // cleared by hardware when the vector runs
+		dispatch(adc_isr);
+		return 1;
+	}
+	if (twi_isr && twi_flagged && (TWCR & (1 << TWIE))){
+		twi_flagged = 0;                                 // TWINT stays set until the ISR writes it
+		dispatch(twi_isr);
+		return 1;
+	}
+	return 0;
+}
+
+/** @brief Number of CPU cycles one character occupies on a USART, 1 start, 8 data and 1 stop bit
+ *
+ *  @param[in] u The USART
+ *  @return uint64_t
+ */
+static uint64_t char_time(struct avr_sim_usart *u)
+{
+	return 10ULL * 16 * (*u->ubrr + 1);
+}
+
+/** @brief Finds the USART whose data register empty interrupt is the next to fire
+ *
+ *  @param[in] target Latest time of interest
+ *  @param[out] when Time at which the interrupt fires
+ *  @return struct avr_sim_usart* The USART, or 0 if none fires by target
+ */
+static struct avr_sim_usart *udre_due(uint64_t target, uint64_t *when)
+{
+	struct avr_sim_usart *due = 0;
+	if (!(SREG & SREG_I))
+		return 0;
+	for (uint8_t i = 0; i < 2; i++){
+		struct avr_sim_usart *u = &usart[i];
+		if (!u->udre_isr || !(*u->ucsrb & (1 << UDRIE0)))
+			continue;
+		uint64_t t = (u->busy_until > avr_sim_cycles) ? u->busy_until : avr_sim_cycles;
+		if (t <= target && (!due || t < *when)){
+			due = u;
+			*when = t;
+		}
+	}
+	return due;
+}
+
+/** @brief Runs a data register empty ISR and puts whatever it loads into UDRn on the line
+ *
+ *  @param[in] u The USART whose transmitter is ready
+ *  @return void
+ */
+static void udre_interrupt(struct avr_sim_usart *u)
+{
+	if (u->pending && u->log_len < USART_LOG)
+		u->log[u->log_len++] = *u->udr;                 // last character loaded by polling
+	u->pending = 0;
+	dispatch(u->udre_isr);
+	if (*u->ucsrb & (1 << UDRIE0)){                      // still enabled, so the ISR loaded UDRn
+		if (u->log_len < USART_LOG)
+			u->log[u->log_len++] = *u->udr;
+		u->busy_until = avr_sim_cycles + char_time(u);
+	}
+}
+
+/** @brief Performs the bus action encoded in TWCR against the attached TWI slave
+ *
+ *  A STOP is sent first if TWSTO is set, and on its own sets no status.
+ *
+ *  @param[out] cycles How long the action takes on the bus
+ *  @return uint8_t The status it leaves in TWSR, or TWI_NO_STATUS
+ */
+static uint8_t twi_action(uint32_t *cycles)
+{
+	uint8_t status;
+	uint32_t bit_time = 16 + 2 * TWBR * (1 << (2 * (TWSR & 0x03)));
+
+	*cycles = 0;
+	if (TWCR & (1 << TWSTO)){
+		TWCR &= ~(1 << TWSTO);                           // cleared by hardware once the STOP is sent
+		twi_state = TWI_IDLE;
+		twi_dev = 0;
+		*cycles = bit_time;
+		if (!(TWCR & (1 << TWSTA)))
+			return TWI_NO_STATUS;
+	}
+	if (TWCR & (1 << TWSTA)){
+		status = (twi_state == TWI_IDLE) ? 0x08 : 0x10;  // START or repeated START
+		twi_state = TWI_ADDRESS;
+		*cycles += bit_time;
+	}
+	else if (twi_state == TWI_ADDRESS){
+		uint8_t read = TWDR & 0x01;
+		twi_dev = 0;
+		for (uint8_t i = 0; i < AVR_SIM_MAX_TWI; i++){
+			if (twi_bus[i] && twi_bus[i]->address == (TWDR >> 1))
+				twi_dev = twi_bus[i];
+		}
+		if (twi_dev && twi_dev->start(twi_dev->ctx, read)){
+			status = read ? 0x40 : 0x18;
+			twi_state = read ? TWI_READ : TWI_WRITE;
+		}
+		else{
+			status = read ? 0x48 : 0x20;
+			twi_state = TWI_IDLE;
+		}
+		*cycles += 9 * bit_time;
+	}
+	else if (twi_state == TWI_WRITE){
+		status = twi_dev->write(twi_dev->ctx, TWDR) ? 0x28 : 0x30;
+		*cycles += 9 * bit_time;
+	}
+	else if (twi_state == TWI_READ){
+		TWDR = twi_dev->read(twi_dev->ctx);
+		status = (TWCR & (1 << TWEA)) ? 0x50 : 0x58;
+		*cycles += 9 * bit_time;
+	}
+	else{
+		status = 0x00;                                   // bus error
+	}
+	return status;
+}
+
+/** @brief Ends the TWI action on the bus, setting TWINT so that TWI_vect runs
+ *
+ *  @param void
+ *  @return void
+ */
+static void twi_finish(void)
+{
+	if (!twi_busy)
+		return;                                          // the firmware reset the TWI in the meantime
+	twi_busy = 0;
+	if (twi_status != TWI_NO_STATUS){
+		TWSR = twi_status | (TWSR & 0x03);
+		TWCR |= (1 << TWINT);
+		twi_flagged = 1;
+	}
+	twi_cr = TWCR;
+}
+
+/** @brief Takes up an action the firmware has written to TWCR, when TWI_vect is registered
+ *
+ *  Writing TWCR while an action is on the bus, which the firmware only does to turn the TWI off and on
+ *  again, throws the action away and lets go of the bus.
+ *
+ *  @param void
+ *  @return void
+ */
+static void twi_accept(void)
+{
+	if (!twi_isr)
+		return;
+	if ((twi_busy || twi_flagged) && TWCR != twi_cr){
+		twi_busy = 0;                                    // reset, the bus is let go
+		twi_flagged = 0;
+		twi_state = TWI_IDLE;
+		twi_dev = 0;
+	}
+	if (twi_busy || twi_flagged || (TWCR & ((1 << TWINT) | (1 << TWEN))) != ((1 << TWINT) | (1 << TWEN)))
+		return;
+	TWCR &= ~(1 << TWINT);                               // writing it clears the flag
+	twi_status = twi_action(&twi_cycles);
+	twi_cr = TWCR;
+	twi_busy = 1;
+	if (!twi_stalled)
+		avr_sim_at(avr_sim_cycles + twi_cycles, twi_finish);
+}
+
+/** @brief Number of CPU cycles one conversion takes, 13 ADC clocks
+ *
+ *  @param void
+ *  @return uint64_t
+ */
+static uint64_t adc_time(void)
+{
+	uint32_t div = 1 << (ADCSRA & 0x07);
+	if (div < 2)
+		div = 2;
+	return 13ULL * div;
+}
+
+/** @brief Ends the conversion in the background, and starts the next one in free running mode
+ *
+ *  @param void
+ *  @return void
+ */
+static void adc_finish(void)
+{
+	if (!adc_busy)
+		return;
+	if (!(ADCSRA & (1 << ADEN))){
+		ADCSRA &= ~(1 << ADSC);                          // turned off part way through
+		adc_busy = 0;
+		return;
+	}
+	ADCW = adc_value[adc_mux];
+	ADCSRA |= (1 << ADIF);
+	if ((ADCSRA & (1 << ADATE)) && (ADCSRB & 0x07) == 0){
+		adc_mux = ADMUX & 0x1F;                          // ADMUX as it is now, before the ISR changes it
+		avr_sim_at(avr_sim_cycles + adc_time(), adc_finish);
+	}
+	else{
+		ADCSRA &= ~(1 << ADSC);
+		adc_busy = 0;
+	}
+}
+
+/** @brief Starts a conversion in the background once the firmware sets ADSC, when ADC_vect is registered
+ *
+ *  @param void
+ *  @return void
+ */
+static void adc_accept(void)
+{
+	if (!adc_isr || adc_busy || (ADCSRA & ((1 << ADEN) | (1 << ADSC))) != ((1 << ADEN) | (1 << ADSC)))
+		return;
+	adc_busy = 1;
+	adc_mux = ADMUX & 0x1F;
+	avr_sim_at(avr_sim_cycles + adc_time(), adc_finish);
+}
+
+/** @brief Moves simulated time forward, running any interrupts which come due
+ *
+ *  @param[in] cycles Number of CPU cycles to advance by
+ *  @return void
+ */
+void avr_sim_advance(uint64_t cycles)
+{
+	uint64_t target = avr_sim_cycles + cycles;
+
+	while (1){
+		twi_accept();
+		adc_accept();
+		if (service_pending())
+			continue;
+
+		// Find the next event, sources first on a tie
+		uint64_t when = UINT64_MAX;
+		struct avr_sim_source *due = 0;
+		for (uint8_t i = 0; i < AVR_SIM_MAX_SOURCES; i++){
+			if (sources[i].isr && sources[i].next < when){
+				due = &sources[i];
+				when = sources[i].next;
+			}
+		}
+		uint64_t tx_when;
+		struct avr_sim_usart *tx = udre_due(target, &tx_when);
+		if (tx && tx_when < when){
+			due = 0;
+			when = tx_when;
+		}
+		else{
+			tx = 0;
+		}
+		uint8_t timer_event = 0;
+		for (uint8_t i = 0; i < 6; i++){
+			uint64_t cycles_to = timer_next_event(&timers[i]);
+			if (cycles_to != UINT64_MAX && avr_sim_cycles + cycles_to < when){
+				due = 0;
+				tx = 0;
+				timer_event = 1;
+				when = avr_sim_cycles + cycles_to;
+			}
+		}
+		struct avr_sim_event *event = 0;
+		for (uint8_t i = 0; i < AVR_SIM_MAX_EVENTS; i++){
+			if (events[i].run && events[i].when < when){
+				event = &events[i];
+				due = 0;
+				tx = 0;
+				when = events[i].when;
+			}
+		}
+		if (when > target || (!due && !tx && !timer_event && !event))
+			break;
+
+		move_to(when);                                   // sets the flag of a timer event
+		if (event){
+			avr_sim_event_t run = event->run;
+			event->run = 0;
+			run();
+		}
+		else if (tx){
+			udre_interrupt(tx);
+		}
+		else if (due){
+			due->next += due->period;
+			if (due->mask && !(*due->mask & (1 << due->bit)))
+				continue;                                // masked at the source, the edge is lost
+			if (SREG & SREG_I)
+				dispatch(due->isr);
+			else
+				due->pending = 1;                        // global interrupts are off, latch it
+		}
+	}
+	move_to(target);
+}
+
+/** @brief Disables global interrupts
+ *
+ *  @param void
+ *  @return void
+ */
+void avr_sim_cli(void)
+{
+	SREG &= ~SREG_I;
+}
+
+/** @brief Enables global interrupts and services anything which was latched while they were off
+ *
+ *  @param void
+ *  @return void
+ */
+void avr_sim_sei(void)
+{
+	SREG |= SREG_I;
+	avr_sim_advance(0);
+}
+
+/** @brief Registers a periodic interrupt source, such as the pulse train from a flow meter
+ *
+ *  @param[in] isr ISR to call on every event
+ *  @param[in] period Number of cycles between events
+ *  @param[in] mask Optional mask register which must have bit set for the event to be delivered
+ *  @param[in] bit Bit within mask
+ *  @return int Handle for the source, or -1 if the table is full
+ */
+int avr_sim_add_source(avr_sim_isr_t isr, uint64_t period, volatile uint8_t *mask, uint8_t bit)
+{
+	for (uint8_t i = 0; i < AVR_SIM_MAX_SOURCES; i++){
+		if (!sources[i].isr){
+			sources[i].isr = isr;
+			sources[i].period = period;
+			sources[i].next = avr_sim_cycles + period;
+			sources[i].mask = mask;
+			sources[i].bit = bit;
+			sources[i].pending = 0;
+			return i;
+		}
+	}
+	return -1;
+}
+
+/** @brief Changes the period of an interrupt source starting with its next event
+ *
+ *  @param[in] source Handle returned by avr_sim_add_source()
+ *  @param[in] period New number of cycles between events
+ *  @return void
+ */
+void avr_sim_set_period(int source, uint64_t period)
+{
+	sources[source].period = period;
+}
+
+/** @brief Removes an interrupt source
+ *
+ *  @param[in] source Handle returned by avr_sim_add_source()
+ *  @return void
+ */
+void avr_sim_remove_source(int source)
+{
+	sources[source].isr = 0;
+}
+
+/** @brief Registers a timer interrupt vector
+ *
+ *  The ISR runs when the flag is set in TIFRn, its enable bit is set in TIMSKn and global interrupts
+ *  are on, and the flag is cleared as it runs, the same as on the AVR.
+ *
+ *  @param[in] timer Timer number, 0-5
+ *  @param[in] flag TOVn, OCFnA or OCFnB
+ *  @param[in] isr TIMERn_OVF_vect, TIMERn_COMPA_vect or TIMERn_COMPB_vect of the firmware under test
+ *  @return void
+ */
+void avr_sim_timer_isr(uint8_t timer, uint8_t flag, avr_sim_isr_t isr)
+{
+	timers[timer].isr[flag] = isr;
+}
+
+/** @brief Registers the ISR of an external interrupt
+ *
+ *  @param[in] line External interrupt number, 0-7
+ *  @param[in] isr The INTn_vect of the firmware under test
+ *  @return void
+ */
+void avr_sim_ext_isr(uint8_t line, avr_sim_isr_t isr)
+{
+	ext_isr[line] = isr;
+}
+
+/** @brief Has a device model called back at a given time, for something it does by itself such as finishing a transmission
+ *
+ *  A callback which is already waiting is moved to the new time rather than added again.
+ *
+ *  @param[in] when Simulation time of the call
+ *  @param[in] run The callback
+ *  @return void
+ */
+void avr_sim_at(uint64_t when, avr_sim_event_t run)
+{
+	struct avr_sim_event *free = 0;
+	for (uint8_t i = 0; i < AVR_SIM_MAX_EVENTS; i++){
+		if (events[i].run == run){
+			events[i].when = when;
+			return;
+		}
+		if (!events[i].run && !free)
+			free = &events[i];
+	}
+	if (free){
+		free->run = run;
+		free->when = when;
+	}
+}
+
+/** @brief Signals the active edge on an external interrupt pin, as driven by a device model
+ *
+ *  The flag is latched in EIFR and the ISR is run from the next avr_sim_advance() in which INTn is
+ *  unmasked and interrupts are on, so an edge during an SPI transaction never cuts into it.
+ *
+ *  @param[in] line External interrupt number, 0-7
+ *  @return void
+ */
+void avr_sim_ext_edge(uint8_t line)
+{
+	EIFR |= 1 << line;
+}
+
+/** @brief Attaches the device which answers on the SPI bus
+ *
+ *  @param[in] dev The SPI slave model
+ *  @return void
+ */
+void avr_sim_attach_spi(const struct avr_sim_spi_dev *dev)
+{
+	spi_dev = dev;
+}
+
+/** @brief Tells the SPI slave model about a chip select edge, called from the hal_cs_* macros
+ *
+ *  @param[in] active 1 when the chip select line has been pulled low, 0 when it has been released
+ *  @return void
+ */
+void avr_sim_spi_cs(uint8_t active)
+{
+	if (spi_dev && spi_dev->select)
+		spi_dev->select(active);
+}
+
+/** @brief Registers SPI_STC_vect, which has bytes written through hal_spi_write() clocked in the background while SPIE is set
+ *
+ *  @param[in] isr The SPI_STC_vect of the firmware under test
+ *  @return void
+ */
+void avr_sim_spi_isr(avr_sim_isr_t isr)
+{
+	spi_isr = isr;
+}
+
+/** @brief Number of CPU cycles one byte takes on the SPI bus
+ *
+ *  @param void
+ *  @return uint32_t
+ */
+static uint32_t spi_time(void)
+{
+	static const uint8_t divider[4] = {4, 16, 64, 128};
+	uint32_t div = divider[SPCR & 0x03];
+	if (SPSR & (1 << SPI2X))
+		div >>= 1;
+	return 8 * div;
+}
+
+/** @brief Ends the byte on the SPI bus, setting SPIF so that SPI_STC_vect runs
+ *
+ *  @param void
+ *  @return void
+ */
+static void spi_finish(void)
+{
+	if (!spi_busy)
+		return;
+	spi_busy = 0;
+	SPDR = spi_miso;
+	SPSR |= (1 << SPIF);
+	spi_flagged = 1;
+}
+
+/** @brief Starts clocking the byte just written to SPDR, called from hal_spi_write()
+ *
+ *  Writing SPDR twice with the same byte looks the same as writing it once, so unlike TWCR and ADCSRA the
+ *  write has to be announced.  With SPIE clear the byte is left for poll_spi() to clock when SPSR is polled.
+ *
+ *  @param void
+ *  @return void
+ */
+void avr_sim_spi_start(void)
+{
+	if (!spi_isr || !(SPCR & (1 << SPIE)))
+		return;
+	SPSR &= ~(1 << SPIF);
+	spi_miso = spi_dev ? spi_dev->xfer(SPDR) : 0xFF;
+	spi_busy = 1;
+	spi_until = avr_sim_cycles + spi_time();
+	avr_sim_at(spi_until, spi_finish);
+}
+
+/** @brief Attaches a device to the TWI bus
+ *
+ *  @param[in] dev The TWI slave model
+ *  @return void
+ */
+void avr_sim_attach_twi(const struct avr_sim_twi_dev *dev)
+{
+	for (uint8_t i = 0; i < AVR_SIM_MAX_TWI; i++){
+		if (!twi_bus[i]){
+			twi_bus[i] = dev;
+			return;
+		}
+	}
+}
+
+/** @brief Registers TWI_vect, which has TWI actions run in the background as on the AVR
+ *
+ *  @param[in] isr The TWI_vect of the firmware under test
+ *  @return void
+ */
+void avr_sim_twi_isr(avr_sim_isr_t isr)
+{
+	twi_isr = isr;
+}
+
+/** @brief Has a slave hold the clock low, so that the action on the bus never ends until it lets go
+ *
+ *  @param[in] stalled 1 to hold the clock, 0 to let go of it
+ *  @return void
+ */
+void avr_sim_twi_stall(uint8_t stalled)
+{
+	twi_stalled = stalled;
+	if (!stalled && twi_busy)
+		avr_sim_at(avr_sim_cycles + twi_cycles, twi_finish);
+}
+
+/** @brief Sets the value which the ADC will return for a given channel
+ *
+ *  @param[in] channel ADMUX channel number
+ *  @param[in] value 10 bit conversion result
+ *  @return void
+ */
+void avr_sim_set_adc(uint8_t channel, uint16_t value)
+{
+	adc_value[channel & 0x1F] = value & 0x3FF;
+}
+
+/** @brief Registers ADC_vect, which has conversions run in the background as on the AVR
+ *
+ *  @param[in] isr The ADC_vect of the firmware under test
+ *  @return void
+ */
+void avr_sim_adc_isr(avr_sim_isr_t isr)
+{
+	adc_isr = isr;
+}
+
+/** @brief Delivers a received character to a USART and runs its receive ISR if interrupts are enabled
+ *
+ *  @param[in] port USART number, 0 or 1
+ *  @param[in] data The received character
+ *  @param[in] isr The USARTn_RX_vect of the firmware under test
+ *  @return void
+ */
+void avr_sim_usart_rx(uint8_t port, uint8_t data, avr_sim_isr_t isr)
+{
+	*usart[port].udr = data;
+	if (SREG & SREG_I)
+		dispatch(isr);
+}
+
+/** @brief Registers the data register empty ISR of a USART
+ *
+ *  While UDRIEn is set in UCSRnB and global interrupts are on, the ISR is called every time the
+ *  transmitter can take another character.  Like on the AVR it must clear UDRIEn when it has nothing
+ *  left to send, and the model takes UDRIEn still being set afterwards to mean UDRn was loaded.
+ *
+ *  @param[in] port USART number, 0 or 1
+ *  @param[in] isr The USARTn_UDRE_vect of the firmware under test
+ *  @return void
+ */
+void avr_sim_usart_udre(uint8_t port, avr_sim_isr_t isr)
+{
+	usart[port].udre_isr = isr;
+}
+
+/** @brief Copies out and clears the characters which have been transmitted on a USART
+ *
+ *  @param[in] port USART number, 0 or 1
+ *  @param[out] buffer Where to copy the characters
+ *  @param[in] len Size of buffer
+ *  @return uint16_t Number of characters copied
+ */
+uint16_t avr_sim_usart_log(uint8_t port, uint8_t *buffer, uint16_t len)
+{
+	struct avr_sim_usart *u = &usart[port];
+	if (u->pending && u->log_len < USART_LOG){
+		u->log[u->log_len++] = *u->udr;
+		u->pending = 0;
+	}
+	if (len > u->log_len)
+		len = u->log_len;
+	for (uint16_t i = 0; i < len; i++){
+		buffer[i] = u->log[i];
+	}
+	u->log_len = 0;
+	return len;
+}
+
+/** @brief Models a poll of TIFRn, which completes when the timer next overflows
+ *
+ *  The firmware clears TOVn by writing a 1 to it, which a plain variable cannot model, so every poll
+ *  waits for a fresh overflow.
+ *
+ *  @param[in] n Timer number
+ *  @return void
+ */
+static void poll_timer(uint8_t n)
+{
+	struct avr_sim_timer *t = &timers[n];
+	uint32_t prescale = timer_prescale(t);
+	if (!prescale){
+		fprintf(stderr, "avr_sim: TIFR%u polled while timer %u is stopped, this would hang the MCU\n", n, n);
+		abort();
+	}
+	wait((uint64_t) timer_ticks_to(t, timer_top(t) + 1) * prescale - t->residue);
+	*t->tifr |= (1 << TOV0);
+}
+
+/** @brief Models a poll of UCSRnA for UDRE, which completes once the previous character has shifted out
+ *
+ *  @param[in] u The USART being polled
+ *  @return void
+ */
+static void poll_usart(struct avr_sim_usart *u)
+{
+	if (avr_sim_cycles < u->busy_until)
+		wait(u->busy_until - avr_sim_cycles);
+	if (u->pending && u->log_len < USART_LOG)
+		u->log[u->log_len++] = *u->udr;
+	u->pending = 1;                                      // the caller will now load UDRn
+	u->busy_until = avr_sim_cycles + char_time(u);
+}
+
+/** @brief Models a poll of SPSR, which clocks SPDR through the attached slave
+ *
+ *  @param void
+ *  @return void
+ */
+static void poll_spi(void)
+{
+	SPDR = spi_dev ? spi_dev->xfer(SPDR) : 0xFF;
+	wait(spi_time());
+	SPSR |= (1 << SPIF);
+}
+
+/** @brief Models a poll of SPCR, which lets the byte on the bus from avr_sim_spi_start() finish and its ISR run
+ *
+ *  @param void
+ *  @return void
+ */
+static void poll_spcr(void)
+{
+	if (spi_busy)
+		wait(spi_until - avr_sim_cycles);
+}
+
+/** @brief Models a poll of TWCR, which performs the action last written to TWCR and waits for it
+ *
+ *  With TWI_vect registered the action has already been taken up by twi_accept(), so this does nothing.
+ *
+ *  @param void
+ *  @return void
+ */
+static void poll_twi(void)
+{
+	if (twi_isr)
+		return;
+	uint32_t cycles;
+	uint8_t status = twi_action(&cycles);
+	wait(cycles);
+	if (status != TWI_NO_STATUS){
+		TWSR = status | (TWSR & 0x03);
+		TWCR |= (1 << TWINT);
+	}
+}
+
+/** @brief Models a read of ADCSRA, finishing the conversion in progress if enough time has passed
+ *
+ *  @param void
+ *  @return void
+ */
+static void poll_adc(void)
+{
+	if (adc_isr || !(ADCSRA & (1 << ADSC)))
+		return;
+	if (!adc_busy){
+		adc_busy = 1;                                    // conversion was started since the last look
+		adc_start = avr_sim_cycles;
+		return;
+	}
+	if (avr_sim_cycles - adc_start >= adc_time()){
+		ADCW = adc_value[ADMUX & 0x1F];
+		ADCSRA = (ADCSRA & ~(1 << ADSC)) | (1 << ADIF);
+		adc_busy = 0;
+	}
+}
+
+/** @brief Reads a register through the peripheral models.  This is what _SFR_BYTE expands to on the host
+ *
+ *  @param[in] reg The register being read
+ *  @return uint8_t The value of the register after the model has run
+ */
+uint8_t avr_sim_read8(volatile uint8_t *reg)
+{
+	if (reg == &TIFR0)
+		poll_timer(0);
+	else if (reg == &TIFR1)
+		poll_timer(1);
+	else if (reg == &TIFR3)
+		poll_timer(3);
+	else if (reg == &TIFR4)
+		poll_timer(4);
+	else if (reg == &TIFR5)
+		poll_timer(5);
+	else if (reg == &UCSR0A)
+		poll_usart(&usart[0]);
+	else if (reg == &UCSR1A)
+		poll_usart(&usart[1]);
+	else if (reg == &SPSR)
+		poll_spi();
+	else if (reg == &SPCR)
+		poll_spcr();
+	else if (reg == &TWCR)
+		poll_twi();
+	else if (reg == &ADCSRA)
+		poll_adc();
+	return *reg;
+}
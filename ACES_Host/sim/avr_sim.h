@@ -0,0 +1,101 @@
+/** @file avr_sim.h
+ *  @author Nick Moore
+ *  @date October 15, 2026
+ *  @brief Simulated ATmega2561 peripherals for the host build of the ECU and ESB firmware
+ *
+ *  The simulator keeps a cycle clock at F_CPU.  Time only moves when the firmware polls a status
+ *  register (through _SFR_BYTE) or when a benchmark calls avr_sim_advance(), which makes the cost of
+ *  every busy-wait in the firmware show up as simulated cycles that can be compared between versions.
+ *
+ *  Peripheral models:
+ *  1) Timers 0-5: count from their prescaled clock and run their overflow and compare ISRs when enabled,
+ *     and polling TIFRn waits for the next overflow of timer n
+ *  2) USART0/1: polling UCSRnA waits out the previous character at the programmed baud rate, and with
+ *     UDRIEn set the data register empty ISR runs each time the transmitter can take a character
+ *  3) SPI: polling SPSR clocks one byte through the attached SPI slave
+ *  4) TWI: polling TWCR performs the bus action encoded in TWCR against the attached TWI slave.  With
+ *     TWI_vect registered, an action written to TWCR with TWINT set runs in the background instead and
+ *     TWI_vect is run when it is done, unless a slave is holding the clock low (avr_sim_twi_stall())
+ *  5) ADC: a conversion started with ADSC completes 13 ADC clocks later with the value set per channel.
+ *     With ADC_vect registered it runs in the background instead, taking its channel from ADMUX as it
+ *     starts, and in free running mode (ADATE) the next one starts as soon as it is done
+ *  6) Interrupt sources: periodic events which call a registered ISR when unmasked
+ *  7) External interrupts INT0-7: a device model signals an edge, which sets INTFn in EIFR whether or not
+ *     it is masked, and the registered ISR runs once INTn is set in EIMSK and interrupts are on
+ *  8) Device events: a device model can have itself called back at a later time with avr_sim_at()
+ *
+ *  @bug No known bugs
+ */
+
+#ifndef AVR_SIM_H_
+#define AVR_SIM_H_
+
+#include <stdint.h>
+#include <avr/io.h>
+
+#ifndef F_CPU
+#define F_CPU 16000000UL
+#endif
+
+//! Maximum number of periodic interrupt sources
+#define AVR_SIM_MAX_SOURCES 8
+
+//! Maximum number of device model callbacks waiting at once, see avr_sim_at()
+#define AVR_SIM_MAX_EVENTS 8
+
+typedef void (*avr_sim_isr_t)(void);
+typedef void (*avr_sim_event_t)(void);
+
+//! Simulated SPI slave.  xfer shifts one byte each way, select is told about chip select edges
+struct avr_sim_spi_dev {
+	uint8_t (*xfer)(uint8_t mosi);
+	void (*select)(uint8_t active);
+};
+
+//! Maximum number of slaves on the simulated TWI bus
+#define AVR_SIM_MAX_TWI 8
+
+//! Simulated TWI slave.  start returns 1 to ACK its address, write returns 1 to ACK a data byte
+struct avr_sim_twi_dev {
+	uint8_t address;                       // 7 bit address
+	void *ctx;                             // handed back to every callback
+	uint8_t (*start)(void *ctx, uint8_t read);
+	uint8_t (*write)(void *ctx, uint8_t data);
+	uint8_t (*read)(void *ctx);
+};
+
+//! Simulation clock in CPU cycles since avr_sim_reset()
+extern uint64_t avr_sim_cycles;
+
+//! Cycles the firmware has spent spinning on a status register since avr_sim_reset()
+extern uint64_t avr_sim_wait_cycles;
+
+void avr_sim_reset(void);
+void avr_sim_advance(uint64_t cycles);
+uint8_t avr_sim_read8(volatile uint8_t *reg);
+void avr_sim_cli(void);
+void avr_sim_sei(void);
+
+int avr_sim_add_source(avr_sim_isr_t isr, uint64_t period, volatile uint8_t *mask, uint8_t bit);
+void avr_sim_set_period(int source, uint64_t period);
+void avr_sim_remove_source(int source);
+
+void avr_sim_timer_isr(uint8_t timer, uint8_t flag, avr_sim_isr_t isr);
+void avr_sim_ext_isr(uint8_t line, avr_sim_isr_t isr);
+void avr_sim_ext_edge(uint8_t line);
+void avr_sim_at(uint64_t when, avr_sim_event_t run);
+void avr_sim_attach_spi(const struct avr_sim_spi_dev *dev);
+void avr_sim_spi_cs(uint8_t active);
+void avr_sim_spi_isr(avr_sim_isr_t isr);
+void avr_sim_spi_start(void);
+void avr_sim_attach_twi(const struct avr_sim_twi_dev *dev);
+void avr_sim_twi_isr(avr_sim_isr_t isr);
+void avr_sim_twi_stall(uint8_t stalled);
+void avr_sim_set_adc(uint8_t channel, uint16_t value);
+void avr_sim_adc_isr(avr_sim_isr_t isr);
+
+void avr_sim_usart_rx(uint8_t port, uint8_t data, avr_sim_isr_t isr);
+void avr_sim_usart_udre(uint8_t port, avr_sim_isr_t isr);
+uint16_t avr_sim_usart_log(uint8_t port, uint8_t *buffer, uint16_t len);
+
+#endif /* AVR_SIM_H_ */
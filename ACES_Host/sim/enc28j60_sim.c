@@ -0,0 +1,786 @@
+/** @file enc28j60_sim.c
+ *  @author Nick Moore
+ *  @date October 15, 2026
+ *  @brief Implementation of the ENC28J60 model
+ *
+ *  Register addresses use the same encoding as Ethernet.h: bits 0-4 are the address, bits 5-6 the bank
+ *  and bit 7 marks a MAC/MII register which returns a dummy byte before its data on a read.
+ *
+ *  @bug The magic packet filter is not modelled, it never passes a frame
+ */
+
+#include <string.h>
+#include "enc28j60_sim.h"
+
+#define MEM_SIZE     0x2000
+#define MEM_MASK     0x1FFF
+
+// Common registers, present in every bank
+#define R_EIE        0x1B
+#define R_EIR        0x1C
+#define R_ESTAT      0x1D
+#define R_ECON2      0x1E
+#define R_ECON1      0x1F
+
+// Bank 0
+#define R_ERDPTL     0x00
+#define R_EWRPTL     0x02
+#define R_ETXSTL     0x04
+#define R_ETXNDL     0x06
+#define R_ERXSTL     0x08
+#define R_ERXSTH     0x09
+#define R_ERXNDL     0x0A
+#define R_ERXRDPTL   0x0C
+#define R_ERXWRPTL   0x0E
+#define R_EDMASTL    0x10
+#define R_EDMANDL    0x12
+#define R_EDMADSTL   0x14
+#define R_EDMACSL    0x16
+#define R_EDMACSH    0x17
+// Bank 1
+#define R_EHT0       0x00
+#define R_EPMM0      0x08
+#define R_EPMCSL     0x10
+#define R_EPMOL      0x14
+#define R_ERXFCON    0x18
+#define R_EPKTCNT    0x19
+// Bank 2
+#define R_MICMD      0x12
+#define R_MIREGADR   0x14
+#define R_MIWRL      0x16
+#define R_MIWRH      0x17
+#define R_MIRDL      0x18
+#define R_MIRDH      0x19
+// Bank 3
+#define R_MISTAT     0x0A
+
+#define OP_RCR       0x00
+#define OP_RBM       0x20
+#define OP_WCR       0x40
+#define OP_WBM       0x60
+#define OP_BFS       0x80
+#define OP_BFC       0xA0
+#define OP_SRC       0xE0
+
+#define EIE_INTIE    0x80
+
+#define ERXFCON_UCEN  0x80
+#define ERXFCON_ANDOR 0x40
+#define ERXFCON_CRCEN 0x20
+#define ERXFCON_PMEN  0x10
+#define ERXFCON_MPEN  0x08
+#define ERXFCON_HTEN  0x04
+#define ERXFCON_MCEN  0x02
+#define ERXFCON_BCEN  0x01
+#define PATTERN_LEN   64                  // bytes in the pattern match window
+#define EIR_PKTIF    0x40
+#define EIR_TXIF     0x08
+#define EIR_TXERIF   0x02
+#define EIR_RXERIF   0x01
+#define ESTAT_TXABRT 0x02
+#define ECON1_TXRST  0x80
+#define ECON1_DMAST  0x20
+#define ECON1_CSUMEN 0x10
+#define EIR_DMAIF    0x20
+#define EIR_FLAGS    0x7B              // the flags which can drive the INT pin
+#define ECON1_TXRTS  0x08
+#define ECON1_RXEN   0x04
+#define ECON2_PKTDEC 0x40
+#define MICMD_MIISCAN 0x02
+#define MICMD_MIIRD  0x01
+#define MISTAT_SCAN  0x02
+#define MISTAT_BUSY  0x01
+
+// PHY registers and bits
+#define P_PHSTAT1    0x01
+#define P_PHCON2     0x10
+#define P_PHSTAT2    0x11
+#define P_PHIE       0x12
+#define P_PHIR       0x13
+#define PHSTAT1_LLSTAT 0x0004
+#define PHSTAT2_LSTAT  0x0400
+#define PHCON2_FRCLINK 0x4000
+#define PHIE_PLNKIE  0x0010
+#define PHIE_PGEIE   0x0002
+#define PHIR_PLNKIF  0x0010
+#define PHIR_PGIF    0x0004
+#define EIR_LINKIF   0x10
+
+//! Time the MII takes to read or write a PHY register, 10.24 us
+#define MII_CYCLES   ((uint64_t) F_CPU * 1024 / 100000000)
+
+//! Bit rate of 10BASE-T, the time on the wire is worked out from it in whole CPU cycles per frame
+#define BIT_RATE     10000000UL
+
+//! Time the DMA takes over each byte, in ns
+#define DMA_BYTE_NS  80
+
+struct enc28j60_sim_stats enc28j60_sim_stats;
+
+static uint8_t bank_regs[4][0x20];
+static uint8_t common_regs[5];
+static uint8_t mem[MEM_SIZE];
+static uint16_t phy[0x20];
+static uint16_t rx_write;                // hardware receive write pointer
+static uint64_t tx_done_at;              // when the frame on the wire finishes, 0 if idle
+static uint64_t dma_done_at;             // when the running DMA operation finishes, 0 if idle
+static uint64_t mii_done_at;             // when the MII operation under way finishes, 0 if idle
+static uint8_t cable = 1;                // a link partner is on the other end of the cable
+static uint8_t tx_fail;                  // the frame on the wire is going to be aborted
+static uint8_t tx_stuck;                 // TXRTS was left set by an aborted frame, as in Rev. B4 Silicon Errata point 12
+static uint16_t tx_fail_every;           // every this many transmissions one is aborted, 0 for never
+static uint16_t tx_fail_count;           // transmissions since the last one aborted
+static enc28j60_sim_tx_t tx_callback;
+static uint8_t int_line;                 // external interrupt the INT pin is wired to, 0xFF if none
+static uint8_t int_asserted;             // INT pin is being driven low
+
+static uint8_t cs_active;
+static uint8_t opcode;
+static uint16_t count;                    // bytes so far in this CS window, buffer bursts run past 255
+
+/** @brief Finds the storage for a 5 bit register address in the current bank
+ *
+ *  @param[in] bank Bank number 0-3
+ *  @param[in] addr 5 bit register address
+ *  @return uint8_t*
+ */
+static uint8_t *reg(uint8_t bank, uint8_t addr)
+{
+	if (addr >= R_EIE)
+		return &common_regs[addr - R_EIE];
+	return &bank_regs[bank][addr];
+}
+
+static uint8_t current_bank(void)
+{
+	return common_regs[R_ECON1 - R_EIE] & 0x03;
+}
+
+static uint16_t get16(uint8_t bank, uint8_t addr)
+{
+	return bank_regs[bank][addr] | (bank_regs[bank][addr + 1] << 8);
+}
+
+static void set16(uint8_t bank, uint8_t addr, uint16_t value)
+{
+	bank_regs[bank][addr] = value & 0xFF;
+	bank_regs[bank][addr + 1] = (value >> 8) & 0x1F;
+}
+
+/** @brief Returns 1 for the MAC and MII registers which shift out a dummy byte before the data
+ *
+ *  @param[in] bank Bank number 0-3
+ *  @param[in] addr 5 bit register address
+ *  @return uint8_t
+ */
+static uint8_t is_mac_mii(uint8_t bank, uint8_t addr)
+{
+	if (addr >= R_EIE)
+		return 0;
+	if (bank == 2)
+		return addr <= R_MIRDH;
+	if (bank == 3)
+		return addr <= 0x05 || addr == R_MISTAT;
+	return 0;
+}
+
+/** @brief Drives the INT pin from EIE and EIR, signalling the falling edge when it asserts
+ *
+ *  @param void
+ *  @return void
+ */
+static void update_int(void)
+{
+	uint8_t eie = common_regs[R_EIE - R_EIE];
+	uint8_t asserted = (eie & EIE_INTIE) && (eie & common_regs[R_EIR - R_EIE] & EIR_FLAGS);
+
+	if (asserted && !int_asserted && int_line != 0xFF)
+		avr_sim_ext_edge(int_line);
+	int_asserted = asserted;
+}
+
+/** @brief Power on / soft reset state
+ *
+ *  @param void
+ *  @return void
+ */
+static void reset(void)
+{
+	memset(bank_regs, 0, sizeof(bank_regs));
+	memset(common_regs, 0, sizeof(common_regs));
+	common_regs[R_ECON2 - R_EIE] = 0x80;              // AUTOINC
+	common_regs[R_ESTAT - R_EIE] = 0x01;              // CLKRDY
+	set16(0, R_ERDPTL, 0x05FA);
+	set16(0, R_ERXNDL, MEM_MASK);
+	bank_regs[1][R_ERXFCON] = ERXFCON_UCEN | ERXFCON_CRCEN | ERXFCON_BCEN;
+	rx_write = 0;
+	tx_done_at = 0;
+	dma_done_at = 0;
+	mii_done_at = 0;
+	tx_fail = 0;
+	tx_stuck = 0;
+	memset(phy, 0, sizeof(phy));
+	phy[P_PHSTAT1] = 0x1800 | (cable ? PHSTAT1_LLSTAT : 0);   // full/half duplex capable, and the link
+	phy[0x02] = 0x0083;                               // PHHID1
+	phy[0x03] = 0x1400;                               // PHHID2
+	phy[P_PHSTAT2] = cable ? PHSTAT2_LSTAT : 0;
+	int_asserted = 0;
+}
+
+/** @brief Brings the link status in PHSTAT1 and PHSTAT2 in line with the cable and PHCON2.FRCLINK
+ *
+ *  A change sets PHIR.PLNKIF, and PHIR.PGIF and EIR.LINKIF too if PHIE lets the link interrupt through.
+ *  PHSTAT1.LLSTAT latches low, it only comes back once PHSTAT1 is read with the link up.
+ *
+ *  @param void
+ *  @return void
+ */
+static void phy_link(void)
+{
+	uint8_t up = cable || (phy[P_PHCON2] & PHCON2_FRCLINK);
+
+	if (up == !!(phy[P_PHSTAT2] & PHSTAT2_LSTAT))
+		return;
+	phy[P_PHSTAT2] ^= PHSTAT2_LSTAT;
+	if (!up)
+		phy[P_PHSTAT1] &= ~PHSTAT1_LLSTAT;
+	phy[P_PHIR] |= PHIR_PLNKIF;
+	if ((phy[P_PHIE] & (PHIE_PGEIE | PHIE_PLNKIE)) == (PHIE_PGEIE | PHIE_PLNKIE)){
+		phy[P_PHIR] |= PHIR_PGIF;
+		common_regs[R_EIR - R_EIE] |= EIR_LINKIF;
+		update_int();
+	}
+}
+
+/** @brief Reads a PHY register through the MII, with the side effects of a read
+ *
+ *  Reading PHIR clears its flags and EIR.LINKIF with them, and reading PHSTAT1 lets LLSTAT back up.
+ *
+ *  @param[in] address PHY register address
+ *  @return void
+ */
+static void mii_read(uint8_t address)
+{
+	uint16_t value = phy[address & 0x1F];
+
+	bank_regs[2][R_MIRDL] = value & 0xFF;
+	bank_regs[2][R_MIRDH] = value >> 8;
+	if ((address & 0x1F) == P_PHIR){
+		phy[P_PHIR] = 0;
+		common_regs[R_EIR - R_EIE] &= ~EIR_LINKIF;
+		update_int();
+	}
+	else if ((address & 0x1F) == P_PHSTAT1 && (phy[P_PHSTAT2] & PHSTAT2_LSTAT))
+		phy[P_PHSTAT1] |= PHSTAT1_LLSTAT;
+}
+
+static void schedule(void);
+
+/** @brief Finishes a transmission once its time on the wire has elapsed, and the MII operation under way
+ *
+ *  An aborted transmission sets TXERIF and TXABRT as well as TXIF, and leaves TXRTS set until the
+ *  transmit logic is reset with ECON1.TXRST.  While MICMD.MIISCAN is set, MIRD follows the PHY register
+ *  being scanned without the 10.24 us it takes the silicon to read it again.
+ *
+ *  @param void
+ *  @return void
+ */
+static void update(void)
+{
+	uint8_t *mistat = &bank_regs[3][R_MISTAT];
+
+	if (*mistat & MISTAT_SCAN)
+		mii_read(bank_regs[2][R_MIREGADR]);
+	else if (mii_done_at && avr_sim_cycles >= mii_done_at){
+		mii_done_at = 0;
+		*mistat &= ~MISTAT_BUSY;
+	}
+	if (dma_done_at && avr_sim_cycles >= dma_done_at){
+		dma_done_at = 0;
+		common_regs[R_ECON1 - R_EIE] &= ~ECON1_DMAST;
+		common_regs[R_EIR - R_EIE] |= EIR_DMAIF;
+		update_int();
+	}
+	if (tx_done_at && avr_sim_cycles >= tx_done_at){
+		tx_done_at = 0;
+		if (tx_fail){
+			tx_fail = 0;
+			tx_stuck = 1;
+			common_regs[R_EIR - R_EIE] |= EIR_TXIF | EIR_TXERIF;
+			common_regs[R_ESTAT - R_EIE] |= ESTAT_TXABRT;
+		}
+		else{
+			common_regs[R_ECON1 - R_EIE] &= ~ECON1_TXRTS;
+			common_regs[R_EIR - R_EIE] |= EIR_TXIF;
+		}
+		update_int();
+	}
+	schedule();                                     // whichever of the two is still running
+}
+
+/** @brief Has update() called at the next time something finishes
+ *
+ *  @param void
+ *  @return void
+ */
+static void schedule(void)
+{
+	uint64_t next = tx_done_at;
+	if (dma_done_at && (!next || dma_done_at < next))
+		next = dma_done_at;
+	if (next)
+		avr_sim_at(next, update);
+}
+
+/** @brief Address of the buffer memory byte after a given one as the DMA steps through it
+ *
+ *  A range which starts in the receive ring wraps from ERXND back to ERXST, as the silicon does.
+ *
+ *  @param[in] address The current address
+ *  @param[in] start EDMAST of the operation
+ *  @return uint16_t
+ */
+static uint16_t dma_next(uint16_t address, uint16_t start)
+{
+	uint16_t rx_start = get16(0, R_ERXSTL);
+	uint16_t rx_end = get16(0, R_ERXNDL);
+	if (address == rx_end && start >= rx_start && start <= rx_end)
+		return rx_start;
+	return (address + 1) & MEM_MASK;
+}
+
+/** @brief Runs the DMA operation set up in EDMAST and EDMAND, which only takes effect on the registers
+ *  once its time has passed
+ *
+ *  In checksum mode the result is the Internet checksum of the range, high byte in EDMACSH.  Otherwise the
+ *  range is copied to EDMADST, which wraps around the receive ring the same way.  The copy is made at once,
+ *  which firmware that waits for DMAST to clear cannot tell apart.
+ *
+ *  @param void
+ *  @return void
+ */
+static void dma(void)
+{
+	uint16_t start = get16(0, R_EDMASTL);
+	uint16_t end = get16(0, R_EDMANDL);
+	uint32_t sum = 0;
+	uint16_t len = 0;
+	static uint8_t copy[MEM_MASK + 1];
+
+	for (uint16_t a = start;; a = dma_next(a, start)){
+		sum += (len & 1) ? mem[a] : (uint16_t) mem[a] << 8;
+		copy[len++] = mem[a];
+		if (a == end || len > MEM_MASK)           // an end outside a ring it started in is never reached
+			break;
+	}
+	if (!(common_regs[R_ECON1 - R_EIE] & ECON1_CSUMEN)){
+		uint16_t dest = get16(0, R_EDMADSTL);
+		uint16_t d = dest;
+		for (uint16_t i = 0; i < len; i++, d = dma_next(d, dest)){
+			mem[d] = copy[i];
+		}
+	}
+	else {
+		while (sum >> 16)
+			sum = (sum & 0xFFFF) + (sum >> 16);
+		sum = ~sum & 0xFFFF;
+		bank_regs[0][R_EDMACSH] = sum >> 8;
+		bank_regs[0][R_EDMACSL] = sum & 0xFF;
+	}
+	dma_done_at = avr_sim_cycles + ((uint64_t) len * DMA_BYTE_NS * F_CPU + 999999999) / 1000000000;
+	schedule();
+}
+
+/** @brief Puts the frame between ETXST and ETXND on the wire and writes its status vector
+ *
+ *  @param void
+ *  @return void
+ */
+static void transmit(void)
+{
+	uint16_t start = get16(0, R_ETXSTL);
+	uint16_t end = get16(0, R_ETXNDL);
+	uint16_t len = (end - start) & MEM_MASK;          // the control byte at ETXST is not sent
+
+	if (tx_fail_every && ++tx_fail_count == tx_fail_every){
+		tx_fail_count = 0;
+		tx_fail = 1;
+		enc28j60_sim_stats.frames_aborted++;
+	}
+	else{
+		if (tx_callback && (phy[P_PHSTAT2] & PHSTAT2_LSTAT))     // with no link the frame goes nowhere
+			tx_callback(&mem[(start + 1) & MEM_MASK], len);
+		enc28j60_sim_stats.frames_tx++;
+	}
+
+	// transmit status vector goes just past the end of the frame
+	uint8_t *tsv = &mem[(end + 1) & MEM_MASK];
+	memset(tsv, 0, 7);
+	tsv[0] = len & 0xFF;
+	tsv[1] = len >> 8;
+	tsv[2] = 0x80;                                    // transmit done
+
+	uint16_t wire = (len < 60 ? 60 : len) + 4 + 8 + 12;   // pad, CRC, preamble, inter packet gap
+	tx_done_at = avr_sim_cycles + ((uint64_t) wire * 8 * F_CPU + BIT_RATE - 1) / BIT_RATE;
+	schedule();                                       // TXIF comes up on time even if nothing reads the chip
+}
+
+/** @brief Applies the side effects of writing a control register
+ *
+ *  @param[in] bank Bank number 0-3
+ *  @param[in] addr 5 bit register address
+ *  @return void
+ */
+static void written(uint8_t bank, uint8_t addr)
+{
+	uint8_t *econ1 = &common_regs[R_ECON1 - R_EIE];
+	uint8_t *econ2 = &common_regs[R_ECON2 - R_EIE];
+
+	if (addr == R_ECON1){
+		if (*econ1 & ECON1_TXRST){
+			*econ1 &= ~ECON1_TXRTS;                   // transmit logic held in reset
+			tx_done_at = 0;
+			tx_fail = 0;
+			tx_stuck = 0;
+		}
+		else if ((*econ1 & ECON1_TXRTS) && !tx_done_at && !tx_stuck)
+			transmit();
+		else if (!(*econ1 & ECON1_TXRTS))
+			tx_done_at = 0;                           // transmission aborted
+		if ((*econ1 & ECON1_DMAST) && !dma_done_at)
+			dma();
+	}
+	else if (addr == R_ECON2 && (*econ2 & ECON2_PKTDEC)){
+		*econ2 &= ~ECON2_PKTDEC;
+		if (bank_regs[1][R_EPKTCNT])
+			bank_regs[1][R_EPKTCNT]--;
+		if (!bank_regs[1][R_EPKTCNT])
+			common_regs[R_EIR - R_EIE] &= ~EIR_PKTIF;
+	}
+	else if (bank == 0 && (addr == R_ERXSTL || addr == R_ERXSTH)){
+		rx_write = get16(0, R_ERXSTL);
+	}
+	else if (bank == 2 && addr == R_MICMD){
+		uint8_t *mistat = &bank_regs[3][R_MISTAT];
+		if (bank_regs[2][R_MICMD] & MICMD_MIISCAN)
+			*mistat |= MISTAT_SCAN | MISTAT_BUSY;
+		else if (*mistat & MISTAT_SCAN){
+			*mistat &= ~MISTAT_SCAN;                  // busy until the read under way is finished
+			mii_done_at = avr_sim_cycles + MII_CYCLES;
+		}
+		else if ((bank_regs[2][R_MICMD] & MICMD_MIIRD) && !(*mistat & MISTAT_BUSY)){
+			mii_read(bank_regs[2][R_MIREGADR]);
+			*mistat |= MISTAT_BUSY;
+			mii_done_at = avr_sim_cycles + MII_CYCLES;
+		}
+	}
+	else if (bank == 2 && addr == R_MIWRH){
+		phy[bank_regs[2][R_MIREGADR] & 0x1F] = bank_regs[2][R_MIWRL] | (bank_regs[2][R_MIWRH] << 8);
+		bank_regs[3][R_MISTAT] |= MISTAT_BUSY;
+		mii_done_at = avr_sim_cycles + MII_CYCLES;
+		phy_link();                                   // PHCON2.FRCLINK may have changed
+	}
+	update_int();
+}
+
+/** @brief Advances the buffer read pointer, wrapping inside the receive ring as the silicon does
+ *
+ *  @param void
+ *  @return void
+ */
+static void next_read(void)
+{
+	uint16_t rdpt = get16(0, R_ERDPTL);
+	if (rdpt == get16(0, R_ERXNDL))
+		rdpt = get16(0, R_ERXSTL);
+	else
+		rdpt = (rdpt + 1) & MEM_MASK;
+	set16(0, R_ERDPTL, rdpt);
+}
+
+static void spi_select(uint8_t active)
+{
+	cs_active = active;
+	count = 0;
+	if (active)
+		enc28j60_sim_stats.transactions++;
+}
+
+static uint8_t spi_xfer(uint8_t mosi)
+{
+	uint8_t miso = 0;
+	enc28j60_sim_stats.bytes++;
+	update();
+	if (!cs_active)
+		return 0xFF;
+
+	if (count == 0){
+		opcode = mosi;
+		if (opcode == 0xFF)
+			reset();
+		count++;
+		return 0;
+	}
+
+	uint8_t bank = current_bank();
+	uint8_t addr = opcode & 0x1F;
+	uint8_t *r = reg(bank, addr);
+
+	switch (opcode & 0xE0){
+		case OP_RCR:
+			if (count == 1 && is_mac_mii(bank, addr))
+				miso = 0;                             // dummy byte
+			else
+				miso = *r;
+			break;
+		case OP_RBM:
+			miso = mem[get16(0, R_ERDPTL)];
+			next_read();
+			break;
+		case OP_WCR:
+			if (count == 1){
+				*r = mosi;
+				written(bank, addr);
+			}
+			break;
+		case OP_WBM:
+			{
+				uint16_t wrpt = get16(0, R_EWRPTL);
+				mem[wrpt] = mosi;
+				set16(0, R_EWRPTL, (wrpt + 1) & MEM_MASK);
+			}
+			break;
+		case OP_BFS:
+			if (count == 1){
+				*r |= mosi;
+				written(bank, addr);
+			}
+			break;
+		case OP_BFC:
+			if (count == 1){
+				*r &= ~mosi;
+				written(bank, addr);
+			}
+			break;
+	}
+	count++;
+	return miso;
+}
+
+static const struct avr_sim_spi_dev enc28j60_dev = { spi_xfer, spi_select };
+
+/** @brief Resets the model, clears its statistics and attaches it to the simulated SPI bus
+ *
+ *  @param void
+ *  @return void
+ */
+void enc28j60_sim_init(void)
+{
+	reset();
+	memset(mem, 0, sizeof(mem));
+	memset(&enc28j60_sim_stats, 0, sizeof(enc28j60_sim_stats));
+	cs_active = 0;
+	count = 0;
+	tx_callback = 0;
+	tx_fail_every = 0;
+	tx_fail_count = 0;
+	int_line = 0xFF;
+	avr_sim_attach_spi(&enc28j60_dev);
+}
+
+/** @brief Makes every so many transmissions abort with a transmit error, for testing the recovery from one
+ *
+ *  @param[in] every One transmission out of this many is aborted, 0 for none
+ *  @return void
+ */
+void enc28j60_sim_fail_tx(uint16_t every)
+{
+	tx_fail_every = every;
+	tx_fail_count = 0;
+}
+
+/** @brief Wires the INT pin to an external interrupt of the simulated AVR
+ *
+ *  @param[in] line External interrupt number, 0-7
+ *  @return void
+ */
+void enc28j60_sim_attach_int(uint8_t line)
+{
+	int_line = line;
+	int_asserted = 0;
+	update_int();
+}
+
+/** @brief Plugs the cable in or pulls it out, which the PHY reports as a link change
+ *
+ *  While the link is down transmitted frames are lost and nothing can be injected.  The cable stays as it
+ *  is over enc28j60_sim_init() and soft resets, as the other end would.
+ *
+ *  @param[in] up 1 if a link partner is on the other end
+ *  @return void
+ */
+void enc28j60_sim_set_link(uint8_t up)
+{
+	cable = up;
+	phy_link();
+}
+
+/** @brief Sets the function which receives every transmitted frame
+ *
+ *  @param[in] callback Called with the frame (without the control byte) when TXRTS is set, if the link is up
+ *  @return void
+ */
+void enc28j60_sim_on_transmit(enc28j60_sim_tx_t callback)
+{
+	tx_callback = callback;
+}
+
+/** @brief Runs a frame past the receive filters set up in ERXFCON, see section 8 of the data sheet
+ *
+ *  With no filter enabled every frame is passed.  Otherwise a frame is passed if it matches any of the
+ *  enabled filters, or all of them with ANDOR set.  The CRC of an injected frame is always good, so CRCEN
+ *  never drops one.
+ *
+ *  @param[in] frame The Ethernet frame, destination MAC first, without CRC
+ *  @param[in] len Length of frame
+ *  @return uint8_t 1 if the frame is passed
+ */
+static uint8_t filter(const uint8_t *frame, uint16_t len)
+{
+	static const uint8_t maadr[6] = {0x04, 0x05, 0x02, 0x03, 0x00, 0x01};   // bank 3 MAADR1 to MAADR6
+	uint8_t mode = bank_regs[1][R_ERXFCON];
+	uint8_t enabled = mode & ~(ERXFCON_ANDOR | ERXFCON_CRCEN);
+	uint8_t matched = 0;
+
+	if (!enabled)
+		return 1;
+	uint8_t unicast = 1, broadcast = 1;
+	for (uint8_t i = 0; i < 6; i++){
+		unicast &= frame[i] == bank_regs[3][maadr[i]];
+		broadcast &= frame[i] == 0xFF;
+	}
+	if (unicast)
+		matched |= ERXFCON_UCEN;
+	if (broadcast)
+		matched |= ERXFCON_BCEN;
+	if (frame[0] & 0x01)
+		matched |= ERXFCON_MCEN;
+
+	// The hash table takes bits 28 to 23 of the CRC of the destination address, worked out as for the FCS
+	uint32_t crc = 0xFFFFFFFF;
+	for (uint8_t i = 0; i < 6; i++){
+		uint8_t byte = frame[i];
+		for (uint8_t bit = 0; bit < 8; bit++, byte >>= 1){
+			crc = ((crc >> 31) ^ (byte & 1)) ? (crc << 1) ^ 0x04C11DB7 : crc << 1;
+		}
+	}
+	uint8_t pointer = (crc >> 23) & 0x3F;
+	if (bank_regs[1][R_EHT0 + (pointer >> 3)] & (1 << (pointer & 7)))
+		matched |= ERXFCON_HTEN;
+
+	// The pattern match sums the bytes picked out of the window by EPMM, which has to fit in the packet
+	// as received, CRC included.  The CRC of an injected frame reads as 0
+	uint16_t offset = get16(1, R_EPMOL);
+	if (offset + PATTERN_LEN <= len + 4){
+		uint32_t sum = 0;
+		uint8_t n = 0;
+		for (uint8_t i = 0; i < PATTERN_LEN; i++){
+			if (bank_regs[1][R_EPMM0 + (i >> 3)] & (1 << (i & 7))){
+				uint8_t byte = offset + i < len ? frame[offset + i] : 0;
+				sum += (n++ & 1) ? byte : byte << 8;
+			}
+		}
+		while (sum >> 16)
+			sum = (sum & 0xFFFF) + (sum >> 16);
+		if ((~sum & 0xFFFF) == (bank_regs[1][R_EPMCSL] | (bank_regs[1][R_EPMCSL + 1] << 8)))
+			matched |= ERXFCON_PMEN;
+	}
+
+	if (mode & ERXFCON_ANDOR)
+		return (matched & enabled) == enabled;
+	return (matched & enabled) != 0;
+}
+
+/** @brief Delivers a frame from the wire into the receive ring
+ *
+ *  @param[in] frame The Ethernet frame, destination MAC first, without CRC
+ *  @param[in] len Length of frame
+ *  @return uint8_t 1 if the frame was stored, 0 if there is no link, or it was dropped by the receive filters
+ *  or did not fit
+ */
+uint8_t enc28j60_sim_inject(const uint8_t *frame, uint16_t len)
+{
+	if (!(common_regs[R_ECON1 - R_EIE] & ECON1_RXEN) || !(phy[P_PHSTAT2] & PHSTAT2_LSTAT))
+		return 0;
+	if (!filter(frame, len)){
+		enc28j60_sim_stats.frames_filtered++;
+		return 0;
+	}
+
+	uint16_t start = get16(0, R_ERXSTL);
+	uint16_t end = get16(0, R_ERXNDL);
+	uint16_t size = end - start + 1;
+	uint16_t count_with_crc = len + 4;
+	uint16_t need = (6 + count_with_crc + 1) & ~1;    // packets start on even addresses
+	uint16_t read = get16(0, R_ERXRDPTL);
+	uint16_t used = (rx_write - read + size) % size;
+
+	if (bank_regs[1][R_EPKTCNT] == 0xFF || used + need >= size){
+		enc28j60_sim_stats.frames_dropped++;
+		common_regs[R_EIR - R_EIE] |= EIR_RXERIF;
+		update_int();
+		return 0;
+	}
+
+	uint16_t next = start + (rx_write - start + need) % size;
+	uint8_t header[6] = {next & 0xFF, next >> 8, count_with_crc & 0xFF, count_with_crc >> 8, 0x80, 0x00};
+	uint16_t w = rx_write;
+	for (uint16_t i = 0; i < need; i++){
+		uint8_t byte = 0;
+		if (i < 6)
+			byte = header[i];
+		else if (i - 6 < len)
+			byte = frame[i - 6];
+		mem[w] = byte;
+		w = (w == end) ? start : w + 1;
+	}
+	rx_write = next;
+	set16(0, R_ERXWRPTL, rx_write);
+
+	bank_regs[1][R_EPKTCNT]++;
+	common_regs[R_EIR - R_EIE] |= EIR_PKTIF;
+	update_int();
+	enc28j60_sim_stats.frames_rx++;
+	return 1;
+}
+
+/** @brief Reads a control register without going through SPI
+ *
+ *  @param[in] address Register address as encoded in Ethernet.h
+ *  @return uint8_t
+ */
+uint8_t enc28j60_sim_read_reg(uint8_t address)
+{
+	update();
+	return *reg((address >> 5) & 0x03, address & 0x1F);
+}
+
+/** @brief Reads a PHY register without going through the MII interface
+ *
+ *  @param[in] address PHY register address
+ *  @return uint16_t
+ */
+uint16_t enc28j60_sim_read_phy(uint8_t address)
+{
+	return phy[address & 0x1F];
+}
+
+/** @brief Direct access to the 8 KB buffer memory
+ *
+ *  @param void
+ *  @return uint8_t*
+ */
+uint8_t *enc28j60_sim_memory(void)
+{
+	return mem;
+}
@@ -0,0 +1,47 @@
+/** @file enc28j60_sim.h
+ *  @author Nick Moore
+ *  @date October 15, 2026
+ *  @brief SPI slave model of the ENC28J60 Ethernet controller for the host build
+ *
+ *  The model implements the SPI instruction set (RCR, WCR, BFS, BFC, RBM, WBM, SRC), the banked
+ *  control registers, the 8 KB buffer memory with the receive ring and its filters, transmission on
+ *  ECON1.TXRTS and the MII interface to the PHY registers, with its background scan and the link change
+ *  interrupt.  Frames can be injected into the receive ring and transmitted frames are handed to a callback,
+ *  so a benchmark can stand in for the other end of the cable, which it can also pull out.  The active low
+ *  INT pin can be wired to one of the external interrupts of the AVR model.
+ *
+ *  @bug No known bugs
+ */
+
+#ifndef ENC28J60_SIM_H_
+#define ENC28J60_SIM_H_
+
+#include <stdint.h>
+#include "avr_sim.h"
+
+//! Counters kept by the model, cleared by enc28j60_sim_init()
+struct enc28j60_sim_stats {
+	uint32_t transactions;        // chip select windows
+	uint32_t bytes;               // bytes clocked over SPI, including opcodes
+	uint32_t frames_tx;           // frames put on the wire
+	uint32_t frames_aborted;      // transmissions aborted by enc28j60_sim_fail_tx()
+	uint32_t frames_rx;           // frames accepted into the receive ring
+	uint32_t frames_dropped;      // frames which did not fit in the receive ring
+	uint32_t frames_filtered;     // frames turned away by the receive filters
+};
+
+typedef void (*enc28j60_sim_tx_t)(const uint8_t *frame, uint16_t len);
+
+extern struct enc28j60_sim_stats enc28j60_sim_stats;
+
+void enc28j60_sim_init(void);
+void enc28j60_sim_on_transmit(enc28j60_sim_tx_t callback);
+void enc28j60_sim_attach_int(uint8_t line);
+void enc28j60_sim_fail_tx(uint16_t every);
+void enc28j60_sim_set_link(uint8_t up);
+uint8_t enc28j60_sim_inject(const uint8_t *frame, uint16_t len);
+uint8_t enc28j60_sim_read_reg(uint8_t address);
+uint16_t enc28j60_sim_read_phy(uint8_t address);
+uint8_t *enc28j60_sim_memory(void);
+
+#endif /* ENC28J60_SIM_H_ */
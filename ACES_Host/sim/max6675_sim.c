@@ -0,0 +1,84 @@
+/** @file max6675_sim.c
+ *  @author Nick Moore
+ *  @date October 15, 2026
+ *  @brief Implementation of the MAX6675 model
+ *
+ *  The MAX6675 shifts out 16 bits, MSB first: a dummy zero, the 12 bit temperature in quarter degrees,
+ *  the open thermocouple flag, the device ID and a tri-state bit.  Pulling CS low stops any conversion in
+ *  progress and a new one starts when CS is released, so reading more often than every 220 ms returns the
+ *  previous result.
+ *
+ *  @bug No known bugs
+ */
+
+#include "max6675_sim.h"
+
+struct max6675_sim_stats max6675_sim_stats;
+
+static uint16_t temperature;             // quarter degrees, 12 bits
+static uint8_t open_circuit;
+static uint16_t latched;                 // result of the last completed conversion
+static uint64_t conversion_start;
+static uint8_t converting;
+static uint8_t bit_count;
+
+static uint16_t encode(void)
+{
+	return ((temperature & 0x0FFF) << 3) | (open_circuit ? 0x04 : 0);
+}
+
+static void spi_select(uint8_t active)
+{
+	if (active){
+		if (!converting || avr_sim_cycles - conversion_start >= MAX6675_CONVERSION_CYCLES)
+			latched = encode();
+		else
+			max6675_sim_stats.early_reads++;
+		bit_count = 0;
+	}
+	else{
+		if (bit_count >= 16)
+			max6675_sim_stats.reads++;
+		conversion_start = avr_sim_cycles;
+		converting = 1;
+	}
+}
+
+static uint8_t spi_xfer(uint8_t mosi)
+{
+	(void) mosi;                         // the MAX6675 has no data input
+	uint8_t miso = (bit_count == 0) ? latched >> 8 : latched & 0xFF;
+	bit_count += 8;
+	return miso;
+}
+
+static const struct avr_sim_spi_dev max6675_dev = { spi_xfer, spi_select };
+
+/** @brief Resets the model with a finished conversion and attaches it to the simulated SPI bus
+ *
+ *  @param[in] quarter_degrees Thermocouple temperature in quarter degrees C
+ *  @return void
+ */
+void max6675_sim_init(uint16_t quarter_degrees)
+{
+	temperature = quarter_degrees;
+	open_circuit = 0;
+	latched = encode();
+	converting = 0;
+	bit_count = 0;
+	max6675_sim_stats.reads = 0;
+	max6675_sim_stats.early_reads = 0;
+	avr_sim_attach_spi(&max6675_dev);
+}
+
+/** @brief Changes the temperature the next conversion will report
+ *
+ *  @param[in] quarter_degrees Thermocouple temperature in quarter degrees C
+ *  @param[in] open 1 to report an open thermocouple
+ *  @return void
+ */
+void max6675_sim_set(uint16_t quarter_degrees, uint8_t open)
+{
+	temperature = quarter_degrees;
+	open_circuit = open;
+}
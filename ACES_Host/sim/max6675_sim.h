@@ -0,0 +1,29 @@
+/** @file max6675_sim.h
+ *  @author Nick Moore
+ *  @date October 15, 2026
+ *  @brief SPI slave model of the MAX6675 thermocouple converter read by the ESB
+ *
+ *  @bug No known bugs
+ */
+
+#ifndef MAX6675_SIM_H_
+#define MAX6675_SIM_H_
+
+#include <stdint.h>
+#include "avr_sim.h"
+
+//! Conversion time of the MAX6675, 220 ms maximum
+#define MAX6675_CONVERSION_CYCLES (F_CPU / 1000 * 220)
+
+//! Counters kept by the model, cleared by max6675_sim_init()
+struct max6675_sim_stats {
+	uint32_t reads;               // completed 16 bit reads
+	uint32_t early_reads;         // reads which cut a conversion short and returned the previous result
+};
+
+extern struct max6675_sim_stats max6675_sim_stats;
+
+void max6675_sim_init(uint16_t quarter_degrees);
+void max6675_sim_set(uint16_t quarter_degrees, uint8_t open);
+
+#endif /* MAX6675_SIM_H_ */
@@ -0,0 +1,67 @@
+/** @file mcp9808_sim.c
+ *  @author Nick Moore
+ *  @date October 15, 2026
+ *  @brief Implementation of the MCP9808 temperature sensor model
+ *
+ *  Only the register pointer and the ambient temperature register (0x05) are modelled.  Every other
+ *  register reads back as zero.
+ *
+ *  @bug No known bugs
+ */
+
+#include "mcp9808_sim.h"
+
+#define MCP9808_TA 0x05
+
+static uint8_t sensor_start(void *ctx, uint8_t read)
+{
+	struct mcp9808_sim *sensor = ctx;
+	if (!read)
+		sensor->byte = 0xFF;      // the first byte written is the register pointer
+	else
+		sensor->byte = 0;
+	return 1;
+}
+
+static uint8_t sensor_write(void *ctx, uint8_t data)
+{
+	struct mcp9808_sim *sensor = ctx;
+	if (sensor->byte == 0xFF){
+		sensor->pointer = data & 0x0F;
+		sensor->byte = 0;
+	}
+	return 1;
+}
+
+static uint8_t sensor_read(void *ctx)
+{
+	struct mcp9808_sim *sensor = ctx;
+	uint16_t raw = 0;
+	if (sensor->pointer == MCP9808_TA)
+		raw = (uint16_t) sensor->temperature & 0x1FFF;    // 13 bit two's complement, sign in bit 12
+
+	if (sensor->byte++ == 0)
+		return raw >> 8;
+	sensor->reads++;
+	return raw & 0xFF;
+}
+
+/** @brief Sets up a sensor model at a 7 bit address
+ *
+ *  @param[out] sensor The sensor to set up
+ *  @param[in] address 7 bit TWI address
+ *  @param[in] temperature Initial ambient temperature in sixteenths of a degree C
+ *  @return void
+ */
+void mcp9808_sim_init(struct mcp9808_sim *sensor, uint8_t address, int16_t temperature)
+{
+	sensor->dev.address = address;
+	sensor->dev.ctx = sensor;
+	sensor->dev.start = sensor_start;
+	sensor->dev.write = sensor_write;
+	sensor->dev.read = sensor_read;
+	sensor->temperature = temperature;
+	sensor->pointer = 0;
+	sensor->byte = 0;
+	sensor->reads = 0;
+}
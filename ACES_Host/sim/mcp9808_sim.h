@@ -0,0 +1,26 @@
+/** @file mcp9808_sim.h
+ *  @author Nick Moore
+ *  @date October 15, 2026
+ *  @brief TWI slave model of the MCP9808 temperature sensor read by the ECU
+ *
+ *  @bug No known bugs
+ */
+
+#ifndef MCP9808_SIM_H_
+#define MCP9808_SIM_H_
+
+#include <stdint.h>
+#include "avr_sim.h"
+
+//! One simulated sensor.  Fill in temperature, then pass dev to avr_sim_attach_twi()
+struct mcp9808_sim {
+	struct avr_sim_twi_dev dev;
+	int16_t temperature;          // sixteenths of a degree C
+	uint8_t pointer;              // register pointer
+	uint8_t byte;                 // which byte of the register is read next
+	uint32_t reads;               // completed temperature reads
+};
+
+void mcp9808_sim_init(struct mcp9808_sim *sensor, uint8_t address, int16_t temperature);
+
+#endif /* MCP9808_SIM_H_ */